@@ -0,0 +1,44 @@
+#include "CCameraSource.h"
+#include "frame_hub.h"
+
+// The `resolution` array is a standard part of the esp32-camera driver component.
+// It maps the framesize enum to width and height.
+extern "C" {
+    #include "ll_cam.h"
+}
+
+bool CCameraSource::grab(SourceFrame &frame)
+{
+    camera_fb_t *fb = frame_hub_get(FRAME_HUB_RTSP);
+    if (!fb) {
+        Serial.println("Camera frame buffer could not be acquired");
+        return false;
+    }
+    if (fb->format != PIXFORMAT_JPEG || fb->len == 0) {
+        frame_hub_release(fb);
+        return false;
+    }
+
+    frame.data = fb->buf;
+    frame.len = fb->len;
+    frame.timestampMs = fb->timestamp.tv_sec * 1000 + fb->timestamp.tv_usec / 1000;
+    frame.grabUs = getMicros();
+    frame.handle = fb;
+    return true;
+}
+
+void CCameraSource::release(SourceFrame &frame)
+{
+    if (frame.handle) frame_hub_release((camera_fb_t *) frame.handle);
+    frame.handle = NULL;
+}
+
+u_short CCameraSource::width()
+{
+    return resolution[esp_camera_sensor_get()->status.framesize].width;
+}
+
+u_short CCameraSource::height()
+{
+    return resolution[esp_camera_sensor_get()->status.framesize].height;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "CFrameSource.h"
+
+// Camera frames through the frame hub (shared with the SD recorder and the
+// web server). Only JPEG frames are handed out; the sensor must be
+// configured for PIXFORMAT_JPEG.
+class CCameraSource : public CFrameSource
+{
+public:
+    virtual bool grab(SourceFrame &frame) override;
+    virtual void release(SourceFrame &frame) override;
+
+    virtual u_short width() override;
+    virtual u_short height() override;
+};
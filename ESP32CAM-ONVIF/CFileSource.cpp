@@ -0,0 +1,93 @@
+#include "CFileSource.h"
+#include "CStreamer.h"
+
+#ifndef ARDUINO_ARCH_ESP32
+
+CFileSource::CFileSource(const char *path) : m_Data(NULL), m_Len(0), m_Pos(0), m_FrameCount(0), m_Width(0), m_Height(0)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        printf("Can't open %s\n", path);
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size > 0) {
+        m_Data = (unsigned char *) malloc(size);
+        if (m_Data && fread(m_Data, 1, size, f) == (size_t) size)
+            m_Len = size;
+    }
+    fclose(f);
+
+    uint32_t start, end;
+    for (uint32_t pos = 0; m_Len && nextFrame(pos, &start, &end); pos = end) {
+        if (m_FrameCount++ == 0)
+            readDimensions(start, end);
+    }
+    if (m_FrameCount == 0) {
+        printf("No JPEG frames in %s\n", path);
+        free(m_Data);
+        m_Data = NULL;
+        return;
+    }
+    printf("%s: %u frames, %dx%d\n", path, m_FrameCount, m_Width, m_Height);
+}
+
+CFileSource::~CFileSource()
+{
+    free(m_Data);
+}
+
+// Find the frame (SOI .. EOI) at or after from. Inside the entropy coded data
+// 0xff is always followed by 0x00 or a restart marker, so the first EOI ends
+// the frame (frames with an embedded thumbnail are not supported).
+bool CFileSource::nextFrame(uint32_t from, uint32_t *start, uint32_t *end)
+{
+    uint32_t i = from;
+    while (i + 1 < m_Len && !(m_Data[i] == 0xff && m_Data[i + 1] == 0xd8))
+        i++;
+    if (i + 1 >= m_Len)
+        return false;
+    *start = i;
+
+    for (i += 2; i + 1 < m_Len; i++) {
+        if (m_Data[i] == 0xff && m_Data[i + 1] == 0xd9) {
+            *end = i + 2;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CFileSource::readDimensions(uint32_t start, uint32_t end)
+{
+    JpegFrameInfo jpeg;
+    if (parseJPEG(m_Data + start, end - start, &jpeg)) {
+        m_Width = jpeg.width;
+        m_Height = jpeg.height;
+    }
+}
+
+bool CFileSource::grab(SourceFrame &frame)
+{
+    if (!m_Data)
+        return false;
+
+    uint32_t start, end;
+    if (!nextFrame(m_Pos, &start, &end)) {
+        // End of file, start over
+        if (!nextFrame(0, &start, &end))
+            return false;
+    }
+    m_Pos = end;
+
+    frame.data = m_Data + start;
+    frame.len = end - start;
+    frame.timestampMs = getMicros() / 1000;
+    frame.grabUs = getMicros();
+    frame.handle = NULL;
+    return true;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "CFrameSource.h"
+
+#ifndef ARDUINO_ARCH_ESP32
+
+// Replays a file of concatenated JPEG frames (e.g. "ffmpeg -i in.mp4 -f mjpeg
+// out.mjpeg") so the streaming code can be run and profiled on a PC. The
+// whole file is loaded into memory and frames are handed out in place, in
+// a loop. grab() never blocks; the caller is responsible for the frame rate.
+class CFileSource : public CFrameSource
+{
+public:
+    CFileSource(const char *path);
+    virtual ~CFileSource();
+
+    bool isOpen() const { return m_Data != NULL; }
+    uint32_t frameCount() const { return m_FrameCount; }
+
+    virtual bool grab(SourceFrame &frame) override;
+    virtual void release(SourceFrame &) override {}
+
+    virtual u_short width() override { return m_Width; }
+    virtual u_short height() override { return m_Height; }
+
+private:
+    bool nextFrame(uint32_t from, uint32_t *start, uint32_t *end);
+    void readDimensions(uint32_t start, uint32_t end);
+
+    unsigned char *m_Data;
+    uint32_t m_Len;
+    uint32_t m_Pos;         // where the search for the next frame starts
+    uint32_t m_FrameCount;
+    u_short  m_Width;
+    u_short  m_Height;
+};
+
+#endif
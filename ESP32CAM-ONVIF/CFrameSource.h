@@ -0,0 +1,31 @@
+#pragma once
+
+#include "platglue.h"
+
+// A JPEG frame handed out by a CFrameSource. The data stays valid until the
+// frame is given back with CFrameSource::release().
+struct SourceFrame
+{
+    const unsigned char *data;
+    uint32_t len;
+    uint32_t timestampMs;   // capture time
+    uint32_t grabUs;        // getMicros() when grab() got the frame
+    void    *handle;        // owned by the source (camera_fb_t on the ESP32)
+};
+
+// Where the JPEG frames come from: the camera on the ESP32 (CCameraSource),
+// or a recorded MJPEG file when running on a PC (CFileSource). Keeps the
+// streaming core (CStreamer, CRtspSession, MyStreamer) free of esp_camera.h.
+class CFrameSource
+{
+public:
+    virtual ~CFrameSource() {}
+
+    // Next frame. May block until one is captured. Returns false if there is
+    // no frame (camera error, end of file).
+    virtual bool grab(SourceFrame &frame) = 0;
+    virtual void release(SourceFrame &frame) = 0;
+
+    virtual u_short width() = 0;
+    virtual u_short height() = 0;
+};
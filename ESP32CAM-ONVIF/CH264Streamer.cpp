@@ -0,0 +1,267 @@
+#include "CH264Streamer.h"
+
+#include <string.h>
+
+// RTP Header size
+#define RTP_HEADER_SIZE 12
+
+// Maximum RTP payload size (MTU - IP/UDP headers)
+#define MAX_RTP_PAYLOAD 1400
+
+// NAL unit types
+#define NAL_TYPE_SLICE    1
+#define NAL_TYPE_IDR      5
+#define NAL_TYPE_SEI      6
+#define NAL_TYPE_SPS      7
+#define NAL_TYPE_PPS      8
+#define NAL_TYPE_FU_A    28
+
+CH264Streamer::CH264Streamer(SOCKET aClient, u_short width, u_short height)
+    : CStreamer(aClient, width, height),
+      m_spsSize(0),
+      m_ppsSize(0),
+      m_spsPpsValid(false),
+      m_frameData(NULL),
+      m_frameSize(0),
+      m_nalData(NULL),
+      m_nalSize(0),
+      m_nalSent(0),
+      m_nalIsLast(false),
+      m_waitForIDR(false),
+      m_joinWait(false) {
+    
+    memset(m_sps, 0, sizeof(m_sps));
+    memset(m_pps, 0, sizeof(m_pps));
+}
+
+bool CH264Streamer::beginAccessUnit(const uint8_t* data, size_t size, bool idr, uint32_t curMsec, uint32_t intervalMs) {
+    // Extract SPS/PPS if this is an IDR frame
+    if (idr) {
+        extractSPSPPS(data, size);
+    }
+    
+    if (m_waitForIDR) {
+        if (!idr) {
+            if (!m_joinWait) m_DropStats.droppedFrames++;
+            return false;
+        }
+        m_waitForIDR = false;
+        m_joinWait = false;
+    }
+    if (!startFrame(size, intervalMs)) return false;
+    
+    // Calculate RTP timestamp (90kHz clock), kept per client
+    advanceTimestamp(curMsec);
+    
+    m_frameData = data;
+    m_frameSize = size;
+    m_nalData = NULL;
+    m_nalSize = 0;
+    m_FrameOffset = 0;
+    m_FramePending = (size > 0);
+    return true;
+}
+
+void CH264Streamer::resumeAtNextIDR() {
+    if (!m_waitForIDR) m_joinWait = true;
+    frameDropped();
+}
+
+void CH264Streamer::frameDropped() {
+    if (!m_waitForIDR) requestIDR();
+    m_waitForIDR = true;
+}
+
+int CH264Streamer::findNextNALUnit(const uint8_t* data, size_t size, size_t offset) {
+    // Look for start code: 0x00 0x00 0x01 or 0x00 0x00 0x00 0x01
+    for (size_t i = offset; i + 3 < size; i++) {
+        if (data[i] == 0x00 && data[i+1] == 0x00) {
+            if (data[i+2] == 0x01) {
+                return i + 3; // 3-byte start code
+            }
+            if (data[i+2] == 0x00 && i + 4 < size && data[i+3] == 0x01) {
+                return i + 4; // 4-byte start code
+            }
+        }
+    }
+    return -1;
+}
+
+size_t CH264Streamer::findNALUnitEnd(const uint8_t* data, size_t size, size_t nalStart) {
+    int next = findNextNALUnit(data, size, nalStart);
+    if (next < 0) {
+        return size;
+    }
+    // Back up over the start code of the next NAL unit
+    size_t end = next - 3;
+    if (end > nalStart && data[end - 1] == 0x00) {
+        end--; // 4-byte start code
+    }
+    return end;
+}
+
+int CH264Streamer::sendNextPacket() {
+    // Pick up the next NAL unit of the frame
+    if (m_nalSize == 0) {
+        int nalStart = findNextNALUnit(m_frameData, m_frameSize, m_FrameOffset);
+        if (nalStart < 0) {
+            m_FramePending = false;
+            return 0;
+        }
+        size_t nalEnd = findNALUnitEnd(m_frameData, m_frameSize, nalStart);
+        
+        m_nalData = m_frameData + nalStart;
+        m_nalSize = nalEnd - nalStart;
+        m_nalSent = 0;
+        m_FrameOffset = nalEnd;
+        if (m_nalSize == 0) {
+            return 0;
+        }
+        
+        // Nothing but trailing bytes after this NAL -> it carries the marker bit
+        m_nalIsLast = (findNextNALUnit(m_frameData, m_frameSize, nalEnd) < 0);
+    }
+    
+    int sent;
+    
+    if (m_nalSize <= MAX_RTP_PAYLOAD) {
+        // Single NAL unit mode (small NAL fits in one packet)
+        sent = sendH264RtpPacket(NULL, 0, m_nalData, m_nalSize, m_nalIsLast, m_Timestamp);
+        m_nalSize = 0;
+    } else {
+        // FU-A Fragmentation mode (NAL too large for single packet)
+        // The NAL unit header is removed and replaced with FU indicator + FU header
+        bool isFirst = (m_nalSent == 0);
+        if (isFirst) {
+            m_nalSent = 1; // Skip original NAL header
+        }
+        
+        size_t payloadRemaining = m_nalSize - m_nalSent;
+        size_t chunkSize = (payloadRemaining > MAX_RTP_PAYLOAD - 2) ? 
+                           (MAX_RTP_PAYLOAD - 2) : payloadRemaining;
+        bool isEnd = (payloadRemaining <= MAX_RTP_PAYLOAD - 2);
+        
+        // Build FU-A header, the fragment itself is sent in place
+        uint8_t fuHeader[2];
+        fuHeader[0] = (m_nalData[0] & 0xE0) | NAL_TYPE_FU_A;  // F, NRI from original, type = 28
+        fuHeader[1] = m_nalData[0] & 0x1F;                    // original NAL type
+        
+        if (isFirst) fuHeader[1] |= 0x80;  // Start bit
+        if (isEnd)   fuHeader[1] |= 0x40;  // End bit
+        
+        bool marker = isEnd && m_nalIsLast;
+        sent = sendH264RtpPacket(fuHeader, sizeof(fuHeader), m_nalData + m_nalSent, chunkSize, marker, m_Timestamp);
+        
+        m_nalSent += chunkSize;
+        if (isEnd) {
+            m_nalSize = 0;
+        }
+    }
+    
+    if (m_nalSize == 0 && m_FrameOffset >= m_frameSize) {
+        m_FramePending = false;
+    }
+    return sent;
+}
+
+int CH264Streamer::sendH264RtpPacket(const uint8_t* prefix, size_t prefixSize,
+                                    const uint8_t* data, size_t size, bool marker, uint32_t timestamp) {
+    // Header buffer (interleaved header + RTP header + optional FU-A header).
+    // The NAL payload is sent straight from the encoder output.
+    static uint8_t rtpBuf[4 + RTP_HEADER_SIZE + 2];  // shared scratch buffer, we assume single threaded
+    
+    size_t rtpPacketSize = RTP_HEADER_SIZE + prefixSize + size;
+    
+    // RTP-over-RTSP interleaved header (4 bytes)
+    rtpBuf[0] = '$';        // Magic
+    rtpBuf[1] = 0;          // Channel (RTP)
+    rtpBuf[2] = (rtpPacketSize >> 8) & 0xFF;
+    rtpBuf[3] = rtpPacketSize & 0xFF;
+    
+    // RTP Header (12 bytes)
+    rtpBuf[4] = 0x80;       // V=2, P=0, X=0, CC=0
+    rtpBuf[5] = 96;         // PT=96 (dynamic H.264)
+    if (marker) rtpBuf[5] |= 0x80;  // Marker bit
+    
+    // Sequence number (big endian)
+    rtpBuf[6] = (m_SequenceNumber >> 8) & 0xFF;
+    rtpBuf[7] = m_SequenceNumber & 0xFF;
+    m_SequenceNumber++;
+    
+    // Timestamp (big endian)
+    rtpBuf[8]  = (timestamp >> 24) & 0xFF;
+    rtpBuf[9]  = (timestamp >> 16) & 0xFF;
+    rtpBuf[10] = (timestamp >> 8) & 0xFF;
+    rtpBuf[11] = timestamp & 0xFF;
+    
+    // SSRC
+    rtpBuf[12] = (m_Ssrc >> 24) & 0xFF;
+    rtpBuf[13] = (m_Ssrc >> 16) & 0xFF;
+    rtpBuf[14] = (m_Ssrc >> 8) & 0xFF;
+    rtpBuf[15] = m_Ssrc & 0xFF;
+    
+    // FU-A indicator/header, if any
+    if (prefixSize > 0) {
+        memcpy(rtpBuf + 4 + RTP_HEADER_SIZE, prefix, prefixSize);
+    }
+    size_t headerSize = 4 + RTP_HEADER_SIZE + prefixSize;
+    
+    m_RtpPacketCount++;
+    m_RtpOctetCount += prefixSize + size;
+    
+    if (m_TCPTransport) {
+        // RTP over RTSP - interleaved header + RTP header, payload in place
+        tcpSend(rtpBuf, headerSize, data, size);
+        return headerSize + size;
+    }
+    
+    // UDP - skip the interleaved header and send to the client's RTP port
+    // (or the multicast group) from the port pair bound in InitTransport()
+    udpSend(rtpBuf + 4, headerSize - 4, data, size);
+    return headerSize - 4 + size;
+}
+
+void CH264Streamer::extractSPSPPS(const uint8_t* data, size_t size) {
+    size_t offset = 0;
+    while (offset + 4 < size) {
+        int nalStart = findNextNALUnit(data, size, offset);
+        if (nalStart < 0) break;
+        
+        size_t nalEnd = findNALUnitEnd(data, size, nalStart);
+        
+        uint8_t nalType = data[nalStart] & 0x1F;
+        size_t nalSize = nalEnd - nalStart;
+        
+        if (nalType == NAL_TYPE_SPS && nalSize <= sizeof(m_sps)) {
+            memcpy(m_sps, data + nalStart, nalSize);
+            m_spsSize = nalSize;
+        } else if (nalType == NAL_TYPE_PPS && nalSize <= sizeof(m_pps)) {
+            memcpy(m_pps, data + nalStart, nalSize);
+            m_ppsSize = nalSize;
+        }
+        
+        offset = nalEnd;
+    }
+    
+    if (m_spsSize > 0 && m_ppsSize > 0) {
+        m_spsPpsValid = true;
+    }
+}
+
+bool CH264Streamer::getSPS(uint8_t* buffer, size_t* size) {
+    if (!m_spsPpsValid || m_spsSize == 0) return false;
+    
+    size_t copySize = (*size < m_spsSize) ? *size : m_spsSize;
+    memcpy(buffer, m_sps, copySize);
+    *size = m_spsSize;
+    return true;
+}
+
+bool CH264Streamer::getPPS(uint8_t* buffer, size_t* size) {
+    if (!m_spsPpsValid || m_ppsSize == 0) return false;
+    
+    size_t copySize = (*size < m_ppsSize) ? *size : m_ppsSize;
+    memcpy(buffer, m_pps, copySize);
+    *size = m_ppsSize;
+    return true;
+}
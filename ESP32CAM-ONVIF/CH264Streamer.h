@@ -0,0 +1,68 @@
+#pragma once
+
+#include "CStreamer.h"
+
+// RFC 6184 packetizer: sends H.264 access units (Annex B byte stream, NAL
+// units separated by start codes) as Single NAL Unit and FU-A packets.
+// Knows nothing about where the frames come from, so it builds on a PC too;
+// H264Streamer adds the on-chip encoder.
+class CH264Streamer : public CStreamer
+{
+public:
+    CH264Streamer(SOCKET aClient, u_short width, u_short height);
+    virtual ~CH264Streamer() {}
+
+    // Paced sending of one access unit, see CStreamer::beginFrame(). data must
+    // stay valid until pumpFrame() returns true. Returns false if the frame
+    // was skipped (client behind, or waiting for an IDR frame after a drop).
+    // SPS/PPS are picked up from IDR frames for getSPS()/getPPS().
+    bool beginAccessUnit(const uint8_t* data, size_t size, bool idr, uint32_t curMsec, uint32_t intervalMs);
+
+    bool getSPS(uint8_t* buffer, size_t* size);
+    bool getPPS(uint8_t* buffer, size_t* size);
+
+    // Ask the frame source for a keyframe (nothing to ask by default)
+    virtual void requestIDR() {}
+
+    // Skip frames until the next IDR frame and ask for one. For a viewer
+    // joining mid-GOP: the skipped frames are not counted as dropped.
+    void resumeAtNextIDR();
+
+protected:
+    // Send the next Single NAL or FU-A packet of the pending frame
+    virtual int sendNextPacket() override;
+
+    // P frames after a lost frame would decode as garbage: ask for a
+    // keyframe and skip everything until it arrives
+    virtual void frameDropped() override;
+
+private:
+    // Send RTP packet for H.264: optional FU-A prefix bytes followed by the payload.
+    // Returns the packet size on the wire.
+    int sendH264RtpPacket(const uint8_t* prefix, size_t prefixSize,
+                          const uint8_t* data, size_t size, bool marker, uint32_t timestamp);
+
+    // Parse NAL units from encoded frame
+    int findNextNALUnit(const uint8_t* data, size_t size, size_t offset);
+    size_t findNALUnitEnd(const uint8_t* data, size_t size, size_t nalStart);
+
+    // Cache SPS/PPS from an IDR access unit
+    void extractSPSPPS(const uint8_t* data, size_t size);
+
+    // SPS/PPS cache for SDP
+    uint8_t m_sps[64];
+    size_t m_spsSize;
+    uint8_t m_pps[64];
+    size_t m_ppsSize;
+    bool m_spsPpsValid;
+
+    // Packetizer state of the pending frame
+    const uint8_t* m_frameData;
+    size_t m_frameSize;
+    const uint8_t* m_nalData;     // NAL unit being sent, NULL between units
+    size_t m_nalSize;
+    size_t m_nalSent;             // bytes of the NAL already sent (FU-A)
+    bool m_nalIsLast;
+    bool m_waitForIDR;            // a frame was dropped, resume at the next IDR
+    bool m_joinWait;              // waiting for the first IDR after joining, not a drop
+};
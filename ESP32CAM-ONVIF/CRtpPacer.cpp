@@ -0,0 +1,79 @@
+#include "CRtpPacer.h"
+
+#include <string.h>
+
+CRtpPacer::CRtpPacer(uint32_t rateBytesPerSec, uint32_t burstBytes)
+{
+    memset(&m_Stats, 0, sizeof(m_Stats));
+    m_Tokens       = 0;
+    m_LastRefillUs = 0;
+    m_FrameStartUs = 0;
+    configure(rateBytesPerSec, burstBytes);
+}
+
+void CRtpPacer::configure(uint32_t rateBytesPerSec, uint32_t burstBytes)
+{
+    m_Rate      = rateBytesPerSec ? rateBytesPerSec : 1;
+    m_Burst     = burstBytes ? burstBytes : 1;
+    m_FrameRate = m_Rate;
+    if(m_Tokens > (int32_t) m_Burst)
+        m_Tokens = m_Burst;
+}
+
+void CRtpPacer::beginFrame(uint32_t frameBytes, uint32_t intervalMs, uint32_t nowUs)
+{
+    m_FrameRate = m_Rate;
+    if(intervalMs > 0) {
+        // aim to finish within 3/4 of the interval so jitter doesn't push us into the next frame
+        uint32_t budgetMs = intervalMs * 3 / 4;
+        if(budgetMs == 0)
+            budgetMs = 1;
+        uint32_t needed = (uint32_t) ((uint64_t) frameBytes * 1000 / budgetMs);
+        if(needed > m_FrameRate)
+            m_FrameRate = needed;
+    }
+
+    refill(nowUs);
+    m_FrameStartUs = nowUs;
+}
+
+void CRtpPacer::endFrame(uint32_t nowUs)
+{
+    uint32_t took = nowUs - m_FrameStartUs;
+    m_Stats.frames++;
+    m_Stats.lastFrameUs = took;
+    if(took > m_Stats.maxFrameUs)
+        m_Stats.maxFrameUs = took;
+    m_FrameRate = m_Rate;
+}
+
+void CRtpPacer::refill(uint32_t nowUs)
+{
+    uint32_t elapsed = nowUs - m_LastRefillUs;
+    uint64_t add = (uint64_t) elapsed * m_FrameRate / 1000000;
+    if(add == 0)
+        return; // keep the fractional credit for the next call
+    m_LastRefillUs = nowUs;
+
+    int64_t tokens = (int64_t) m_Tokens + (int64_t) add;
+    if(tokens > (int64_t) m_Burst)
+        tokens = m_Burst;
+    m_Tokens = (int32_t) tokens;
+}
+
+bool CRtpPacer::canSend(uint32_t nowUs)
+{
+    refill(nowUs);
+    if(m_Tokens > 0)
+        return true;
+
+    m_Stats.deferrals++;
+    return false;
+}
+
+void CRtpPacer::consume(uint32_t bytes)
+{
+    m_Tokens -= (int32_t) bytes;
+    m_Stats.packets++;
+    m_Stats.bytes += bytes;
+}
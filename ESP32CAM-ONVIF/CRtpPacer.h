@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+// Counters for tuning the pacer against a real access point
+struct RtpPacerStats
+{
+    uint32_t frames;        // frames fully sent
+    uint32_t packets;       // packets released
+    uint32_t bytes;         // bytes released
+    uint32_t writes;        // socket writes (fewer than packets when TCP writes are coalesced)
+    uint32_t copied;        // bytes copied into the TCP segment buffer on the way out
+    uint32_t deferrals;     // times the bucket ran dry and control went back to loop()
+    uint32_t lastFrameUs;   // first to last packet of the previous frame
+    uint32_t maxFrameUs;    // worst frame send time seen
+};
+
+// Token bucket that spreads the packets of a frame over the frame interval.
+// Tokens are bytes. They refill at the pacing rate up to the burst size and
+// a packet may be released whenever the bucket is not empty (it can overdraw
+// by one packet). When the bucket is empty the caller returns to loop()
+// instead of sleeping and resumes on the next pass.
+class CRtpPacer
+{
+public:
+    CRtpPacer(uint32_t rateBytesPerSec, uint32_t burstBytes);
+
+    void configure(uint32_t rateBytesPerSec, uint32_t burstBytes);
+    uint32_t rate() const { return m_Rate; }
+    uint32_t burst() const { return m_Burst; }
+
+    // Start a frame of frameBytes that should be sent within intervalMs.
+    // The rate is raised for this frame if the configured one is too slow
+    // to finish it in time. intervalMs = 0 uses the configured rate only.
+    void beginFrame(uint32_t frameBytes, uint32_t intervalMs, uint32_t nowUs);
+    void endFrame(uint32_t nowUs);
+
+    bool canSend(uint32_t nowUs);   // refill the bucket and check for tokens
+    void consume(uint32_t bytes);   // account for a packet that was sent
+    void countWrite() { m_Stats.writes++; }
+    void countCopy(uint32_t bytes) { m_Stats.copied += bytes; }
+
+    const RtpPacerStats &stats() const { return m_Stats; }
+
+private:
+    void refill(uint32_t nowUs);
+
+    uint32_t m_Rate;            // configured rate in bytes per second
+    uint32_t m_Burst;           // bucket size in bytes
+    uint32_t m_FrameRate;       // rate used for the current frame
+    int32_t  m_Tokens;
+    uint32_t m_LastRefillUs;
+    uint32_t m_FrameStartUs;
+    RtpPacerStats m_Stats;
+};
@@ -1,9 +1,9 @@
 #include "CRtspSession.h"
 #include <stdio.h>
 #include <time.h>
-#include "esp_camera.h"
+#include <strings.h>
 
-CRtspSession::CRtspSession(SOCKET aRtspClient, CStreamer * aStreamer) : m_RtspClient(aRtspClient),m_Streamer(aStreamer)
+CRtspSession::CRtspSession(SOCKET aRtspClient, CStreamer * aStreamer) : m_RtspClient(aRtspClient),m_Streamer(aStreamer),m_MulticastStreamer(NULL)
 {
     printf("Creating RTSP session\n");
     Init();
@@ -14,8 +14,13 @@ CRtspSession::CRtspSession(SOCKET aRtspClient, CStreamer * aStreamer) : m_RtspCl
     m_ClientRTPPort  =  0;
     m_ClientRTCPPort =  0;
     m_TcpTransport   =  false;
+    m_MulticastTransport = false;
+    m_Multicast      =  false;
     m_streaming = false;
+    m_playUs = 0;
     m_stopped = false;
+    m_RecvLen = 0;
+    m_RecvSkip = 0;
 };
 
 CRtspSession::~CRtspSession()
@@ -33,200 +38,167 @@ void CRtspSession::Init()
     m_ContentLength  =  0;
 };
 
+// copy [p, end) into a string field, truncating if needed
+static void CopyField(char * aDst, size_t aDstSize, char const * p, char const * end)
+{
+    size_t n = end - p;
+    if (n > aDstSize - 1) n = aDstSize - 1;
+    memcpy(aDst, p, n);
+    aDst[n] = '\0';
+}
+
+static unsigned ParseUInt(char const * p, char const * end, char const ** aNext)
+{
+    unsigned v = 0;
+    while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+    if (aNext) *aNext = p;
+    return v;
+}
+
+// Returns the length of the header block (including the blank line) or 0
+// if the terminating blank line has not arrived yet.
+static unsigned HeaderLength(char const * aBuf, unsigned aLen)
+{
+    char const * p = aBuf;
+    char const * end = aBuf + aLen;
+    while ((p = (char const *) memchr(p, '\n', end - p)) != nullptr)
+    {
+        p++;
+        if (p < end && *p == '\n') return p + 1 - aBuf;
+        if (p + 1 < end && p[0] == '\r' && p[1] == '\n') return p + 2 - aBuf;
+    }
+    return 0;
+}
+
 bool CRtspSession::ParseRtspRequest(char const * aRequest, unsigned aRequestSize)
 {
+    // Single pass over the request line and headers, nothing is copied
+    // except the fields we keep.
     char CmdName[RTSP_PARAM_STRING_MAX];
-    static char CurRequest[RTSP_BUFFER_SIZE]; // Note: we assume single threaded, this large buf we keep off of the tiny stack
-    unsigned CurRequestSize;
+    char const * end = aRequest + aRequestSize;
 
     Init();
-    CurRequestSize = aRequestSize;
-    memcpy(CurRequest,aRequest,aRequestSize);
-
-    // check whether the request contains information about the RTP/RTCP UDP client ports (SETUP command)
-    char * ClientPortPtr;
-    char * TmpPtr;
-    static char CP[1024];
-    char * pCP;
-
-    ClientPortPtr = strstr(CurRequest,"client_port");
-    if (ClientPortPtr != nullptr)
-    {
-        TmpPtr = strstr(ClientPortPtr,"\r\n");
-        if (TmpPtr != nullptr)
-        {
-            TmpPtr[0] = 0x00;
-            strcpy(CP,ClientPortPtr);
-            pCP = strstr(CP,"=");
-            if (pCP != nullptr)
-            {
-                pCP++;
-                strcpy(CP,pCP);
-                pCP = strstr(CP,"-");
-                if (pCP != nullptr)
-                {
-                    pCP[0] = 0x00;
-                    m_ClientRTPPort  = atoi(CP);
-                    m_ClientRTCPPort = m_ClientRTPPort + 1;
-                };
-            };
-        };
-    };
 
-    // Read everything up to the first space as the command name
-    bool parseSucceeded = false;
-    unsigned i;
-    for (i = 0; i < sizeof(CmdName)-1 && i < CurRequestSize; ++i)
-    {
-        char c = CurRequest[i];
-        if (c == ' ' || c == '\t')
-        {
-            parseSucceeded = true;
-            break;
-        }
-        CmdName[i] = c;
-    }
-    CmdName[i] = '\0';
-    if (!parseSucceeded) {
+    // Request line: <method> <url> RTSP/1.0
+    char const * LineEnd = (char const *) memchr(aRequest, '\n', aRequestSize);
+    if (LineEnd == nullptr) LineEnd = end;
+    char const * Space = (char const *) memchr(aRequest, ' ', LineEnd - aRequest);
+    if (Space == nullptr) {
         printf("failed to parse RTSP\n");
         return false;
     }
+    CopyField(CmdName, sizeof(CmdName), aRequest, Space);
 
     printf("RTSP received %s\n", CmdName);
 
     // find out the command type
-    if (strstr(CmdName,"OPTIONS")   != nullptr) m_RtspCmdType = RTSP_OPTIONS; else
-    if (strstr(CmdName,"DESCRIBE")  != nullptr) m_RtspCmdType = RTSP_DESCRIBE; else
-    if (strstr(CmdName,"SETUP")     != nullptr) m_RtspCmdType = RTSP_SETUP; else
-    if (strstr(CmdName,"PLAY")      != nullptr) m_RtspCmdType = RTSP_PLAY; else
-    if (strstr(CmdName,"TEARDOWN")  != nullptr) m_RtspCmdType = RTSP_TEARDOWN; else
-    if (strstr(CmdName,"GET_PARAMETER") != nullptr) m_RtspCmdType = RTSP_GET_PARAMETER;
-
-    // check whether the request contains transport information (UDP or TCP)
-    if (m_RtspCmdType == RTSP_SETUP)
-    {
-        TmpPtr = strstr(CurRequest,"RTP/AVP/TCP");
-        if (TmpPtr != nullptr) m_TcpTransport = true; else m_TcpTransport = false;
-    };
-
-    // Skip over the prefix of any "rtsp://" or "rtsp:/" URL that follows:
-    unsigned j = i+1;
-    while (j < CurRequestSize && (CurRequest[j] == ' ' || CurRequest[j] == '\t')) ++j; // skip over any additional white space
-    for (; (int)j < (int)(CurRequestSize-8); ++j)
+    if (strcmp(CmdName,"OPTIONS")   == 0) m_RtspCmdType = RTSP_OPTIONS; else
+    if (strcmp(CmdName,"DESCRIBE")  == 0) m_RtspCmdType = RTSP_DESCRIBE; else
+    if (strcmp(CmdName,"SETUP")     == 0) m_RtspCmdType = RTSP_SETUP; else
+    if (strcmp(CmdName,"PLAY")      == 0) m_RtspCmdType = RTSP_PLAY; else
+    if (strcmp(CmdName,"TEARDOWN")  == 0) m_RtspCmdType = RTSP_TEARDOWN; else
+    if (strcmp(CmdName,"GET_PARAMETER") == 0) m_RtspCmdType = RTSP_GET_PARAMETER;
+
+    char const * Url = Space + 1;
+    while (Url < LineEnd && (*Url == ' ' || *Url == '\t')) ++Url; // skip over any additional white space
+    char const * UrlEnd = (char const *) memchr(Url, ' ', LineEnd - Url);
+    if (UrlEnd == nullptr) return false; // no "RTSP/1.0" after the URL
+
+    // Skip over the "rtsp://host:port" prefix, keeping the host:port part
+    char const * Path = Url;
+    if (UrlEnd - Path >= 7 && strncasecmp(Path, "rtsp://", 7) == 0)
     {
-        if ((CurRequest[j]   == 'r' || CurRequest[j]   == 'R')   &&
-            (CurRequest[j+1] == 't' || CurRequest[j+1] == 'T') &&
-            (CurRequest[j+2] == 's' || CurRequest[j+2] == 'S') &&
-            (CurRequest[j+3] == 'p' || CurRequest[j+3] == 'P') &&
-            CurRequest[j+4] == ':' && CurRequest[j+5] == '/')
-        {
-            j += 6;
-            if (CurRequest[j] == '/')
-            {   // This is a "rtsp://" URL; skip over the host:port part that follows:
-                ++j;
-                unsigned uidx = 0;
-                while (j < CurRequestSize && CurRequest[j] != '/' && CurRequest[j] != ' ' && uidx < sizeof(m_URLHostPort) - 1)
-                {   // extract the host:port part of the URL here
-                    m_URLHostPort[uidx] = CurRequest[j];
-                    uidx++;
-                    ++j;
-                };
-            }
-            else --j;
-            i = j;
-            break;
-        }
+        char const * Host = Path + 7;
+        Path = Host;
+        while (Path < UrlEnd && *Path != '/') ++Path;
+        CopyField(m_URLHostPort, sizeof(m_URLHostPort), Host, Path);
     }
+    if (Path < UrlEnd && *Path == '/') ++Path;
 
-    // Look for the URL suffix (before the following "RTSP/"):
-    parseSucceeded = false;
-    for (unsigned k = i+1; (int)k < (int)(CurRequestSize-5); ++k)
-    {
-        if (CurRequest[k]   == 'R'   && CurRequest[k+1] == 'T'   &&
-            CurRequest[k+2] == 'S'   && CurRequest[k+3] == 'P'   &&
-            CurRequest[k+4] == '/')
-        {
-            while (--k >= i && CurRequest[k] == ' ') {}
-            unsigned k1 = k;
-            while (k1 > i && CurRequest[k1] != '/') --k1;
-            if (k - k1 + 1 > sizeof(m_URLSuffix)) return false;
-            unsigned n = 0, k2 = k1+1;
-
-            while (k2 <= k) m_URLSuffix[n++] = CurRequest[k2++];
-            m_URLSuffix[n] = '\0';
-
-            if (k1 - i > sizeof(m_URLPreSuffix)) return false;
-            n = 0; k2 = i + 1;
-            while (k2 <= k1 - 1) m_URLPreSuffix[n++] = CurRequest[k2++];
-            m_URLPreSuffix[n] = '\0';
-            i = k + 7;
-            parseSucceeded = true;
-            break;
-        }
-    }
-    if (!parseSucceeded) return false;
+    // The suffix is the last path component, the pre suffix everything before it
+    char const * Last = UrlEnd;
+    while (Last > Path && Last[-1] != '/') --Last;
+    CopyField(m_URLSuffix, sizeof(m_URLSuffix), Last, UrlEnd);
+    CopyField(m_URLPreSuffix, sizeof(m_URLPreSuffix), Path, Last > Path ? Last - 1 : Path);
 
-    // Look for "CSeq:", skip whitespace, then read everything up to the next \r or \n as 'CSeq':
-    parseSucceeded = false;
-    for (j = i; (int)j < (int)(CurRequestSize-5); ++j)
+    // Headers we care about: CSeq, Content-Length and Transport (SETUP)
+    bool HaveCSeq = false;
+    for (char const * p = LineEnd + 1; p < end; p = LineEnd + 1)
     {
-        if (CurRequest[j]   == 'C' && CurRequest[j+1] == 'S' &&
-            CurRequest[j+2] == 'e' && CurRequest[j+3] == 'q' &&
-            CurRequest[j+4] == ':')
+        LineEnd = (char const *) memchr(p, '\n', end - p);
+        if (LineEnd == nullptr) LineEnd = end;
+        char const * ValueEnd = LineEnd;
+        if (ValueEnd > p && ValueEnd[-1] == '\r') --ValueEnd;
+        if (ValueEnd == p) break; // blank line ends the headers
+
+        char const * Colon = (char const *) memchr(p, ':', ValueEnd - p);
+        if (Colon == nullptr) continue;
+        char const * Value = Colon + 1;
+        while (Value < ValueEnd && (*Value == ' ' || *Value == '\t')) ++Value;
+        size_t NameLen = Colon - p;
+
+        if (NameLen == 4 && strncasecmp(p, "CSeq", 4) == 0)
         {
-            j += 5;
-            while (j < CurRequestSize && (CurRequest[j] ==  ' ' || CurRequest[j] == '\t')) ++j;
-            unsigned n;
-            for (n = 0; n < sizeof(m_CSeq)-1 && j < CurRequestSize; ++n,++j)
-            {
-                char c = CurRequest[j];
-                if (c == '\r' || c == '\n')
-                {
-                    parseSucceeded = true;
-                    break;
-                }
-                m_CSeq[n] = c;
-            }
-            m_CSeq[n] = '\0';
-            break;
+            CopyField(m_CSeq, sizeof(m_CSeq), Value, ValueEnd);
+            HaveCSeq = true;
         }
+        else if (NameLen == 14 && strncasecmp(p, "Content-Length", 14) == 0)
+            m_ContentLength = ParseUInt(Value, ValueEnd, nullptr);
+        else if (NameLen == 9 && strncasecmp(p, "Transport", 9) == 0 && m_RtspCmdType == RTSP_SETUP)
+            ParseTransport(Value, ValueEnd);
     }
-    if (!parseSucceeded) return false;
+    return HaveCSeq;
+};
+
+// check whether the request asks for UDP, TCP or multicast and which
+// RTP/RTCP client ports to use. Only the first (preferred) transport is read.
+void CRtspSession::ParseTransport(char const * aValue, char const * aEnd)
+{
+    char const * Comma = (char const *) memchr(aValue, ',', aEnd - aValue);
+    if (Comma != nullptr) aEnd = Comma;
 
-    // Also: Look for "Content-Length:" (optional)
-    for (j = i; (int)j < (int)(CurRequestSize-15); ++j)
+    m_TcpTransport = false;
+    m_MulticastTransport = false;
+    for (char const * p = aValue; p < aEnd; )
     {
-        if (CurRequest[j]    == 'C'  && CurRequest[j+1]  == 'o'  &&
-            CurRequest[j+2]  == 'n'  && CurRequest[j+3]  == 't'  &&
-            CurRequest[j+4]  == 'e'  && CurRequest[j+5]  == 'n'  &&
-            CurRequest[j+6]  == 't'  && CurRequest[j+7]  == '-'  &&
-            (CurRequest[j+8] == 'L' || CurRequest[j+8]   == 'l') &&
-            CurRequest[j+9]  == 'e'  && CurRequest[j+10] == 'n' &&
-            CurRequest[j+11] == 'g' && CurRequest[j+12]  == 't' &&
-            CurRequest[j+13] == 'h' && CurRequest[j+14] == ':')
+        char const * Semi = (char const *) memchr(p, ';', aEnd - p);
+        char const * TokEnd = Semi ? Semi : aEnd;
+        size_t TokLen = TokEnd - p;
+
+        if (TokLen == 11 && strncmp(p, "RTP/AVP/TCP", 11) == 0)
+            m_TcpTransport = true;
+        else if (TokLen == 9 && strncmp(p, "multicast", 9) == 0)
+            m_MulticastTransport = true;
+        else if (TokLen > 12 && strncmp(p, "client_port=", 12) == 0)
         {
-            j += 15;
-            while (j < CurRequestSize && (CurRequest[j] ==  ' ' || CurRequest[j] == '\t')) ++j;
-            unsigned num;
-            if (sscanf(&CurRequest[j], "%u", &num) == 1) m_ContentLength = num;
+            char const * Next;
+            m_ClientRTPPort  = ParseUInt(p + 12, TokEnd, &Next);
+            m_ClientRTCPPort = m_ClientRTPPort + 1;
+            if (Next < TokEnd && *Next == '-')
+                m_ClientRTCPPort = ParseUInt(Next + 1, TokEnd, nullptr);
         }
+        p = TokEnd + 1;
     }
-    return true;
+    if (m_TcpTransport) m_MulticastTransport = false;
 };
 
 RTSP_CMD_TYPES CRtspSession::Handle_RtspRequest(char const * aRequest, unsigned aRequestSize)
 {
     if (ParseRtspRequest(aRequest,aRequestSize))
+        return DispatchRtspRequest();
+    return m_RtspCmdType;
+};
+
+RTSP_CMD_TYPES CRtspSession::DispatchRtspRequest()
+{
+    switch (m_RtspCmdType)
     {
-        switch (m_RtspCmdType)
-        {
-        case RTSP_OPTIONS:  { Handle_RtspOPTION();   break; };
-        case RTSP_DESCRIBE: { Handle_RtspDESCRIBE(); break; };
-        case RTSP_SETUP:    { Handle_RtspSETUP();    break; };
-        case RTSP_PLAY:     { Handle_RtspPLAY();     break; };
-        case RTSP_GET_PARAMETER: { Handle_RtspGET_PARAMETER(); break; };
-        default: {};
-        };
+    case RTSP_OPTIONS:  { Handle_RtspOPTION();   break; };
+    case RTSP_DESCRIBE: { Handle_RtspDESCRIBE(); break; };
+    case RTSP_SETUP:    { Handle_RtspSETUP();    break; };
+    case RTSP_PLAY:     { Handle_RtspPLAY();     break; };
+    case RTSP_GET_PARAMETER: { Handle_RtspGET_PARAMETER(); break; };
+    default: {};
     };
     return m_RtspCmdType;
 };
@@ -244,9 +216,10 @@ void CRtspSession::Handle_RtspOPTION()
 
 void CRtspSession::Handle_RtspDESCRIBE()
 {
-    static char Response[1024]; // Note: we assume single threaded, this large buf we keep off of the tiny stack
     static char SDPBuf[1024];
-    static char URLBuf[1024];
+    static char URLBuf[MAX_HOSTNAME_LEN + 32];  // rtsp://, host:port and the stream name
+    // Note: we assume single threaded, these large bufs we keep off of the tiny stack
+    static char Response[sizeof(SDPBuf) + sizeof(URLBuf) + 256];
 
     // check whether we know a stream with the URL which is requested
     m_StreamID = -1;        // invalid URL
@@ -278,14 +251,6 @@ void CRtspSession::Handle_RtspDESCRIBE()
     ColonPtr = strstr(OBuf,":"); 
     if (ColonPtr != nullptr) ColonPtr[0] = 0x00;
 
-    // Get actual resolution from camera
-    sensor_t * s = esp_camera_sensor_get();
-    int width = 640, height = 480;
-    if (s) {
-        width = 640;  // Default VGA
-        height = 480;
-    }
-    
     // Determine codec based on stream ID (0-1 = MJPEG, 2-3 = H.264)
     bool useH264 = (m_StreamID >= 2);
     
@@ -331,23 +296,14 @@ void CRtspSession::Handle_RtspDESCRIBE()
                  "a=control:track1\r\n",
                  rand(),
                  OBuf,
-                 width,
-                 height);
+                 m_Streamer->GetWidth(),
+                 m_Streamer->GetHeight());
     }
     
-    char StreamName[64];
-    switch (m_StreamID)
-    {
-    case 0: strcpy(StreamName,"mjpeg/1"); break;
-    case 1: strcpy(StreamName,"mjpeg/2"); break;
-    case 2: strcpy(StreamName,"h264/1"); break;
-    case 3: strcpy(StreamName,"h264/2"); break;
-    default: strcpy(StreamName,"1"); break;
-    };
     snprintf(URLBuf,sizeof(URLBuf),
              "rtsp://%s/%s",
              m_URLHostPort,
-             StreamName);
+             StreamName());
     snprintf(Response,sizeof(Response),
              "RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
              "%s\r\n"
@@ -369,24 +325,47 @@ void CRtspSession::Handle_RtspSETUP()
     static char Response[1024];
     static char Transport[255];
 
-    // init RTP streamer transport type (UDP or TCP) and ports for UDP transport
-    if (m_Streamer) {
-        m_Streamer->InitTransport(m_ClientRTPPort,m_ClientRTCPPort,m_TcpTransport);
-    } else {
-        printf("Error: m_Streamer is null in SETUP\n");
-        return;
+    if (m_MulticastTransport)
+    {   // all multicast clients share one streamer, nothing to set up per client
+        if (!m_MulticastStreamer)
+        {
+            snprintf(Response,sizeof(Response),
+                     "RTSP/1.0 461 Unsupported Transport\r\nCSeq: %s\r\n%s\r\n\r\n",
+                     m_CSeq,
+                     DateHeader());
+            socketsend(m_RtspClient,Response,strlen(Response));
+            return;
+        }
+        m_Multicast = true;
+        snprintf(Transport,sizeof(Transport),
+                 "RTP/AVP;multicast;destination=%s;port=%i-%i;ttl=%i",
+                 m_MulticastStreamer->GetMulticastGroup(),
+                 m_MulticastStreamer->GetMulticastPort(),
+                 m_MulticastStreamer->GetMulticastPort() + 1,
+                 m_MulticastStreamer->GetMulticastTtl());
     }
-
-    // simulate SETUP server response
-    if (m_TcpTransport)
-        snprintf(Transport,sizeof(Transport),"RTP/AVP/TCP;unicast;interleaved=0-1");
     else
-        snprintf(Transport,sizeof(Transport),
-                 "RTP/AVP;unicast;destination=127.0.0.1;source=127.0.0.1;client_port=%i-%i;server_port=%i-%i",
-                 m_ClientRTPPort,
-                 m_ClientRTCPPort,
-                 m_Streamer ? m_Streamer->GetRtpServerPort() : 0,
-                 m_Streamer ? m_Streamer->GetRtcpServerPort() : 0);
+    {
+        // init RTP streamer transport type (UDP or TCP) and ports for UDP transport
+        if (m_Streamer) {
+            m_Streamer->InitTransport(m_ClientRTPPort,m_ClientRTCPPort,m_TcpTransport);
+        } else {
+            printf("Error: m_Streamer is null in SETUP\n");
+            return;
+        }
+        m_Multicast = false;
+
+        // simulate SETUP server response
+        if (m_TcpTransport)
+            snprintf(Transport,sizeof(Transport),"RTP/AVP/TCP;unicast;interleaved=0-1");
+        else
+            snprintf(Transport,sizeof(Transport),
+                     "RTP/AVP;unicast;client_port=%i-%i;server_port=%i-%i",
+                     m_ClientRTPPort,
+                     m_ClientRTCPPort,
+                     m_Streamer->GetRtpServerPort(),
+                     m_Streamer->GetRtcpServerPort());
+    }
     snprintf(Response,sizeof(Response),
              "RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
              "%s\r\n"
@@ -404,27 +383,43 @@ void CRtspSession::Handle_RtspPLAY()
 {
     static char Response[1024];
 
-    // Get IP for dynamic URL construction
-    IPADDRESS clientip;
-    IPPORT clientport;
-    socketpeeraddr(m_RtspClient, &clientip, &clientport);
-    
+    // RTP-Info tells the client which packet comes first and its RTP time, so
+    // it can line up the stream with the play range. A multicast viewer joins
+    // a stream that is already running.
+    CStreamer * Streamer = m_Multicast && m_MulticastStreamer ? m_MulticastStreamer : m_Streamer;
+    unsigned Seq = Streamer->nextSequenceNumber();
+    unsigned long RtpTime = Streamer->rtpTimeAt(getMillis());
+
     // Hikvision-compatible PLAY response with proper timeout and RTP-Info
     snprintf(Response,sizeof(Response),
              "RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
              "%s\r\n"
              "Range: npt=0.000-\r\n"
              "Session: %i;timeout=60\r\n"
-             "RTP-Info: url=rtsp://%s:%d/mjpeg/1/track1;seq=0;rtptime=0\r\n\r\n",
+             "RTP-Info: url=rtsp://%s/%s/track1;seq=%u;rtptime=%lu\r\n\r\n",
              m_CSeq,
              DateHeader(),
              m_RtspSessionID,
              m_URLHostPort,
-             554);
+             StreamName(),
+             Seq,
+             RtpTime);
 
     socketsend(m_RtspClient,Response,strlen(Response));
 }
 
+char const * CRtspSession::StreamName()
+{
+    switch (m_StreamID)
+    {
+    case 0: return "mjpeg/1";
+    case 1: return "mjpeg/2";
+    case 2: return "h264/1";
+    case 3: return "h264/2";
+    default: return "1";
+    };
+}
+
 char const * CRtspSession::DateHeader()
 {
     static char buf[200];
@@ -462,20 +457,12 @@ bool CRtspSession::handleRequests(uint32_t readTimeoutMs)
     if(m_stopped)
         return false; // Already closed down
 
-    static char RecvBuf[RTSP_BUFFER_SIZE];   // Note: we assume single threaded, this large buf we keep off of the tiny stack
-
-    memset(RecvBuf,0x00,sizeof(RecvBuf));
-    int res = socketread(m_RtspClient,RecvBuf,sizeof(RecvBuf), readTimeoutMs);
+    // Append to whatever is left of a partial request from the last read.
+    // ProcessRecvBuf() never leaves the buffer full.
+    int res = socketread(m_RtspClient, m_RecvBuf + m_RecvLen, sizeof(m_RecvBuf) - m_RecvLen, readTimeoutMs);
     if(res > 0) {
-        // we filter away everything which seems not to be an RTSP command: O-ption, D-escribe, S-etup, P-lay, T-eardown
-        if ((RecvBuf[0] == 'O') || (RecvBuf[0] == 'D') || (RecvBuf[0] == 'S') || (RecvBuf[0] == 'P') || (RecvBuf[0] == 'T'))
-        {
-            RTSP_CMD_TYPES C = Handle_RtspRequest(RecvBuf,res);
-            if (C == RTSP_PLAY)
-                m_streaming = true;
-            else if (C == RTSP_TEARDOWN)
-                m_stopped = true;
-        }
+        m_RecvLen += res;
+        ProcessRecvBuf();
         return true;
     }
     else if(res == 0) {
@@ -490,6 +477,95 @@ bool CRtspSession::handleRequests(uint32_t readTimeoutMs)
     }
 }
 
+/**
+   Handle every complete unit in the receive buffer: RTSP requests (several
+   may be pipelined in one read) and '$' interleaved frames, whose channel 1
+   carries the client's RTCP receiver reports. Incomplete data stays buffered.
+ */
+void CRtspSession::ProcessRecvBuf()
+{
+    unsigned pos = 0;
+    while (pos < m_RecvLen && !m_stopped)
+    {
+        char * p = m_RecvBuf + pos;
+        unsigned avail = m_RecvLen - pos;
+
+        if (m_RecvSkip > 0)
+        {   // rest of an interleaved frame too large to buffer
+            unsigned n = avail < m_RecvSkip ? avail : m_RecvSkip;
+            m_RecvSkip -= n;
+            pos += n;
+            continue;
+        }
+
+        if (p[0] == '$')
+        {
+            if (avail < 4) break;
+            unsigned len = ((uint8_t) p[2] << 8) | (uint8_t) p[3];
+            if (4 + len > sizeof(m_RecvBuf))
+            {
+                m_RecvSkip = 4 + len;
+                continue;
+            }
+            if (avail < 4 + len) break;
+            if (p[1] == 1 && m_Streamer)
+                m_Streamer->handleRtcpPacket((const uint8_t *) p + 4, len);
+            pos += 4 + len;
+            continue;
+        }
+
+        // Requests start with an upper case method name, drop anything else
+        if (p[0] < 'A' || p[0] > 'Z')
+        {
+            pos++;
+            continue;
+        }
+
+        unsigned hdrLen = HeaderLength(p, avail);
+        if (hdrLen == 0)
+        {
+            if (pos == 0 && m_RecvLen == sizeof(m_RecvBuf))
+            {
+                printf("RTSP request too large, dropped\n");
+                pos = m_RecvLen;
+            }
+            break; // wait for the rest of the headers
+        }
+
+        if (!ParseRtspRequest(p, hdrLen))
+        {
+            pos += hdrLen;
+            continue;
+        }
+        if (avail < hdrLen + m_ContentLength)
+        {
+            if (hdrLen + m_ContentLength > sizeof(m_RecvBuf))
+            {   // body can never fit, skip it
+                m_RecvSkip = hdrLen + m_ContentLength;
+                continue;
+            }
+            break; // wait for the body, parse again once it is here
+        }
+
+        RTSP_CMD_TYPES C = DispatchRtspRequest();
+        if (C == RTSP_PLAY)
+        {
+            if (!m_streaming) m_playUs = getMicros();
+            m_streaming = true;
+        }
+        else if (C == RTSP_TEARDOWN)
+            m_stopped = true;
+        pos += hdrLen + m_ContentLength;
+    }
+
+    // keep the incomplete tail for the next read
+    if (pos > 0)
+    {
+        memmove(m_RecvBuf, m_RecvBuf + pos, m_RecvLen - pos);
+        m_RecvLen -= pos;
+    }
+}
+
 void CRtspSession::broadcastCurrentFrame(uint32_t curMsec) {
     // Send a frame - CRASH PROOFING
     if (m_streaming && !m_stopped) {
@@ -15,7 +15,7 @@ enum RTSP_CMD_TYPES
     RTSP_UNKNOWN
 };
 
-#define RTSP_BUFFER_SIZE       10000    // for incoming requests, and outgoing responses
+#define RTSP_BUFFER_SIZE       2048     // per session, for incoming requests (and '$' RTCP frames)
 #define RTSP_PARAM_STRING_MAX  200
 #define MAX_HOSTNAME_LEN       256
 
@@ -40,13 +40,30 @@ public:
      */
     void broadcastCurrentFrame(uint32_t curMsec);
 
+    /**
+       Streamer shared by all multicast clients, or NULL if multicast SETUP
+       is refused. Its RTP/RTCP ports and group are announced in SETUP.
+     */
+    void setMulticastStreamer(CStreamer * aStreamer) { m_MulticastStreamer = aStreamer; }
+
+    /**
+       True once the client set up multicast: frames for it are sent by the
+       multicast streamer, not by this session's own streamer.
+     */
+    bool isMulticast() const { return m_Multicast; }
+
     bool m_streaming;
     bool m_stopped;
+    uint32_t m_playUs;                                        // getMicros() of the first PLAY
 
 private:
     void Init();
     bool ParseRtspRequest(char const * aRequest, unsigned aRequestSize);
+    void ParseTransport(char const * aValue, char const * aEnd);
+    RTSP_CMD_TYPES DispatchRtspRequest();
+    void ProcessRecvBuf();
     char const * DateHeader();
+    char const * StreamName();                                // path of m_StreamID, e.g. "mjpeg/1"
 
     // RTSP request command handlers
     void Handle_RtspOPTION();
@@ -62,7 +79,10 @@ private:
     IPPORT m_ClientRTPPort;                                  // client port for UDP based RTP transport
     IPPORT m_ClientRTCPPort;                                 // client port for UDP based RTCP transport
     bool m_TcpTransport;                                      // if Tcp based streaming was activated
+    bool m_MulticastTransport;                                // if the last SETUP asked for multicast
+    bool m_Multicast;                                         // if multicast streaming was activated
     CStreamer    * m_Streamer;                                // the UDP or TCP streamer of that session
+    CStreamer    * m_MulticastStreamer;                       // shared multicast streamer (optional)
 
     // parameters of the last received RTSP request
 
@@ -72,4 +92,9 @@ private:
     char m_CSeq[RTSP_PARAM_STRING_MAX];                       // RTSP command sequence number
     char m_URLHostPort[MAX_HOSTNAME_LEN];                     // host:port part of the URL
     unsigned m_ContentLength;                                 // SDP string size
+
+    // receive buffer, holds partial requests between reads
+    char m_RecvBuf[RTSP_BUFFER_SIZE];
+    unsigned m_RecvLen;                                       // bytes buffered
+    unsigned m_RecvSkip;                                      // bytes still to drop of an oversized '$' frame
 };
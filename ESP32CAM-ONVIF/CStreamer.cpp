@@ -1,8 +1,13 @@
 #include "CStreamer.h"
 
 #include <stdio.h>
+#include <string.h>
 
-CStreamer::CStreamer(SOCKET aClient, u_short width, u_short height) : m_Client(aClient)
+// Default pacing until the server applies its own settings (1 MB/s, ~6 packets burst)
+#define DEFAULT_PACE_RATE  (1000 * 1000)
+#define DEFAULT_PACE_BURST (8 * 1024)
+
+CStreamer::CStreamer(SOCKET aClient, u_short width, u_short height) : m_Client(aClient), m_Pacer(DEFAULT_PACE_RATE, DEFAULT_PACE_BURST)
 {
     printf("Creating TSP streamer\n");
     m_RtpServerPort  = 0;
@@ -12,6 +17,9 @@ CStreamer::CStreamer(SOCKET aClient, u_short width, u_short height) : m_Client(a
 
     m_SequenceNumber = 0;
     m_Timestamp      = 0;
+    m_Ssrc           = getRandom32(); // RFC 3550 8.1: random, so streams and sessions don't collide
+    m_RtpPacketCount = 0;
+    m_RtpOctetCount  = 0;
     m_SendIdx        = 0;
     m_TCPTransport   = false;
 
@@ -21,20 +29,121 @@ CStreamer::CStreamer(SOCKET aClient, u_short width, u_short height) : m_Client(a
     m_width = width;
     m_height = height;
     m_prevMsec = 0;
+
+    m_Multicast = false;
+    m_MulticastAddr = IPADDRESS();
+    m_MulticastGroup[0] = '\0';
+    m_MulticastTtl = 0;
+
+    memset(&m_RtcpStats, 0, sizeof(m_RtcpStats));
+    m_LastSrMsec   = 0;
+
+    m_FramePending = false;
+    m_FrameOffset  = 0;
+    m_FrameBytes   = 0;
+    m_FrameSent    = 0;
+    m_FirstPacketUs = 0;
+    m_LastPacketUs  = 0;
+    memset(&m_Frame, 0, sizeof(m_Frame));
+    memset(&m_DropStats, 0, sizeof(m_DropStats));
+
+    m_TxBuf        = NULL;
+    m_TxLen        = 0;
+    m_TxSize       = 0;
+    udpbatchinit(&m_UdpBatch);
 };
 
 CStreamer::~CStreamer()
 {
-    udpsocketclose(m_RtpSocket);
-    udpsocketclose(m_RtcpSocket);
+    closePortPair();
+    heap_tracker_free(m_TxBuf);
+};
+
+void CStreamer::setTcpSegmentSize(uint32_t bytes)
+{
+    if (bytes == m_TxSize)
+        return;
+
+    tcpFlush();
+    heap_tracker_free(m_TxBuf);
+    m_TxBuf  = NULL;
+    m_TxSize = bytes;
+};
+
+void CStreamer::tcpSend(const void *hdr, size_t hdrLen, const void *payload, size_t payloadLen)
+{
+    if (m_TxSize && !m_TxBuf) {
+        m_TxBuf = (uint8_t *) HEAP_ALLOC(HEAP_RTSP, m_TxSize);
+        if (!m_TxBuf) {
+            printf("no memory for the TCP segment buffer, sending packets one by one\n");
+            m_TxSize = 0;
+        }
+    }
+
+    if (!m_TxBuf) {
+        socketsendv(m_Client, hdr, hdrLen, payload, payloadLen);
+        m_Pacer.countWrite();
+        return;
+    }
+
+    tcpAppend((const uint8_t *) hdr, hdrLen);
+    tcpAppend((const uint8_t *) payload, payloadLen);
+};
+
+// Copy into the segment buffer, writing it out each time it fills up. A
+// packet may straddle two segments, TCP is a byte stream after all.
+void CStreamer::tcpAppend(const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        size_t chunk = m_TxSize - m_TxLen;
+        if (chunk > len)
+            chunk = len;
+        memcpy(m_TxBuf + m_TxLen, data, chunk);
+        m_Pacer.countCopy(chunk);
+        m_TxLen += chunk;
+        data += chunk;
+        len -= chunk;
+        if (m_TxLen == m_TxSize)
+            tcpFlush();
+    }
+};
+
+void CStreamer::tcpFlush()
+{
+    if (m_TxLen == 0)
+        return;
+
+    socketsendv(m_Client, m_TxBuf, m_TxLen, NULL, 0);
+    m_Pacer.countWrite();
+    m_TxLen = 0;
+};
+
+void CStreamer::udpSend(const void *hdr, size_t hdrLen, const void *payload, size_t payloadLen)
+{
+    IPADDRESS otherip;
+    if (!udpDestination(&otherip))
+        return;
+
+    int calls = udpbatchadd(&m_UdpBatch, m_RtpSocket, hdr, hdrLen, payload, payloadLen, otherip, m_RtpClientPort);
+    while (calls-- > 0)
+        m_Pacer.countWrite();
+};
+
+void CStreamer::flushSends()
+{
+    tcpFlush();
+    int calls = udpbatchflush(&m_UdpBatch);
+    while (calls-- > 0)
+        m_Pacer.countWrite();
 };
 
-int CStreamer::SendRtpPacket(unsigned const char * jpeg, int jpegLen, int fragmentOffset, BufPtr quant0tbl, BufPtr quant1tbl)
+int CStreamer::SendRtpPacket(const JpegFrameInfo &jpeg, int fragmentOffset, int *wireLen)
 {
 #define KRtpHeaderSize 12           // size of the RTP header
 #define KJpegHeaderSize 8           // size of the special JPEG payload header
 
 #define MAX_FRAGMENT_SIZE 1280 // Safe MTU for WiFi (1500 - headers)
+    int jpegLen = jpeg.scanLen;
     int fragmentLen = MAX_FRAGMENT_SIZE;
     if(fragmentLen + fragmentOffset > jpegLen) // Shrink last fragment if needed
         fragmentLen = jpegLen - fragmentOffset;
@@ -43,13 +152,14 @@ int CStreamer::SendRtpPacket(unsigned const char * jpeg, int jpegLen, int fragme
 
     // Do we have custom quant tables? If so include them per RFC
 
-    bool includeQuantTbl = quant0tbl && quant1tbl && fragmentOffset == 0;
+    bool includeQuantTbl = jpeg.qtable0 && jpeg.qtable1 && fragmentOffset == 0;
     uint8_t q = includeQuantTbl ? 128 : 0x5e;
 
-    static char RtpBuf[2048]; // Note: we assume single threaded, this large buf we keep off of the tiny stack
+    // Only the headers are assembled here, the JPEG scan data is sent straight
+    // from the frame buffer. Worst case: 4 interleave + 12 RTP + 8 JPEG + 4 + 128 quant
+    static char RtpBuf[4 + KRtpHeaderSize + KJpegHeaderSize + 4 + 64 * 2]; // Note: we assume single threaded
     int RtpPacketSize = fragmentLen + KRtpHeaderSize + KJpegHeaderSize + (includeQuantTbl ? (4 + 64 * 2) : 0);
 
-    memset(RtpBuf,0x00,sizeof(RtpBuf));
     // Prepare the first 4 byte of the packet. This is the Rtp over Rtsp header in case of TCP based transport
     RtpBuf[0]  = '$';        // magic number
     RtpBuf[1]  = 0;          // number of multiplexed subchannel on RTPS connection - here the RTP channel
@@ -64,10 +174,10 @@ int CStreamer::SendRtpPacket(unsigned const char * jpeg, int jpegLen, int fragme
     RtpBuf[9]  = (m_Timestamp & 0x00FF0000) >> 16;
     RtpBuf[10] = (m_Timestamp & 0x0000FF00) >> 8;
     RtpBuf[11] = (m_Timestamp & 0x000000FF);
-    RtpBuf[12] = 0x13;                               // 4 byte SSRC (sychronization source identifier)
-    RtpBuf[13] = 0xf9;                               // we just an arbitrary number here to keep it simple
-    RtpBuf[14] = 0x7e;
-    RtpBuf[15] = 0x67;
+    RtpBuf[12] = (m_Ssrc & 0xFF000000) >> 24;        // 4 byte SSRC (sychronization source identifier)
+    RtpBuf[13] = (m_Ssrc & 0x00FF0000) >> 16;
+    RtpBuf[14] = (m_Ssrc & 0x0000FF00) >> 8;
+    RtpBuf[15] = (m_Ssrc & 0x000000FF);
 
     // Prepare the 8 byte payload JPEG header
     RtpBuf[16] = 0x00;                               // type specific
@@ -79,10 +189,10 @@ int CStreamer::SendRtpPacket(unsigned const char * jpeg, int jpegLen, int fragme
        type 0 video is downsampled horizontally by 2 (often called 4:2:2)
        while the chrominance components of type 1 video are downsampled both
        horizontally and vertically by 2 (often called 4:2:0). */
-    RtpBuf[20] = 0x00;                               // type (fixme might be wrong for camera data) https://tools.ietf.org/html/rfc2435
+    RtpBuf[20] = jpeg.type;                          // type, from the SOF0 sampling factors https://tools.ietf.org/html/rfc2435
     RtpBuf[21] = q;                               // quality scale factor was 0x5e
-    RtpBuf[22] = m_width / 8;                           // width  / 8
-    RtpBuf[23] = m_height / 8;                           // height / 8
+    RtpBuf[22] = jpeg.width / 8;                     // width  / 8
+    RtpBuf[23] = jpeg.height / 8;                    // height / 8
 
     int headerLen = 24; // Inlcuding jpeg header but not qant table header
     if(includeQuantTbl) { // we need a quant header - but only in first packet of the frame
@@ -96,29 +206,30 @@ int CStreamer::SendRtpPacket(unsigned const char * jpeg, int jpegLen, int fragme
 
         headerLen += 4;
 
-        memcpy(RtpBuf + headerLen, quant0tbl, numQantBytes);
+        memcpy(RtpBuf + headerLen, jpeg.qtable0, numQantBytes);
         headerLen += numQantBytes;
 
-        memcpy(RtpBuf + headerLen, quant1tbl, numQantBytes);
+        memcpy(RtpBuf + headerLen, jpeg.qtable1, numQantBytes);
         headerLen += numQantBytes;
     }
     // printf("Sending timestamp %d, seq %d, fragoff %d, fraglen %d, jpegLen %d\n", m_Timestamp, m_SequenceNumber, fragmentOffset, fragmentLen, jpegLen);
 
-    // append the JPEG scan data to the RTP buffer
-    memcpy(RtpBuf + headerLen,jpeg + fragmentOffset, fragmentLen);
+    // the JPEG scan data for this fragment is sent in place
+    BufPtr fragment = jpeg.scan + fragmentOffset;
     fragmentOffset += fragmentLen;
 
     m_SequenceNumber++;                              // prepare the packet counter for the next packet
+    m_RtpPacketCount++;
+    m_RtpOctetCount += headerLen - 4 - KRtpHeaderSize + fragmentLen;
 
-    IPADDRESS otherip;
-    IPPORT otherport;
-    socketpeeraddr(m_Client, &otherip, &otherport);
+    if (wireLen) // the 4 byte interleave header only goes out over TCP
+        *wireLen = headerLen + fragmentLen - (m_TCPTransport ? 0 : 4);
 
     // RTP marker bit must be set on last fragment
     if (m_TCPTransport) // RTP over RTSP - we send the buffer + 4 byte additional header
-        socketsend(m_Client,RtpBuf,RtpPacketSize + 4);
+        tcpSend(RtpBuf, headerLen, fragment, fragmentLen);
     else                // UDP - we send just the buffer by skipping the 4 byte RTP over RTSP header
-        udpsocketsend(m_RtpSocket,&RtpBuf[4],RtpPacketSize, otherip, m_RtpClientPort);
+        udpSend(&RtpBuf[4], headerLen - 4, fragment, fragmentLen);
 
     return isLastFragment ? 0 : fragmentOffset;
 };
@@ -129,28 +240,93 @@ void CStreamer::InitTransport(u_short aRtpPort, u_short aRtcpPort, bool TCP)
     m_RtcpClientPort = aRtcpPort;
     m_TCPTransport   = TCP;
 
+    // A client may SETUP again, e.g. to switch transports: the ports of the
+    // previous SETUP are not used any more
+    closePortPair();
     if (!m_TCPTransport)
-    {   // allocate port pairs for RTP/RTCP ports in UDP transport mode
-        for (u_short P = 6970; P < 0xFFFE; P += 2)
-        {
-            m_RtpSocket     = udpsocketcreate(P);
-            if (m_RtpSocket)
-            {   // Rtp socket was bound successfully. Lets try to bind the consecutive Rtsp socket
-                m_RtcpSocket = udpsocketcreate(P + 1);
-                if (m_RtcpSocket)
-                {
-                    m_RtpServerPort  = P;
-                    m_RtcpServerPort = P+1;
-                    break;
-                }
-                else
-                {
-                    udpsocketclose(m_RtpSocket);
-                    udpsocketclose(m_RtcpSocket);
-                };
+        bindPortPair();
+};
+
+bool CStreamer::InitMulticast(const char *aGroup, u_short aRtpPort, u_char aTtl)
+{
+    if (!ipaddrparse(aGroup, &m_MulticastAddr))
+    {
+        printf("Invalid multicast group %s\n", aGroup);
+        return false;
+    }
+
+    m_Multicast      = true;
+    m_TCPTransport   = false;
+    m_RtpClientPort  = aRtpPort;
+    m_RtcpClientPort = aRtpPort + 1;
+    m_MulticastTtl   = aTtl;
+    snprintf(m_MulticastGroup, sizeof(m_MulticastGroup), "%s", aGroup);
+
+    if (!bindPortPair())
+        return false;
+    // Clients are told this TTL in SETUP and by ONVIF, don't send with another one
+    if (!udpsocketsetttl(m_RtpSocket, aTtl) || !udpsocketsetttl(m_RtcpSocket, aTtl))
+    {
+        printf("Can't set multicast TTL %d\n", aTtl);
+        closePortPair();
+        return false;
+    }
+    return true;
+};
+
+void CStreamer::closePortPair()
+{
+    if (m_RtpSocket != NULLSOCKET)
+        udpsocketclose(m_RtpSocket);
+    if (m_RtcpSocket != NULLSOCKET)
+        udpsocketclose(m_RtcpSocket);
+    m_RtpSocket      = NULLSOCKET;
+    m_RtcpSocket     = NULLSOCKET;
+    m_RtpServerPort  = 0;
+    m_RtcpServerPort = 0;
+};
+
+bool CStreamer::bindPortPair()
+{
+    closePortPair();
+
+    // allocate port pairs for RTP/RTCP ports in UDP transport mode
+    for (u_short P = 6970; P < 0xFFFE; P += 2)
+    {
+        m_RtpSocket     = udpsocketcreate(P);
+        if (m_RtpSocket)
+        {   // Rtp socket was bound successfully. Lets try to bind the consecutive Rtsp socket
+            m_RtcpSocket = udpsocketcreate(P + 1);
+            if (m_RtcpSocket)
+            {
+                m_RtpServerPort  = P;
+                m_RtcpServerPort = P+1;
+                return true;
             }
-        };
+            else
+            {
+                udpsocketclose(m_RtpSocket);
+                m_RtpSocket  = NULLSOCKET;
+                m_RtcpSocket = NULLSOCKET;
+            };
+        }
     };
+    return false;
+};
+
+bool CStreamer::udpDestination(IPADDRESS *addr)
+{
+    if (m_Multicast)
+    {
+        *addr = m_MulticastAddr;
+        return true;
+    }
+    if (!m_Client)
+        return false;
+
+    IPPORT otherport;
+    socketpeeraddr(m_Client, addr, &otherport);
+    return true;
 };
 
 u_short CStreamer::GetRtpServerPort()
@@ -164,7 +340,7 @@ u_short CStreamer::GetRtcpServerPort()
 };
 
 
-void CStreamer::streamFrame(unsigned const char *data, uint32_t dataLen, uint32_t curMsec)
+void CStreamer::advanceTimestamp(uint32_t curMsec)
 {
     if(m_prevMsec == 0) // first frame init our timestamp
         m_prevMsec = curMsec;
@@ -173,177 +349,422 @@ void CStreamer::streamFrame(unsigned const char *data, uint32_t dataLen, uint32_
     uint32_t deltams = (curMsec >= m_prevMsec) ? curMsec - m_prevMsec : 100;
     m_prevMsec = curMsec;
 
-    // locate quant tables if possible
-    BufPtr qtable0, qtable1;
+    uint32_t units = 90000; // Hz per RFC 2435
+    m_Timestamp += (units * deltams / 1000);
+};
+
+uint32_t CStreamer::rtpTimeAt(uint32_t curMsec) const
+{
+    // m_Timestamp belongs to the frame stamped at m_prevMsec, extrapolate it
+    // at 90 kHz. Before the first frame the clock starts at m_Timestamp.
+    if(m_prevMsec == 0)
+        return m_Timestamp;
+    return m_Timestamp + (curMsec - m_prevMsec) * 90;
+}
 
-    if(!decodeJPEGfile(&data, &dataLen, &qtable0, &qtable1)) {
-        printf("can't decode jpeg data\n");
-        return;
+void CStreamer::serviceRtcp(uint32_t curMsec)
+{
+    // Receiver reports over UDP arrive on our RTCP port, interleaved ones
+    // are handed over by the RTSP session.
+    if (!m_TCPTransport && m_RtcpSocket)
+    {
+        static uint8_t RtcpBuf[512]; // Note: we assume single threaded
+        int len;
+        while ((len = udpsocketread(m_RtcpSocket, (char *) RtcpBuf, sizeof(RtcpBuf))) > 0)
+            handleRtcpPacket(RtcpBuf, len);
     }
 
-    int offset = 0;
-    do {
-        offset = SendRtpPacket(data, dataLen, offset, qtable0, qtable1);
-        // CRITICAL FOR SMOOTH STREAMING:
-        // Yield to allow WiFi stack to actually transmit the packet
-        // otherwise we fill the buffer and choke.
-        yield();
-        // Tiny pacing to prevent UDP burst loss on router side
-        delayMicroseconds(500); 
-    } while(offset != 0);
-
-    // Increment ONLY after a full frame
-    uint32_t units = 90000; // Hz per RFC 2435
-    m_Timestamp += (units * deltams / 1000);                             // fixed timestamp increment for a frame rate of 25fps
+    // Nothing to report before the first RTP packet
+    if (m_RtpPacketCount == 0)
+        return;
+    if (m_RtcpStats.srSent > 0 && curMsec - m_LastSrMsec < RTCP_SR_INTERVAL_MS)
+        return;
 
-    m_SendIdx++;
-    if (m_SendIdx > 1) m_SendIdx = 0;
+    sendRtcpSenderReport(curMsec);
 };
 
-#include <assert.h>
+static inline void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
 
-// search for a particular JPEG marker, moves *start to just after that marker
-// This function fixes up the provided start ptr to point to the
-// actual JPEG stream data and returns the number of bytes skipped
-// APP0 e0
-// DQT db
-// DQT db
-// DHT c4
-// DHT c4
-// DHT c4
-// DHT c4
-// SOF0 c0 baseline (not progressive) 3 color 0x01 Y, 0x21 2h1v, 0x00 tbl0
-// - 0x02 Cb, 0x11 1h1v, 0x01 tbl1 - 0x03 Cr, 0x11 1h1v, 0x01 tbl1
-// therefore 4:2:2, with two separate quant tables (0 and 1)
-// SOS da
-// EOI d9 (no need to strip data after this RFC says client will discard)
-bool findJPEGheader(BufPtr *start, uint32_t *len, uint8_t marker) {
-    // per https://en.wikipedia.org/wiki/JPEG_File_Interchange_Format
-    unsigned const char *bytes = *start;
-
-    // kinda skanky, will break if unlucky and the headers inxlucde 0xffda
-    // might fall off array if jpeg is invalid
-    // FIXME - return false instead
-    while(bytes - *start < *len) {
-        uint8_t framing = *bytes++; // better be 0xff
-        if(framing != 0xff) {
-            printf("malformed jpeg, framing=%x\n", framing);
-            return false;
-        }
-        uint8_t typecode = *bytes++;
-        if(typecode == marker) {
-            unsigned skipped = bytes - *start;
-            //printf("found marker 0x%x, skipped %d\n", marker, skipped);
+static inline uint32_t get32(const uint8_t *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
 
-            *start = bytes;
+void CStreamer::sendRtcpSenderReport(uint32_t curMsec)
+{
+#define KRtcpCname "esp32cam"
+    // 4 interleave + 28 SR + SDES with one CNAME item, padded to 32 bits
+    static uint8_t RtcpBuf[4 + 28 + 8 + ((2 + sizeof(KRtcpCname) - 1 + 1 + 3) & ~3)]; // Note: we assume single threaded
+    uint8_t *p = RtcpBuf + 4;
+
+    // Map the wall clock to the RTP clock
+    uint32_t ntpSec, ntpFrac;
+    getNtpTime(&ntpSec, &ntpFrac);
+    uint32_t rtpTime = rtpTimeAt(curMsec);
+
+    // Sender report, no report blocks since we receive nothing
+    p[0] = 0x80;                                     // version 2, RC = 0
+    p[1] = 200;                                      // PT = SR
+    p[2] = 0;
+    p[3] = 6;                                        // length in 32 bit words - 1
+    put32(p + 4, m_Ssrc);
+    put32(p + 8, ntpSec);
+    put32(p + 12, ntpFrac);
+    put32(p + 16, rtpTime);
+    put32(p + 20, m_RtpPacketCount);
+    put32(p + 24, m_RtpOctetCount);
+    p += 28;
+
+    // SDES with our CNAME, RFC 3550 requires it in every compound packet
+    int cnameLen = sizeof(KRtcpCname) - 1;
+    int sdesLen = 8 + ((2 + cnameLen + 1 + 3) & ~3); // header, SSRC, item + end marker, padded
+    memset(p, 0, sdesLen);
+    p[0] = 0x81;                                     // version 2, SC = 1
+    p[1] = 202;                                      // PT = SDES
+    p[2] = 0;
+    p[3] = sdesLen / 4 - 1;
+    put32(p + 4, m_Ssrc);
+    p[8] = 1;                                        // CNAME
+    p[9] = cnameLen;
+    memcpy(p + 10, KRtcpCname, cnameLen);
+    p += sdesLen;
+
+    int rtcpLen = p - (RtcpBuf + 4);
+    if (m_TCPTransport)
+    {   // RTCP over RTSP uses the second interleaved channel
+        RtcpBuf[0] = '$';
+        RtcpBuf[1] = 1;
+        RtcpBuf[2] = (rtcpLen & 0x0000FF00) >> 8;
+        RtcpBuf[3] = (rtcpLen & 0x000000FF);
+        tcpSend(RtcpBuf, rtcpLen + 4, NULL, 0);
+        tcpFlush();
+    }
+    else
+    {
+        IPADDRESS otherip;
+        if (udpDestination(&otherip))
+            udpsocketsend(m_RtcpSocket, RtcpBuf + 4, rtcpLen, otherip, m_RtcpClientPort);
+    }
 
-            // shrink len for the bytes we just skipped
-            *len -= skipped;
+    m_LastSrMsec = curMsec;
+    m_RtcpStats.srSent++;
+};
 
-            return true;
-        }
-        else {
-            // not the section we were looking for, skip the entire section
-            switch(typecode) {
-            case 0xd8:     // start of image
-            {
-                break;   // no data to skip
-            }
-            case 0xe0:   // app0
-            case 0xdb:   // dqt
-            case 0xc4:   // dht
-            case 0xc0:   // sof0
-            case 0xda:   // sos
+void CStreamer::handleRtcpPacket(const uint8_t *buf, uint32_t len)
+{
+    // A compound packet is a sequence of RTCP packets, each with its own length
+    while (len >= 8)
+    {
+        if ((buf[0] & 0xC0) != 0x80)
+            return; // not RTP version 2, give up on the rest
+
+        uint32_t pktLen = ((buf[2] << 8) | buf[3]) * 4 + 4;
+        if (pktLen > len)
+            return; // truncated
+
+        int count = buf[0] & 0x1F;
+        const uint8_t *block = NULL;
+        if (buf[1] == 201)                           // RR: header + SSRC
+            block = buf + 8;
+        else if (buf[1] == 200)                      // SR: header + SSRC + 20 byte sender info
+            block = buf + 28;
+
+        for (int i = 0; block && i < count && block + 24 <= buf + pktLen; i++, block += 24)
+        {
+            if (get32(block) != m_Ssrc)
+                continue; // about some other source
+
+            int32_t lost = get32(block + 4) & 0x00FFFFFF;
+            if (lost & 0x00800000)
+                lost |= 0xFF000000; // 24 bit signed
+
+            m_RtcpStats.reports++;
+            m_RtcpStats.fractionLost   = block[4];
+            m_RtcpStats.cumulativeLost = lost;
+            m_RtcpStats.highestSeq     = get32(block + 8);
+            m_RtcpStats.jitter         = get32(block + 12);
+
+            // RTT = arrival - LSR - DLSR, all in 1/65536 s (middle 32 bits of NTP)
+            uint32_t lsr  = get32(block + 16);
+            uint32_t dlsr = get32(block + 20);
+            if (lsr != 0)
             {
-                // standard format section with 2 bytes for len.  skip that many bytes
-                uint32_t len = bytes[0] * 256 + bytes[1];
-                //printf("skipping section 0x%x, %d bytes\n", typecode, len);
-                bytes += len;
-                break;
-            }
-            default:
-                printf("unexpected jpeg typecode 0x%x\n", typecode);
-                break;
+                uint32_t ntpSec, ntpFrac;
+                getNtpTime(&ntpSec, &ntpFrac);
+                uint32_t arrival = (ntpSec << 16) | (ntpFrac >> 16);
+                uint32_t rtt = arrival - lsr - dlsr;
+                if ((int32_t) rtt >= 0)
+                    m_RtcpStats.rttMs = (uint32_t) (((uint64_t) rtt * 1000) >> 16);
             }
         }
+
+        buf += pktLen;
+        len -= pktLen;
     }
+};
 
-    printf("failed to find jpeg marker 0x%x", marker);
-    return false;
-}
+void CStreamer::streamFrame(unsigned const char *data, uint32_t dataLen, uint32_t curMsec)
+{
+    // locate scan and quant tables
+    JpegFrameInfo jpeg;
 
-// the scan data uses byte stuffing to guarantee anything that starts with 0xff
-// followed by something not zero, is a new section.  Look for that marker and return the ptr
-// pointing there
-void skipScanBytes(BufPtr *start) {
-    BufPtr bytes = *start;
-
-    while(true) { // FIXME, check against length
-        while(*bytes++ != 0xff);
-        if(*bytes++ != 0) {
-            *start = bytes - 2; // back up to the 0xff marker we just found
-            return;
-        }
+    if(!parseJPEG(data, dataLen, &jpeg)) {
+        printf("can't decode jpeg data\n");
+        return;
     }
-}
-void  nextJpegBlock(BufPtr *bytes) {
-    uint32_t len = (*bytes)[0] * 256 + (*bytes)[1];
-    //printf("going to next jpeg block %d bytes\n", len);
-    *bytes += len;
-}
 
-// When JPEG is stored as a file it is wrapped in a container
-// This function fixes up the provided start ptr to point to the
-// actual JPEG stream data and returns the number of bytes skipped
-bool decodeJPEGfile(BufPtr *start, uint32_t *len, BufPtr *qtable0, BufPtr *qtable1) {
-    // per https://en.wikipedia.org/wiki/JPEG_File_Interchange_Format
-    unsigned const char *bytes = *start;
-
-    if(!findJPEGheader(&bytes, len, 0xd8)) // better at least look like a jpeg file
-        return false; // FAILED!
-
-    // Look for quant tables if they are present
-    *qtable0 = NULL;
-    *qtable1 = NULL;
-    BufPtr quantstart = *start;
-    uint32_t quantlen = *len;
-    if(!findJPEGheader(&quantstart, &quantlen, 0xdb)) {
-        printf("error can't find quant table 0\n");
+    streamDecodedFrame(jpeg, curMsec);
+};
+
+void CStreamer::streamDecodedFrame(const JpegFrameInfo &jpeg, uint32_t curMsec)
+{
+    if(!beginFrame(jpeg, curMsec, 0))
+        return;
+    while(!pumpFrame())
+        yield(); // let the WiFi stack drain while the bucket refills
+};
+
+bool CStreamer::beginFrame(const JpegFrameInfo &jpeg, uint32_t curMsec, uint32_t intervalMs)
+{
+    if (!startFrame(jpeg.scanLen, intervalMs))
+        return false;
+
+    // Stamp this frame relative to the previous one sent to this client
+    advanceTimestamp(curMsec);
+
+    m_Frame        = jpeg;
+    m_FrameOffset  = 0;
+    m_FramePending = jpeg.scanLen > 0;
+    return true;
+};
+
+bool CStreamer::startFrame(uint32_t frameBytes, uint32_t intervalMs)
+{
+    // A full send window means the client hasn't even received the last
+    // frame yet. Queueing another one behind it would only add delay.
+    if (m_TCPTransport && !socketwritable(m_Client)) {
+        m_DropStats.droppedFrames++;
+        frameDropped();
+        return false;
     }
-    else {
-        // printf("found quant table %x\n", quantstart[2]);
 
-        *qtable0 = quantstart + 3;     // 3 bytes of header skipped
-        nextJpegBlock(&quantstart);
-        if(!findJPEGheader(&quantstart, &quantlen, 0xdb)) {
-            printf("error can't find quant table 1\n");
+    m_FrameBytes = frameBytes;
+    m_FrameSent  = 0;
+    m_Pacer.beginFrame(frameBytes, intervalMs, getMicros());
+    return true;
+};
+
+void CStreamer::dropFrame()
+{
+    if (!m_FramePending)
+        return;
+
+    uint32_t backlog = m_FrameSent < m_FrameBytes ? m_FrameBytes - m_FrameSent : 0;
+    if (backlog > m_DropStats.maxBacklogBytes)
+        m_DropStats.maxBacklogBytes = backlog;
+    m_DropStats.droppedFrames++;
+    m_FramePending = false;
+    flushSends(); // the packets already queued are complete
+    frameDropped();
+};
+
+RtpDropStats CStreamer::dropStats() const
+{
+    RtpDropStats stats = m_DropStats;
+    if (m_FramePending && m_FrameSent < m_FrameBytes)
+        stats.backlogBytes = m_FrameBytes - m_FrameSent;
+    return stats;
+};
+
+int CStreamer::sendNextPacket()
+{
+    int wireLen = 0;
+    int offset = SendRtpPacket(m_Frame, m_FrameOffset, &wireLen);
+    if (offset == 0)
+        m_FramePending = false;
+    else
+        m_FrameOffset = offset;
+    return wireLen;
+};
+
+bool CStreamer::pumpFrame()
+{
+    if (!m_FramePending)
+        return true;
+
+    // Send while the token bucket allows, then hand control back to loop().
+    // On TCP also stop while the send window is full: a write would block.
+    while (m_FramePending) {
+        if (!m_Pacer.canSend(getMicros())) {
+            flushSends(); // don't sit on data while waiting for tokens
+            return false;
         }
-        else {
-            // printf("found quant table %x\n", quantstart[2]);
+        if (m_TCPTransport && !socketwritable(m_Client)) {
+            m_DropStats.stalls++;
+            return false;
         }
-        *qtable1 = quantstart + 3;
-        nextJpegBlock(&quantstart);
+        if (m_FrameSent == 0)
+            m_FirstPacketUs = getMicros();
+        int wireLen = sendNextPacket();
+        m_Pacer.consume(wireLen);
+        m_FrameSent += wireLen;
     }
 
-    if(!findJPEGheader(start, len, 0xda))
-        return false; // FAILED!
+    flushSends();
+    m_LastPacketUs = getMicros();
+    m_Pacer.endFrame(m_LastPacketUs);
 
-    // Skip the header bytes of the SOS marker FIXME why doesn't this work?
-    uint32_t soslen = (*start)[0] * 256 + (*start)[1];
-    *start += soslen;
-    *len -= soslen;
+    m_SendIdx++;
+    if (m_SendIdx > 1) m_SendIdx = 0;
+    return true;
+};
 
-    // start scanning the data portion of the scan to find the end marker
-    BufPtr endmarkerptr = *start;
-    uint32_t endlen = *len;
+// Baseline JPEG as produced by the camera:
+// SOI d8
+// APP0 e0
+// DQT db (table 0, luma)
+// DQT db (table 1, chroma)
+// SOF0 c0 baseline (not progressive) 3 color 0x01 Y, 0x21 2h1v, 0x00 tbl0
+// - 0x02 Cb, 0x11 1h1v, 0x01 tbl1 - 0x03 Cr, 0x11 1h1v, 0x01 tbl1
+// therefore 4:2:2, with two separate quant tables (0 and 1)
+// DHT c4 (x4)
+// SOS da, followed by the entropy coded scan
+// EOI d9 (no need to send it, the RFC says the client adds it)
+//
+// Every header segment carries its length, so those are hopped over. The
+// scan has no length: byte stuffing guarantees that 0xff inside it is followed
+// by 0x00 (or a restart marker), so the first 0xff with anything else after
+// it is the EOI. memchr() does that search a word at a time.
+bool parseJPEG(BufPtr data, uint32_t len, JpegFrameInfo *info)
+{
+    memset(info, 0, sizeof(*info));
 
-    skipScanBytes(&endmarkerptr);
-    if(!findJPEGheader(&endmarkerptr, &endlen, 0xd9))
-        return false; // FAILED!
+    if(len < 4 || data[0] != 0xff || data[1] != 0xd8) {
+        printf("malformed jpeg, no SOI\n");
+        return false;
+    }
 
-    // endlen must now be the # of bytes between the start of our scan and
-    // the end marker, tell the caller to ignore bytes afterwards
-    *len = endmarkerptr - *start;
+    bool haveSof = false;
+    uint32_t pos = 2;
+    while(pos + 4 <= len) {
+        if(data[pos] != 0xff) {
+            printf("malformed jpeg, framing=%x at %u\n", data[pos], pos);
+            return false;
+        }
+        uint8_t marker = data[pos + 1];
+        if(marker == 0xff) { // fill byte
+            pos++;
+            continue;
+        }
+        if(marker == 0xd9) {
+            printf("jpeg ends before the scan\n");
+            return false;
+        }
 
-    return true;
+        BufPtr seg = data + pos + 4; // segment payload, after the length
+        uint32_t segLen = data[pos + 2] * 256 + data[pos + 3];
+        if(segLen < 2 || pos + 2 + segLen > len) {
+            printf("truncated jpeg segment 0x%x\n", marker);
+            return false;
+        }
+        segLen -= 2;
+
+        switch(marker) {
+        case 0xdb: // DQT, may hold several tables
+            for(uint32_t i = 0; i < segLen; ) {
+                uint8_t precision = seg[i] >> 4;
+                uint8_t id = seg[i] & 0x0f;
+                uint32_t tableLen = precision ? 128 : 64;
+                if(i + 1 + tableLen > segLen) {
+                    printf("truncated jpeg quant table\n");
+                    return false;
+                }
+                if(precision == 0 && id == 0) info->qtable0 = seg + i + 1;
+                if(precision == 0 && id == 1) info->qtable1 = seg + i + 1;
+                i += 1 + tableLen;
+            }
+            break;
+
+        case 0xc0: // SOF0
+        case 0xc1: // SOF1, extended sequential: same layout
+            if(segLen < 6 + 3 * 3 || seg[5] != 3) {
+                printf("unsupported jpeg, need 3 components\n");
+                return false;
+            }
+            info->height = seg[1] * 256 + seg[2];
+            info->width  = seg[3] * 256 + seg[4];
+            // RFC 2435 types: chroma at 1h1v, luma 2h1v (4:2:2) or 2h2v (4:2:0)
+            if(seg[7] == 0x21 && seg[10] == 0x11 && seg[13] == 0x11)
+                info->type = 0;
+            else if(seg[7] == 0x22 && seg[10] == 0x11 && seg[13] == 0x11)
+                info->type = 1;
+            else {
+                printf("unsupported jpeg sampling 0x%x\n", seg[7]);
+                return false;
+            }
+            haveSof = true;
+            break;
+
+        case 0xc2: // progressive and friends can't be sent as RTP/JPEG
+        case 0xc3:
+        case 0xc5: case 0xc6: case 0xc7:
+        case 0xc9: case 0xca: case 0xcb:
+        case 0xcd: case 0xce: case 0xcf:
+            printf("unsupported jpeg type 0x%x\n", marker);
+            return false;
+
+        case 0xdd: // DRI
+            if(segLen >= 2 && (seg[0] | seg[1])) {
+                printf("jpeg restart intervals not supported\n");
+                return false;
+            }
+            break;
+
+        case 0xda: // SOS
+        {
+            if(!haveSof) {
+                printf("malformed jpeg, SOS before SOF\n");
+                return false;
+            }
+            BufPtr scan = seg + segLen;
+            BufPtr end = data + len;
+            BufPtr p = scan;
+            while(p < end) {
+                p = (BufPtr) memchr(p, 0xff, end - p);
+                if(!p || p + 1 >= end)
+                    break;
+                uint8_t next = p[1];
+                if(next == 0xd9) {
+                    info->scan = scan;
+                    info->scanLen = p - scan;
+                    return true;
+                }
+                if(next == 0x00 || (next >= 0xd0 && next <= 0xd7))
+                    p += 2; // stuffed 0xff or restart marker
+                else if(next == 0xff)
+                    p += 1; // fill byte
+                else {
+                    printf("unexpected jpeg marker 0x%x in scan\n", next);
+                    return false;
+                }
+            }
+            printf("truncated jpeg, no EOI\n");
+            return false;
+        }
+
+        default: // APPn, COM, DHT: nothing we need
+            break;
+        }
+
+        pos += 4 + segLen;
+    }
+
+    printf("truncated jpeg, no SOS\n");
+    return false;
 }
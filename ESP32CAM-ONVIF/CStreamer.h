@@ -1,9 +1,48 @@
 #pragma once
 
 #include "platglue.h"
+#include "CRtpPacer.h"
 
 typedef unsigned const char *BufPtr;
 
+// Everything the RTP/JPEG header (RFC 2435) needs to know about a frame.
+// Filled in once per capture by parseJPEG() and shared by all clients.
+struct JpegFrameInfo
+{
+    BufPtr   scan;              // entropy coded data following the SOS header
+    uint32_t scanLen;           // up to, not including, the EOI marker
+    BufPtr   qtable0;           // 64 byte luma/chroma quant tables, NULL if absent
+    BufPtr   qtable1;
+    uint8_t  type;              // RTP/JPEG type: 0 = 4:2:2, 1 = 4:2:0
+    u_short  width;             // from SOF0
+    u_short  height;
+};
+
+#define RTCP_SR_INTERVAL_MS 5000    // RFC 3550 suggests no less than 5 s between reports
+
+// Reception quality of our stream as reported by the client in RTCP RR/SR
+// report blocks, plus what we sent to it. Times are in milliseconds.
+struct RtcpStats
+{
+    uint32_t srSent;            // sender reports sent
+    uint32_t reports;           // report blocks about our SSRC received
+    uint8_t  fractionLost;      // loss since the previous report, in 1/256
+    int32_t  cumulativeLost;    // total packets lost (negative with duplicates)
+    uint32_t highestSeq;        // extended highest sequence number received
+    uint32_t jitter;            // interarrival jitter in 90 kHz timestamp units
+    uint32_t rttMs;             // round trip time from LSR/DLSR, 0 until known
+};
+
+// How well a client keeps up. Frames are dropped rather than queued when it
+// falls behind, so a slow viewer sees a lower frame rate, not growing delay.
+struct RtpDropStats
+{
+    uint32_t droppedFrames;     // frames skipped or cut short for this client
+    uint32_t stalls;            // times a packet had to wait for the TCP send window
+    uint32_t backlogBytes;      // bytes of the current frame still to be sent
+    uint32_t maxBacklogBytes;   // largest unsent remainder of a dropped frame
+};
+
 class CStreamer
 {
 public:
@@ -11,19 +50,91 @@ public:
     virtual ~CStreamer();
 
     void    InitTransport(u_short aRtpPort, u_short aRtcpPort, bool TCP);
+    // Send to a multicast group (RTP on aRtpPort, RTCP on aRtpPort + 1)
+    // instead of a single client. Returns false if the address is invalid.
+    bool    InitMulticast(const char *aGroup, u_short aRtpPort, u_char aTtl);
     u_short GetRtpServerPort();
     u_short GetRtcpServerPort();
+    u_short GetWidth() const { return m_width; }
+    u_short GetHeight() const { return m_height; }
+
+    bool    IsMulticast() const { return m_Multicast; }
+    const char *GetMulticastGroup() const { return m_MulticastGroup; }
+    u_short GetMulticastPort() const { return m_RtpClientPort; }
+    u_char  GetMulticastTtl() const { return m_MulticastTtl; }
     
     // Updates the TCP client socket for RTP-over-RTSP
     void setClientSocket(SOCKET client) { m_Client = client; }
 
     virtual void    streamImage(uint32_t curMsec) = 0; // send a new image to the client
-protected:
 
     void    streamFrame(unsigned const char *data, uint32_t dataLen, uint32_t curMsec);
 
-private:
-    int    SendRtpPacket(unsigned const char *jpeg, int jpegLen, int fragmentOffset, BufPtr quant0tbl = NULL, BufPtr quant1tbl = NULL);// returns new fragmentOffset or 0 if finished with frame
+    // Send a JPEG frame that was already parsed with parseJPEG().
+    // This lets the server parse a capture once and fan it out to every client.
+    // Blocks until the whole frame is sent, see beginFrame() for the paced variant.
+    void    streamDecodedFrame(const JpegFrameInfo &jpeg, uint32_t curMsec);
+
+    // Non-blocking transmission: beginFrame() queues a parsed JPEG frame and
+    // pumpFrame() sends as many packets as the pacer and the TCP send window
+    // allow. The frame data must stay valid until pumpFrame() returns true.
+    // beginFrame() skips the frame and returns false if the client has not
+    // drained the previous one yet (RTP over TCP).
+    bool    beginFrame(const JpegFrameInfo &jpeg, uint32_t curMsec, uint32_t intervalMs);
+    bool    pumpFrame();            // returns true once no packets are left
+    bool    isFramePending() const { return m_FramePending; }
+    // Give up on the rest of the pending frame because a newer one is ready
+    void    dropFrame();
+    RtpDropStats dropStats() const;
+
+    // RTCP: send a sender report when one is due and read any receiver
+    // reports that arrived on the UDP RTCP port. Call regularly while streaming.
+    void    serviceRtcp(uint32_t curMsec);
+    // Parse a compound RTCP packet from the client (UDP or interleaved channel 1)
+    void    handleRtcpPacket(const uint8_t *buf, uint32_t len);
+    const RtcpStats &rtcpStats() const { return m_RtcpStats; }
+
+    void    setPacing(uint32_t rateBytesPerSec, uint32_t burstBytes) { m_Pacer.configure(rateBytesPerSec, burstBytes); }
+    // RTP over TCP: collect interleaved packets and write them in chunks of
+    // this many bytes (ideally the TCP MSS). 0 writes every packet on its own.
+    void    setTcpSegmentSize(uint32_t bytes);
+    const RtpPacerStats &pacingStats() const { return m_Pacer.stats(); }
+    // getMicros() when the first and the last packet of the previous frame
+    // went out, for latency tracking
+    uint32_t firstPacketUs() const { return m_FirstPacketUs; }
+    uint32_t lastPacketUs() const { return m_LastPacketUs; }
+    // For RTP-Info in the PLAY response: sequence number of the next packet
+    // and the RTP clock at curMsec (same time base as the frame times)
+    u_short nextSequenceNumber() const { return m_SequenceNumber; }
+    uint32_t rtpTimeAt(uint32_t curMsec) const;
+
+protected:
+    // Advance the 90 kHz RTP clock by the time elapsed since the previous frame
+    void    advanceTimestamp(uint32_t curMsec);
+
+    // Where UDP packets go: the multicast group or the RTSP client's address.
+    // Returns false if there is nowhere to send to.
+    bool    udpDestination(IPADDRESS *addr);
+
+    // Send the next packet of the pending frame and return its size on the
+    // wire. Clears m_FramePending after the last packet.
+    virtual int sendNextPacket();
+
+    // Called by the beginFrame() variants with the size of the new frame.
+    // Returns false (and counts a dropped frame) if the client can't take it.
+    bool    startFrame(uint32_t frameBytes, uint32_t intervalMs);
+    // Hook for streamers that have to resync after a lost frame
+    virtual void frameDropped() {}
+
+    // Interleaved RTP/RTCP to the RTSP connection, coalesced into segments.
+    // Whole packets only, so RTSP replies can be written in between.
+    void    tcpSend(const void *hdr, size_t hdrLen, const void *payload, size_t payloadLen);
+    void    tcpFlush();
+    // RTP over UDP to udpDestination(), batched into as few syscalls as the
+    // platform allows. The payload must stay valid until flushSends().
+    void    udpSend(const void *hdr, size_t hdrLen, const void *payload, size_t payloadLen);
+    // Push out everything queued by tcpSend()/udpSend()
+    void    flushSends();
 
     UDPSOCKET m_RtpSocket;           // RTP socket for streaming RTP packets to client
     UDPSOCKET m_RtcpSocket;          // RTCP socket for sending/receiving RTCP packages
@@ -35,25 +146,54 @@ private:
 
     u_short m_SequenceNumber;
     uint32_t m_Timestamp;
+    uint32_t m_Ssrc;
+    uint32_t m_RtpPacketCount;     // RTP packets and payload octets sent, for RTCP SR
+    uint32_t m_RtpOctetCount;
     int m_SendIdx;
     bool m_TCPTransport;
     SOCKET m_Client;
     uint32_t m_prevMsec;
 
+    bool m_Multicast;
+    IPADDRESS m_MulticastAddr;
+    char m_MulticastGroup[16];
+    u_char m_MulticastTtl;
+
     u_short m_width; // image data info
     u_short m_height;
-};
 
+    CRtpPacer m_Pacer;
+    bool     m_FramePending;      // a frame is partially sent
+    uint32_t m_FrameOffset;       // next byte of the pending frame to send
+    uint32_t m_FrameBytes;        // size of the pending frame
+    uint32_t m_FrameSent;         // bytes put on the wire for it so far
+    uint32_t m_FirstPacketUs;
+    uint32_t m_LastPacketUs;
+    RtpDropStats m_DropStats;
+
+    uint8_t *m_TxBuf;             // coalesced interleaved packets, allocated on first use
+    uint32_t m_TxLen;
+    uint32_t m_TxSize;            // segment size, 0 = no coalescing
+    UdpBatch m_UdpBatch;          // RTP datagrams of the frame not yet handed to the OS
+
+private:
+    bool    bindPortPair();
+    void    closePortPair();
+    void    tcpAppend(const uint8_t *data, size_t len);
+    void    sendRtcpSenderReport(uint32_t curMsec);
+
+    RtcpStats m_RtcpStats;
+    uint32_t m_LastSrMsec;        // when the last sender report went out
+
+    JpegFrameInfo m_Frame;        // pending JPEG frame
+
+    int    SendRtpPacket(const JpegFrameInfo &jpeg, int fragmentOffset, int *wireLen = NULL);// returns new fragmentOffset or 0 if finished with frame
+};
 
 
-// When JPEG is stored as a file it is wrapped in a container
-// This function fixes up the provided start ptr to point to the
-// actual JPEG stream data and returns the number of bytes skipped
-// returns true if the file seems to be valid jpeg
-// If quant tables can be found they will be stored in qtable0/1
-bool decodeJPEGfile(BufPtr *start, uint32_t *len, BufPtr *qtable0, BufPtr *qtable1);
-bool findJPEGheader(BufPtr *start, uint32_t *len, uint8_t marker);
 
-// Given a jpeg ptr pointing to a pair of length bytes, advance the pointer to
-// the next 0xff marker byte
-void nextJpegBlock(BufPtr *start);
+// Locate the scan, quant tables and frame geometry of a baseline JPEG in one
+// pass over the len bytes at data. Never reads past len. Returns false for
+// anything that can't be sent as RTP/JPEG: truncated frames (no EOI), frames
+// without SOF0/SOS, progressive, restart intervals or unsupported sampling.
+bool parseJPEG(BufPtr data, uint32_t len, JpegFrameInfo *info);
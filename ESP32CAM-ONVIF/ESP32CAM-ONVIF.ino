@@ -23,6 +23,10 @@
 #include "serial_console.h"
 #include "auto_flash.h"
 #include "status_led.h"
+#include "frame_hub.h"
+#include "metrics.h"
+#include "loop_profiler.h"
+#include "heap_tracker.h"
 #include <esp_task_wdt.h>
 
 #define WDT_TIMEOUT 30 // 30 seconds hardware watchdog
@@ -55,9 +59,11 @@ void setup() {
   #endif
   Serial.println("[INFO] WDT Enabled");
   printBanner();
+  heap_tracker_init();
   
   // Initialize camera
   if (!camera_init()) fatalError("Camera init failed!");
+  frame_hub_init();
   
   // Initialize WiFi - try stored credentials first, fallback to AP mode
   bool wifiConnected = wifiManager.begin();
@@ -84,6 +90,7 @@ void setup() {
   motion_detection_init();
   auto_flash_init(); 
   status_led_init();
+  loop_profiler_init();
   status_led_flash(1); 
   
   if(wifiConnected) {
@@ -95,23 +102,32 @@ void setup() {
 }
 
 void loop() {
+  uint32_t loopStart = micros();
+  
   // Feed Watchdog
   esp_task_wdt_reset();
   
   // Critical Loops (Keep minimal blocking)
-  rtsp_server_loop();   // Highest priority for streaming
-  wifiManager.loop();   // Connectivity
-  web_config_loop();    // Web UI
-  onvif_server_loop();  // Discovery/SOAP
+  // RTSP streaming runs in its own task, see rtsp_server_start()
+  // Each call is timed against its budget, see loop_profiler.h
+  { LoopTimer t(LOOP_WIFI);       wifiManager.loop(); }     // Connectivity
+  { LoopTimer t(LOOP_WEB);        web_config_loop(); }      // Web UI
+  { LoopTimer t(LOOP_ONVIF);      onvif_server_loop(); }    // Discovery/SOAP
   
   // Background Tasks
-  motion_detection_loop();
-  sd_recorder_loop();
-  serial_console_loop();
-  auto_flash_loop();
-  status_led_loop();
+  { LoopTimer t(LOOP_MOTION);     motion_detection_loop(); }
+  { LoopTimer t(LOOP_SD);         sd_recorder_loop(); }
+  { LoopTimer t(LOOP_SERIAL);     serial_console_loop(); }
+  { LoopTimer t(LOOP_AUTO_FLASH); auto_flash_loop(); }
+  { LoopTimer t(LOOP_STATUS_LED); status_led_loop(); }
+  { LoopTimer t(LOOP_HEAP);       heap_tracker_loop(); }
   
   // Optional: Power saving delay if NO clients connected? 
   // For RTSP low latency, we usually avoid delay, but a yield() helps watchdog.
   yield(); 
+  
+  uint32_t loopUs = micros() - loopStart;
+  metrics_add(metrics.loopIterations);
+  metrics.loopLastUs.store(loopUs, std::memory_order_relaxed);
+  metrics_max(metrics.loopMaxUs, loopUs);
 }
@@ -8,53 +8,47 @@
 
 #include "config.h"
 #include "board_config.h"
-#include "CStreamer.h"
+#include "CH264Streamer.h"
 #include "h264_encoder.h"
 
 #ifdef VIDEO_CODEC_H264
 
-class H264Streamer : public CStreamer {
+// Feeds the shared on-chip encoder into the RFC 6184 packetizer (CH264Streamer)
+class H264Streamer : public CH264Streamer {
 public:
     H264Streamer();
     virtual ~H264Streamer();
     
     // Initialize the H.264 encoder with default settings
-    bool init(uint16_t width = 640, uint16_t height = 480);
+    // The encoder is shared by every streamer, so this only needs to succeed once.
+    static bool init(uint16_t width = 640, uint16_t height = 480);
     
     // Stream a new frame (overrides base class)
     virtual void streamImage(uint32_t curMsec) override;
     
-    // Get SPS for SDP generation
-    bool getSPS(uint8_t* buffer, size_t* size);
+    // Capture and encode one frame with the shared encoder.
+    // Returns false if no frame is available; out_frame is valid until the next call.
+    // grabUs, if given, is set to getMicros() when the camera frame arrived.
+    static bool encodeFrame(h264_frame_t *out_frame, uint32_t *grabUs = NULL);
     
-    // Get PPS for SDP generation  
-    bool getPPS(uint8_t* buffer, size_t* size);
+    // Packetize an already encoded frame to this client (blocking)
+    void streamEncodedFrame(const h264_frame_t &frame, uint32_t curMsec);
+    
+    // Paced variant: queue the frame and send it with pumpFrame().
+    // frame.data must stay valid until pumpFrame() returns true.
+    // Returns false if the frame was skipped (client behind, or waiting for
+    // an IDR frame after a drop).
+    bool beginEncodedFrame(const h264_frame_t &frame, uint32_t curMsec, uint32_t intervalMs);
     
     // Request IDR frame (keyframe)
-    void requestIDR();
+    virtual void requestIDR() override;
     
     // Check if using hardware encoder
     bool isHardwareEncoder() const;
     
 private:
-    // Send a single NAL unit (handles fragmentation if needed)
-    void sendNALUnit(const uint8_t* nalData, size_t nalSize, bool isLast, uint32_t timestamp);
-    
-    // Send RTP packet for H.264
-    void sendH264RtpPacket(const uint8_t* data, size_t size, bool marker, uint32_t timestamp);
-    
-    // Parse NAL units from encoded frame
-    int findNextNALUnit(const uint8_t* data, size_t size, size_t offset);
-    
-    bool m_initialized;
-    h264_encoder_config_t m_config;
-    
-    // SPS/PPS cache for SDP
-    uint8_t m_sps[64];
-    size_t m_spsSize;
-    uint8_t m_pps[64];
-    size_t m_ppsSize;
-    bool m_spsPpsValid;
+    static bool s_encoderReady;      // shared encoder has been initialized
+    static h264_encoder_config_t s_config;
 };
 
 #else // VIDEO_CODEC_H264 not defined
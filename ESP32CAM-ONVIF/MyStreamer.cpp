@@ -1,26 +1,15 @@
 // MyStreamer.cpp
 #include "MyStreamer.h"
 
-// The `resolution` array is a standard part of the esp32-camera driver component.
-// It maps the framesize enum to width and height.
-extern "C" {
-    #include "ll_cam.h"
-}
-
-MyStreamer::MyStreamer() : CStreamer(NULL, resolution[esp_camera_sensor_get()->status.framesize].width, resolution[esp_camera_sensor_get()->status.framesize].height) {
+MyStreamer::MyStreamer(CFrameSource &source) : CStreamer(NULLSOCKET, source.width(), source.height()), m_Source(source) {
     // The CStreamer base class constructor needs the image width and height.
-    // We get it from the currently configured camera sensor.
+    // We get it from the frame source (the configured camera sensor on the ESP32).
 }
 
 void MyStreamer::streamImage(uint32_t curMsec) {
-    camera_fb_t *fb = esp_camera_fb_get();
-    if (!fb) {
-        Serial.println("Camera frame buffer could not be acquired");
-        return;
-    }
+    SourceFrame frame;
+    if (!m_Source.grab(frame)) return;
     
-    if (fb->format == PIXFORMAT_JPEG && fb->len > 0) {
-        streamFrame(fb->buf, fb->len, curMsec);
-    }
-    esp_camera_fb_return(fb);
+    streamFrame(frame.data, frame.len, curMsec);
+    m_Source.release(frame);
 }
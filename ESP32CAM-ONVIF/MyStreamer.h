@@ -1,11 +1,14 @@
 // MyStreamer.h
 #pragma once
 #include "CStreamer.h"
-#include "esp_camera.h"
+#include "CFrameSource.h"
 
 class MyStreamer : public CStreamer {
 public:
-    MyStreamer();
+    MyStreamer(CFrameSource &source);
     virtual ~MyStreamer() {}
     virtual void streamImage(uint32_t curMsec) override;
+
+private:
+    CFrameSource &m_Source;
 };
@@ -4,13 +4,40 @@
 #include "esp_camera.h"
 #include "config.h"
 #include "board_config.h"
+#include "frame_hub.h"
 #ifdef PTZ_ENABLED
 #include <ESP32Servo.h>
 Servo panServo;
 Servo tiltServo;
 #endif
 
-bool camera_init() {
+struct CaptureProfileInfo {
+  const char *name;
+  camera_grab_mode_t grabMode;
+  size_t fbCount;
+  camera_fb_location_t fbLocation;
+  int xclkHz;
+};
+
+// Only used with PSRAM. Without it there is room for a single frame buffer
+// in DRAM, whatever the profile.
+static const CaptureProfileInfo captureProfiles[CAPTURE_PROFILES] = {
+  // The driver keeps refilling its spare buffer, so a grab always returns
+  // the newest frame. Frames that nobody fetched in time are dropped.
+  { "low_latency", CAMERA_GRAB_LATEST,     2, CAMERA_FB_IN_PSRAM, 20000000 },
+  // Frames are handed out in capture order. The one fetched may already be
+  // a frame time old when the other buffer was filled first.
+  { "balanced",    CAMERA_GRAB_WHEN_EMPTY, 2, CAMERA_FB_IN_PSRAM, 20000000 },
+  // A third buffer so the sensor keeps capturing while consumers hold two
+  { "throughput",  CAMERA_GRAB_WHEN_EMPTY, 3, CAMERA_FB_IN_PSRAM, 20000000 },
+};
+
+static CaptureProfile activeProfile = CAPTURE_PROFILE;
+
+#define CAMERA_REINIT_TIMEOUT_MS 2000   // Wait this long for consumers to return their frames
+
+static bool camera_start(CaptureProfile profile) {
+  const CaptureProfileInfo &p = captureProfiles[profile];
   camera_config_t config;
   config.ledc_channel = LEDC_CHANNEL_0;
   config.ledc_timer = LEDC_TIMER_0;
@@ -32,17 +59,22 @@ bool camera_init() {
   config.pin_sccb_scl = SIOC_GPIO_NUM;
   config.pin_pwdn = PWDN_GPIO_NUM;
   config.pin_reset = RESET_GPIO_NUM;
-  config.xclk_freq_hz = 20000000;
+  config.xclk_freq_hz = p.xclkHz;
   config.pixel_format = PIXFORMAT_JPEG;
   if(psramFound()){
     config.frame_size = FRAMESIZE_VGA; // 640x480 - Rock Solid Stability for NVRs
     config.jpeg_quality = 12;          // High quality (lower num)
-    config.fb_count = 2;
-    Serial.println(F("[INFO] PSRAM found. Using VGA (640x480) and 2 Frame Buffers"));
+    config.fb_count = p.fbCount;
+    config.fb_location = p.fbLocation;
+    config.grab_mode = p.grabMode;
+    Serial.printf("[INFO] PSRAM found. Using VGA (640x480), %u Frame Buffers (%s profile)\n",
+                  (unsigned) p.fbCount, p.name);
   } else {
     config.frame_size = FRAMESIZE_VGA; // Non-PSRAM cannot do HD well, fallback to SVGA
     config.jpeg_quality = 12;
     config.fb_count = 1;
+    config.fb_location = CAMERA_FB_IN_DRAM;
+    config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
     Serial.println(F("[WARN] No PSRAM. Using VGA and 1 Frame Buffer"));
   }
   
@@ -52,6 +84,11 @@ bool camera_init() {
     Serial.printf("[ERROR] Camera init failed: 0x%x\n", err);
     return false;
   }
+  return true;
+}
+
+bool camera_init() {
+  if (!camera_start(activeProfile)) return false;
   Serial.println("[INFO] Camera initialized.");
   
   if (FLASH_LED_ENABLED) {
@@ -65,6 +102,59 @@ bool camera_init() {
   return true;
 }
 
+bool camera_set_profile(CaptureProfile profile) {
+  if (profile >= CAPTURE_PROFILES) return false;
+  if (profile == activeProfile) return true;
+  
+  // Runtime settings live in the sensor and are lost by the re-init
+  sensor_t *s = esp_camera_sensor_get();
+  if (!s) return false;
+  camera_status_t saved = s->status;
+  
+  if (!frame_hub_suspend(CAMERA_REINIT_TIMEOUT_MS)) {
+    Serial.println("[WARN] Camera busy, capture profile not changed");
+    return false;
+  }
+  Serial.printf("[INFO] Switching capture profile: %s -> %s\n",
+                captureProfiles[activeProfile].name, captureProfiles[profile].name);
+  esp_camera_deinit();
+  
+  bool ok = camera_start(profile);
+  if (ok) {
+    activeProfile = profile;
+  } else if (!camera_start(activeProfile)) {
+    Serial.println("[ERROR] Camera re-init failed, restarting");
+    ESP.restart();
+  }
+  
+  s = esp_camera_sensor_get();
+  s->set_framesize(s, saved.framesize);
+  s->set_quality(s, saved.quality);
+  s->set_brightness(s, saved.brightness);
+  s->set_contrast(s, saved.contrast);
+  s->set_saturation(s, saved.saturation);
+  s->set_hmirror(s, saved.hmirror);
+  s->set_vflip(s, saved.vflip);
+  
+  frame_hub_resume();
+  return ok;
+}
+
+CaptureProfile camera_profile() {
+  return activeProfile;
+}
+
+const char *camera_profile_name(CaptureProfile profile) {
+  return profile < CAPTURE_PROFILES ? captureProfiles[profile].name : "unknown";
+}
+
+CaptureProfile camera_profile_from_name(const char *name) {
+  for (int i = 0; i < CAPTURE_PROFILES; i++) {
+    if (strcmp(name, captureProfiles[i].name) == 0) return (CaptureProfile) i;
+  }
+  return CAPTURE_PROFILES;
+}
+
 void init_flash_led() {
     pinMode(FLASH_LED_PIN, OUTPUT);
     digitalWrite(FLASH_LED_PIN, FLASH_LED_INVERT ? HIGH : LOW); // Off by default
@@ -1,5 +1,23 @@
 #pragma once
+#include <stdint.h>
+
+// Capture profiles (see CAPTURE_PROFILE in config.h): how the camera driver
+// buffers frames, traded between latency and frame rate
+enum CaptureProfile {
+    CAPTURE_LOW_LATENCY,
+    CAPTURE_BALANCED,
+    CAPTURE_THROUGHPUT,
+    CAPTURE_PROFILES
+};
+
 bool camera_init();
+// Re-initializes the camera with another profile once all frames are back
+// from the consumers. Sensor settings (resolution, quality, ...) are kept.
+bool camera_set_profile(CaptureProfile profile);
+CaptureProfile camera_profile();
+const char *camera_profile_name(CaptureProfile profile);
+// Profile by name ("low_latency", "balanced", "throughput"), CAPTURE_PROFILES if unknown
+CaptureProfile camera_profile_from_name(const char *name);
 void init_flash_led();
 void set_flash_led(bool on);
 void ptz_init();
@@ -99,6 +99,77 @@
 #define RTSP_PORT       554             // RTSP Streaming port (standard: 554)
 #define ONVIF_PORT      8000            // ONVIF Service port (standard: 80, 8000, or 8080)
 #define DEFAULT_ONVIF_ENABLED true      // Enable ONVIF service by default
+#define ONVIF_MAX_REQUEST 4096          // Largest SOAP request accepted (static buffer)
+
+// --- RTSP Settings ---
+// Each client gets its own RTP session, but the camera frame is captured once
+// and shared. Every extra client still costs one send of each frame over WiFi.
+#define RTSP_MAX_CLIENTS    3           // Concurrent RTSP viewers (NVR + VLC + ...)
+// RTP packets are paced with a token bucket instead of being burst onto the
+// air. The rate is raised per frame if needed to finish within the frame interval.
+// Runtime adjustable via /api/config ("pace_kbps", "pace_burst").
+#define RTP_PACE_RATE_KBPS   8000        // Pacing rate per client (kbit/s)
+#define RTP_PACE_BURST_BYTES 8192        // Bucket size, ~6 packets back to back
+// RTP over TCP (interleaved in the RTSP connection): packets are collected and
+// written in segments of this size instead of one small write per packet.
+// UDP packets are sized by the codec (MJPEG 1280, H.264 1400 byte payload).
+// Keep it at or below half the lwIP send buffer (2 x TCP_MSS = 2872) so a
+// segment always fits once the socket reports writable.
+#define RTP_TCP_SEGMENT_SIZE 2872        // Bytes per write; 0 = one write per packet
+
+// --- RTP Multicast ---
+// Clients that SETUP with "RTP/AVP;multicast" all join one group instead of
+// getting a unicast copy each. Every packet is sent once, whatever the viewer count.
+// Your switch/AP needs multicast (IGMP snooping) enabled for this to help;
+// without it the stream floods every port of the network, so it is off by default.
+#define RTSP_MULTICAST_ENABLED false
+#define RTSP_MULTICAST_ADDR  "239.255.42.42" // Group address (239.x.x.x = site local)
+#define RTSP_MULTICAST_PORT  5000            // RTP port (even), RTCP uses port + 1
+#define RTSP_MULTICAST_TTL   1               // 1 = stay in the local subnet
+
+// --- RTSP Streaming Task ---
+// Capture and RTP packetization run in their own FreeRTOS task, so a slow web
+// page or SOAP request can't stall the frame clock. The task runs at a higher
+// priority than loop() (priority 1), which keeps web/ONVIF/WiFi housekeeping.
+#define RTSP_TASK_CORE      1           // APP_CPU (WiFi/lwIP run on core 0)
+#define RTSP_TASK_PRIORITY  3
+#define RTSP_TASK_STACK     8192        // Bytes
+#define RTSP_CAPTURE_STACK  4096        // MJPEG capture task
+#define RTSP_TASK_IDLE_MS   5           // Max RTSP request latency when no frame is due
+
+// --- Capture Profile ---
+// How the camera driver buffers frames (needs PSRAM, otherwise one buffer):
+//   CAPTURE_LOW_LATENCY : 2 buffers, always the newest frame (grab latest)
+//   CAPTURE_BALANCED    : 2 buffers, frames in capture order
+//   CAPTURE_THROUGHPUT  : 3 buffers, highest frame rate with several consumers
+// Runtime switchable via /api/config ("capture_profile": "low_latency", ...),
+// which re-initializes the camera. /api/status reports the capture latency.
+#define CAPTURE_PROFILE CAPTURE_BALANCED
+
+// --- Frame Hub ---
+// Camera frames are captured once and shared by RTSP, the SD recorder,
+// /snapshot and /stream. A consumer gets the last capture if it hasn't seen it
+// yet and it is at most this old, otherwise a new frame is captured. Keep it
+// below the RTSP frame interval (50 ms) so RTSP frames stay evenly spaced.
+#define FRAME_HUB_MAX_AGE_MS 40
+
+// --- Loop Profiler ---
+// Every subsystem called from loop() is timed. A call slower than this is
+// logged and counted (esp32cam_loop_budget_overruns_total in /metrics).
+// Per subsystem at runtime via /api/config: {"loop_budgets": {"sd": 100}} (milliseconds)
+#define LOOP_BUDGET_MS 50
+
+// --- Packet Capture ---
+// RTSP/RTP/RTCP traffic sent by the camera, kept in a PSRAM ring of this size
+// while a capture runs (serial "pcap start" or POST /api/pcap/start).
+// Download it from /api/pcap or save it to SD with "pcap save".
+#define PCAP_RING_SIZE (1024 * 1024)
+
+// --- Heap Tracker ---
+// Tagged heap use, free memory and fragmentation of internal RAM and PSRAM
+// are logged at this interval (0 = only with the serial "heap" command)
+#define HEAP_REPORT_INTERVAL_MS 600000
+#define HEAP_FRAG_WARN_PCT      60      // Warn when the largest free block is this much smaller than free RAM
 
 // --- Flash LED Settings ---
 // GPIO 4 is standard for ESP32-CAM Flash.
@@ -124,6 +195,7 @@
 #define ENABLE_DAILY_RECORDING  false   // If true, records continuously (loop overwrite)
 #define RECORD_SEGMENT_SEC      300     // 5 minutes per file
 #define MAX_DISK_USAGE_PCT      90      // Auto-delete oldest files if disk usage > 90%
+#define RECORD_FRAME_INTERVAL_MS 200    // 5 FPS background recording
 #define ENABLE_MOTION_DETECTION false    // Set false to disable motion detection to save CPU
 
 // --- Device Information (ONVIF) ---
@@ -141,6 +213,7 @@
 // --- Debugging ---
 #define DEBUG_MODE      true            // Set to false to disable all serial output (saves CPU)
 #define DEBUG_LEVEL     3               // 1=Errors Only, 2=Info/Actions, 3=Verbose (Parsing)
+#define ONVIF_DEBUG_SOAP false          // Print WS-Security fields and unknown requests (shows credentials!)
 
 #if DEBUG_MODE
     #define LOG_E(x) Serial.println("[ERROR] " + String(x))
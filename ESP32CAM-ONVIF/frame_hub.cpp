@@ -0,0 +1,166 @@
+#include "frame_hub.h"
+#include "config.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+// Frames out of the driver at the same time; the driver never hands out more
+// than its fb_count, so this only has to be larger than that.
+#define FRAME_HUB_ENTRIES 4
+
+struct HubEntry {
+    camera_fb_t *fb;
+    uint8_t refs;
+};
+
+static HubEntry entries[FRAME_HUB_ENTRIES];
+
+// The hub keeps a reference to the last capture so consumers that ask a bit
+// later can still share it
+static camera_fb_t *latest = nullptr;
+static uint32_t latestSeq = 0;
+static uint32_t latestMs = 0;
+
+static uint32_t seenSeq[FRAME_HUB_CONSUMERS];
+static uint32_t lastGetMs[FRAME_HUB_CONSUMERS];
+static uint32_t intervalMs[FRAME_HUB_CONSUMERS];
+static FrameHubStats hubStats;
+
+// stateLock guards the tables above and is only held briefly. captureLock
+// serializes captures, so consumers arriving while the driver is busy wait
+// for that frame instead of grabbing one of their own. Releasing a frame
+// never needs captureLock, otherwise a capture waiting for a free buffer
+// could never get one.
+static SemaphoreHandle_t stateLock = nullptr;
+static SemaphoreHandle_t captureLock = nullptr;
+
+void frame_hub_init() {
+    stateLock = xSemaphoreCreateMutex();
+    captureLock = xSemaphoreCreateMutex();
+}
+
+void frame_hub_set_interval(FrameHubConsumer consumer, uint32_t interval) {
+    intervalMs[consumer] = interval;
+}
+
+static HubEntry *hub_find(camera_fb_t *fb) {
+    for (int i = 0; i < FRAME_HUB_ENTRIES; i++) {
+        if (entries[i].fb == fb) return &entries[i];
+    }
+    return nullptr;
+}
+
+// Both with stateLock held
+static void hub_unref(camera_fb_t *fb) {
+    HubEntry *entry = hub_find(fb);
+    if (!entry) {
+        esp_camera_fb_return(fb);
+        return;
+    }
+    if (--entry->refs == 0) {
+        esp_camera_fb_return(fb);
+        entry->fb = nullptr;
+    }
+}
+
+static void hub_drop_latest() {
+    if (!latest) return;
+    hub_unref(latest);
+    latest = nullptr;
+}
+
+camera_fb_t *frame_hub_get(FrameHubConsumer consumer) {
+    if (!stateLock) return nullptr;
+
+    uint32_t now = millis();
+    if (intervalMs[consumer] && seenSeq[consumer] && now - lastGetMs[consumer] < intervalMs[consumer]) {
+        return nullptr;
+    }
+
+    xSemaphoreTake(captureLock, portMAX_DELAY);
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    camera_fb_t *fb = nullptr;
+    if (latest && latestSeq != seenSeq[consumer] && millis() - latestMs <= FRAME_HUB_MAX_AGE_MS) {
+        fb = latest;
+        hub_find(fb)->refs++;
+        hubStats.shared++;
+    } else {
+        // Give the old buffer back first, the driver may have no other
+        hub_drop_latest();
+    }
+    xSemaphoreGive(stateLock);
+
+    if (!fb) {
+        fb = esp_camera_fb_get();
+        if (fb) {
+            xSemaphoreTake(stateLock, portMAX_DELAY);
+            HubEntry *entry = hub_find(nullptr);
+            if (entry) {
+                entry->fb = fb;
+                entry->refs = 2;    // the consumer and the hub
+                latest = fb;
+                latestSeq++;
+                latestMs = millis();
+            }
+            hubStats.captures++;
+            xSemaphoreGive(stateLock);
+        }
+    }
+
+    if (fb) {
+        seenSeq[consumer] = latestSeq;
+        lastGetMs[consumer] = now;
+        hubStats.frames[consumer]++;
+    }
+    xSemaphoreGive(captureLock);
+    return fb;
+}
+
+void frame_hub_release(camera_fb_t *fb) {
+    if (!fb) return;
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    hub_unref(fb);
+    xSemaphoreGive(stateLock);
+}
+
+static bool hub_idle() {
+    for (int i = 0; i < FRAME_HUB_ENTRIES; i++) {
+        if (entries[i].fb) return false;
+    }
+    return true;
+}
+
+bool frame_hub_suspend(uint32_t timeoutMs) {
+    if (!stateLock) return true;
+    uint32_t start = millis();
+    if (xSemaphoreTake(captureLock, pdMS_TO_TICKS(timeoutMs)) != pdTRUE) return false;
+    
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    hub_drop_latest();
+    bool idle = hub_idle();
+    xSemaphoreGive(stateLock);
+    
+    // RTSP gives its frame back once the clients have sent it
+    while (!idle && millis() - start < timeoutMs) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+        xSemaphoreTake(stateLock, portMAX_DELAY);
+        idle = hub_idle();
+        xSemaphoreGive(stateLock);
+    }
+    if (!idle) xSemaphoreGive(captureLock);
+    return idle;
+}
+
+void frame_hub_resume() {
+    if (stateLock) xSemaphoreGive(captureLock);
+}
+
+void frame_hub_stats(FrameHubStats *stats) {
+    if (!stateLock) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    *stats = hubStats;
+    xSemaphoreGive(stateLock);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <Arduino.h>
+#include "esp_camera.h"
+
+// Everything that needs camera frames gets them from the frame hub instead of
+// calling esp_camera_fb_get() itself. Each frame is captured once and handed
+// out as a reference to every consumer that asks for it; the buffer goes back
+// to the driver when the last reference is released. With only two DMA
+// buffers this keeps e.g. the SD recorder from stealing frames from RTSP.
+enum FrameHubConsumer {
+    FRAME_HUB_RTSP,
+    FRAME_HUB_RECORDER,
+    FRAME_HUB_SNAPSHOT,
+    FRAME_HUB_STREAM,
+    FRAME_HUB_CONSUMERS
+};
+
+struct FrameHubStats {
+    uint32_t captures;                      // Frames taken from the camera driver
+    uint32_t shared;                        // Frames handed out without a new capture
+    uint32_t frames[FRAME_HUB_CONSUMERS];   // Frames handed to each consumer
+};
+
+// Call once after camera_init()
+void frame_hub_init();
+
+// Hand a consumer at most one frame every intervalMs (0 = no limit)
+void frame_hub_set_interval(FrameHubConsumer consumer, uint32_t intervalMs);
+
+// Newest frame the consumer hasn't had yet: the last capture if it is at most
+// FRAME_HUB_MAX_AGE_MS old, otherwise a new one (blocks in the driver).
+// Returns nullptr if the consumer's interval hasn't passed or on camera errors.
+// Every frame returned must be given back with frame_hub_release().
+camera_fb_t *frame_hub_get(FrameHubConsumer consumer);
+void frame_hub_release(camera_fb_t *fb);
+
+// Stop handing out frames and wait until every buffer is back with the
+// driver, so the camera can be re-initialized. Consumers block in
+// frame_hub_get() meanwhile. Returns false (and resumes) if buffers are still
+// held after timeoutMs.
+bool frame_hub_suspend(uint32_t timeoutMs);
+void frame_hub_resume();
+
+void frame_hub_stats(FrameHubStats *stats);
@@ -12,6 +12,7 @@
 #include "h264_encoder.h"
 #include "config.h"
 #include "board_config.h"
+#include "heap_tracker.h"
 
 #ifdef VIDEO_CODEC_H264
 
@@ -161,10 +162,7 @@ h264_status_t h264_encoder_init(const h264_encoder_config_t *config) {
             ESP_H264_MEM_SPIRAM  // Use SPIRAM if available
         );
     } else {
-        g_encoder.input_buffer = (uint8_t*)heap_caps_malloc(
-            g_encoder.input_buffer_size, 
-            MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT
-        );
+        g_encoder.input_buffer = (uint8_t*)HEAP_ALLOC_PSRAM(HEAP_ENCODER, g_encoder.input_buffer_size);
     }
     
     if (!g_encoder.input_buffer) {
@@ -178,7 +176,9 @@ h264_status_t h264_encoder_init(const h264_encoder_config_t *config) {
     ret = esp_h264_enc_open(g_encoder.encoder);
     if (ret != ESP_OK) {
         Serial.printf("[ERROR] H.264: Failed to open encoder (err=%d)\n", ret);
-        free(g_encoder.input_buffer);
+        if (g_encoder.use_hw_encoder) esp_h264_free(g_encoder.input_buffer);
+        else heap_tracker_free(g_encoder.input_buffer);
+        g_encoder.input_buffer = NULL;
         esp_h264_enc_del(g_encoder.encoder);
         return H264_ERR_INIT_FAILED;
     }
@@ -318,7 +318,7 @@ void h264_encoder_destroy(void) {
         if (g_encoder.use_hw_encoder) {
             esp_h264_free(g_encoder.input_buffer);
         } else {
-            free(g_encoder.input_buffer);
+            heap_tracker_free(g_encoder.input_buffer);
         }
         g_encoder.input_buffer = NULL;
     }
@@ -0,0 +1,221 @@
+#include "heap_tracker.h"
+#include "config.h"
+#include "esp_heap_caps.h"
+#include <assert.h>
+#include <atomic>
+#include <algorithm>
+
+static const char *tagNames[HEAP_TAGS] = { "rtsp", "onvif", "encoder", "pcap" };
+static const char *regionNames[HEAP_REGIONS] = { "internal", "psram" };
+
+// In front of every tracked block. Keeps the returned pointer aligned like
+// malloc's own result.
+struct HeapBlockHeader {
+    uint32_t size;
+    uint8_t tag;
+    uint8_t region;
+    uint8_t site;           // Index into sites, NO_SITE if the table was full
+    uint8_t magic;
+};
+
+#define HEAP_BLOCK_MAGIC 0xA5
+#define NO_SITE 0xFF
+#define HEAP_REPORT_SITES 5     // Busiest sites in a report
+
+struct HeapSite {
+    const char *file;       // __FILE__, compared by pointer
+    int line;
+    uint8_t tag;
+    uint32_t allocs;
+    uint32_t bytes;
+};
+
+// Allocations come from loop() and the RTSP task, a spinlock keeps the
+// counters consistent. malloc() itself runs outside of it.
+static portMUX_TYPE heapMux = portMUX_INITIALIZER_UNLOCKED;
+static HeapTagStats tags[HEAP_TAGS];
+static HeapSite sites[HEAP_TRACKER_SITES];
+static int siteCount = 0;
+
+// Filled by the IDF hook, which runs inside the failing allocation
+static std::atomic<uint32_t> failedAllocs(0);
+static volatile uint32_t lastFailedSize = 0;
+static const char *volatile lastFailedFunction = "";
+static uint32_t reportedFailures = 0;
+static uint32_t lastReportMs = 0;
+
+static void heap_failed_alloc(size_t size, uint32_t caps, const char *function) {
+    (void) caps;
+    lastFailedSize = size;
+    lastFailedFunction = function ? function : "";
+    failedAllocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void heap_tracker_init() {
+    heap_caps_register_failed_alloc_callback(heap_failed_alloc);
+}
+
+static uint8_t heap_site_index(const char *file, int line, HeapTag tag) {
+    for (int i = 0; i < siteCount; i++) {
+        if (sites[i].file == file && sites[i].line == line) return i;
+    }
+    if (siteCount == HEAP_TRACKER_SITES) return NO_SITE;
+    sites[siteCount].file = file;
+    sites[siteCount].line = line;
+    sites[siteCount].tag = tag;
+    return siteCount++;
+}
+
+void *heap_tracker_alloc(HeapTag tag, size_t size, bool psram, const char *file, int line) {
+    HeapBlockHeader *h;
+    if (psram) {
+        h = (HeapBlockHeader *) heap_caps_malloc(sizeof(HeapBlockHeader) + size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    } else {
+        h = (HeapBlockHeader *) malloc(sizeof(HeapBlockHeader) + size);
+    }
+
+    HeapTagStats &t = tags[tag];
+    portENTER_CRITICAL(&heapMux);
+    if (!h) {
+        t.failures++;
+        portEXIT_CRITICAL(&heapMux);
+        return NULL;
+    }
+    HeapRegion region = psram ? HEAP_PSRAM : HEAP_INTERNAL;
+    uint8_t site = heap_site_index(file, line, tag);
+    t.allocs++;
+    t.bytes[region] += size;
+    if (t.bytes[region] > t.peakBytes[region]) t.peakBytes[region] = t.bytes[region];
+    if (site != NO_SITE) {
+        sites[site].allocs++;
+        sites[site].bytes += size;
+    }
+    portEXIT_CRITICAL(&heapMux);
+
+    h->size = size;
+    h->tag = tag;
+    h->region = region;
+    h->site = site;
+    h->magic = HEAP_BLOCK_MAGIC;
+    return h + 1;
+}
+
+// Only blocks from heap_tracker_alloc() come here, so the header is always
+// there to read. The magic number catches double frees in debug builds; it
+// can't tell whether some other pointer is ours, reading in front of that
+// would already be out of bounds.
+void heap_tracker_free(void *ptr) {
+    if (!ptr) return;
+    HeapBlockHeader *h = (HeapBlockHeader *) ptr - 1;
+    assert(h->magic == HEAP_BLOCK_MAGIC && h->tag < HEAP_TAGS);
+    h->magic = 0;
+
+    portENTER_CRITICAL(&heapMux);
+    HeapTagStats &t = tags[h->tag];
+    t.frees++;
+    t.bytes[h->region] -= h->size;
+    if (h->site != NO_SITE) sites[h->site].bytes -= h->size;
+    portEXIT_CRITICAL(&heapMux);
+
+    free(h);
+}
+
+void heap_tracker_tag_stats(HeapTag tag, HeapTagStats *stats) {
+    portENTER_CRITICAL(&heapMux);
+    *stats = tags[tag];
+    portEXIT_CRITICAL(&heapMux);
+}
+
+void heap_tracker_region_stats(HeapRegion region, HeapRegionStats *stats) {
+    uint32_t caps = region == HEAP_PSRAM ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    stats->totalBytes = heap_caps_get_total_size(caps);
+    stats->freeBytes = heap_caps_get_free_size(caps);
+    stats->minFreeBytes = heap_caps_get_minimum_free_size(caps);
+    stats->largestBlock = heap_caps_get_largest_free_block(caps);
+    stats->fragmentationPct = stats->freeBytes ? 100 - (uint64_t) stats->largestBlock * 100 / stats->freeBytes : 0;
+    stats->taggedBytes = 0;
+    portENTER_CRITICAL(&heapMux);
+    for (int i = 0; i < HEAP_TAGS; i++) stats->taggedBytes += tags[i].bytes[region];
+    portEXIT_CRITICAL(&heapMux);
+}
+
+int heap_tracker_sites(HeapSiteStats *out, int max) {
+    HeapSite copy[HEAP_TRACKER_SITES];
+    portENTER_CRITICAL(&heapMux);
+    int n = siteCount;
+    memcpy(copy, sites, n * sizeof(HeapSite));
+    portEXIT_CRITICAL(&heapMux);
+
+    std::sort(copy, copy + n, [](const HeapSite &a, const HeapSite &b) { return a.allocs > b.allocs; });
+    if (n > max) n = max;
+    for (int i = 0; i < n; i++) {
+        const char *slash = strrchr(copy[i].file, '/');
+        out[i].file = slash ? slash + 1 : copy[i].file;
+        out[i].line = copy[i].line;
+        out[i].tag = (HeapTag) copy[i].tag;
+        out[i].allocs = copy[i].allocs;
+        out[i].bytes = copy[i].bytes;
+    }
+    return n;
+}
+
+uint32_t heap_tracker_failed_allocs() {
+    return failedAllocs.load(std::memory_order_relaxed);
+}
+
+const char *heap_tag_name(HeapTag tag) {
+    return tagNames[tag];
+}
+
+const char *heap_region_name(HeapRegion region) {
+    return regionNames[region];
+}
+
+void heap_tracker_report(Print &out) {
+    out.println("--- Heap ---");
+    for (int r = 0; r < HEAP_REGIONS; r++) {
+        HeapRegionStats rs;
+        heap_tracker_region_stats((HeapRegion) r, &rs);
+        if (rs.totalBytes == 0) continue;   // No PSRAM
+        out.printf("%-8s %u of %u bytes free (min %u), largest block %u, %u%% fragmented, %u tagged\n",
+                   regionNames[r], rs.freeBytes, rs.totalBytes, rs.minFreeBytes, rs.largestBlock,
+                   rs.fragmentationPct, rs.taggedBytes);
+    }
+    for (int i = 0; i < HEAP_TAGS; i++) {
+        HeapTagStats ts;
+        heap_tracker_tag_stats((HeapTag) i, &ts);
+        out.printf("  %-8s internal %u (peak %u), psram %u (peak %u), %u allocs, %u frees, %u failed\n",
+                   tagNames[i], ts.bytes[HEAP_INTERNAL], ts.peakBytes[HEAP_INTERNAL],
+                   ts.bytes[HEAP_PSRAM], ts.peakBytes[HEAP_PSRAM], ts.allocs, ts.frees, ts.failures);
+    }
+    HeapSiteStats top[HEAP_REPORT_SITES];
+    int n = heap_tracker_sites(top, HEAP_REPORT_SITES);
+    if (n > 0) out.println("Busiest allocation sites:");
+    for (int i = 0; i < n; i++) {
+        out.printf("  %s:%d (%s) %u allocs, %u bytes in use\n",
+                   top[i].file, top[i].line, tagNames[top[i].tag], top[i].allocs, top[i].bytes);
+    }
+    out.printf("Failed allocations: %u\n", heap_tracker_failed_allocs());
+}
+
+void heap_tracker_loop() {
+    uint32_t failures = heap_tracker_failed_allocs();
+    if (failures != reportedFailures) {
+        Serial.printf("[ERROR] heap: %u allocation(s) failed, last %u bytes in %s\n",
+                      failures - reportedFailures, lastFailedSize, lastFailedFunction);
+        reportedFailures = failures;
+    }
+
+    if (HEAP_REPORT_INTERVAL_MS == 0) return;
+    uint32_t now = millis();
+    if (now - lastReportMs < HEAP_REPORT_INTERVAL_MS) return;
+    lastReportMs = now;
+
+    HeapRegionStats internal;
+    heap_tracker_region_stats(HEAP_INTERNAL, &internal);
+    if (internal.fragmentationPct >= HEAP_FRAG_WARN_PCT) {
+        Serial.printf("[WARN] heap: internal RAM %u%% fragmented, largest block %u of %u bytes free\n",
+                      internal.fragmentationPct, internal.largestBlock, internal.freeBytes);
+    }
+    heap_tracker_report(Serial);
+}
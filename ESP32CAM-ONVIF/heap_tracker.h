@@ -0,0 +1,88 @@
+#pragma once
+#include <Arduino.h>
+#include <new>
+#include <utility>
+
+// Heap use by subsystem, to tell a leak from fragmentation after days of
+// uptime. Long-lived and per-connection buffers are allocated through
+// HEAP_ALLOC / HEAP_NEW with a tag; each block carries a small header so the
+// free side finds its tag and size again. Allocations made elsewhere (String,
+// lwIP, the camera driver) are not tagged and show up as "untagged".
+//
+// Every call site is counted: sites with many allocations are the ones
+// churning the heap. Failed allocations anywhere are caught by an IDF hook.
+enum HeapTag {
+    HEAP_RTSP,          // Sessions, streamers, sockets
+    HEAP_ONVIF,         // SOAP response buffers
+    HEAP_ENCODER,       // H.264 encoder input
+    HEAP_PCAP,          // Packet capture ring
+    HEAP_TAGS
+};
+
+enum HeapRegion {
+    HEAP_INTERNAL,
+    HEAP_PSRAM,
+    HEAP_REGIONS
+};
+
+#define HEAP_TRACKER_SITES 24   // Distinct allocation sites kept
+
+struct HeapTagStats {
+    uint32_t bytes[HEAP_REGIONS];       // In use
+    uint32_t peakBytes[HEAP_REGIONS];   // High-water mark since boot
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+};
+
+struct HeapRegionStats {
+    uint32_t totalBytes;
+    uint32_t freeBytes;
+    uint32_t minFreeBytes;              // Low-water mark since boot
+    uint32_t largestBlock;
+    uint32_t fragmentationPct;          // 100 - largest block / free
+    uint32_t taggedBytes;
+};
+
+struct HeapSiteStats {
+    const char *file;                   // Base name
+    int line;
+    HeapTag tag;
+    uint32_t allocs;
+    uint32_t bytes;                     // In use
+};
+
+void heap_tracker_init();
+// Logs a report every HEAP_REPORT_INTERVAL_MS, failed allocations right away
+void heap_tracker_loop();
+
+void *heap_tracker_alloc(HeapTag tag, size_t size, bool psram, const char *file, int line);
+// Only for blocks from heap_tracker_alloc() (HEAP_ALLOC / HEAP_NEW)
+void heap_tracker_free(void *ptr);
+
+void heap_tracker_tag_stats(HeapTag tag, HeapTagStats *stats);
+void heap_tracker_region_stats(HeapRegion region, HeapRegionStats *stats);
+// Sites sorted by allocation count, busiest first. Returns the count.
+int heap_tracker_sites(HeapSiteStats *out, int max);
+uint32_t heap_tracker_failed_allocs();   // Anywhere, tagged or not
+const char *heap_tag_name(HeapTag tag);
+const char *heap_region_name(HeapRegion region);
+void heap_tracker_report(Print &out);
+
+#define HEAP_ALLOC(tag, size)       heap_tracker_alloc(tag, size, false, __FILE__, __LINE__)
+#define HEAP_ALLOC_PSRAM(tag, size) heap_tracker_alloc(tag, size, true, __FILE__, __LINE__)
+#define HEAP_NEW(tag, T, ...)       heap_tracker_new<T>(tag, __FILE__, __LINE__, ##__VA_ARGS__)
+
+template <class T, class... Args>
+T *heap_tracker_new(HeapTag tag, const char *file, int line, Args &&... args) {
+    void *p = heap_tracker_alloc(tag, sizeof(T), false, file, line);
+    return p ? new (p) T(std::forward<Args>(args)...) : NULL;
+}
+
+// For objects from HEAP_NEW, in place of delete
+template <class T>
+void heap_delete(T *obj) {
+    if (!obj) return;
+    obj->~T();
+    heap_tracker_free(obj);
+}
@@ -0,0 +1,108 @@
+#include "latency_stats.h"
+#include <atomic>
+
+static const uint32_t bucketLimitUs[LATENCY_BUCKETS] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, UINT32_MAX
+};
+
+static const char *stageNames[LATENCY_STAGES] = {
+    "fb_get", "ready", "first_packet", "last_packet"
+};
+
+static LatencyHistogram histograms[LATENCY_SESSIONS][LATENCY_STAGES];
+
+// Sample ring. seq is odd while an entry is being written and holds the
+// (even) write count once it is complete.
+struct RingEntry {
+    std::atomic<uint32_t> seq;
+    LatencySample sample;
+};
+static RingEntry ring[LATENCY_RING_SIZE];
+static std::atomic<uint32_t> ringHead(0);   // entries written so far
+
+// Frame being sent, set by latency_begin_frame()
+static uint32_t frameCaptureMs;
+static uint32_t frameFbGetUs;
+static uint32_t frameReadyUs;
+
+uint32_t latency_bucket_limit_us(int bucket) {
+    return bucketLimitUs[bucket];
+}
+
+const char *latency_stage_name(LatencyStage stage) {
+    return stageNames[stage];
+}
+
+static void latency_add(LatencyHistogram *h, uint32_t us) {
+    int b = 0;
+    while (us > bucketLimitUs[b]) b++;
+    h->counts[b]++;
+    if (us > h->maxUs) h->maxUs = us;
+}
+
+// The capture time is in milliseconds; scaled to microseconds it wraps
+// together with getMicros(), so the differences stay right
+static uint32_t since_capture(uint32_t us) {
+    int32_t d = (int32_t) (us - frameCaptureMs * 1000);
+    return d > 0 ? (uint32_t) d : 0;
+}
+
+void latency_begin_frame(uint32_t captureMs, uint32_t grabUs, uint32_t readyUs) {
+    frameCaptureMs = captureMs;
+    frameFbGetUs = since_capture(grabUs);
+    frameReadyUs = since_capture(readyUs);
+}
+
+void latency_session_sent(int session, uint32_t firstPacketUs, uint32_t lastPacketUs) {
+    if (session < 0 || session >= LATENCY_SESSIONS) return;
+
+    LatencySample sample;
+    sample.session = session;
+    sample.captureMs = frameCaptureMs;
+    sample.stageUs[LATENCY_FB_GET] = frameFbGetUs;
+    sample.stageUs[LATENCY_READY] = frameReadyUs;
+    sample.stageUs[LATENCY_FIRST_PACKET] = since_capture(firstPacketUs);
+    sample.stageUs[LATENCY_LAST_PACKET] = since_capture(lastPacketUs);
+
+    for (int s = 0; s < LATENCY_STAGES; s++) {
+        latency_add(&histograms[session][s], sample.stageUs[s]);
+    }
+
+    uint32_t n = ringHead.load(std::memory_order_relaxed);
+    RingEntry &e = ring[n % LATENCY_RING_SIZE];
+    e.seq.store(2 * n + 1, std::memory_order_release);
+    e.sample = sample;
+    e.seq.store(2 * n + 2, std::memory_order_release);
+    ringHead.store(n + 1, std::memory_order_release);
+}
+
+void latency_reset_session(int session) {
+    if (session < 0 || session >= LATENCY_SESSIONS) return;
+    memset(histograms[session], 0, sizeof(histograms[session]));
+}
+
+void latency_histogram(LatencyStage stage, int session, LatencyHistogram *out) {
+    memset(out, 0, sizeof(*out));
+    for (int s = 0; s < LATENCY_SESSIONS; s++) {
+        if (session >= 0 && s != session) continue;
+        const LatencyHistogram &h = histograms[s][stage];
+        for (int b = 0; b < LATENCY_BUCKETS; b++) out->counts[b] += h.counts[b];
+        if (h.maxUs > out->maxUs) out->maxUs = h.maxUs;
+    }
+}
+
+int latency_recent(LatencySample *out, int max) {
+    uint32_t head = ringHead.load(std::memory_order_acquire);
+    int count = 0;
+    for (uint32_t i = 0; i < LATENCY_RING_SIZE && i < head && count < max; i++) {
+        uint32_t n = head - 1 - i;
+        RingEntry &e = ring[n % LATENCY_RING_SIZE];
+        uint32_t before = e.seq.load(std::memory_order_acquire);
+        if (before != 2 * n + 2) continue;  // being rewritten or already newer
+        LatencySample sample = e.sample;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (e.seq.load(std::memory_order_relaxed) != before) continue;
+        out[count++] = sample;
+    }
+    return count;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <Arduino.h>
+#include "config.h"
+
+// Where the time goes between the sensor and the network, per frame. Every
+// stage is measured from the sensor capture time:
+//   fb_get       frame handed to the RTSP task (camera driver, frame hub)
+//   ready        JPEG parsed / H.264 encoded (task scheduling, encoder)
+//   first_packet first RTP packet of the frame out to a session (pacing of
+//                the previous frame, other sessions)
+//   last_packet  last RTP packet out (pacing, WiFi/TCP back pressure)
+// Slow fb_get points at capture stalls, a large gap between ready and the
+// packets at WiFi congestion, ready lagging fb_get at a blocked task.
+//
+// Only the RTSP task records. Readers on other tasks take no lock: the
+// histogram counters are single 32-bit words and the sample ring uses a
+// sequence number per entry to detect entries overwritten while copied.
+enum LatencyStage {
+    LATENCY_FB_GET,
+    LATENCY_READY,
+    LATENCY_FIRST_PACKET,
+    LATENCY_LAST_PACKET,
+    LATENCY_STAGES
+};
+
+#define LATENCY_BUCKETS     10
+#define LATENCY_RING_SIZE   32              // Recent samples kept
+#define LATENCY_SESSIONS    (RTSP_MAX_CLIENTS + 1) // Client slots + multicast
+
+struct LatencyHistogram {
+    uint32_t counts[LATENCY_BUCKETS];       // See latency_bucket_limit_us()
+    uint32_t maxUs;
+};
+
+// One session's view of one frame, in microseconds since capture
+struct LatencySample {
+    uint8_t  session;                       // Slot, RTSP_MAX_CLIENTS = multicast
+    uint32_t captureMs;                     // Capture time (RTP clock base)
+    uint32_t stageUs[LATENCY_STAGES];
+};
+
+// Upper bound of a bucket (the last one is open ended)
+uint32_t latency_bucket_limit_us(int bucket);
+
+// Recording, RTSP task only. A frame is started with its capture time and
+// the getMicros() stamps of the first two stages; every session that sends
+// it completely then adds its packet times.
+void latency_begin_frame(uint32_t captureMs, uint32_t grabUs, uint32_t readyUs);
+void latency_session_sent(int session, uint32_t firstPacketUs, uint32_t lastPacketUs);
+// A new client took over the slot
+void latency_reset_session(int session);
+
+// Histogram of one stage, for one session or all of them (session < 0)
+void latency_histogram(LatencyStage stage, int session, LatencyHistogram *out);
+// Copies up to max recent samples, newest first. Returns the number copied.
+int latency_recent(LatencySample *out, int max);
+
+const char *latency_stage_name(LatencyStage stage);
@@ -0,0 +1,77 @@
+#include "loop_profiler.h"
+#include "config.h"
+#include <algorithm>
+
+static const char *subsystemNames[LOOP_SUBSYSTEMS] = {
+    "wifi", "web", "onvif", "motion", "sd", "serial", "auto_flash", "status_led", "heap"
+};
+
+struct SubsystemTimes {
+    uint32_t samples[LOOP_PROFILER_WINDOW];
+    uint32_t calls;
+    uint32_t budgetUs;
+    uint32_t overruns;
+    uint32_t lastWarnMs;
+};
+
+static SubsystemTimes times[LOOP_SUBSYSTEMS];
+
+#define LOOP_BUDGET_WARN_MS 1000    // At most one log line per subsystem and second
+
+void loop_profiler_init() {
+    for (int i = 0; i < LOOP_SUBSYSTEMS; i++) {
+        times[i].budgetUs = LOOP_BUDGET_MS * 1000;
+    }
+}
+
+void loop_profiler_record(LoopSubsystem subsystem, uint32_t us) {
+    SubsystemTimes &t = times[subsystem];
+    t.samples[t.calls % LOOP_PROFILER_WINDOW] = us;
+    t.calls++;
+
+    if (us > t.budgetUs) {
+        t.overruns++;
+        uint32_t now = millis();
+        if (now - t.lastWarnMs >= LOOP_BUDGET_WARN_MS) {
+            t.lastWarnMs = now;
+            Serial.printf("[WARN] loop: %s took %u us (budget %u us, %u overruns)\n",
+                          subsystemNames[subsystem], us, t.budgetUs, t.overruns);
+        }
+    }
+}
+
+void loop_profiler_set_budget(LoopSubsystem subsystem, uint32_t us) {
+    times[subsystem].budgetUs = us;
+}
+
+void loop_profiler_get(LoopSubsystem subsystem, LoopProfile *profile) {
+    const SubsystemTimes &t = times[subsystem];
+    memset(profile, 0, sizeof(*profile));
+    profile->calls = t.calls;
+    profile->budgetUs = t.budgetUs;
+    profile->overruns = t.overruns;
+
+    uint32_t n = t.calls < LOOP_PROFILER_WINDOW ? t.calls : LOOP_PROFILER_WINDOW;
+    if (n == 0) return;
+
+    uint32_t sorted[LOOP_PROFILER_WINDOW];
+    memcpy(sorted, t.samples, n * sizeof(uint32_t));
+    std::sort(sorted, sorted + n);
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) sum += sorted[i];
+    profile->minUs = sorted[0];
+    profile->maxUs = sorted[n - 1];
+    profile->avgUs = sum / n;
+    profile->p99Us = sorted[(n * 99 + 99) / 100 - 1];   // nearest rank
+}
+
+const char *loop_subsystem_name(LoopSubsystem subsystem) {
+    return subsystemNames[subsystem];
+}
+
+LoopSubsystem loop_subsystem_from_name(const char *name) {
+    for (int i = 0; i < LOOP_SUBSYSTEMS; i++) {
+        if (strcmp(name, subsystemNames[i]) == 0) return (LoopSubsystem) i;
+    }
+    return LOOP_SUBSYSTEMS;
+}
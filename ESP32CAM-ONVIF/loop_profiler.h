@@ -0,0 +1,53 @@
+#pragma once
+#include <Arduino.h>
+
+// Time spent in each subsystem called from loop(), to find the one that
+// held up everything else. Every call is timed with a LoopTimer; the last
+// LOOP_PROFILER_WINDOW durations per subsystem are kept for the statistics.
+// A call that takes longer than its budget is logged and counted.
+//
+// Recording and reading both happen on the loop() task (the web server and
+// the serial console are serviced from loop()), so no locking is needed.
+enum LoopSubsystem {
+    LOOP_WIFI,
+    LOOP_WEB,
+    LOOP_ONVIF,
+    LOOP_MOTION,
+    LOOP_SD,
+    LOOP_SERIAL,
+    LOOP_AUTO_FLASH,
+    LOOP_STATUS_LED,
+    LOOP_HEAP,
+    LOOP_SUBSYSTEMS
+};
+
+#define LOOP_PROFILER_WINDOW 128    // Samples per subsystem
+
+struct LoopProfile {
+    uint32_t calls;                 // Since boot
+    uint32_t minUs;                 // Over the window
+    uint32_t avgUs;
+    uint32_t maxUs;
+    uint32_t p99Us;
+    uint32_t budgetUs;
+    uint32_t overruns;              // Calls over budget since boot
+};
+
+void loop_profiler_init();
+void loop_profiler_record(LoopSubsystem subsystem, uint32_t us);
+void loop_profiler_set_budget(LoopSubsystem subsystem, uint32_t us);
+void loop_profiler_get(LoopSubsystem subsystem, LoopProfile *profile);
+const char *loop_subsystem_name(LoopSubsystem subsystem);
+// Subsystem by name, LOOP_SUBSYSTEMS if unknown
+LoopSubsystem loop_subsystem_from_name(const char *name);
+
+// Times the enclosing scope:
+//   { LoopTimer t(LOOP_WEB); web_config_loop(); }
+class LoopTimer {
+public:
+    explicit LoopTimer(LoopSubsystem subsystem) : _subsystem(subsystem), _start(micros()) {}
+    ~LoopTimer() { loop_profiler_record(_subsystem, micros() - _start); }
+private:
+    LoopSubsystem _subsystem;
+    uint32_t _start;
+};
@@ -0,0 +1,143 @@
+#include "metrics.h"
+#include <WiFi.h>
+#include "esp_heap_caps.h"
+#include "rtsp_server.h"
+#include "onvif_server.h"
+#include "frame_hub.h"
+#include "loop_profiler.h"
+#include "heap_tracker.h"
+
+MetricCounters metrics;
+
+static void metric_header(Print &out, const char *name, const char *type, const char *help) {
+    out.printf("# HELP esp32cam_%s %s\n# TYPE esp32cam_%s %s\n", name, help, name, type);
+}
+
+static void metric(Print &out, const char *name, const char *type, const char *help, uint32_t value) {
+    metric_header(out, name, type, help);
+    out.printf("esp32cam_%s %u\n", name, value);
+}
+
+static void metric_seconds(Print &out, const char *name, const char *type, const char *help, uint32_t us) {
+    metric_header(out, name, type, help);
+    out.printf("esp32cam_%s %u.%06u\n", name, us / 1000000, us % 1000000);
+}
+
+void metrics_write(Print &out) {
+    RtspTotals rtsp;
+    rtsp_server_totals(&rtsp);
+    RtspFrameTiming timing;
+    rtsp_server_frame_timing(&timing);
+    metric(out, "rtsp_sessions", "gauge", "Connected RTSP clients", rtsp_server_client_count());
+    metric(out, "rtsp_multicast_viewers", "gauge", "RTSP clients watching the multicast group",
+           rtsp_server_multicast_viewers());
+    metric(out, "rtsp_frames_captured_total", "counter", "Frames started for the RTSP clients", timing.frames);
+    metric(out, "rtsp_frames_sent_total", "counter", "Frames completely sent, summed over clients", rtsp.framesSent);
+    metric(out, "rtsp_packets_sent_total", "counter", "RTP packets sent", rtsp.packets);
+    metric(out, "rtsp_bytes_sent_total", "counter", "RTP bytes sent", rtsp.bytes);
+    metric_header(out, "rtsp_dropped_frames_total", "counter", "Frames dropped by the RTSP server");
+    out.printf("esp32cam_rtsp_dropped_frames_total{reason=\"slow_client\"} %u\n", rtsp.clientDrops);
+    out.printf("esp32cam_rtsp_dropped_frames_total{reason=\"stale_capture\"} %u\n", timing.dropped);
+
+    metric_seconds(out, "rtsp_first_frame_seconds", "gauge", "PLAY until the newest viewer's first frame was sent",
+                   timing.firstFrameMs * 1000);
+    metric_seconds(out, "rtsp_first_frame_max_seconds", "gauge", "Slowest time to first frame",
+                   timing.maxFirstFrameMs * 1000);
+
+    FrameHubStats hub;
+    frame_hub_stats(&hub);
+    metric(out, "camera_captures_total", "counter", "Frames taken from the camera driver", hub.captures);
+    metric(out, "camera_shared_frames_total", "counter", "Frames shared without a new capture", hub.shared);
+
+    metric_header(out, "onvif_requests_total", "counter", "ONVIF SOAP requests by action");
+    for (int i = 0; i < onvif_action_count(); i++) {
+        out.printf("esp32cam_onvif_requests_total{action=\"%s\"} %u\n", onvif_action_name(i), onvif_action_requests(i));
+    }
+    metric(out, "onvif_auth_failures_total", "counter", "ONVIF requests rejected for missing or bad credentials",
+           onvif_auth_failures());
+    OnvifParseStats soap;
+    onvif_parse_stats(&soap);
+    metric_seconds(out, "onvif_parse_seconds", "gauge", "Parsing and authenticating the latest SOAP request",
+                   soap.lastParseUs);
+    metric_seconds(out, "onvif_parse_max_seconds", "gauge", "Slowest SOAP request parse", soap.maxParseUs);
+    metric(out, "onvif_request_max_bytes", "gauge", "Largest SOAP request body", soap.maxRequestBytes);
+    metric(out, "onvif_oversized_requests_total", "counter", "SOAP requests too large for the request buffer",
+           soap.oversized);
+
+    metric(out, "sd_bytes_written_total", "counter", "Bytes written to SD recordings", metrics.sdBytes.load());
+    metric(out, "sd_writes_total", "counter", "Frames written to SD recordings", metrics.sdWrites.load());
+    metric_seconds(out, "sd_write_seconds_total", "counter", "Time spent in SD writes", metrics.sdWriteUs.load());
+    metric_seconds(out, "sd_write_max_seconds", "gauge", "Slowest SD write", metrics.sdWriteMaxUs.load());
+
+    metric(out, "motion_events_total", "counter", "Motion detected", metrics.motionEvents.load());
+
+    metric_header(out, "wifi_rssi_dbm", "gauge", "WiFi signal strength");
+    out.printf("esp32cam_wifi_rssi_dbm %d\n", WiFi.status() == WL_CONNECTED ? (int) WiFi.RSSI() : 0);
+    metric(out, "wifi_reconnects_total", "counter", "WiFi reconnect attempts", metrics.wifiReconnects.load());
+
+    metric(out, "heap_free_bytes", "gauge", "Free internal heap", ESP.getFreeHeap());
+    metric(out, "heap_largest_free_block_bytes", "gauge", "Largest free internal heap block",
+           heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    metric(out, "psram_free_bytes", "gauge", "Free PSRAM", ESP.getFreePsram());
+    metric(out, "psram_largest_free_block_bytes", "gauge", "Largest free PSRAM block",
+           heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+
+    HeapRegionStats regions[HEAP_REGIONS];
+    for (int r = 0; r < HEAP_REGIONS; r++) heap_tracker_region_stats((HeapRegion) r, &regions[r]);
+    metric_header(out, "heap_min_free_bytes", "gauge", "Lowest free memory since boot");
+    for (int r = 0; r < HEAP_REGIONS; r++) {
+        out.printf("esp32cam_heap_min_free_bytes{region=\"%s\"} %u\n", heap_region_name((HeapRegion) r),
+                   regions[r].minFreeBytes);
+    }
+    metric_header(out, "heap_fragmentation_ratio", "gauge", "1 - largest free block / free memory");
+    for (int r = 0; r < HEAP_REGIONS; r++) {
+        uint32_t pct = regions[r].fragmentationPct;
+        out.printf("esp32cam_heap_fragmentation_ratio{region=\"%s\"} %u.%02u\n", heap_region_name((HeapRegion) r),
+                   pct / 100, pct % 100);
+    }
+    HeapTagStats tagStats[HEAP_TAGS];
+    for (int i = 0; i < HEAP_TAGS; i++) heap_tracker_tag_stats((HeapTag) i, &tagStats[i]);
+    metric_header(out, "heap_tagged_bytes", "gauge", "Heap in use by subsystem");
+    for (int i = 0; i < HEAP_TAGS; i++) {
+        for (int r = 0; r < HEAP_REGIONS; r++) {
+            out.printf("esp32cam_heap_tagged_bytes{tag=\"%s\",region=\"%s\"} %u\n", heap_tag_name((HeapTag) i),
+                       heap_region_name((HeapRegion) r), tagStats[i].bytes[r]);
+        }
+    }
+    metric_header(out, "heap_tagged_peak_bytes", "gauge", "Highest heap use by subsystem since boot");
+    for (int i = 0; i < HEAP_TAGS; i++) {
+        for (int r = 0; r < HEAP_REGIONS; r++) {
+            out.printf("esp32cam_heap_tagged_peak_bytes{tag=\"%s\",region=\"%s\"} %u\n", heap_tag_name((HeapTag) i),
+                       heap_region_name((HeapRegion) r), tagStats[i].peakBytes[r]);
+        }
+    }
+    HeapSiteStats sites[HEAP_TRACKER_SITES];
+    int siteCount = heap_tracker_sites(sites, HEAP_TRACKER_SITES);
+    metric_header(out, "heap_site_allocs_total", "counter", "Allocations per call site");
+    for (int i = 0; i < siteCount; i++) {
+        out.printf("esp32cam_heap_site_allocs_total{site=\"%s:%d\",tag=\"%s\"} %u\n", sites[i].file, sites[i].line,
+                   heap_tag_name(sites[i].tag), sites[i].allocs);
+    }
+    metric(out, "heap_failed_allocs_total", "counter", "Failed heap allocations", heap_tracker_failed_allocs());
+
+    metric(out, "loop_iterations_total", "counter", "loop() passes", metrics.loopIterations.load());
+    metric_seconds(out, "loop_last_seconds", "gauge", "Duration of the last loop() pass", metrics.loopLastUs.load());
+    // Reset per scrape, so spikes between two scrapes are never lost
+    metric_seconds(out, "loop_max_seconds", "gauge", "Longest loop() pass since the previous scrape",
+                   metrics.loopMaxUs.exchange(0));
+
+    LoopProfile loopProfiles[LOOP_SUBSYSTEMS];
+    for (int i = 0; i < LOOP_SUBSYSTEMS; i++) loop_profiler_get((LoopSubsystem) i, &loopProfiles[i]);
+    metric_header(out, "loop_subsystem_p99_seconds", "gauge", "99th percentile of recent calls per loop() subsystem");
+    for (int i = 0; i < LOOP_SUBSYSTEMS; i++) {
+        uint32_t us = loopProfiles[i].p99Us;
+        out.printf("esp32cam_loop_subsystem_p99_seconds{subsystem=\"%s\"} %u.%06u\n",
+                   loop_subsystem_name((LoopSubsystem) i), us / 1000000, us % 1000000);
+    }
+    metric_header(out, "loop_budget_overruns_total", "counter", "loop() subsystem calls over their time budget");
+    for (int i = 0; i < LOOP_SUBSYSTEMS; i++) {
+        out.printf("esp32cam_loop_budget_overruns_total{subsystem=\"%s\"} %u\n",
+                   loop_subsystem_name((LoopSubsystem) i), loopProfiles[i].overruns);
+    }
+    metric(out, "uptime_seconds", "counter", "Seconds since boot", millis() / 1000);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+// Counters for the Prometheus /metrics endpoint. Modules bump them on their
+// hot paths with relaxed atomic adds (a single S32C1I loop on the ESP32, no
+// locks), so they stay on in production. Subsystems that already keep their
+// own statistics (RTSP, frame hub, ONVIF) are read directly when rendering.
+struct MetricCounters {
+    std::atomic<uint32_t> sdBytes;          // Bytes written to recordings
+    std::atomic<uint32_t> sdWrites;         // Frame writes
+    std::atomic<uint32_t> sdWriteUs;        // Time spent writing (wraps after ~71 min of writing)
+    std::atomic<uint32_t> sdWriteMaxUs;
+    std::atomic<uint32_t> motionEvents;     // Motion started
+    std::atomic<uint32_t> wifiReconnects;   // Reconnect attempts after losing WiFi
+    std::atomic<uint32_t> loopIterations;   // loop() passes; 1 / rate() is the mean loop time
+    std::atomic<uint32_t> loopLastUs;
+    std::atomic<uint32_t> loopMaxUs;        // Longest pass since the previous scrape
+};
+
+extern MetricCounters metrics;
+
+inline void metrics_add(std::atomic<uint32_t> &counter, uint32_t n = 1) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void metrics_max(std::atomic<uint32_t> &gauge, uint32_t value) {
+    uint32_t current = gauge.load(std::memory_order_relaxed);
+    while (value > current && !gauge.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+// Write all metrics in the Prometheus text format (version 0.0.4)
+void metrics_write(Print &out);
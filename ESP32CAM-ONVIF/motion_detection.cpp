@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include "motion_detection.h"
 #include "config.h"
+#include "metrics.h"
 
 // Basic frame-difference motion detection stub
 static bool motion = false;
@@ -12,7 +13,10 @@ void motion_detection_init() {
 
 void motion_detection_loop() {
   if (!ENABLE_MOTION_DETECTION) return;
+  static bool wasMotion = false;
   // logic to update 'motion' variable would go here
+  if (motion && !wasMotion) metrics_add(metrics.motionEvents);
+  wasMotion = motion;
 }
 
 bool motion_detected() {
@@ -0,0 +1,49 @@
+#pragma once
+
+// The SOAP actions the ONVIF server answers, found by the name of the first
+// element in the Body (without its namespace prefix). Sorted by name (strcmp
+// order) for the binary search with soap_lookup(); the host benchmarks check
+// that, and classify requests against this same list.
+//
+// ONVIF_ACTION(name, auth, handler, template): protected actions need
+// authentication, actions without a handler answer with the fixed template.
+// Only onvif_server.cpp has the handlers and templates, other users of the
+// list leave those two arguments out of their expansion.
+//
+// Note: Some NVRs will fail Probe/Discovery if authentication is required for simple gets.
+// ONVIF Specification: GetCapabilities, GetServices, GetSystemDateAndTime, GetDeviceInformation
+// should be PUBLIC (no auth required) to allow discovery. Hikvision calls many of the
+// other public ones during its initial camera probe too.
+// Only protected actions (streams, settings) need authentication.
+#define ONVIF_ACTION_LIST(ONVIF_ACTION) \
+    ONVIF_ACTION(AbsoluteMove,                        true,  handle_ptz_request,                  NULL) \
+    ONVIF_ACTION(ContinuousMove,                      true,  handle_ack,                          NULL) \
+    ONVIF_ACTION(GetAudioEncoderConfiguration,        false, NULL,                                TPL_AUDIO_CONFIG) \
+    ONVIF_ACTION(GetAudioEncoderConfigurationOptions, false, NULL,                                TPL_AUDIO_OPTIONS) \
+    ONVIF_ACTION(GetAudioEncoderConfigurations,       false, NULL,                                TPL_AUDIO_CONFIG) \
+    ONVIF_ACTION(GetCapabilities,                     false, handle_GetCapabilities,              NULL) \
+    ONVIF_ACTION(GetDNS,                              false, NULL,                                TPL_DNS) \
+    ONVIF_ACTION(GetDeviceInformation,                false, handle_GetDeviceInformation,         NULL) \
+    ONVIF_ACTION(GetHostname,                         false, NULL,                                TPL_HOSTNAME) \
+    ONVIF_ACTION(GetMoveOptions,                      false, handle_GetMoveOptions,               NULL) \
+    ONVIF_ACTION(GetNTP,                              false, NULL,                                TPL_NTP) \
+    ONVIF_ACTION(GetNetworkInterfaces,                false, handle_GetNetworkInterfaces,         NULL) \
+    ONVIF_ACTION(GetNetworkProtocols,                 false, NULL,                                TPL_NET_PROTOCOLS) \
+    ONVIF_ACTION(GetOSDOptions,                       false, NULL,                                TPL_OSD_OPTIONS) \
+    ONVIF_ACTION(GetOptions,                          false, NULL,                                TPL_IMAGING_OPTIONS) \
+    ONVIF_ACTION(GetProfiles,                         true,  handle_GetProfiles,                  NULL) \
+    ONVIF_ACTION(GetScopes,                           false, NULL,                                TPL_SCOPES) \
+    ONVIF_ACTION(GetServices,                         false, handle_GetServices,                  NULL) \
+    ONVIF_ACTION(GetSnapshotUri,                      true,  handle_GetSnapshotUri,               NULL) \
+    ONVIF_ACTION(GetStreamUri,                        true,  handle_GetStreamUri,                 NULL) \
+    ONVIF_ACTION(GetSystemDateAndTime,                false, handle_GetSystemDateAndTime,         NULL) \
+    ONVIF_ACTION(GetVideoAnalyticsConfigurations,     false, NULL,                                TPL_ANALYTICS_CONFIG) \
+    ONVIF_ACTION(GetVideoEncoderConfiguration,        true,  handle_GetVideoEncoderConfiguration, NULL) \
+    ONVIF_ACTION(GetVideoEncoderConfigurationOptions, false, NULL,                                TPL_VIDEO_OPTIONS) /* Needed for codec negotiation */ \
+    ONVIF_ACTION(GetVideoEncoderConfigurations,       true,  handle_GetVideoEncoderConfiguration, NULL) \
+    ONVIF_ACTION(GetVideoSources,                     true,  handle_GetVideoSources,              NULL) \
+    ONVIF_ACTION(SetImagingSettings,                  true,  handle_imaging_request,              NULL) \
+    ONVIF_ACTION(SetSynchronizationPoint,             false, NULL,                                TPL_SET_SYNC_POINT) \
+    ONVIF_ACTION(SetSystemDateAndTime,                true,  handle_set_time_request,             NULL) \
+    ONVIF_ACTION(SetVideoEncoderConfiguration,        true,  handle_ack,                          NULL) \
+    ONVIF_ACTION(Stop,                                true,  handle_ack,                          NULL)
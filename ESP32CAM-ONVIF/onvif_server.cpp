@@ -2,12 +2,17 @@
 #include "onvif_server.h"
 #include "rtsp_server.h"
 #include "camera_control.h"
+#include "esp_camera.h"
 #include <WiFiUdp.h>
 #include <WebServer.h>
 #include <time.h>
 #include "mbedtls/sha1.h"
 #include "mbedtls/base64.h"
 #include "config.h"
+#include "heap_tracker.h"
+#include "soap_reader.h"
+#include "onvif_actions.h"
+#include <atomic>
 
 WebServer onvifServer(ONVIF_PORT);
 WiFiUDP onvifUDP;
@@ -16,6 +21,25 @@ static bool _onvifEnabled = DEFAULT_ONVIF_ENABLED;
 bool onvif_is_enabled() { return _onvifEnabled; }
 void onvif_set_enabled(bool en) { _onvifEnabled = en; }
 
+static std::atomic<uint32_t> onvifAuthFailures(0);
+
+uint32_t onvif_auth_failures() { return onvifAuthFailures.load(std::memory_order_relaxed); }
+
+// RTP multicast as announced to NVRs (see RTSP_MULTICAST_* in config.h)
+#define ONVIF_STR_(x) #x
+#define ONVIF_STR(x) ONVIF_STR_(x)
+#if RTSP_MULTICAST_ENABLED
+    #define ONVIF_RTP_MULTICAST "true"
+    #define ONVIF_MULTICAST_CONFIG \
+        "<tt:Multicast><tt:Address><tt:Type>IPv4</tt:Type><tt:IPv4Address>" RTSP_MULTICAST_ADDR "</tt:IPv4Address></tt:Address>" \
+        "<tt:Port>" ONVIF_STR(RTSP_MULTICAST_PORT) "</tt:Port><tt:TTL>" ONVIF_STR(RTSP_MULTICAST_TTL) "</tt:TTL><tt:AutoStart>false</tt:AutoStart></tt:Multicast>"
+#else
+    #define ONVIF_RTP_MULTICAST "false"
+    #define ONVIF_MULTICAST_CONFIG \
+        "<tt:Multicast><tt:Address><tt:Type>IPv4</tt:Type><tt:IPv4Address>0.0.0.0</tt:IPv4Address></tt:Address>" \
+        "<tt:Port>0</tt:Port><tt:TTL>1</tt:TTL><tt:AutoStart>false</tt:AutoStart></tt:Multicast>"
+#endif
+
 const char PROGMEM PART_HEADER[] = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://www.w3.org/2003/05/soap-envelope\" ";
 const char PROGMEM PART_BODY[] = "<SOAP-ENV:Body>";
 const char PROGMEM PART_END[] = "</SOAP-ENV:Body></SOAP-ENV:Envelope>";
@@ -37,7 +61,7 @@ const char PROGMEM TPL_CAPABILITIES[] =
     "</tt:Device>"
     "<tt:Media>"
         "<tt:XAddr>http://%s:%d/onvif/device_service</tt:XAddr>"
-        "<tt:StreamingCapabilities><tt:RTPMulticast>false</tt:RTPMulticast><tt:RTP_TCP>true</tt:RTP_TCP><tt:RTP_RTSP_TCP>true</tt:RTP_RTSP_TCP></tt:StreamingCapabilities>"
+        "<tt:StreamingCapabilities><tt:RTPMulticast>" ONVIF_RTP_MULTICAST "</tt:RTPMulticast><tt:RTP_TCP>true</tt:RTP_TCP><tt:RTP_RTSP_TCP>true</tt:RTP_RTSP_TCP></tt:StreamingCapabilities>"
     "</tt:Media>"
     "<tt:Imaging><tt:XAddr>http://%s:%d/onvif/device_service</tt:XAddr></tt:Imaging>"
     "</tds:Capabilities>"
@@ -126,146 +150,117 @@ const char PROGMEM TPL_NET_PROTOCOLS[] =
     "</tds:GetNetworkProtocolsResponse>"
     "</SOAP-ENV:Body></SOAP-ENV:Envelope>";
 
-// Helper to base64 decode
-int base64_decode(String input, uint8_t *output) {
-    size_t olen;
-    mbedtls_base64_decode(output, 64, &olen, (const unsigned char *)input.c_str(), input.length());
-    return olen;
-}
-
-// Helper to base64 encode
-String base64_encode(uint8_t *data, size_t length) {
-    unsigned char output[128];
-    size_t olen;
-    mbedtls_base64_encode(output, sizeof(output), &olen, data, length);
-    return String((char *)output);
-}
-
-// WS-UsernameToken Verification
-bool verify_soap_header(String &soapReq) {
-    // 1. Check if Security Header exists
-    int secIdx = soapReq.indexOf("Security");
-    if (secIdx < 0) {
-        LOG_D("Auth: No Security header in request");
-        return false;
-    }
-
-    // 2. Extract Username
-    int userStart = soapReq.indexOf("<wsse:Username>", secIdx);
-    if (userStart < 0) {
+// SOAP Fault: code, subcode, reason
+const char PROGMEM TPL_SOAP_FAULT[] =
+    "xmlns:ter=\"http://www.onvif.org/ver10/error\">"
+    "<SOAP-ENV:Body><SOAP-ENV:Fault>"
+    "<SOAP-ENV:Code><SOAP-ENV:Value>%s</SOAP-ENV:Value>"
+    "<SOAP-ENV:Subcode><SOAP-ENV:Value>%s</SOAP-ENV:Value></SOAP-ENV:Subcode>"
+    "</SOAP-ENV:Code>"
+    "<SOAP-ENV:Reason><SOAP-ENV:Text xml:lang=\"en\">%s</SOAP-ENV:Text></SOAP-ENV:Reason>"
+    "</SOAP-ENV:Fault></SOAP-ENV:Body></SOAP-ENV:Envelope>";
+
+// WS-Discovery Probe Match: MAC address, IP, ONVIF port
+const char PROGMEM TPL_PROBE_MATCH[] =
+    "xmlns:SOAP-ENC=\"http://www.w3.org/2003/05/soap-encoding\" "
+    "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
+    "xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\">"
+    "<SOAP-ENV:Body>"
+    "<ProbeMatches xmlns=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\">"
+    "<ProbeMatch>"
+    "<EndpointReference><Address>urn:uuid:esp32-cam-onvif-%s</Address></EndpointReference>"
+    "<Types>dn:NetworkVideoTransmitter</Types>"
+    "<Scopes>onvif://www.onvif.org/type/Network_Video_Transmitter onvif://www.onvif.org/Profile/Streaming onvif://www.onvif.org/location/Office onvif://www.onvif.org/name/" DEVICE_MODEL " onvif://www.onvif.org/hardware/" DEVICE_HARDWARE_ID "</Scopes>"
+    "<XAddrs>http://%s:%d/onvif/device_service</XAddrs>"
+    "<MetadataVersion>1</MetadataVersion>"
+    "</ProbeMatch>"
+    "</ProbeMatches>"
+    "</SOAP-ENV:Body>"
+    "</SOAP-ENV:Envelope>";
+
+// WS-UsernameToken Verification, security is inside the Security header
+bool verify_soap_header(SoapReader *security) {
+    // 1. Extract the token fields in one pass, in whatever order the client sent them
+    static const char *const fields[] = { "Username", "Password", "Nonce", "Created" };
+    SoapStr token[4];
+    SoapReader r = *security;
+    soap_find_texts(&r, fields, token, 4);
+    const SoapStr &username = token[0], &digestBase64 = token[1], &nonceBase64 = token[2], &created = token[3];
+    if (!username.p) {
         LOG_E("Auth: No Username element found");
         return false;
     }
-    userStart += 15;
-    int userEnd = soapReq.indexOf("</wsse:Username>", userStart);
-    if (userEnd < 0) {
-        LOG_E("Auth: Malformed Username element");
-        return false;
-    }
-    String username = soapReq.substring(userStart, userEnd);
-    username.trim();
-    
-    if (username != WEB_USER) {
-        LOG_E("Auth: User mismatch. Expected: '" + String(WEB_USER) + "', Got: '" + username + "'");
+    if (!digestBase64.p) {
+        LOG_E("Auth: No Password element found");
         return false;
     }
-
-    // 3. Extract Password (Digest)
-    int passStart = soapReq.indexOf("<wsse:Password", secIdx); 
-    if (passStart < 0) {
-        LOG_E("Auth: No Password element found");
+    if (!nonceBase64.p) {
+        LOG_E("Auth: No Nonce element found");
         return false;
     }
-    passStart = soapReq.indexOf(">", passStart) + 1;
-    int passEnd = soapReq.indexOf("</wsse:Password>", passStart);
-    if (passEnd < 0) {
-        LOG_E("Auth: Malformed Password element");
+    if (!created.p) {
+        LOG_E("Auth: No Created timestamp found");
         return false;
     }
-    String digestBase64 = soapReq.substring(passStart, passEnd);
-    digestBase64.trim();
 
-    // 4. Extract Nonce
-    int nonceStart = soapReq.indexOf("<wsse:Nonce", secIdx);
-    if (nonceStart < 0) {
-        LOG_E("Auth: No Nonce element found");
-        return false;
+    // Debug output for troubleshooting, prints the password
+    if (ONVIF_DEBUG_SOAP) {
+        Serial.println("[DEBUG] Auth components:");
+        Serial.printf("  User: '%.*s'\n", (int) username.len, username.p);
+        Serial.printf("  Nonce: '%.*s'\n", (int) nonceBase64.len, nonceBase64.p);
+        Serial.printf("  Created: '%.*s'\n", (int) created.len, created.p);
+        Serial.println("  Password (config): '" WEB_PASS "'");
+        Serial.printf("  Digest (received): '%.*s'\n", (int) digestBase64.len, digestBase64.p);
     }
-    nonceStart = soapReq.indexOf(">", nonceStart) + 1;
-    int nonceEnd = soapReq.indexOf("</wsse:Nonce>", nonceStart);
-    if (nonceEnd < 0) {
-        LOG_E("Auth: Malformed Nonce element");
+
+    if (!soap_str_equals(username, WEB_USER)) {
+        if (DEBUG_MODE) {
+            Serial.printf("[ERROR] Auth: User mismatch. Expected: '%s', Got: '%.*s'\n",
+                          WEB_USER, (int) username.len, username.p);
+        }
         return false;
     }
-    String nonceBase64 = soapReq.substring(nonceStart, nonceEnd);
-    nonceBase64.trim();
 
-    // 5. Extract Created timestamp
-    int createdStart = soapReq.indexOf("<wsu:Created>", secIdx);
-    if (createdStart < 0) {
-        LOG_E("Auth: No Created timestamp found");
+    // 2. Verify Digest = Base64(SHA1(Base64Decode(Nonce) + Created + Password))
+    // Concatenate: nonce + created + password
+    uint8_t buffer[256];
+    size_t nonceLen = 0;
+    if (mbedtls_base64_decode(buffer, 64, &nonceLen, (const unsigned char *) nonceBase64.p, nonceBase64.len) != 0 ||
+        nonceLen == 0) {
+        LOG_E("Auth: Failed to decode nonce");
         return false;
     }
-    createdStart += 13;
-    int createdEnd = soapReq.indexOf("</wsu:Created>", createdStart);
-    if (createdEnd < 0) {
+    if (created.len + strlen(WEB_PASS) > sizeof(buffer) - nonceLen) {
         LOG_E("Auth: Malformed Created element");
         return false;
     }
-    String created = soapReq.substring(createdStart, createdEnd);
-    created.trim();
-    
-    // Debug output for troubleshooting (only in verbose mode)
-    if (DEBUG_LEVEL >= 3) {
-        Serial.println("[DEBUG] Auth components:");
-        Serial.println("  User: '" + username + "'");
-        Serial.println("  Nonce: '" + nonceBase64 + "'");
-        Serial.println("  Created: '" + created + "'");
-        Serial.println("  Password (config): '" + String(WEB_PASS) + "'");
-        Serial.println("  Digest (received): '" + digestBase64 + "'");
-    }
-    
-    // 6. Verify Digest = Base64(SHA1(Base64Decode(Nonce) + Created + Password))
-    uint8_t nonce[64];
-    memset(nonce, 0, sizeof(nonce));
-    int nonceLen = base64_decode(nonceBase64, nonce);
-    
-    if (nonceLen <= 0) {
-        LOG_E("Auth: Failed to decode nonce");
-        return false;
-    }
-    
-    // Concatenate: nonce + created + password
-    uint8_t buffer[256];  // Increased buffer size
-    size_t offset = 0;
-    memcpy(buffer + offset, nonce, nonceLen);
-    offset += nonceLen;
-    memcpy(buffer + offset, created.c_str(), created.length());
-    offset += created.length();
+    size_t offset = nonceLen;
+    memcpy(buffer + offset, created.p, created.len);
+    offset += created.len;
     memcpy(buffer + offset, WEB_PASS, strlen(WEB_PASS));
     offset += strlen(WEB_PASS);
-    
-    size_t totalLen = offset;
-    
+
     uint8_t sha1Result[20];
-    mbedtls_sha1(buffer, totalLen, sha1Result);
-    
-    String calculatedDigest = base64_encode(sha1Result, 20);
-    
+    mbedtls_sha1(buffer, offset, sha1Result);
+
+    unsigned char calculatedDigest[32];
+    size_t digestLen = 0;
+    mbedtls_base64_encode(calculatedDigest, sizeof(calculatedDigest), &digestLen, sha1Result, sizeof(sha1Result));
+
     if (DEBUG_LEVEL >= 3) {
-        Serial.println("  Digest (calculated): '" + calculatedDigest + "'");
+        Serial.printf("  Digest (calculated): '%.*s'\n", (int) digestLen, calculatedDigest);
     }
-    
+
     // Verify digest match
-    if (calculatedDigest.equals(digestBase64)) {
+    if (digestLen == digestBase64.len && memcmp(calculatedDigest, digestBase64.p, digestLen) == 0) {
          LOG_D("Auth: Digest verification successful");
          return true;
     }
-    
+
     LOG_E("Auth: Digest verification failed");
     if (DEBUG_LEVEL >= 2) {
-        Serial.println("  Expected: " + calculatedDigest);
-        Serial.println("  Got: " + digestBase64);
+        Serial.printf("  Expected: %.*s\n", (int) digestLen, calculatedDigest);
+        Serial.printf("  Got: %.*s\n", (int) digestBase64.len, digestBase64.p);
     }
     return false; 
 }
@@ -290,32 +285,25 @@ time_t timegm_impl(struct tm *tm) {
     return (total_days * 86400) + (tm->tm_hour * 3600) + (tm->tm_min * 60) + tm->tm_sec;
 }
 
-void handle_SetSystemDateAndTime(String &req) {
-    int container = req.indexOf("UTCDateTime");
-    if (container < 0) container = req.indexOf("DateTime"); // Fallback
-    
-    if (container > 0) {
+void handle_SetSystemDateAndTime(SoapReader *body) {
+    SoapToken container;
+    if (soap_find(body, "UTCDateTime", &container)) {
         int year = 0, month = 0, day = 0, hour = 0, min = 0, sec = 0;
         
-        // Robust Tag Parsing (Handles optional namespaces)
-        // Helper lambda to find value between tags
-        auto getVal = [&](String tag) -> int {
-            int start = req.indexOf("<" + tag + ">", container); // check <tag>
-            if(start < 0) start = req.indexOf(":" + tag + ">", container); // check :tag>
-            if(start > 0) {
-                int valStart = req.indexOf(">", start) + 1;
-                int valEnd = req.indexOf("<", valStart);
-                return req.substring(valStart, valEnd).toInt();
-            }
-            return 0;
+        // All fields in one pass over UTCDateTime, whatever the order of Date and Time
+        static const char *const tags[] = { "Year", "Month", "Day", "Hour", "Minute", "Second" };
+        SoapStr val[6];
+        soap_find_texts(body, tags, val, 6);
+        auto getVal = [&](int i) -> int {
+            return val[i].p ? soap_str_int(val[i]) : 0;
         };
         
-        year = getVal("Year");
-        month = getVal("Month");
-        day = getVal("Day");
-        hour = getVal("Hour");
-        min = getVal("Minute");
-        sec = getVal("Second");
+        year = getVal(0);
+        month = getVal(1);
+        day = getVal(2);
+        hour = getVal(3);
+        min = getVal(4);
+        sec = getVal(5);
 
         if(year > 2000) {
             struct tm tm;
@@ -348,16 +336,16 @@ void sendPROGMEM(WebServer &server, const char* content) {
 
 // Helper to send SOAP Fault
 void send_soap_fault(WebServer &server, const char* code, const char* subcode, const char* reason) {
-    String fault = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>";
-    fault += "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://www.w3.org/2003/05/soap-envelope\" xmlns:ter=\"http://www.onvif.org/ver10/error\">";
-    fault += "<SOAP-ENV:Body><SOAP-ENV:Fault>";
-    fault += "<SOAP-ENV:Code><SOAP-ENV:Value>" + String(code) + "</SOAP-ENV:Value>";
-    fault += "<SOAP-ENV:Subcode><SOAP-ENV:Value>" + String(subcode) + "</SOAP-ENV:Value></SOAP-ENV:Subcode>";
-    fault += "</SOAP-ENV:Code>";
-    fault += "<SOAP-ENV:Reason><SOAP-ENV:Text xml:lang=\"en\">" + String(reason) + "</SOAP-ENV:Text></SOAP-ENV:Reason>";
-    fault += "</SOAP-ENV:Fault></SOAP-ENV:Body></SOAP-ENV:Envelope>";
-    
-    server.send(500, "application/soap+xml", fault);
+    char *buffer = (char *) HEAP_ALLOC(HEAP_ONVIF, 1024);
+    if(buffer) {
+        snprintf_P(buffer, 1024, PART_HEADER);
+        size_t len = strlen(buffer);
+        snprintf_P(buffer + len, 1024 - len, TPL_SOAP_FAULT, code, subcode, reason);
+        server.send(500, "application/soap+xml", buffer);
+        heap_tracker_free(buffer);
+    } else {
+        server.send(500, "text/plain", "OOM");
+    }
 }
 
 // Optimized heap-less send for dynamic content
@@ -431,7 +419,7 @@ const char PROGMEM TPL_VIDEO_ENCODER_CONFIG_MAIN[] =
         "<tt:Quality>10</tt:Quality>"
         "<tt:RateControl><tt:FrameRateLimit>20</tt:FrameRateLimit><tt:EncodingInterval>1</tt:EncodingInterval><tt:BitrateLimit>4096</tt:BitrateLimit></tt:RateControl>"
         "<tt:JPEG><tt:Resolution><tt:Width>640</tt:Width><tt:Height>480</tt:Height></tt:Resolution></tt:JPEG>"
-        "<tt:Multicast><tt:Address><tt:Type>IPv4</tt:Type><tt:IPv4Address>0.0.0.0</tt:IPv4Address></tt:Address><tt:Port>0</tt:Port><tt:TTL>1</tt:TTL><tt:AutoStart>false</tt:AutoStart></tt:Multicast>"
+        ONVIF_MULTICAST_CONFIG
         "<tt:SessionTimeout>PT60S</tt:SessionTimeout>"
         "</trt:Configuration>"
     "</trt:GetVideoEncoderConfigurationResponse>"
@@ -449,7 +437,7 @@ const char PROGMEM TPL_VIDEO_ENCODER_CONFIG_SUB[] =
         "<tt:Quality>10</tt:Quality>"
         "<tt:RateControl><tt:FrameRateLimit>20</tt:FrameRateLimit><tt:EncodingInterval>1</tt:EncodingInterval><tt:BitrateLimit>4096</tt:BitrateLimit></tt:RateControl>"
         "<tt:JPEG><tt:Resolution><tt:Width>640</tt:Width><tt:Height>480</tt:Height></tt:Resolution></tt:JPEG>"
-        "<tt:Multicast><tt:Address><tt:Type>IPv4</tt:Type><tt:IPv4Address>0.0.0.0</tt:IPv4Address></tt:Address><tt:Port>0</tt:Port><tt:TTL>1</tt:TTL><tt:AutoStart>false</tt:AutoStart></tt:Multicast>"
+        ONVIF_MULTICAST_CONFIG
         "<tt:SessionTimeout>PT60S</tt:SessionTimeout>"
         "</trt:Configuration>"
     "</trt:GetVideoEncoderConfigurationResponse>"
@@ -469,6 +457,17 @@ const char PROGMEM TPL_HOSTNAME[] =
     "</tds:GetHostnameResponse>"
     "</SOAP-ENV:Body></SOAP-ENV:Envelope>";
 
+const char PROGMEM TPL_SCOPES[] = 
+    "xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\" xmlns:tt=\"http://www.onvif.org/ver10/schema\">"
+    "<SOAP-ENV:Body>"
+    "<tds:GetScopesResponse>"
+        "<tds:Scopes><tt:ScopeDef>Configurable</tt:ScopeDef><tt:ScopeItem>onvif://www.onvif.org/name/" DEVICE_MODEL "</tt:ScopeItem></tds:Scopes>"
+        "<tds:Scopes><tt:ScopeDef>Fixed</tt:ScopeDef><tt:ScopeItem>onvif://www.onvif.org/type/Network_Video_Transmitter</tt:ScopeItem></tds:Scopes>"
+        "<tds:Scopes><tt:ScopeDef>Fixed</tt:ScopeDef><tt:ScopeItem>onvif://www.onvif.org/hardware/" DEVICE_HARDWARE_ID "</tt:ScopeItem></tds:Scopes>"
+        "<tds:Scopes><tt:ScopeDef>Configurable</tt:ScopeDef><tt:ScopeItem>onvif://www.onvif.org/location/Office</tt:ScopeItem></tds:Scopes>"
+    "</tds:GetScopesResponse>"
+    "</SOAP-ENV:Body></SOAP-ENV:Envelope>";
+
 // Audio Stubs (Empty to prevent errors)
 // Imaging Options (Brightness/Contrast/Saturation)
 const char PROGMEM TPL_IMAGING_OPTIONS[] = 
@@ -590,7 +589,7 @@ const char PROGMEM TPL_NETWORK_INTERFACES[] =
     "</tds:GetNetworkInterfacesResponse>"
     "</SOAP-ENV:Body></SOAP-ENV:Envelope>";
 
-void handle_GetCapabilities() {
+void handle_GetCapabilities(SoapReader *body) {
     String ip = WiFi.localIP().toString();
     
     LOG_D("Sending GetCapabilities response");
@@ -628,7 +627,7 @@ void handle_GetCapabilities() {
             "<tt:Media>"
                 "<tt:XAddr>http://%s:%d/onvif/device_service</tt:XAddr>"
                 "<tt:StreamingCapabilities>"
-                    "<tt:RTPMulticast>false</tt:RTPMulticast>"
+                    "<tt:RTPMulticast>" ONVIF_RTP_MULTICAST "</tt:RTPMulticast>"
                     "<tt:RTP_TCP>true</tt:RTP_TCP>"
                     "<tt:RTP_RTSP_TCP>true</tt:RTP_RTSP_TCP>"
                 "</tt:StreamingCapabilities>"
@@ -655,17 +654,23 @@ void handle_GetCapabilities() {
     }
 }
 
-void handle_GetStreamUri() {
+void handle_GetStreamUri(SoapReader *body) {
+    // The same URI serves both modes, the client picks multicast in RTSP SETUP
+    SoapStr stream;
+    if (soap_find_text(body, "Stream", &stream) && soap_str_equals(stream, "RTP-Multicast") && !RTSP_MULTICAST_ENABLED) {
+        send_soap_fault(onvifServer, "env:Sender", "ter:InvalidArgVal", "RTP multicast is disabled");
+        return;
+    }
     sendDynamicPROGMEM(onvifServer, TPL_STREAM_URI, WiFi.localIP().toString().c_str(), RTSP_PORT);
 }
 
-void handle_GetSystemDateAndTime() {
+void handle_GetSystemDateAndTime(SoapReader *body) {
     time_t now;
     struct tm timeinfo;
     time(&now);
     gmtime_r(&now, &timeinfo);
     
-    char *buffer = new char[1024];
+    char *buffer = (char *) HEAP_ALLOC(HEAP_ONVIF, 1024);
     if(buffer) {
         snprintf_P(buffer, 1024, PART_HEADER);
         size_t len = strlen(buffer);
@@ -675,7 +680,7 @@ void handle_GetSystemDateAndTime() {
             timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday);
             
         onvifServer.send(200, "application/soap+xml", buffer);
-        delete[] buffer;
+        heap_tracker_free(buffer);
     } else {
         onvifServer.send(500, "text/plain", "OOM");
     }
@@ -690,12 +695,12 @@ void handle_GetSystemDateAndTime() {
 // Simple parser for SetImagingSettings
 // We look for <tt:IrCutFilterMode>OFF</tt:IrCutFilterMode> to turn on 'Night Mode' (Flash ON)
 // and ON or AUTO for 'Day Mode' (Flash OFF)
-void handle_set_imaging_settings(String &req) {
+void handle_set_imaging_settings(SoapReader *body) {
     if (!FLASH_LED_ENABLED) return;
     
-    // Very basic string parsing as XML parsing is heavy
-    if (req.indexOf("IrCutFilterMode") > 0) {
-        if (req.indexOf(">OFF<") > 0) {
+    SoapStr mode;
+    if (soap_find_text(body, "IrCutFilterMode", &mode)) {
+        if (soap_str_equals(mode, "OFF")) {
             // Night mode -> Flash ON
             set_flash_led(true);
             LOG_I("Night Mode: ON (Flash)");
@@ -709,171 +714,32 @@ void handle_set_imaging_settings(String &req) {
 
 
 
-void handle_ptz(String &req) {
+// AbsoluteMove: <tptz:Position><tt:PanTilt x="0.5" y="0.5" space="..."/></tptz:Position>
+void handle_ptz(SoapReader *body) {
    #if PTZ_ENABLED
-   // AbsoluteMove
-   // <tptz:Vector PanTilt="x" y="0.5"/>
-   // Simplified parsing: find PanTilt space x=" and y="
-   // This is fragile but suffices for minimal SOAP
+   float x = 0.5f; 
+   float y = 0.5f;
    
-   if (req.indexOf("AbsoluteMove") > 0) {
-       // Look for x="0.5" y="0.5" or similar
-       // Or PanTilt x="0.5" y="0.5"
-       // Actually ONVIF usually sends: <tt:PanTilt x="0.5" y="0.5" ... />
-       
-       float x = 0.5f; 
-       float y = 0.5f;
-       
-       int xIdx = req.indexOf("x=\"");
-       if (xIdx > 0) {
-           int endQ = req.indexOf("\"", xIdx + 3);
-           String val = req.substring(xIdx + 3, endQ);
-           x = val.toFloat();
-       }
-       
-       int yIdx = req.indexOf("y=\"");
-       if (yIdx > 0) {
-           int endQ = req.indexOf("\"", yIdx + 3);
-           String val = req.substring(yIdx + 3, endQ);
-           y = val.toFloat();
-       }
-       
-       // ONVIF uses -1 to 1. Map to 0 to 1.
-       // x = (x + 1.0) / 2.0;
-       // y = (y + 1.0) / 2.0; 
-       // NOTE: Some NVRs assume 0..1, others -1..1. 
-       // Let's assume -1..1 for standard ONVIF PTZ vectors.
-       
-       float finalX = (x + 1.0f) / 2.0f;
-       float finalY = (y + 1.0f) / 2.0f;
-       
-       ptz_set_absolute(finalX, finalY);
-       Serial.printf("[INFO] PTZ Move: x=%.2f y=%.2f -> servo=%.2f, %.2f\n", x, y, finalX, finalY);
+   SoapToken panTilt;
+   if (soap_find(body, "PanTilt", &panTilt)) {
+       SoapStr val;
+       if (soap_attr(&panTilt, "x", &val)) x = soap_str_float(val);
+       if (soap_attr(&panTilt, "y", &val)) y = soap_str_float(val);
    }
+   
+   // ONVIF uses -1 to 1. Map to 0 to 1.
+   // NOTE: Some NVRs assume 0..1, others -1..1. 
+   // Let's assume -1..1 for standard ONVIF PTZ vectors.
+   
+   float finalX = (x + 1.0f) / 2.0f;
+   float finalY = (y + 1.0f) / 2.0f;
+   
+   ptz_set_absolute(finalX, finalY);
+   Serial.printf("[INFO] PTZ Move: x=%.2f y=%.2f -> servo=%.2f, %.2f\n", x, y, finalX, finalY);
    #endif
 }
 
-// Note: Some NVRs will fail Probe/Discovery if authentication is required for simple gets.
-// ONVIF Specification: GetCapabilities, GetServices, GetSystemDateAndTime, GetDeviceInformation
-// should be PUBLIC (no auth required) to allow discovery.
-// Only protected actions like GetStreamUri, GetProfiles need authentication.
-void handle_onvif_soap() {
-  String req = onvifServer.arg(0);
-  
-  // Detect action first for proper logging and auth decisions
-  String action = "Unknown";
-  if (req.indexOf("GetSystemDateAndTime") > 0) action = "GetSystemDateAndTime";
-  else if (req.indexOf("SetSystemDateAndTime") > 0) action = "SetSystemDateAndTime";
-  else if (req.indexOf("SetSynchronizationPoint") > 0) action = "SetSynchronizationPoint";
-  else if (req.indexOf("GetCapabilities") > 0) action = "GetCapabilities";
-  else if (req.indexOf("GetServices") > 0) action = "GetServices";
-  else if (req.indexOf("GetDeviceInformation") > 0) action = "GetDeviceInformation";
-  else if (req.indexOf("GetProfiles") > 0) action = "GetProfiles";
-  else if (req.indexOf("GetStreamUri") > 0) action = "GetStreamUri";
-  else if (req.indexOf("GetSnapshotUri") > 0) action = "GetSnapshotUri";
-  else if (req.indexOf("GetVideoSources") > 0) action = "GetVideoSources";
-  else if (req.indexOf("GetVideoEncoderConfigurationOptions") > 0) action = "GetVideoOptions";
-  else if (req.indexOf("GetVideoEncoderConfiguration") > 0) action = "GetVideoConfig";
-  else if (req.indexOf("GetAudioEncoderConfiguration") > 0) action = "GetAudioConfig";
-  else if (req.indexOf("SetVideoEncoderConfiguration") > 0) action = "SetVideoConfig";
-  else if (req.indexOf("GetNetworkInterfaces") > 0) action = "GetNetworkInterfaces";
-  else if (req.indexOf("GetNetworkProtocols") > 0) action = "GetNetworkProtocols";
-  else if (req.indexOf("GetScopes") > 0) action = "GetScopes";
-  else if (req.indexOf("GetHostname") > 0) action = "GetHostname";
-  else if (req.indexOf("GetDNS") > 0) action = "GetDNS";
-  else if (req.indexOf("GetNTP") > 0) action = "GetNTP";
-  else if (req.indexOf("GetOSDOptions") > 0) action = "GetOSDOptions";
-  else if (req.indexOf("GetMoveOptions") > 0) action = "GetMoveOptions";
-  else if (req.indexOf("GetVideoAnalyticsConfigurations") > 0) action = "GetAnalyticsConfig";
-  else if (req.indexOf("GetOptions") > 0 && req.indexOf("VideoSourceToken") > 0) action = "GetImagingOptions";
-  else if (req.indexOf("SetImagingSettings") > 0) action = "SetImagingSettings";
-  else if (req.indexOf("AbsoluteMove") > 0 || req.indexOf("ContinuousMove") > 0 || req.indexOf("Stop") > 0) action = "PTZ";
-  
-  // PUBLIC actions (no auth required per ONVIF spec)
-  // These are needed for device discovery and initial handshake
-  // Hikvision calls many of these during initial camera probe
-  bool isPublicAction = (
-      action == "GetCapabilities" ||
-      action == "GetServices" ||
-      action == "GetSystemDateAndTime" ||
-      action == "GetDeviceInformation" ||
-      action == "GetScopes" ||
-      action == "GetHostname" ||
-      action == "GetNetworkInterfaces" ||
-      action == "GetNetworkProtocols" ||
-      action == "GetDNS" ||
-      action == "GetNTP" ||
-      action == "GetVideoOptions" ||   // Needed for codec negotiation
-      action == "GetAudioConfig"       // Usually empty, safe to expose
-  );
-  
-  // PROTECTED actions (require authentication)
-  // These provide access to actual streams or modify settings
-  bool isProtectedAction = (
-      action == "GetStreamUri" || 
-      action == "GetProfiles" || 
-      action == "SetSystemDateAndTime" ||
-      action == "GetVideoSources" ||
-      action == "GetVideoConfig" ||
-      action == "GetSnapshotUri" ||
-      action == "SetVideoConfig" ||
-      action == "SetImagingSettings" ||
-      action == "PTZ"
-  );
-  
-  // Check if request contains Security header
-  bool hasSecurity = (req.indexOf("Security") > 0);
-  
-  // Authentication logic:
-  // 1. If Security header is present, we MUST verify it (even for public actions)
-  // 2. If action is protected but no Security header, require auth
-  // 3. If action is public and no Security header, allow through
-  
-  if (hasSecurity) {
-      // Request has auth header - verify it
-      if (!verify_soap_header(req)) {
-          LOG_E("Auth Failed for: " + action);
-          if (DEBUG_LEVEL >= 3) {
-              // Verbose: show why auth failed
-              int secIdx = req.indexOf("Security");
-              int userIdx = req.indexOf("wsse:Username");
-              int passIdx = req.indexOf("wsse:Password");
-              Serial.printf("[DEBUG] Security header at %d, Username at %d, Password at %d\n", 
-                           secIdx, userIdx, passIdx);
-          }
-          send_soap_fault(onvifServer, "env:Sender", "ter:NotAuthorized", "Authentication failed");
-          return;
-      }
-      LOG_D("Auth OK for: " + action);
-  } else if (isProtectedAction) {
-      // Protected action without auth - reject
-      LOG_E("Auth Required for: " + action + " (no credentials provided)");
-      send_soap_fault(onvifServer, "env:Sender", "ter:NotAuthorized", "Authentication required");
-      return;
-  }
-  // Public action without auth - allow through
-  
-  LOG_I("ONVIF: " + action);
-
-  // Handle unknown actions with debug output
-  if (action == "Unknown") {
-      // Find the Body tag to show relevant info without header spam
-      int bodyIdx = req.indexOf("<SOAP-ENV:Body>");
-      if (bodyIdx == -1) bodyIdx = req.indexOf("Body>");
-      
-      Serial.println("[DEBUG] UNKNOWN ACTION BODY:");
-      if (bodyIdx > 0) {
-          Serial.println(req.substring(bodyIdx)); 
-      } else {
-          Serial.println(req); 
-      }
-  }
-
-  if (req.indexOf("GetCapabilities") > 0) {
-    handle_GetCapabilities();
-  } else if (req.indexOf("GetStreamUri") > 0) {
-    handle_GetStreamUri();
-  } else if (req.indexOf("GetSnapshotUri") > 0) {
+static void handle_GetSnapshotUri(SoapReader *body) {
     // Send dynamic Snapshot URI pointing to /snapshot
     const char PROGMEM TPL_SNAPSHOT_URI[] = 
     "xmlns:trt=\"http://www.onvif.org/ver10/media/wsdl\" xmlns:tt=\"http://www.onvif.org/ver10/schema\">"
@@ -889,12 +755,14 @@ void handle_onvif_soap() {
     "</SOAP-ENV:Body></SOAP-ENV:Envelope>";
     
     sendDynamicPROGMEM(onvifServer, TPL_SNAPSHOT_URI, WiFi.localIP().toString().c_str(), WEB_PORT);
-  } else if (req.indexOf("GetDeviceInformation") > 0) {
+}
+
+static void handle_GetDeviceInformation(SoapReader *body) {
     // Dynamically insert MAC address as Serial Number for better NVR compatibility
-    sendDynamicPROGMEM(onvifServer, TPL_DEV_INFO, WiFi.macAddress().c_str(), 0); 
-  } else if (req.indexOf("GetSystemDateAndTime") > 0) {
-    handle_GetSystemDateAndTime();
-  } else if (req.indexOf("GetServices") > 0) {
+    sendDynamicPROGMEM(onvifServer, TPL_DEV_INFO, WiFi.macAddress().c_str(), 0);
+}
+
+static void handle_GetServices(SoapReader *body) {
     onvifServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
     onvifServer.send(200, "application/soap+xml", "");
     
@@ -915,8 +783,9 @@ void handle_onvif_soap() {
     "</tds:GetServicesResponse>"
     "</SOAP-ENV:Body></SOAP-ENV:Envelope>"), ip.c_str(), ONVIF_PORT);
     onvifServer.sendContent(buffer);
+}
 
-  } else if (req.indexOf("GetProfiles") > 0) {
+static void handle_GetProfiles(SoapReader *body) {
      LOG_D("Sending GetProfiles response");
      
      char buffer[1800];
@@ -963,12 +832,7 @@ void handle_onvif_soap() {
                         "<tt:GovLength>30</tt:GovLength>"
                         "<tt:H264Profile>Baseline</tt:H264Profile>"
                     "</tt:H264>"
-                    "<tt:Multicast>"
-                        "<tt:Address><tt:Type>IPv4</tt:Type><tt:IPv4Address>0.0.0.0</tt:IPv4Address></tt:Address>"
-                        "<tt:Port>0</tt:Port>"
-                        "<tt:TTL>1</tt:TTL>"
-                        "<tt:AutoStart>false</tt:AutoStart>"
-                    "</tt:Multicast>"
+                    ONVIF_MULTICAST_CONFIG
                     "<tt:SessionTimeout>PT60S</tt:SessionTimeout>"
                 "</tt:VideoEncoderConfiguration>"
             "</trt:Profiles>"
@@ -1007,12 +871,7 @@ void handle_onvif_soap() {
                         "<tt:EncodingInterval>1</tt:EncodingInterval>"
                         "<tt:BitrateLimit>4096</tt:BitrateLimit>"
                     "</tt:RateControl>"
-                    "<tt:Multicast>"
-                        "<tt:Address><tt:Type>IPv4</tt:Type><tt:IPv4Address>0.0.0.0</tt:IPv4Address></tt:Address>"
-                        "<tt:Port>0</tt:Port>"
-                        "<tt:TTL>1</tt:TTL>"
-                        "<tt:AutoStart>false</tt:AutoStart>"
-                    "</tt:Multicast>"
+                    ONVIF_MULTICAST_CONFIG
                     "<tt:SessionTimeout>PT60S</tt:SessionTimeout>"
                 "</tt:VideoEncoderConfiguration>"
             "</trt:Profiles>"
@@ -1028,9 +887,9 @@ void handle_onvif_soap() {
          LOG_E("GetProfiles buffer overflow!");
          onvifServer.send(500, "text/plain", "Buffer overflow");
      }
+}
 
-
-  } else if (req.indexOf("GetVideoSources") > 0) {
+static void handle_GetVideoSources(SoapReader *body) {
     // Inject current Sensor values
     sensor_t * s = esp_camera_sensor_get();
     // Map -2..2 to 0..100 or similar if needed, but ONVIF is often 0..100.
@@ -1042,28 +901,31 @@ void handle_onvif_soap() {
     // Saturation
     int sa = (s->status.saturation + 2) * 25;
 
-    char *buffer = new char[2048];
+    char *buffer = (char *) HEAP_ALLOC(HEAP_ONVIF, 2048);
     if(buffer) {
         snprintf_P(buffer, 2048, PART_HEADER);
         size_t len = strlen(buffer);
         snprintf_P(buffer + len, 2048 - len, TPL_VIDEO_SOURCES, br, sa, cn);
         onvifServer.send(200, "application/soap+xml", buffer);
-        delete[] buffer;
+        heap_tracker_free(buffer);
     } else {
         onvifServer.send(500, "text/plain", "OOM");
     }
-  } else if (req.indexOf("GetVideoEncoderConfigurationOptions") > 0) {
-    sendFixedPROGMEM(onvifServer, TPL_VIDEO_OPTIONS);
-  } else if (req.indexOf("GetVideoEncoderConfiguration") > 0) {
-    if (req.indexOf("VideoEncoderToken_Sub") > 0) {
+}
+
+static void handle_GetVideoEncoderConfiguration(SoapReader *body) {
+    SoapStr token;
+    if (soap_find_text(body, "ConfigurationToken", &token) && soap_str_equals(token, "VideoEncoderToken_Sub")) {
         sendFixedPROGMEM(onvifServer, TPL_VIDEO_ENCODER_CONFIG_SUB);
     } else {
         // Default to Main if unspecified or Main
         sendFixedPROGMEM(onvifServer, TPL_VIDEO_ENCODER_CONFIG_MAIN);
     }
-  } else if (req.indexOf("GetNetworkInterfaces") > 0) {
+}
+
+static void handle_GetNetworkInterfaces(SoapReader *body) {
     // Pass MAC and IP to the template
-    char *buffer = new char[2048];
+    char *buffer = (char *) HEAP_ALLOC(HEAP_ONVIF, 2048);
     if(buffer) {
         snprintf_P(buffer, 2048, PART_HEADER); 
         size_t len = strlen(buffer);
@@ -1071,62 +933,181 @@ void handle_onvif_soap() {
             WiFi.macAddress().c_str(), 
             WiFi.localIP().toString().c_str());
         onvifServer.send(200, "application/soap+xml", buffer);
-        delete[] buffer;
+        heap_tracker_free(buffer);
     } else {
         onvifServer.send(500, "text/plain", "OOM");
     }
-  } else if (req.indexOf("GetAudioEncoderConfigurationOptions") > 0) {
-    sendFixedPROGMEM(onvifServer, TPL_AUDIO_OPTIONS); // Return empty options
-  } else if (req.indexOf("GetAudioEncoderConfiguration") > 0) {
-     // Return empty or fault? Empty list is safer for "Not Supported"
-     sendFixedPROGMEM(onvifServer, TPL_AUDIO_CONFIG);
-  } else if (req.indexOf("GetOSDOptions") > 0) {
-     sendFixedPROGMEM(onvifServer, TPL_OSD_OPTIONS);
-  } else if (req.indexOf("GetVideoAnalyticsConfigurations") > 0) {
-     sendFixedPROGMEM(onvifServer, TPL_ANALYTICS_CONFIG);
-  } else if (req.indexOf("GetVideoAnalyticsConfigurations") > 0) {
-     sendFixedPROGMEM(onvifServer, TPL_ANALYTICS_CONFIG);
-  } else if (req.indexOf("GetOptions") > 0 && req.indexOf("VideoSourceToken") > 0) {
-     sendFixedPROGMEM(onvifServer, TPL_IMAGING_OPTIONS);
-  } else if (req.indexOf("GetScopes") > 0) {
-     const char PROGMEM TPL_SCOPES[] = 
-     "xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\" xmlns:tt=\"http://www.onvif.org/ver10/schema\">"
-     "<SOAP-ENV:Body>"
-     "<tds:GetScopesResponse>"
-         "<tds:Scopes><tt:ScopeDef>Configurable</tt:ScopeDef><tt:ScopeItem>onvif://www.onvif.org/name/" DEVICE_MODEL "</tt:ScopeItem></tds:Scopes>"
-         "<tds:Scopes><tt:ScopeDef>Fixed</tt:ScopeDef><tt:ScopeItem>onvif://www.onvif.org/type/Network_Video_Transmitter</tt:ScopeItem></tds:Scopes>"
-         "<tds:Scopes><tt:ScopeDef>Fixed</tt:ScopeDef><tt:ScopeItem>onvif://www.onvif.org/hardware/" DEVICE_HARDWARE_ID "</tt:ScopeItem></tds:Scopes>"
-         "<tds:Scopes><tt:ScopeDef>Configurable</tt:ScopeDef><tt:ScopeItem>onvif://www.onvif.org/location/Office</tt:ScopeItem></tds:Scopes>"
-     "</tds:GetScopesResponse>"
-     "</SOAP-ENV:Body></SOAP-ENV:Envelope>";
-     sendFixedPROGMEM(onvifServer, TPL_SCOPES);
-  } else if (req.indexOf("GetHostname") > 0) {
-     sendFixedPROGMEM(onvifServer, TPL_HOSTNAME);
-  } else if (req.indexOf("SetSystemDateAndTime") > 0) {
-    handle_SetSystemDateAndTime(req);
+}
+
+static void handle_GetMoveOptions(SoapReader *body) {
+    // Imaging service (focus) if it names a video source, PTZ otherwise
+    SoapToken token;
+    if (soap_find(body, "VideoSourceToken", &token)) {
+        sendFixedPROGMEM(onvifServer, TPL_IMAGING_MOVE_OPTIONS);
+    } else {
+        sendFixedPROGMEM(onvifServer, TPL_MOVE_OPTIONS);
+    }
+}
+
+static void handle_set_time_request(SoapReader *body) {
+    handle_SetSystemDateAndTime(body);
     sendFixedPROGMEM(onvifServer, TPL_SET_TIME_RES);
-  } else if (req.indexOf("SetImagingSettings") > 0 || req.indexOf("SetVideoEncoderConfiguration") > 0) {
-    // Acknowledge setting commands with OK (we ignore the actual values to enforce stability)
-    onvifServer.send(200, "application/soap+xml", "<ok/>"); 
-  } else if (req.indexOf("GetDNS") > 0) {
-     sendFixedPROGMEM(onvifServer, TPL_DNS);
-  } else if (req.indexOf("GetNTP") > 0) {
-     sendFixedPROGMEM(onvifServer, TPL_NTP);
-  } else if (req.indexOf("GetNetworkProtocols") > 0) {
-     sendFixedPROGMEM(onvifServer, TPL_NET_PROTOCOLS);
-  } else if (req.indexOf("GetMoveOptions") > 0) {
-      if (req.indexOf("VideoSourceToken") > 0) {
-          sendFixedPROGMEM(onvifServer, TPL_IMAGING_MOVE_OPTIONS);
+}
+
+static void handle_imaging_request(SoapReader *body) {
+    handle_set_imaging_settings(body);
+    onvifServer.send(200, "application/soap+xml", "<ok/>");
+}
+
+static void handle_ptz_request(SoapReader *body) {
+    handle_ptz(body);
+    onvifServer.send(200, "application/soap+xml", "<ok/>");
+}
+
+// Acknowledge setting commands with OK (we ignore the actual values to enforce stability)
+static void handle_ack(SoapReader *body) {
+    onvifServer.send(200, "application/soap+xml", "<ok/>");
+}
+
+// One SOAP action of ONVIF_ACTION_LIST (onvif_actions.h)
+struct OnvifAction {
+    const char *name;
+    bool auth;                              // Protected
+    void (*handler)(SoapReader *body);      // Reader inside the action element
+    const char *tpl;                        // PROGMEM, for handler == NULL
+    std::atomic<uint32_t> requests;         // Since boot, for /metrics
+};
+
+#define ONVIF_ACTION_ENTRY(name, auth, handler, tpl) { #name, auth, handler, tpl },
+static OnvifAction onvifActions[] = {
+    ONVIF_ACTION_LIST(ONVIF_ACTION_ENTRY)
+};
+#undef ONVIF_ACTION_ENTRY
+#define ONVIF_ACTIONS ((int) (sizeof(onvifActions) / sizeof(onvifActions[0])))
+static std::atomic<uint32_t> onvifUnknownRequests(0);
+
+int onvif_action_count() { return ONVIF_ACTIONS + 1; }
+const char *onvif_action_name(int i) { return i < ONVIF_ACTIONS ? onvifActions[i].name : "Unknown"; }
+uint32_t onvif_action_requests(int i) {
+    const std::atomic<uint32_t> &n = i < ONVIF_ACTIONS ? onvifActions[i].requests : onvifUnknownRequests;
+    return n.load(std::memory_order_relaxed);
+}
+
+static OnvifAction *onvif_find_action(const SoapStr &name) {
+    return soap_lookup(onvifActions, ONVIF_ACTIONS, name);
+}
+
+// The request body is read straight from the connection into a static
+// buffer (the WebServer would keep it as a String arg otherwise, and
+// arg() copies it once more). Requests are handled one at a time from
+// onvif_server_loop().
+static char soapRequest[ONVIF_MAX_REQUEST];
+static size_t soapRequestLen = 0;
+static bool soapRequestOversized = false;
+static OnvifParseStats parseStats;
+
+void onvif_parse_stats(OnvifParseStats *stats) { *stats = parseStats; }
+
+static void handle_onvif_raw() {
+  HTTPRaw &raw = onvifServer.raw();
+  if (raw.status == RAW_START || raw.status == RAW_ABORTED) {
+      soapRequestLen = 0;
+      soapRequestOversized = false;
+  } else if (raw.status == RAW_WRITE) {
+      size_t n = raw.currentSize;
+      if (n > sizeof(soapRequest) - 1 - soapRequestLen) {
+          n = sizeof(soapRequest) - 1 - soapRequestLen;
+          soapRequestOversized = true;
+      }
+      memcpy(soapRequest + soapRequestLen, raw.buf, n);
+      soapRequestLen += n;
+  }
+  soapRequest[soapRequestLen] = 0;
+}
+
+void handle_onvif_soap() {
+  // Form-encoded posts don't go through handle_onvif_raw()
+  if (soapRequestLen == 0 && !soapRequestOversized && onvifServer.args() > 0) {
+      String arg = onvifServer.arg(0);
+      if (arg.length() < sizeof(soapRequest)) {
+          memcpy(soapRequest, arg.c_str(), arg.length() + 1);
+          soapRequestLen = arg.length();
       } else {
-          sendFixedPROGMEM(onvifServer, TPL_MOVE_OPTIONS);
+          soapRequestOversized = true;
       }
-  } else if (req.indexOf("SetSynchronizationPoint") > 0) {
-      sendFixedPROGMEM(onvifServer, TPL_SET_SYNC_POINT);
-  } else if (req.indexOf("AbsoluteMove") > 0 || req.indexOf("ContinuousMove") > 0 || req.indexOf("Stop") > 0) {
-    handle_ptz(req);
-    onvifServer.send(200, "application/soap+xml", "<ok/>");
+  }
+  size_t len = soapRequestLen;
+  bool oversized = soapRequestOversized;
+  soapRequestLen = 0;
+  soapRequestOversized = false;
+
+  parseStats.requests++;
+  if (len > parseStats.maxRequestBytes) parseStats.maxRequestBytes = len;
+  if (oversized) {
+      parseStats.oversized++;
+      LOG_E("ONVIF request larger than " + String(ONVIF_MAX_REQUEST) + " bytes");
+      send_soap_fault(onvifServer, "env:Sender", "ter:InvalidArgs", "Request too large");
+      return;
+  }
+  uint32_t parseStart = micros();
+
+  // Detect action first for proper logging and auth decisions
+  SoapReader envelope, body, security;
+  soap_reader_init(&envelope, soapRequest, len);
+  SoapToken bodyTag, actionTag, securityTag;
+  body = envelope;
+  bool hasBody = soap_find(&body, "Body", &bodyTag) && !bodyTag.empty && soap_find(&body, NULL, &actionTag);
+  OnvifAction *action = hasBody ? onvif_find_action(actionTag.name) : NULL;
+  if (action) action->requests.fetch_add(1, std::memory_order_relaxed);
+  else onvifUnknownRequests.fetch_add(1, std::memory_order_relaxed);
+  char actionName[48];
+  if (hasBody) snprintf(actionName, sizeof(actionName), "%.*s", (int) actionTag.name.len, actionTag.name.p);
+  else strcpy(actionName, "Unknown");
+  
+  // Check if request contains Security header
+  security = envelope;
+  bool hasSecurity = soap_find(&security, "Header", &securityTag) && soap_find(&security, "Security", &securityTag);
+  
+  // Authentication logic:
+  // 1. If Security header is present, we MUST verify it (even for public actions)
+  // 2. If action is protected but no Security header, require auth
+  // 3. If action is public and no Security header, allow through
+  
+  bool authFailed = hasSecurity && !verify_soap_header(&security);
+  parseStats.lastParseUs = micros() - parseStart;
+  if (parseStats.lastParseUs > parseStats.maxParseUs) parseStats.maxParseUs = parseStats.lastParseUs;
+
+  if (authFailed) {
+      // Request has auth header and it didn't verify
+      onvifAuthFailures.fetch_add(1, std::memory_order_relaxed);
+      LOG_E("Auth Failed for: " + String(actionName));
+      send_soap_fault(onvifServer, "env:Sender", "ter:NotAuthorized", "Authentication failed");
+      return;
+  } else if (hasSecurity) {
+      LOG_D("Auth OK for: " + String(actionName));
+  } else if (action && action->auth) {
+      // Protected action without auth - reject
+      onvifAuthFailures.fetch_add(1, std::memory_order_relaxed);
+      LOG_E("Auth Required for: " + String(actionName) + " (no credentials provided)");
+      send_soap_fault(onvifServer, "env:Sender", "ter:NotAuthorized", "Authentication required");
+      return;
+  }
+  // Public action without auth - allow through
+  
+  LOG_I("ONVIF: " + String(actionName));
+
+  // Handle unknown actions, with the request on Serial to see what to implement
+  if (!action) {
+      if (ONVIF_DEBUG_SOAP) {
+          // Show the Body to skip the header spam
+          Serial.println("[DEBUG] UNKNOWN ACTION BODY:");
+          Serial.println(hasBody ? bodyTag.start : soapRequest);
+      }
+      onvifServer.send(200, "application/soap+xml", "<ok/>");
+  } else if (action->handler) {
+      action->handler(&body);
   } else {
-    onvifServer.send(200, "application/soap+xml", "<ok/>");
+      sendFixedPROGMEM(onvifServer, action->tpl);
   }
 }
 
@@ -1134,41 +1115,33 @@ void handle_onvif_discovery() {
   int packetSize = onvifUDP.parsePacket();
   if (packetSize) {
     char packet[1024];
-    int len = onvifUDP.read(packet, 1024);
+    int len = onvifUDP.read(packet, sizeof(packet) - 1);
     if(len > 0) {
         packet[len] = 0;
         // Optimization: Use strstr on buffer instead of allocating String object
         if (strstr(packet, "Probe") != nullptr) {
-          String ip = WiFi.localIP().toString();
-      
       // WS-Discovery Probe Match Response
       // This is the CRITICAL packet for NVRs to find the camera.
       // - RelatesTo: Should match the MessageID of the Probe (omitted here for simplicity as UDP allows multicast broadcast).
       // - Types: dn:NetworkVideoTransmitter (Tells NVR this is a Camera).
       // - XAddrs: The URL to the implementation of the device service (http://<IP>:8000/onvif/device_service).
       // - Scopes: onvif://www.onvif.org/Profile/Streaming (Capabilities).
-      
-      String resp =
-        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
-        "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://www.w3.org/2003/05/soap-envelope\" "
-        "xmlns:SOAP-ENC=\"http://www.w3.org/2003/05/soap-encoding\" "
-        "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
-        "xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\">"
-        "<SOAP-ENV:Body>"
-        "<ProbeMatches xmlns=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\">"
-        "<ProbeMatch>"
-        "<EndpointReference><Address>urn:uuid:esp32-cam-onvif-" + WiFi.macAddress() + "</Address></EndpointReference>"
-        "<Types>dn:NetworkVideoTransmitter</Types>"
-        "<Scopes>onvif://www.onvif.org/type/Network_Video_Transmitter onvif://www.onvif.org/Profile/Streaming onvif://www.onvif.org/location/Office onvif://www.onvif.org/name/" DEVICE_MODEL " onvif://www.onvif.org/hardware/" DEVICE_HARDWARE_ID "</Scopes>"
-        "<XAddrs>http://" + ip + ":" + String(ONVIF_PORT) + "/onvif/device_service</XAddrs>"
-        "<MetadataVersion>1</MetadataVersion>"
-        "</ProbeMatch>"
-        "</ProbeMatches>"
-        "</SOAP-ENV:Body>"
-        "</SOAP-ENV:Envelope>";
+      uint8_t mac[6];
+      char macStr[18], ip[16];
+      WiFi.macAddress(mac);
+      snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+      IPAddress localIP = WiFi.localIP();
+      snprintf(ip, sizeof(ip), "%u.%u.%u.%u", localIP[0], localIP[1], localIP[2], localIP[3]);
+
+      char *resp = (char *) HEAP_ALLOC(HEAP_ONVIF, 1536);
+      if (!resp) return;
+      snprintf_P(resp, 1536, PART_HEADER);
+      size_t respLen = strlen(resp);
+      snprintf_P(resp + respLen, 1536 - respLen, TPL_PROBE_MATCH, macStr, ip, ONVIF_PORT);
       onvifUDP.beginPacket(onvifUDP.remoteIP(), onvifUDP.remotePort());
-      onvifUDP.write((const uint8_t*)resp.c_str(), resp.length());
+      onvifUDP.write((const uint8_t*)resp, strlen(resp));
       onvifUDP.endPacket();
+      heap_tracker_free(resp);
     }
   }
   } // End if(packetSize)
@@ -1176,8 +1149,8 @@ void handle_onvif_discovery() {
 
 
 void onvif_server_start() {
-  onvifServer.on("/onvif/device_service", HTTP_POST, handle_onvif_soap);
-  onvifServer.on("/onvif/ptz_service", HTTP_POST, handle_onvif_soap); // Route PTZ to same handler for now
+  onvifServer.on("/onvif/device_service", HTTP_POST, handle_onvif_soap, handle_onvif_raw);
+  onvifServer.on("/onvif/ptz_service", HTTP_POST, handle_onvif_soap, handle_onvif_raw); // Route PTZ to same handler for now
   onvifServer.begin();
   onvifUDP.beginMulticast(IPAddress(239,255,255,250), 3702); // Fixed: use only 2 args
   LOG_I("ONVIF server started.");
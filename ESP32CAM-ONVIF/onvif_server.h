@@ -8,3 +8,18 @@ void onvif_server_start();
 void onvif_server_loop();
 bool onvif_is_enabled();
 void onvif_set_enabled(bool en);
+
+// SOAP requests per action since boot, for /metrics
+int onvif_action_count();
+const char *onvif_action_name(int i);
+uint32_t onvif_action_requests(int i);
+uint32_t onvif_auth_failures();
+
+struct OnvifParseStats {
+    uint32_t requests;
+    uint32_t lastParseUs;           // Finding the action and checking credentials
+    uint32_t maxParseUs;
+    uint32_t maxRequestBytes;       // Largest body, see ONVIF_MAX_REQUEST
+    uint32_t oversized;             // Rejected for not fitting
+};
+void onvif_parse_stats(OnvifParseStats *stats);
@@ -0,0 +1,317 @@
+#include "pcap_tap.h"
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "heap_tracker.h"
+#endif
+
+volatile bool pcapTapActive = false;
+
+#define LINKTYPE_RAW 101            // Packets start with the IP header
+#define PCAP_TCP_CONNS 8            // Connections with their own sequence numbers
+
+// pcap headers are written in host byte order, readers detect it by the magic
+struct PcapFileHeader {
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    int32_t  thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+};
+
+struct PcapRecordHeader {
+    uint32_t tsSec;
+    uint32_t tsUsec;
+    uint32_t inclLen;
+    uint32_t origLen;
+};
+
+// A packet as handed to the send functions
+struct TapData {
+    const uint8_t *hdr;
+    size_t hdrlen;
+    const uint8_t *payload;
+    size_t payloadlen;
+};
+
+struct TcpConn {
+    uintptr_t conn;
+    uint32_t seq;
+};
+
+static PcapTapStats tapStats;
+static TcpConn tcpConns[PCAP_TCP_CONNS];
+static int nextTcpConn = 0;
+static uint16_t ipId = 0;
+
+static void pcap_file_header(PcapFileHeader *h) {
+    h->magic = 0xa1b2c3d4;
+    h->versionMajor = 2;
+    h->versionMinor = 4;
+    h->thiszone = 0;
+    h->sigfigs = 0;
+    h->snaplen = PCAP_SNAPLEN;
+    h->network = LINKTYPE_RAW;
+}
+
+#ifdef ARDUINO_ARCH_ESP32
+
+// Ring of pcap records, oldest at ringHead. Filled by the RTSP task, read
+// from loop(); tapLock keeps the two apart.
+static uint8_t *ring = NULL;
+static size_t ringSize = 0;
+static size_t ringHead = 0;
+static size_t ringUsed = 0;
+static SemaphoreHandle_t tapLock = NULL;
+
+static void ring_read(size_t pos, void *dst, size_t len) {
+    pos %= ringSize;
+    size_t first = len < ringSize - pos ? len : ringSize - pos;
+    memcpy(dst, ring + pos, first);
+    memcpy((uint8_t *) dst + first, ring, len - first);
+}
+
+static void tap_put(const void *data, size_t len) {
+    size_t pos = (ringHead + ringUsed) % ringSize;
+    size_t first = len < ringSize - pos ? len : ringSize - pos;
+    memcpy(ring + pos, data, first);
+    memcpy(ring, (const uint8_t *) data + first, len - first);
+    ringUsed += len;
+}
+
+// Makes room for a record of len bytes, dropping the oldest ones. Nothing
+// is stored once the capture is stopped, even by a sender that saw it still
+// running: the ring has to stay as pcap_tap_size() measured it.
+static bool tap_reserve(size_t len) {
+    if (!pcapTapActive || len > ringSize) return false;
+    while (ringUsed + len > ringSize) {
+        PcapRecordHeader rec;
+        ring_read(ringHead, &rec, sizeof(rec));
+        size_t recLen = sizeof(rec) + rec.inclLen;
+        ringHead = (ringHead + recLen) % ringSize;
+        ringUsed -= recLen;
+        tapStats.bytes -= recLen;
+        tapStats.overwritten++;
+    }
+    return true;
+}
+
+static void tap_lock() { if (tapLock) xSemaphoreTake(tapLock, portMAX_DELAY); }
+static void tap_unlock() { if (tapLock) xSemaphoreGive(tapLock); }
+
+bool pcap_tap_start(size_t ringBytes) {
+    if (!tapLock) tapLock = xSemaphoreCreateMutex();
+    if (!ring) {
+        ring = (uint8_t *) HEAP_ALLOC_PSRAM(HEAP_PCAP, ringBytes);
+        if (!ring) return false;
+        ringSize = ringBytes;
+    }
+    tap_lock();
+    ringHead = 0;
+    ringUsed = 0;
+    memset(&tapStats, 0, sizeof(tapStats));
+    memset(tcpConns, 0, sizeof(tcpConns));
+    tap_unlock();
+    pcapTapActive = true;
+    return true;
+}
+
+void pcap_tap_stop() {
+    pcapTapActive = false;
+}
+
+size_t pcap_tap_size() {
+    if (!ring) return 0;
+    tap_lock();     // waits for a packet still being stored
+    size_t size = sizeof(PcapFileHeader) + ringUsed;
+    tap_unlock();
+    return size;
+}
+
+size_t pcap_tap_write(Print &out) {
+    pcap_tap_stop();
+    if (!ring) return 0;
+    tap_lock();     // waits for a packet still being stored
+    PcapFileHeader h;
+    pcap_file_header(&h);
+    size_t written = out.write((const uint8_t *) &h, sizeof(h));
+    size_t first = ringUsed < ringSize - ringHead ? ringUsed : ringSize - ringHead;
+    written += out.write(ring + ringHead, first);
+    written += out.write(ring, ringUsed - first);
+    tap_unlock();
+    return written;
+}
+
+#else
+
+// On a PC the capture goes straight to a file. The streaming code sends
+// from one thread there, so no locking.
+static FILE *tapFile = NULL;
+
+static void tap_put(const void *data, size_t len) {
+    fwrite(data, 1, len, tapFile);
+}
+
+static bool tap_reserve(size_t) {
+    return tapFile != NULL;
+}
+
+static void tap_lock() {}
+static void tap_unlock() {}
+
+bool pcap_tap_start(const char *path) {
+    pcap_tap_stop();
+    tapFile = fopen(path, "wb");
+    if (!tapFile) {
+        printf("Can't open %s\n", path);
+        return false;
+    }
+    PcapFileHeader h;
+    pcap_file_header(&h);
+    fwrite(&h, 1, sizeof(h), tapFile);
+    memset(&tapStats, 0, sizeof(tapStats));
+    memset(tcpConns, 0, sizeof(tcpConns));
+    pcapTapActive = true;
+    return true;
+}
+
+void pcap_tap_stop() {
+    pcapTapActive = false;
+    if (tapFile) fclose(tapFile);
+    tapFile = NULL;
+}
+
+#endif
+
+void pcap_tap_stats(PcapTapStats *stats) {
+    tap_lock();
+    *stats = tapStats;
+    tap_unlock();
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v >> 16);
+    put16(p + 2, v);
+}
+
+static void ip_header(uint8_t *ip, uint8_t proto, uint32_t src, uint32_t dst, size_t len) {
+    memset(ip, 0, 20);
+    ip[0] = 0x45;                   // IPv4, 20 byte header
+    put16(ip + 2, len);
+    put16(ip + 4, ipId++);
+    put16(ip + 6, 0x4000);          // Don't fragment
+    ip[8] = 64;                     // TTL
+    ip[9] = proto;
+    memcpy(ip + 12, &src, 4);       // already in network byte order
+    memcpy(ip + 16, &dst, 4);
+
+    uint32_t sum = 0;
+    for (int i = 0; i < 20; i += 2) sum += (ip[i] << 8) | ip[i + 1];
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    put16(ip + 10, ~sum);
+}
+
+// One record: IPv4 header, the UDP/TCP header and len bytes of the packet
+// data starting at off, cut to PCAP_SNAPLEN. Called with tapLock held.
+static void tap_record(const struct timeval &tv, uint8_t proto, uint32_t src, uint32_t dst,
+                       const uint8_t *l4, size_t l4len, const TapData &d, size_t off, size_t len) {
+    size_t origLen = 20 + l4len + len;
+    size_t inclLen = origLen < PCAP_SNAPLEN ? origLen : PCAP_SNAPLEN;
+    if (!tap_reserve(sizeof(PcapRecordHeader) + inclLen)) return;
+
+    PcapRecordHeader rec;
+    rec.tsSec = tv.tv_sec;
+    rec.tsUsec = tv.tv_usec;
+    rec.inclLen = inclLen;
+    rec.origLen = origLen;
+    tap_put(&rec, sizeof(rec));
+
+    uint8_t ip[20];
+    ip_header(ip, proto, src, dst, origLen);
+    tap_put(ip, sizeof(ip));
+    tap_put(l4, l4len);
+
+    len = inclLen - 20 - l4len;
+    if (off < d.hdrlen) {
+        size_t n = len < d.hdrlen - off ? len : d.hdrlen - off;
+        tap_put(d.hdr + off, n);
+        len -= n;
+        off = 0;
+    } else {
+        off -= d.hdrlen;
+    }
+    if (len > 0) tap_put(d.payload + off, len);
+
+    tapStats.packets++;
+    tapStats.bytes += sizeof(rec) + inclLen;
+}
+
+void pcap_tap_udp(uint32_t srcAddr, uint16_t srcPort, uint32_t dstAddr, uint16_t dstPort,
+                  const void *hdr, size_t hdrlen, const void *payload, size_t payloadlen) {
+    if (!pcapTapActive) return;
+    TapData d = { (const uint8_t *) hdr, hdrlen, (const uint8_t *) payload, payloadlen };
+    size_t len = hdrlen + payloadlen;
+    if (len > 65535 - 28) return;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint8_t udp[8];
+    put16(udp, srcPort);
+    put16(udp + 2, dstPort);
+    put16(udp + 4, 8 + len);
+    put16(udp + 6, 0);              // No checksum
+
+    tap_lock();
+    tap_record(tv, 17, srcAddr, dstAddr, udp, sizeof(udp), d, 0, len);
+    tap_unlock();
+}
+
+void pcap_tap_tcp(uintptr_t conn, uint32_t srcAddr, uint16_t srcPort, uint32_t dstAddr, uint16_t dstPort,
+                  const void *hdr, size_t hdrlen, const void *payload, size_t payloadlen) {
+    if (!pcapTapActive) return;
+    TapData d = { (const uint8_t *) hdr, hdrlen, (const uint8_t *) payload, payloadlen };
+    size_t len = hdrlen + payloadlen;
+    if (len == 0) return;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    tap_lock();
+    TcpConn *c = NULL;
+    for (int i = 0; i < PCAP_TCP_CONNS && !c; i++) {
+        if (tcpConns[i].conn == conn) c = &tcpConns[i];
+    }
+    if (!c) {
+        c = &tcpConns[nextTcpConn];
+        nextTcpConn = (nextTcpConn + 1) % PCAP_TCP_CONNS;
+        c->conn = conn;
+        c->seq = 1;
+    }
+
+    // Split like the TCP stack would, so records stay small
+    for (size_t off = 0; off < len; off += PCAP_TCP_MSS) {
+        size_t seg = len - off < PCAP_TCP_MSS ? len - off : PCAP_TCP_MSS;
+        uint8_t tcp[20];
+        memset(tcp, 0, sizeof(tcp));
+        put16(tcp, srcPort);
+        put16(tcp + 2, dstPort);
+        put32(tcp + 4, c->seq);
+        tcp[12] = 5 << 4;           // 20 byte header
+        tcp[13] = 0x18;             // PSH, ACK
+        put16(tcp + 14, 65535);     // Window
+        tap_record(tv, 6, srcAddr, dstAddr, tcp, sizeof(tcp), d, off, seg);
+        c->seq += seg;
+    }
+    tap_unlock();
+}
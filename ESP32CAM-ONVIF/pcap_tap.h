@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Copy of what the RTSP server sends (RTSP responses, RTP and RTCP over UDP
+// or interleaved in the RTSP connection) in pcap format, to see in Wireshark
+// what an NVR actually got. The platglue send functions tap every packet;
+// they only check pcapTapActive while no capture is running.
+//
+// Packets are stored as raw IPv4 (LINKTYPE_RAW) with made-up UDP/TCP headers.
+// TCP sequence numbers are counted per connection, so Wireshark reassembles
+// RTSP and interleaved RTP. Only outgoing traffic is captured.
+//
+// On the ESP32 the capture goes to a PSRAM ring that keeps the newest
+// packets, read back with pcap_tap_write() (web download or SD card). On a PC
+// it is written straight to a file.
+
+#define PCAP_SNAPLEN 2048           // Longer packets are cut; TCP sends are split at PCAP_TCP_MSS
+#define PCAP_TCP_MSS 1460
+
+struct PcapTapStats {
+    uint32_t packets;               // Captured since the start
+    uint32_t bytes;                 // Stored, including pcap headers
+    uint32_t overwritten;           // Oldest packets dropped for newer ones (ring only)
+};
+
+extern volatile bool pcapTapActive;
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <Arduino.h>
+
+// Allocates the ring on first use, later starts reuse it (and clear it)
+bool pcap_tap_start(size_t ringBytes);
+// Size of the capture file pcap_tap_write() produces. Exact once the
+// capture is stopped, as the web download's Content-Length.
+size_t pcap_tap_size();
+// Stops the capture and writes it out as a pcap file, oldest packet first
+size_t pcap_tap_write(Print &out);
+#else
+bool pcap_tap_start(const char *path);
+#endif
+void pcap_tap_stop();
+void pcap_tap_stats(PcapTapStats *stats);
+
+// Addresses in network byte order (like IPADDRESS on Linux), ports in host
+// byte order. A packet is given as header and payload, either may be empty.
+void pcap_tap_udp(uint32_t srcAddr, uint16_t srcPort, uint32_t dstAddr, uint16_t dstPort,
+                  const void *hdr, size_t hdrlen, const void *payload, size_t payloadlen);
+// conn identifies the connection for its sequence numbers (the SOCKET)
+void pcap_tap_tcp(uintptr_t conn, uint32_t srcAddr, uint16_t srcPort, uint32_t dstAddr, uint16_t dstPort,
+                  const void *hdr, size_t hdrlen, const void *payload, size_t payloadlen);
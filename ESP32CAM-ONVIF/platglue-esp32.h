@@ -1,9 +1,13 @@
 #pragma once
 
 #include <Arduino.h>
+#include <WiFi.h>
 #include <WiFiClient.h>
 #include <WiFiUdp.h>
 #include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 //#include <arpa/inet.h>
 #include <unistd.h>
@@ -12,10 +16,23 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/time.h>
+#include <esp_system.h>
 
+#include "heap_tracker.h"
+#include "pcap_tap.h"
+
+
+// A plain lwIP socket: WiFiUDP assembles every datagram in its own 1460
+// byte tx buffer, so header and payload would be copied once more before
+// lwIP copies them into its pbufs.
+struct UdpSocket {
+    int fd;
+    uint16_t boundPort;             // for the pcap tap
+};
 
 typedef WiFiClient *SOCKET;
-typedef WiFiUDP *UDPSOCKET;
+typedef UdpSocket *UDPSOCKET;
 typedef IPAddress IPADDRESS; // On linux use uint32_t in network byte order (per getpeername)
 typedef uint16_t IPPORT; // on linux use network byte order
 
@@ -26,12 +43,27 @@ inline void closesocket(SOCKET s) {
 
     if(s) {
         s->stop();
-        delete s; // Memory leak fix: We allocated this on heap in rtsp_server.cpp
+        heap_delete(s); // Memory leak fix: We allocated this on heap in rtsp_server.cpp
     }
 }
 
 #define getRandom() random(65536)
 
+// 32 random bits from the hardware RNG, e.g. for RTP SSRCs
+inline uint32_t getRandom32() { return esp_random(); }
+
+inline uint32_t getMicros() { return micros(); }
+inline uint32_t getMillis() { return millis(); }
+
+// Wall clock as NTP timestamp (seconds since 1900 and 32 bit fraction).
+// Follows SNTP once configTime() has synced, time since boot before that.
+inline void getNtpTime(uint32_t *sec, uint32_t *frac) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    *sec  = (uint32_t) tv.tv_sec + 2208988800UL;
+    *frac = (uint32_t) (((uint64_t) tv.tv_usec << 32) / 1000000);
+}
+
 inline void socketpeeraddr(SOCKET s, IPADDRESS *addr, IPPORT *port) {
     *addr = s->remoteIP();
     *port = s->remotePort();
@@ -40,41 +72,219 @@ inline void socketpeeraddr(SOCKET s, IPADDRESS *addr, IPPORT *port) {
 inline void udpsocketclose(UDPSOCKET s) {
     printf("closing UDP socket\n");
     if(s) {
-        s->stop();
-        delete s;
+        close(s->fd);
+        heap_delete(s);
     }
 }
 
+// Parse a dotted IPv4 address
+inline bool ipaddrparse(const char *str, IPADDRESS *addr) {
+    return addr->fromString(str);
+}
+
+// Multicast TTL for packets sent from this socket
+inline bool udpsocketsetttl(UDPSOCKET s, int ttl) {
+    uint8_t t = ttl;            // lwIP takes a u8_t for IP_MULTICAST_TTL
+    return s && setsockopt(s->fd, IPPROTO_IP, IP_MULTICAST_TTL, &t, sizeof(t)) == 0;
+}
+
 inline UDPSOCKET udpsocketcreate(unsigned short portNum)
 {
-    UDPSOCKET s = new WiFiUDP();
+    UDPSOCKET s = HEAP_NEW(HEAP_RTSP, UdpSocket);
+    if(!s) return NULL;
+    s->boundPort = portNum;
+    s->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(s->fd < 0) {
+        printf("Can't create UDP socket: %d\n", errno);
+        heap_delete(s);
+        return NULL;
+    }
 
-    if(!s->begin(portNum)) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons(portNum);
+    if(bind(s->fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
         printf("Can't bind port %d\n", portNum);
-        delete s;
+        close(s->fd);
+        heap_delete(s);
         return NULL;
     }
+    fcntl(s->fd, F_SETFL, O_NONBLOCK);
 
     return s;
 }
 
+// Copies of sent packets for the pcap tap (see pcap_tap.h), only while a
+// capture runs: looking up the addresses costs a few lwIP calls.
+inline void socketsendtap(SOCKET sockfd, const void *hdr, size_t hdrlen,
+                          const void *payload, size_t payloadlen)
+{
+    if(!pcapTapActive) return;
+    pcap_tap_tcp((uintptr_t) sockfd, (uint32_t) sockfd->localIP(), sockfd->localPort(),
+                 (uint32_t) sockfd->remoteIP(), sockfd->remotePort(), hdr, hdrlen, payload, payloadlen);
+}
+
+inline void udpsocketsendtap(UDPSOCKET sockfd, const void *hdr, size_t hdrlen,
+                             const void *payload, size_t payloadlen,
+                             IPADDRESS destaddr, IPPORT destport)
+{
+    if(!pcapTapActive) return;
+    pcap_tap_udp((uint32_t) WiFi.localIP(), sockfd->boundPort, (uint32_t) destaddr, destport,
+                 hdr, hdrlen, payload, payloadlen);
+}
+
 // TCP sending
 inline ssize_t socketsend(SOCKET sockfd, const void *buf, size_t len)
 {
     if(!sockfd) return 0; // Safety guard for TCP
-    return sockfd->write((uint8_t *) buf, len);
+    size_t sent = sockfd->write((uint8_t *) buf, len);
+    socketsendtap(sockfd, buf, sent, NULL, 0);
+    return sent;
+}
+
+inline sockaddr_in udpdestination(IPADDRESS destaddr, IPPORT destport)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = (uint32_t) destaddr;
+    addr.sin_port        = htons(destport);
+    return addr;
 }
 
 inline ssize_t udpsocketsend(UDPSOCKET sockfd, const void *buf, size_t len,
                              IPADDRESS destaddr, IPPORT destport)
 {
     if(!sockfd) return 0; // Safety check
-    sockfd->beginPacket(destaddr, destport);
-    sockfd->write((const uint8_t *)  buf, len);
-    if(!sockfd->endPacket())
-        printf("error sending udp packet\n");
+    sockaddr_in addr = udpdestination(destaddr, destport);
+    ssize_t res = sendto(sockfd->fd, buf, len, 0, (sockaddr *) &addr, sizeof(addr));
+    if(res < 0)
+        printf("error sending udp packet: %d\n", errno);
+    else
+        udpsocketsendtap(sockfd, buf, len, NULL, 0, destaddr, destport);
 
-    return len;
+    return res;
+}
+
+// True if a packet can be written without blocking. lwIP only reports a
+// socket writable while more than TCP_SNDLOWAT (about half of the send
+// buffer, several packets) is free, so one RTP packet always fits.
+inline bool socketwritable(SOCKET sockfd)
+{
+    if(!sockfd) return true; // nothing to wait for, socketsend() ignores it
+    int fd = sockfd->fd();
+    if(fd < 0) return true;  // closed, let the write fail right away
+
+    fd_set wfds;
+    FD_ZERO(&wfds);
+    FD_SET(fd, &wfds);
+    struct timeval tv = { 0, 0 };
+    return select(fd + 1, NULL, &wfds, NULL, &tv) > 0;
+}
+
+// Gather sends: a small header plus a payload that stays where it is (e.g. in
+// the camera frame buffer). Both go to lwIP's sendmsg() in one call, which
+// copies them straight into its pbufs. WiFiClient::write() would take two
+// calls per packet and WiFiUDP would stage the datagram in its tx buffer.
+//
+// Never blocks, and sends all of it or nothing: the streamers only send
+// after socketwritable(), so lwIP normally takes the whole packet. If it
+// has no room at all the packet is skipped (-1, the client sees a gap in
+// the sequence numbers). If it takes only part of it, the rest of an
+// interleaved '$' packet can't follow without blocking and every later
+// packet would be misframed, so the connection is shut down instead; the
+// session sees it closed and goes away.
+inline ssize_t socketsendv(SOCKET sockfd, const void *hdr, size_t hdrlen,
+                           const void *payload, size_t payloadlen)
+{
+    if(!sockfd) return 0; // Safety guard for TCP
+    int fd = sockfd->fd();
+    if(fd < 0) return -1;
+
+    struct iovec iov[2];
+    iov[0].iov_base = (void *) hdr;
+    iov[0].iov_len  = hdrlen;
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len  = payloadlen;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = payloadlen ? 2 : 1;
+
+    size_t total = hdrlen + payloadlen;
+    ssize_t res = sendmsg(fd, &msg, MSG_DONTWAIT);
+    if(res < 0)
+        return -1;
+    if((size_t) res < total) {
+        printf("partial TCP write (%d of %u bytes), closing the connection\n", (int) res, (unsigned) total);
+        shutdown(fd, SHUT_RDWR);
+        return -1;
+    }
+
+    socketsendtap(sockfd, hdr, hdrlen, payload, payloadlen);
+    return res;
+}
+
+inline ssize_t udpsocketsendv(UDPSOCKET sockfd, const void *hdr, size_t hdrlen,
+                              const void *payload, size_t payloadlen,
+                              IPADDRESS destaddr, IPPORT destport)
+{
+    if(!sockfd) return 0; // Safety check
+    sockaddr_in addr = udpdestination(destaddr, destport);
+
+    struct iovec iov[2];
+    iov[0].iov_base = (void *) hdr;
+    iov[0].iov_len  = hdrlen;
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len  = payloadlen;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name    = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = 2;
+
+    ssize_t res = sendmsg(sockfd->fd, &msg, 0);
+    if(res < 0)
+        printf("error sending udp packet: %d\n", errno);
+    else
+        udpsocketsendtap(sockfd, hdr, hdrlen, payload, payloadlen, destaddr, destport);
+    return res;
+}
+
+// Batched UDP sends (see platglue-posix.h). lwIP has no sendmmsg(), so every
+// datagram goes out as soon as it is queued and flushing has nothing to do.
+struct UdpBatch
+{
+};
+
+inline void udpbatchinit(UdpBatch *b)
+{
+}
+
+inline int udpbatchflush(UdpBatch *b)
+{
+    return 0;
+}
+
+inline int udpbatchadd(UdpBatch *b, UDPSOCKET sockfd, const void *hdr, size_t hdrlen,
+                       const void *payload, size_t payloadlen,
+                       IPADDRESS destaddr, IPPORT destport)
+{
+    udpsocketsendv(sockfd, hdr, hdrlen, payload, payloadlen, destaddr, destport);
+    return 1;
+}
+
+// Non-blocking UDP receive, returns -1 if no datagram is waiting
+inline int udpsocketread(UDPSOCKET sockfd, char *buf, size_t buflen)
+{
+    if(!sockfd) return -1;
+    int res = recv(sockfd->fd, buf, buflen, MSG_DONTWAIT);
+    return res > 0 ? res : -1;
 }
 
 /**
@@ -101,8 +311,8 @@ inline int socketread(SOCKET sock, char *buf, size_t buflen, int timeoutmsec)
         return -1;
     }
     else {
-        // int numRead = sock->readBytesUntil('\n', buf, buflen);
-        int numRead = sock->readBytes(buf, buflen);
+        // Only take what is already here, readBytes() would wait for a full buffer
+        int numRead = sock->read((uint8_t *) buf, (size_t) numAvail < buflen ? numAvail : buflen);
         // printf("bytes avail %d, read %d: %s", numAvail, numRead, buf);
         return numRead;
     }
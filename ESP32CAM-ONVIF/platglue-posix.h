@@ -1,6 +1,7 @@
 #pragma once
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -9,6 +10,13 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/random.h>
+
+#include "pcap_tap.h"
 
 typedef int SOCKET;
 typedef int UDPSOCKET;
@@ -17,12 +25,53 @@ typedef uint16_t IPPORT; // on linux use network byte order
 
 #define NULLSOCKET 0
 
+// NULLSOCKET is never closed, like on the ESP32 (it would be stdin here)
 inline void closesocket(SOCKET s) {
-    close(s);
+    if(s != NULLSOCKET)
+        close(s);
 }
 
 #define getRandom() rand()
 
+// 32 random bits from the kernel, e.g. for RTP SSRCs: rand() is never
+// seeded, every process would start with the same sequence
+inline uint32_t getRandom32() {
+    uint32_t r;
+    if(getentropy(&r, sizeof(r)) != 0)
+        r = ((uint32_t) rand() << 16) ^ (uint32_t) rand() ^ getpid();
+    return r;
+}
+
+// There is no heap tracker on a PC (heap_tracker.h), tagged allocations
+// are plain ones
+#define HEAP_ALLOC(tag, size)   malloc(size)
+#define heap_tracker_free(ptr)  free(ptr)
+
+// Arduino's yield(), called while waiting for the pacer to refill
+inline void yield() {
+    sched_yield();
+}
+
+inline uint32_t getMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+inline uint32_t getMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+// Wall clock as NTP timestamp (seconds since 1900 and 32 bit fraction)
+inline void getNtpTime(uint32_t *sec, uint32_t *frac) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    *sec  = (uint32_t) tv.tv_sec + 2208988800UL;
+    *frac = (uint32_t) (((uint64_t) tv.tv_usec << 32) / 1000000);
+}
+
 inline void socketpeeraddr(SOCKET s, IPADDRESS *addr, IPPORT *port) {
 
     sockaddr_in r;
@@ -41,7 +90,23 @@ inline void socketpeeraddr(SOCKET s, IPADDRESS *addr, IPPORT *port) {
 }
 
 inline void udpsocketclose(UDPSOCKET s) {
-    close(s);
+    if(s != NULLSOCKET)
+        close(s);
+}
+
+// Parse a dotted IPv4 address
+inline bool ipaddrparse(const char *str, IPADDRESS *addr) {
+    struct in_addr in;
+    if(inet_aton(str, &in) == 0)
+        return false;
+    *addr = in.s_addr;
+    return true;
+}
+
+// Multicast TTL for packets sent from this socket
+inline bool udpsocketsetttl(UDPSOCKET s, int ttl) {
+    unsigned char t = ttl;
+    return setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &t, sizeof(t)) == 0;
 }
 
 inline UDPSOCKET udpsocketcreate(unsigned short portNum)
@@ -62,11 +127,43 @@ inline UDPSOCKET udpsocketcreate(unsigned short portNum)
     return s;
 }
 
+// Copies of sent packets for the pcap tap (see pcap_tap.h), only while a
+// capture runs
+inline void socketsendtap(SOCKET sockfd, const void *hdr, size_t hdrlen,
+                          const void *payload, size_t payloadlen)
+{
+    if(!pcapTapActive) return;
+    sockaddr_in local, peer;
+    socklen_t len = sizeof(local);
+    memset(&local, 0, sizeof(local));
+    memset(&peer, 0, sizeof(peer));
+    getsockname(sockfd, (sockaddr *) &local, &len);
+    len = sizeof(peer);
+    getpeername(sockfd, (sockaddr *) &peer, &len);
+    pcap_tap_tcp(sockfd, local.sin_addr.s_addr, ntohs(local.sin_port), peer.sin_addr.s_addr, ntohs(peer.sin_port),
+                 hdr, hdrlen, payload, payloadlen);
+}
+
+inline void udpsocketsendtap(UDPSOCKET sockfd, const void *hdr, size_t hdrlen,
+                             const void *payload, size_t payloadlen,
+                             IPADDRESS destaddr, uint16_t destport)
+{
+    if(!pcapTapActive) return;
+    sockaddr_in local;
+    socklen_t len = sizeof(local);
+    memset(&local, 0, sizeof(local));
+    getsockname(sockfd, (sockaddr *) &local, &len);
+    pcap_tap_udp(local.sin_addr.s_addr, ntohs(local.sin_port), destaddr, destport,
+                 hdr, hdrlen, payload, payloadlen);
+}
+
 // TCP sending
 inline ssize_t socketsend(SOCKET sockfd, const void *buf, size_t len)
 {
     // printf("TCP send\n");
-    return send(sockfd, buf, len, 0);
+    ssize_t res = send(sockfd, buf, len, 0);
+    if(res > 0) socketsendtap(sockfd, buf, res, NULL, 0);
+    return res;
 }
 
 inline ssize_t udpsocketsend(UDPSOCKET sockfd, const void *buf, size_t len,
@@ -79,9 +176,222 @@ inline ssize_t udpsocketsend(UDPSOCKET sockfd, const void *buf, size_t len,
     addr.sin_port = htons(destport);
     //printf("UDP send to 0x%0x:%0x\n", destaddr, destport);
 
+    udpsocketsendtap(sockfd, buf, len, NULL, 0, destaddr, destport);
     return sendto(sockfd, buf, len, 0, (sockaddr *) &addr, sizeof(addr));
 }
 
+// True if a packet can be written without blocking (send buffer not full)
+inline bool socketwritable(SOCKET sockfd)
+{
+    struct pollfd p;
+    p.fd = sockfd;
+    p.events = POLLOUT;
+    p.revents = 0;
+    return poll(&p, 1, 0) != 0; // errors count as writable, send() reports them
+}
+
+// For the host benchmarks (stream_bench -b): when set, the gather sends
+// below copy header and payload into one buffer and send that, as the
+// streamers did before they had gather sends and as WiFiUDP still would.
+// sendCopiedBytes counts what is copied in here on the way out.
+inline bool sendBounceBuffer = false;
+inline uint64_t sendCopiedBytes = 0;
+// Cleared by stream_bench -c to send every RTP datagram with its own
+// syscall, as before the UDP batches below, to compare against.
+inline bool sendUdpBatches = true;
+
+inline const void *sendbounce(const void *hdr, size_t hdrlen, const void *payload, size_t payloadlen)
+{
+    static unsigned char bounce[2048];
+    if(hdrlen + payloadlen > sizeof(bounce))
+        return NULL;
+    memcpy(bounce, hdr, hdrlen);
+    memcpy(bounce + hdrlen, payload, payloadlen);
+    sendCopiedBytes += hdrlen + payloadlen;
+    return bounce;
+}
+
+// Gather sends: header and payload go out in one syscall without being
+// copied into a common buffer first.
+inline ssize_t socketsendv(SOCKET sockfd, const void *hdr, size_t hdrlen,
+                           const void *payload, size_t payloadlen)
+{
+    socketsendtap(sockfd, hdr, hdrlen, payload, payloadlen);
+
+    const void *bounce = sendBounceBuffer ? sendbounce(hdr, hdrlen, payload, payloadlen) : NULL;
+    if(bounce) {
+        hdr = bounce;
+        hdrlen += payloadlen;
+        payloadlen = 0;
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = (void *) hdr;
+    iov[0].iov_len  = hdrlen;
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len  = payloadlen;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 2;
+
+    // TCP may accept only part of the data, keep going until all of it is queued
+    size_t total = hdrlen + payloadlen;
+    size_t sent = 0;
+    while(sent < total) {
+        ssize_t res = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if(res <= 0)
+            return sent ? (ssize_t) sent : res;
+        sent += res;
+        while(res > 0 && msg.msg_iovlen > 0) {
+            if((size_t) res >= msg.msg_iov->iov_len) {
+                res -= msg.msg_iov->iov_len;
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            }
+            else {
+                msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + res;
+                msg.msg_iov->iov_len -= res;
+                res = 0;
+            }
+        }
+    }
+    return sent;
+}
+
+inline ssize_t udpsocketsendv(UDPSOCKET sockfd, const void *hdr, size_t hdrlen,
+                              const void *payload, size_t payloadlen,
+                              IPADDRESS destaddr, uint16_t destport)
+{
+    sockaddr_in addr;
+
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = destaddr;
+    addr.sin_port = htons(destport);
+
+    udpsocketsendtap(sockfd, hdr, hdrlen, payload, payloadlen, destaddr, destport);
+
+    const void *bounce = sendBounceBuffer ? sendbounce(hdr, hdrlen, payload, payloadlen) : NULL;
+    if(bounce) {
+        hdr = bounce;
+        hdrlen += payloadlen;
+        payloadlen = 0;
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = (void *) hdr;
+    iov[0].iov_len  = hdrlen;
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len  = payloadlen;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name    = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = 2;
+
+    return sendmsg(sockfd, &msg, 0);
+}
+
+// Batched UDP sends: the packets of a frame are queued with udpbatchadd() and
+// handed to the kernel together by udpbatchflush(), one sendmmsg() for up to
+// UDP_BATCH_MAX datagrams. Headers are copied (callers reuse their header
+// buffer), payloads are referenced in place and must stay valid until the
+// flush. All datagrams of a batch go out on the same socket to the same
+// destination; queueing one for somewhere else flushes the batch first.
+#define UDP_BATCH_MAX     32
+#define UDP_BATCH_HDR_MAX 160        // RTP/JPEG header with quant tables is 152
+
+struct UdpBatch
+{
+    struct mmsghdr msgs[UDP_BATCH_MAX];
+    struct iovec   iov[UDP_BATCH_MAX][2];
+    unsigned char  hdrs[UDP_BATCH_MAX][UDP_BATCH_HDR_MAX];
+    sockaddr_in    addr;
+    UDPSOCKET      sock;
+    unsigned       count;
+};
+
+inline void udpbatchinit(UdpBatch *b)
+{
+    memset(b, 0, sizeof(*b));
+}
+
+// Returns the number of send syscalls made
+inline int udpbatchflush(UdpBatch *b)
+{
+    int calls = 0;
+    unsigned sent = 0;
+    while(sent < b->count) {
+#ifdef __linux__
+        int res = sendmmsg(b->sock, b->msgs + sent, b->count - sent, 0);
+#else
+        int res = sendmsg(b->sock, &b->msgs[sent].msg_hdr, 0) < 0 ? -1 : 1;
+#endif
+        calls++;
+        if(res <= 0) {
+            printf("error sending udp batch: %s\n", strerror(errno));
+            break;
+        }
+        sent += res;
+    }
+    b->count = 0;
+    return calls;
+}
+
+// Returns the number of send syscalls made (only when the batch was full or
+// had to be flushed for a different destination)
+inline int udpbatchadd(UdpBatch *b, UDPSOCKET sockfd, const void *hdr, size_t hdrlen,
+                       const void *payload, size_t payloadlen,
+                       IPADDRESS destaddr, uint16_t destport)
+{
+    if(hdrlen > UDP_BATCH_HDR_MAX || sendBounceBuffer || !sendUdpBatches) {
+        udpsocketsendv(sockfd, hdr, hdrlen, payload, payloadlen, destaddr, destport);
+        return 1;
+    }
+
+    int calls = 0;
+    if(b->count > 0 && (b->sock != sockfd || b->addr.sin_addr.s_addr != destaddr ||
+                        b->addr.sin_port != htons(destport)))
+        calls += udpbatchflush(b);
+
+    if(b->count == 0) {
+        b->sock = sockfd;
+        b->addr.sin_family      = AF_INET;
+        b->addr.sin_addr.s_addr = destaddr;
+        b->addr.sin_port        = htons(destport);
+    }
+
+    udpsocketsendtap(sockfd, hdr, hdrlen, payload, payloadlen, destaddr, destport);
+    unsigned i = b->count++;
+    memcpy(b->hdrs[i], hdr, hdrlen);
+    sendCopiedBytes += hdrlen;
+    b->iov[i][0].iov_base = b->hdrs[i];
+    b->iov[i][0].iov_len  = hdrlen;
+    b->iov[i][1].iov_base = (void *) payload;
+    b->iov[i][1].iov_len  = payloadlen;
+
+    struct msghdr *msg = &b->msgs[i].msg_hdr;
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name    = &b->addr;
+    msg->msg_namelen = sizeof(b->addr);
+    msg->msg_iov     = b->iov[i];
+    msg->msg_iovlen  = 2;
+
+    if(b->count == UDP_BATCH_MAX)
+        calls += udpbatchflush(b);
+    return calls;
+}
+
+// Non-blocking UDP receive, returns -1 if no datagram is waiting
+inline int udpsocketread(UDPSOCKET sockfd, char *buf, size_t buflen)
+{
+    int res = recv(sockfd, buf, buflen, MSG_DONTWAIT);
+    return res > 0 ? res : -1;
+}
+
 /**
    Read from a socket with a timeout.
 
@@ -89,13 +399,19 @@ inline ssize_t udpsocketsend(UDPSOCKET sockfd, const void *buf, size_t len,
  */
 inline int socketread(SOCKET sock, char *buf, size_t buflen, int timeoutmsec)
 {
-    // Use a timeout on our socket read to instead serve frames
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = timeoutmsec * 1000; // send a new frame ever
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    // Use a timeout on our socket read to instead serve frames. A zero
+    // SO_RCVTIMEO would block forever, 0 means don't wait like on the ESP32.
+    int flags = 0;
+    if(timeoutmsec > 0) {
+        struct timeval tv;
+        tv.tv_sec = timeoutmsec / 1000;
+        tv.tv_usec = (timeoutmsec % 1000) * 1000;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    }
+    else
+        flags = MSG_DONTWAIT;
 
-    int res = recv(sock,buf,buflen,0);
+    int res = recv(sock,buf,buflen,flags);
     if(res > 0) {
         return res;
     }
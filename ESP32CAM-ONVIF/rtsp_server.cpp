@@ -2,17 +2,76 @@
 #include "config.h"
 #include "board_config.h"
 #include "status_led.h"
+#include "latency_stats.h"
+#include "heap_tracker.h"
+#include "esp_camera.h"
+#include <esp_task_wdt.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 
 WiFiServer rtspServer(RTSP_PORT);
-CRtspSession *session = nullptr;
 
-// Conditionally define the streamer type
-#ifdef VIDEO_CODEC_H264
-    H264Streamer *streamer = nullptr;
-#else
-    MyStreamer *streamer = nullptr;
+// One entry per connected RTSP client. Every client owns its own streamer so
+// sequence numbers, RTP timestamps and transport stay independent, while the
+// camera capture and frame parsing are shared (see rtsp_broadcast_frame).
+struct RtspClientSlot {
+    CRtspSession *session;
+    RtspStreamer *streamer;
+    bool started;           // PLAY seen and the first frame taken care of
+    bool joinedLate;        // started on the frame that was already going out
+    bool firstFrameSent;    // time to first frame recorded
+};
+
+static RtspClientSlot rtspClients[RTSP_MAX_CLIENTS];
+
+// Sends one copy of each frame to the multicast group for all clients that
+// did a multicast SETUP (nullptr if multicast is disabled)
+static RtspStreamer *multicastStreamer = nullptr;
+
+// Pacing applied to every client streamer
+static uint32_t paceRateKbps = RTP_PACE_RATE_KBPS;
+static uint32_t paceBurstBytes = RTP_PACE_BURST_BYTES;
+static volatile bool paceChanged = false;
+
+// Everything RTSP runs in rtsp_stream_task, pinned to RTSP_TASK_CORE. The
+// web server, ONVIF and serial console only read stats from other tasks;
+// rtspLock keeps a slot from being freed while they look at it, and
+// frameTiming from being read halfway through an update.
+static TaskHandle_t rtspTask = nullptr;
+static SemaphoreHandle_t rtspLock = nullptr;
+static RtspFrameTiming frameTiming;
+static RtspTotals retiredTotals;    // what disconnected clients had sent
+
+#ifndef VIDEO_CODEC_H264
+    // MJPEG frames come from rtsp_capture_task through a one-deep queue. If the
+    // stream task is still busy with the previous frame, the queued frame is
+    // replaced by the newer one, so a slow consumer never sees stale video.
+    static CCameraSource cameraSource;
+    static TaskHandle_t captureTask = nullptr;
+    static QueueHandle_t frameQueue = nullptr;
+    static volatile bool captureWanted = false;
+#endif
+
+// A viewer that PLAYs while a frame is going out is started on that frame
+// right away. Its buffer is held until every client has sent it anyway, so
+// this needs no copy; the viewer doesn't wait for the next capture.
+static bool frameHasLateViewers = false;
+
+static void rtsp_stream_task(void *arg);
+#ifndef VIDEO_CODEC_H264
+    static void rtsp_capture_task(void *arg);
 #endif
 
+static RtspStreamer *rtsp_new_streamer() {
+    #ifdef VIDEO_CODEC_H264
+        return HEAP_NEW(HEAP_RTSP, RtspStreamer);
+    #else
+        return HEAP_NEW(HEAP_RTSP, RtspStreamer, cameraSource);
+    #endif
+}
+
 String getRTSPUrl() {
     #ifdef VIDEO_CODEC_H264
         return "rtsp://" + WiFi.localIP().toString() + ":" + String(RTSP_PORT) + "/h264/1";
@@ -31,11 +90,10 @@ const char* getCodecName() {
 
 void rtsp_server_start() {
     // The camera is already initialized in setup() via camera_init().
-    // Create the appropriate streamer based on codec configuration.
+    // Streamers are created per client when they connect.
     
     #ifdef VIDEO_CODEC_H264
-        Serial.println("[INFO] Creating H.264 streamer...");
-        streamer = new H264Streamer();
+        Serial.println("[INFO] Initializing H.264 encoder...");
         
         // Initialize the H.264 encoder
         // Get current resolution from camera settings
@@ -57,7 +115,8 @@ void rtsp_server_start() {
             #endif
         }
         
-        if (!streamer->init(width, height)) {
+        // The encoder is shared by all client streamers
+        if (!H264Streamer::init(width, height)) {
             Serial.println("[ERROR] H.264 encoder init failed! Falling back to MJPEG.");
             // Note: Would need fallback logic here in production
         }
@@ -65,86 +124,623 @@ void rtsp_server_start() {
         Serial.printf("[INFO] RTSP server started at %s (%s)\n", 
                       getRTSPUrl().c_str(), getCodecName());
     #else
-        Serial.println("[INFO] Creating MJPEG streamer...");
-        streamer = new MyStreamer();
         Serial.println("[INFO] RTSP server started at " + getRTSPUrl());
     #endif
     
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        rtspClients[i].session = nullptr;
+        rtspClients[i].streamer = nullptr;
+    }
+    
+    #if RTSP_MULTICAST_ENABLED
+        multicastStreamer = rtsp_new_streamer();
+        if (multicastStreamer->InitMulticast(RTSP_MULTICAST_ADDR, RTSP_MULTICAST_PORT, RTSP_MULTICAST_TTL)) {
+            multicastStreamer->setPacing(paceRateKbps * 125, paceBurstBytes);
+            Serial.printf("[INFO] RTP multicast: %s:%d (TTL %d)\n",
+                          RTSP_MULTICAST_ADDR, RTSP_MULTICAST_PORT, RTSP_MULTICAST_TTL);
+        } else {
+            Serial.println("[ERROR] RTP multicast init failed, multicast SETUP disabled");
+            heap_delete(multicastStreamer);
+            multicastStreamer = nullptr;
+        }
+    #endif
+    
     rtspServer.begin();
     
+    rtspLock = xSemaphoreCreateMutex();
+    #if CONFIG_FREERTOS_UNICORE
+        const BaseType_t core = 0;
+    #else
+        const BaseType_t core = RTSP_TASK_CORE;
+    #endif
+    #ifndef VIDEO_CODEC_H264
+        frameQueue = xQueueCreate(1, sizeof(SourceFrame));
+        xTaskCreatePinnedToCore(rtsp_capture_task, "rtsp_capture", RTSP_CAPTURE_STACK, nullptr,
+                                RTSP_TASK_PRIORITY, &captureTask, core);
+    #endif
+    if (xTaskCreatePinnedToCore(rtsp_stream_task, "rtsp_stream", RTSP_TASK_STACK, nullptr,
+                                RTSP_TASK_PRIORITY, &rtspTask, core) != pdPASS) {
+        Serial.println("[ERROR] RTSP stream task could not be created");
+    } else {
+        Serial.printf("[INFO] RTSP streaming task on core %d (priority %d)\n", (int) core, RTSP_TASK_PRIORITY);
+    }
+    
     // Log board and codec info
     #ifdef BOARD_NAME
-        Serial.printf("[INFO] Board: %s, Codec: %s\n", BOARD_NAME, getCodecName());
+        Serial.printf("[INFO] Board: %s, Codec: %s, Max clients: %d\n", BOARD_NAME, getCodecName(), RTSP_MAX_CLIENTS);
     #endif
 }
 
-void rtsp_server_loop() {
-    // If we have an active session, handle it
-    if (session) {
-        session->handleRequests(0); // 0 timeout means non-blocking
-        
-        // Broadcast video frame
-        // Frame rate limiting based on codec
-        static uint32_t lastFrameTime = 0;
-        uint32_t now = millis();
+int rtsp_server_client_count() {
+    if (!rtspLock) return 0;
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    int count = 0;
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (rtspClients[i].session) count++;
+    }
+    xSemaphoreGive(rtspLock);
+    return count;
+}
+
+static uint32_t rtsp_frame_interval() {
+    #ifdef VIDEO_CODEC_H264
+        // H.264: Use configured FPS
+        return 1000 / H264_FPS;
+    #else
+        // MJPEG: ~20 FPS (50ms interval)
+        return 50;
+    #endif
+}
+
+// Frame that is currently being paced out to the clients. The capture (or
+// encoder output) is held until every client has sent its last packet.
+static bool frameInFlight = false;
+static uint32_t frameStartMs = 0;
+static uint32_t frameCaptureMs = 0;
+#ifdef VIDEO_CODEC_H264
+    static h264_frame_t currentEncoded;     // valid until the next encode
+#else
+    static SourceFrame currentFrame;
+    static JpegFrameInfo currentJpeg;
+#endif
+
+// Client in PLAY state that gets its own unicast copy of each frame
+static bool rtsp_slot_streaming(int i) {
+    CRtspSession *s = rtspClients[i].session;
+    return s && s->m_streaming && !s->m_stopped && !s->isMulticast();
+}
+
+static int rtsp_count_multicast_viewers() {
+    int count = 0;
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        CRtspSession *s = rtspClients[i].session;
+        if (s && s->m_streaming && !s->m_stopped && s->isMulticast()) count++;
+    }
+    return count;
+}
+
+int rtsp_server_multicast_viewers() {
+    if (!rtspLock) return 0;
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    int count = rtsp_count_multicast_viewers();
+    xSemaphoreGive(rtspLock);
+    return count;
+}
+
+// Capture to last packet sent, with the same 1/16 smoothing as the jitter
+static void rtsp_note_frame_sent(uint32_t now) {
+    uint32_t latency = now - frameCaptureMs;
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    if (frameTiming.latencyMs == 0) frameTiming.latencyMs = latency;
+    frameTiming.latencyMs += ((int32_t) latency - (int32_t) frameTiming.latencyMs) / 16;
+    if (latency > frameTiming.maxLatencyMs) frameTiming.maxLatencyMs = latency;
+    xSemaphoreGive(rtspLock);
+}
+
+static void rtsp_release_frame() {
+    #ifndef VIDEO_CODEC_H264
+        cameraSource.release(currentFrame);
+    #endif
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) rtspClients[i].joinedLate = false;
+    frameHasLateViewers = false;
+    frameInFlight = false;
+}
+
+// Queue the frame in flight on a viewer that has just sent PLAY
+static bool rtsp_begin_late(RtspStreamer *streamer, uint32_t frameInterval) {
+    #ifdef VIDEO_CODEC_H264
+        // P frames only decode on top of the keyframe before them
+        if (currentEncoded.type != H264_FRAME_TYPE_IDR || !currentEncoded.contains_sps_pps) return false;
+        return streamer->beginEncodedFrame(currentEncoded, frameCaptureMs, frameInterval);
+    #else
+        return streamer->beginFrame(currentJpeg, frameCaptureMs, frameInterval);
+    #endif
+}
+
+// Clients that just sent PLAY get the frame that is going out, if there is
+// one (and, for H.264, it is a keyframe), so the viewer shows a picture
+// without waiting for the next capture. Otherwise they start with the next
+// frame; H.264 viewers ask the encoder for a keyframe.
+static void rtsp_start_new_viewers(uint32_t frameInterval) {
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (!rtsp_slot_streaming(i) || rtspClients[i].started) continue;
+        RtspStreamer *streamer = rtspClients[i].streamer;
+        rtspClients[i].started = true;
         
+        if (frameInFlight && rtsp_begin_late(streamer, frameInterval)) {
+            rtspClients[i].joinedLate = true;
+            frameHasLateViewers = true;
+            xSemaphoreTake(rtspLock, portMAX_DELAY);
+            frameTiming.lateStarts++;
+            xSemaphoreGive(rtspLock);
+            continue;
+        }
         #ifdef VIDEO_CODEC_H264
-            // H.264: Use configured FPS
-            uint32_t frameInterval = 1000 / H264_FPS;
-        #else
-            // MJPEG: ~20 FPS (50ms interval)
-            uint32_t frameInterval = 50;
+            streamer->resumeAtNextIDR();
         #endif
+    }
+}
+
+// Track how regularly frames are stamped, i.e. what the viewer's playback
+// sees: interval between the capture times of two frames and its smoothed
+// deviation from the nominal interval (RFC 3550 style, 1/16 gain)
+static void rtsp_note_frame_start(uint32_t captureMs, uint32_t frameInterval) {
+    static uint32_t lastCaptureMs = 0;
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    if (frameTiming.frames > 0) {
+        uint32_t interval = (captureMs - lastCaptureMs) * 1000;
+        int32_t deviation = (int32_t) interval - (int32_t) (frameInterval * 1000);
+        if (deviation < 0) deviation = -deviation;
+        frameTiming.intervalUs = interval;
+        frameTiming.jitterUs += ((int32_t) deviation - (int32_t) frameTiming.jitterUs) / 16;
+        if ((uint32_t) deviation > frameTiming.maxJitterUs) frameTiming.maxJitterUs = deviation;
+    }
+    lastCaptureMs = captureMs;
+    frameTiming.frames++;
+    xSemaphoreGive(rtspLock);
+}
+
+// Fixed-rate frame clock. Deadlines sit on a grid (start + n * interval), so
+// the frame rate doesn't drift with scheduling delays. Deadlines that went by
+// while the previous frame was still busy are skipped, never made up for with
+// frames sent back to back.
+struct RtspFrameClock {
+    uint32_t nextUs;
+    bool started;
+};
+
+static bool rtsp_clock_due(RtspFrameClock *clock, uint32_t frameInterval, uint32_t nowUs) {
+    uint32_t intervalUs = frameInterval * 1000;
+    if (!clock->started) {
+        clock->nextUs = nowUs;
+        clock->started = true;
+    }
+    if ((int32_t) (nowUs - clock->nextUs) < 0) return false;
+    
+    uint32_t missed = (nowUs - clock->nextUs) / intervalUs;
+    if (missed) {
+        xSemaphoreTake(rtspLock, portMAX_DELAY);
+        frameTiming.missedDeadlines += missed;
+        xSemaphoreGive(rtspLock);
+    }
+    clock->nextUs += (missed + 1) * intervalUs;
+    return true;
+}
+
+// Milliseconds until the next deadline (rounded up, 0 if it is due)
+static uint32_t rtsp_clock_wait_ms(const RtspFrameClock *clock, uint32_t nowUs) {
+    int32_t left = (int32_t) (clock->nextUs - nowUs);
+    return left > 0 ? (left + 999) / 1000 : 0;
+}
+
+#ifdef VIDEO_CODEC_H264
+    static RtspFrameClock encodeClock;
+#endif
+
+static bool rtsp_any_streaming() {
+    if (multicastStreamer && rtsp_count_multicast_viewers() > 0) return true;
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (rtsp_slot_streaming(i)) return true;
+    }
+    return false;
+}
+
+// Take the newest frame and queue it on every client that is in PLAY state.
+// The frame buffer is fetched and parsed (or encoded) once, regardless of
+// how many clients are attached. The packets go out in rtsp_pump_frame().
+static void rtsp_begin_frame(uint32_t now, uint32_t frameInterval) {
+    bool multicast = multicastStreamer && rtsp_count_multicast_viewers() > 0;
+    bool anyStreaming = rtsp_any_streaming();
+    #ifndef VIDEO_CODEC_H264
+        captureWanted = anyStreaming;
+        SourceFrame frame;
+        if (xQueueReceive(frameQueue, &frame, 0) != pdTRUE) return;
+        if (!anyStreaming) {
+            cameraSource.release(frame);
+            return;
+        }
+    #else
+        if (!anyStreaming) return;
+    #endif
+    
+    #ifdef VIDEO_CODEC_H264
+        h264_frame_t frame;
+        uint32_t grabUs = 0;
+        if (!H264Streamer::encodeFrame(&frame, &grabUs)) return;
+        latency_begin_frame(frame.timestamp, grabUs, getMicros());
         
-        if (now - lastFrameTime > frameInterval) { 
-            if (session && !session->m_stopped) { 
-                session->broadcastCurrentFrame(now);
+        // RTP timestamps follow the capture time, not when we got to send it
+        for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+            if (rtsp_slot_streaming(i)) {
+                rtspClients[i].streamer->beginEncodedFrame(frame, frame.timestamp, frameInterval);
             }
-            lastFrameTime = now;
         }
+        if (multicast) multicastStreamer->beginEncodedFrame(frame, frame.timestamp, frameInterval);
+        currentEncoded = frame;
+        frameInFlight = true;
+        frameStartMs = now;
+        frameCaptureMs = frame.timestamp;
+        rtsp_note_frame_start(frame.timestamp, frameInterval);
+    #else
+        JpegFrameInfo jpeg;
+        
+        if (parseJPEG(frame.data, frame.len, &jpeg)) {
+            latency_begin_frame(frame.timestampMs, frame.grabUs, getMicros());
+            // RTP timestamps follow the capture time, not when we got to send it
+            for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+                if (rtsp_slot_streaming(i)) {
+                    rtspClients[i].streamer->beginFrame(jpeg, frame.timestampMs, frameInterval);
+                }
+            }
+            if (multicast) multicastStreamer->beginFrame(jpeg, frame.timestampMs, frameInterval);
+            currentFrame = frame;
+            currentJpeg = jpeg;
+            frameInFlight = true;
+            frameStartMs = now;
+            frameCaptureMs = frame.timestampMs;
+            rtsp_note_frame_start(frame.timestampMs, frameInterval);
+        } else {
+            Serial.println("[WARN] RTSP: can't decode jpeg data");
+            cameraSource.release(frame);
+        }
+    #endif
+}
 
-        // Check if the client has disconnected
-        if (session->m_stopped) {
+// Time from PLAY until the last packet of the viewer's first frame was sent
+static void rtsp_note_first_frame(int i, uint32_t lastPacketUs) {
+    if (rtspClients[i].firstFrameSent) return;
+    rtspClients[i].firstFrameSent = true;
+    uint32_t ms = (lastPacketUs - rtspClients[i].session->m_playUs) / 1000;
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    frameTiming.firstFrameMs = ms;
+    if (ms > frameTiming.maxFirstFrameMs) frameTiming.maxFirstFrameMs = ms;
+    xSemaphoreGive(rtspLock);
+}
+
+// Send whatever the pacers allow right now. Never blocks, so RTSP requests
+// and the web/ONVIF servers keep being serviced while a frame is on the wire.
+static void rtsp_pump_frame() {
+    if (!frameInFlight) return;
+    
+    bool done = true;
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        RtspStreamer *streamer = rtspClients[i].streamer;
+        if (streamer && streamer->isFramePending()) {
+            if (rtspClients[i].session->m_stopped) continue;
+            if (!streamer->pumpFrame()) {
+                done = false;
+                continue;
+            }
+            rtsp_note_first_frame(i, streamer->lastPacketUs());
+            if (!rtspClients[i].joinedLate) latency_session_sent(i, streamer->firstPacketUs(), streamer->lastPacketUs());
+        }
+    }
+    if (multicastStreamer && multicastStreamer->isFramePending()) {
+        if (!multicastStreamer->pumpFrame()) done = false;
+        else latency_session_sent(RTSP_MAX_CLIENTS, multicastStreamer->firstPacketUs(),
+                                  multicastStreamer->lastPacketUs());
+    }
+    if (done) {
+        // A late viewer's copy finishes later than the frame's own timing
+        if (!frameHasLateViewers) rtsp_note_frame_sent(millis());
+        rtsp_release_frame();
+    }
+}
+
+// The next frame is ready but some clients are still sending the current one.
+// They lose its remaining packets and pick up with the new frame, so one
+// slow viewer can't hold the capture back for everybody.
+static bool rtsp_frame_overdue(uint32_t now, uint32_t frameInterval) {
+    if (!frameInFlight) return false;
+    #ifndef VIDEO_CODEC_H264
+        // A new viewer's first frame is let through, a partial one shows nothing
+        if (!frameHasLateViewers && uxQueueMessagesWaiting(frameQueue) > 0) return true;
+    #endif
+    // Also with a single frame buffer, where nothing new can be captured
+    // while this frame is held
+    return now - frameStartMs > 2 * frameInterval;
+}
+
+static void rtsp_drop_lagging() {
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        RtspStreamer *streamer = rtspClients[i].streamer;
+        if (streamer && streamer->isFramePending()) streamer->dropFrame();
+    }
+    if (multicastStreamer) multicastStreamer->dropFrame();
+    rtsp_release_frame();
+}
+
+bool rtsp_server_rtcp_stats(int slot, RtcpStats *stats) {
+    if (slot < 0 || slot >= RTSP_MAX_CLIENTS || !rtspLock) return false;
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    bool valid = rtspClients[slot].session != nullptr;
+    if (valid) *stats = rtspClients[slot].streamer->rtcpStats();
+    xSemaphoreGive(rtspLock);
+    return valid;
+}
+
+bool rtsp_server_drop_stats(int slot, RtpDropStats *stats) {
+    if (slot < 0 || slot >= RTSP_MAX_CLIENTS || !rtspLock) return false;
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    bool valid = rtspClients[slot].session != nullptr;
+    if (valid) *stats = rtspClients[slot].streamer->dropStats();
+    xSemaphoreGive(rtspLock);
+    return valid;
+}
+
+// Called from the stream task, so the pacers are never reconfigured mid-packet
+static void rtsp_apply_pacing() {
+    paceChanged = false;
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (rtspClients[i].streamer) {
+            rtspClients[i].streamer->setPacing(paceRateKbps * 125, paceBurstBytes);
+        }
+    }
+    if (multicastStreamer) multicastStreamer->setPacing(paceRateKbps * 125, paceBurstBytes);
+}
+
+void rtsp_server_set_pacing(uint32_t rateKbps, uint32_t burstBytes) {
+    paceRateKbps = rateKbps;
+    paceBurstBytes = burstBytes;
+    paceChanged = true;
+    Serial.printf("[INFO] RTP pacing: %u kbit/s, burst %u bytes\n", paceRateKbps, paceBurstBytes);
+}
+
+uint32_t rtsp_server_pacing_kbps() {
+    return paceRateKbps;
+}
+
+uint32_t rtsp_server_pacing_burst() {
+    return paceBurstBytes;
+}
+
+void rtsp_server_pacing_stats(RtpPacerStats *total) {
+    memset(total, 0, sizeof(*total));
+    if (!rtspLock) return;
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (!rtspClients[i].streamer) continue;
+        const RtpPacerStats &st = rtspClients[i].streamer->pacingStats();
+        total->frames    += st.frames;
+        total->packets   += st.packets;
+        total->bytes     += st.bytes;
+        total->writes    += st.writes;
+        total->copied    += st.copied;
+        total->deferrals += st.deferrals;
+        if (st.lastFrameUs > total->lastFrameUs) total->lastFrameUs = st.lastFrameUs;
+        if (st.maxFrameUs > total->maxFrameUs) total->maxFrameUs = st.maxFrameUs;
+    }
+    xSemaphoreGive(rtspLock);
+}
+
+static void rtsp_add_totals(RtspTotals *totals, const RtspStreamer *streamer) {
+    const RtpPacerStats &st = streamer->pacingStats();
+    totals->framesSent  += st.frames;
+    totals->packets     += st.packets;
+    totals->bytes       += st.bytes;
+    totals->clientDrops += streamer->dropStats().droppedFrames;
+}
+
+void rtsp_server_totals(RtspTotals *totals) {
+    *totals = retiredTotals;
+    if (!rtspLock) return;
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (rtspClients[i].streamer) rtsp_add_totals(totals, rtspClients[i].streamer);
+    }
+    if (multicastStreamer) rtsp_add_totals(totals, multicastStreamer);
+    xSemaphoreGive(rtspLock);
+}
+
+void rtsp_server_frame_timing(RtspFrameTiming *timing) {
+    if (!rtspLock) {
+        memset(timing, 0, sizeof(*timing));
+        return;
+    }
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    *timing = frameTiming;
+    xSemaphoreGive(rtspLock);
+}
+
+void rtsp_server_reset_latency() {
+    if (!rtspLock) return;
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    frameTiming.latencyMs = 0;
+    frameTiming.maxLatencyMs = 0;
+    xSemaphoreGive(rtspLock);
+}
+
+static void rtsp_accept_client() {
+    WiFiClient client = rtspServer.available();
+    if (!client) return;
+    
+    int slot = -1;
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (!rtspClients[i].session) {
+            slot = i;
+            break;
+        }
+    }
+    
+    if (slot < 0) {
+        // Table full: refuse politely so the NVR retries later instead of hanging
+        Serial.printf("[WARN] RTSP client limit (%d) reached, rejecting %s\n",
+                      RTSP_MAX_CLIENTS, client.remoteIP().toString().c_str());
+        const char *busy = "RTSP/1.0 503 Service Unavailable\r\n\r\n";
+        client.write((const uint8_t *)busy, strlen(busy));
+        client.stop();
+        return;
+    }
+    
+    // RTSP Crash Fix:
+    // CRtspSession stores the SOCKET (WiFiClient*).
+    // We MUST allocate it on heap to survive this scope.
+    WiFiClient *clientPtr = HEAP_NEW(HEAP_RTSP, WiFiClient, client);
+    
+    RtspStreamer *clientStreamer = rtsp_new_streamer();
+    CRtspSession *session = NULL;
+    if (clientPtr && clientStreamer) session = HEAP_NEW(HEAP_RTSP, CRtspSession, clientPtr, clientStreamer);
+    if (!session) {
+        Serial.println("[FATAL] Out of memory for RTSP session. Closing client.");
+        heap_delete(clientStreamer);
+        if (clientPtr) closesocket(clientPtr);
+        else client.stop();
+        return;
+    }
+    
+    // Set client socket for RTP-over-TCP
+    clientStreamer->setClientSocket(clientPtr);
+    clientStreamer->setPacing(paceRateKbps * 125, paceBurstBytes);
+    clientStreamer->setTcpSegmentSize(RTP_TCP_SEGMENT_SIZE);
+    
+    session->setMulticastStreamer(multicastStreamer);
+    
+    xSemaphoreTake(rtspLock, portMAX_DELAY);
+    rtspClients[slot].streamer = clientStreamer;
+    rtspClients[slot].session = session;
+    rtspClients[slot].started = false;
+    rtspClients[slot].joinedLate = false;
+    rtspClients[slot].firstFrameSent = false;
+    xSemaphoreGive(rtspLock);
+    latency_reset_session(slot);
+    Serial.printf("[INFO] RTSP Client Connected (%s stream, %d/%d clients)\n",
+                  getCodecName(), rtsp_server_client_count(), RTSP_MAX_CLIENTS);
+    // H.264 clients ask for their keyframe when they PLAY, see rtsp_start_new_viewers()
+}
+
+// One pass over all RTSP work. Only ever runs in rtsp_stream_task.
+static void rtsp_service() {
+    if (paceChanged) rtsp_apply_pacing();
+    
+    // Service RTSP requests of all connected clients
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (rtspClients[i].session) {
+            rtspClients[i].session->handleRequests(0); // 0 timeout means non-blocking
+        }
+    }
+    
+    // Keep the current frame moving out to all clients
+    rtsp_pump_frame();
+    
+    // Start the next frame
+    uint32_t now = millis();
+    uint32_t frameInterval = rtsp_frame_interval();
+    if (rtsp_frame_overdue(now, frameInterval)) rtsp_drop_lagging();
+    rtsp_start_new_viewers(frameInterval);
+    
+    #ifdef VIDEO_CODEC_H264
+        // The encoder output buffer is reused on every call, so H.264 frames
+        // can't be queued: capture and encode right here, on the frame clock.
+        if (!rtsp_any_streaming()) {
+            encodeClock.started = false;
+        } else if (!frameInFlight && rtsp_clock_due(&encodeClock, frameInterval, getMicros())) {
+            rtsp_begin_frame(now, frameInterval);
+        }
+    #else
+        // MJPEG: the capture task sets the pace, take its newest frame
+        if (!frameInFlight) rtsp_begin_frame(now, frameInterval);
+    #endif
+    
+    // RTCP sender reports out, receiver reports in
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (rtsp_slot_streaming(i)) {
+            rtspClients[i].streamer->serviceRtcp(now);
+        }
+    }
+    if (multicastStreamer && rtsp_count_multicast_viewers() > 0) {
+        multicastStreamer->serviceRtcp(now);
+    }
+    
+    // Drop clients that have disconnected
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (rtspClients[i].session && rtspClients[i].session->m_stopped) {
             Serial.println("[INFO] RTSP client disconnected.");
-            delete session;
-            session = nullptr;
+            xSemaphoreTake(rtspLock, portMAX_DELAY);
+            rtsp_add_totals(&retiredTotals, rtspClients[i].streamer);
+            heap_delete(rtspClients[i].session);   // closes the client socket
+            heap_delete(rtspClients[i].streamer);  // closes the UDP ports
+            rtspClients[i].session = nullptr;
+            rtspClients[i].streamer = nullptr;
+            xSemaphoreGive(rtspLock);
         }
-    } else {
-        // No active session, check for new clients
-        WiFiClient client = rtspServer.available();
-        if (client) {
-            // RTSP Crash Fix:
-            // CRtspSession stores the SOCKET (WiFiClient*).
-            // We MUST allocate it on heap to survive this scope.
-            WiFiClient *clientPtr = new WiFiClient(client);
-            
-            // Ensure streamer is valid
-            if (!streamer) {
-                Serial.println("[ERROR] Streamer is NULL! Attempting re-init.");
-                #ifdef VIDEO_CODEC_H264
-                    streamer = new H264Streamer();
-                    streamer->init(640, 480);
-                #else
-                    streamer = new MyStreamer();
-                #endif
-            }
-            
-            if (streamer) {
-                // Set client socket for RTP-over-TCP
-                streamer->setClientSocket(clientPtr);
-                
-                session = new CRtspSession(clientPtr, streamer);
-                Serial.printf("[INFO] RTSP Client Connected (%s stream)\n", getCodecName());
-                
-                #ifdef VIDEO_CODEC_H264
-                    // Request IDR frame for new client
-                    streamer->requestIDR();
-                #endif
-            } else {
-                Serial.println("[FATAL] Streamer init failed. Closing client.");
-                clientPtr->stop();
-                delete clientPtr;
-            } 
+    }
+    
+    // Check for new clients
+    rtsp_accept_client();
+}
+
+static void rtsp_stream_task(void *arg) {
+    esp_task_wdt_add(NULL);
+    for (;;) {
+        esp_task_wdt_reset();
+        rtsp_service();
+        
+        if (frameInFlight) {
+            // Packets are waiting for pacer tokens, come back on the next tick
+            vTaskDelay(1);
+        } else {
+            #ifdef VIDEO_CODEC_H264
+                uint32_t wait = encodeClock.started ? rtsp_clock_wait_ms(&encodeClock, getMicros()) : RTSP_TASK_IDLE_MS;
+                vTaskDelay(pdMS_TO_TICKS(wait < RTSP_TASK_IDLE_MS ? wait : RTSP_TASK_IDLE_MS));
+            #else
+                // Wake up as soon as a frame is captured, or to serve requests
+                SourceFrame next;
+                xQueuePeek(frameQueue, &next, pdMS_TO_TICKS(RTSP_TASK_IDLE_MS));
+            #endif
         }
     }
 }
+
+#ifndef VIDEO_CODEC_H264
+// Grabs a frame on every frame clock deadline while someone is watching.
+// Blocking in the camera driver here keeps the stream task free to service
+// requests.
+static void rtsp_capture_task(void *arg) {
+    RtspFrameClock clock = {};
+    for (;;) {
+        if (!captureWanted) {
+            clock.started = false;
+            vTaskDelay(pdMS_TO_TICKS(rtsp_frame_interval()));
+            continue;
+        }
+        uint32_t nowUs = getMicros();
+        if (!rtsp_clock_due(&clock, rtsp_frame_interval(), nowUs)) {
+            vTaskDelay(pdMS_TO_TICKS(rtsp_clock_wait_ms(&clock, nowUs)));
+            continue;
+        }
+        
+        SourceFrame frame;
+        if (!cameraSource.grab(frame)) continue;
+        
+        // Keep only the newest frame
+        SourceFrame stale;
+        if (xQueueReceive(frameQueue, &stale, 0) == pdTRUE) {
+            cameraSource.release(stale);
+            xSemaphoreTake(rtspLock, portMAX_DELAY);
+            frameTiming.dropped++;
+            xSemaphoreGive(rtspLock);
+        }
+        xQueueSend(frameQueue, &frame, 0);
+    }
+}
+#endif
@@ -8,17 +8,67 @@
 // Conditionally include the appropriate streamer
 #ifdef VIDEO_CODEC_H264
     #include "H264Streamer.h"
-    extern H264Streamer *streamer;
+    typedef H264Streamer RtspStreamer;
 #else
     #include "MyStreamer.h"
-    extern MyStreamer *streamer;
+    #include "CCameraSource.h"
+    typedef MyStreamer RtspStreamer;
 #endif
 
 extern WiFiServer rtspServer;
 
+// Regularity of the outgoing frames, to see what other work does to the stream
+struct RtspFrameTiming {
+    uint32_t frames;       // Frames started
+    uint32_t dropped;      // Captures replaced by a newer one before being sent
+    uint32_t intervalUs;   // Last time between the capture times of two frames
+    uint32_t jitterUs;     // Smoothed deviation from the nominal frame interval
+    uint32_t maxJitterUs;  // Worst deviation seen
+    uint32_t missedDeadlines; // Frame clock ticks skipped because a frame was still busy
+    uint32_t lateStarts;   // Viewers started on the frame that was already going out
+    uint32_t latencyMs;    // Smoothed time from capture until all clients sent the frame
+    uint32_t maxLatencyMs;
+    uint32_t firstFrameMs; // PLAY until the newest viewer had its first frame sent
+    uint32_t maxFirstFrameMs;
+};
+
 String getRTSPUrl();
+// Starts the RTSP server and its streaming task (see RTSP_TASK_CORE).
+// There is no loop function: all RTSP work happens in that task.
 void rtsp_server_start();
-void rtsp_server_loop();
+
+// Number of RTSP clients currently connected (max RTSP_MAX_CLIENTS)
+int rtsp_server_client_count();
+
+// Clients watching the multicast group (they are included in the client count)
+int rtsp_server_multicast_viewers();
+
+// Network stats from the RTCP receiver reports of the client in a slot
+// (0 .. RTSP_MAX_CLIENTS-1). Returns false if the slot is free.
+bool rtsp_server_rtcp_stats(int slot, RtcpStats *stats);
+
+// Frames dropped for the client in a slot because it could not keep up
+bool rtsp_server_drop_stats(int slot, RtpDropStats *stats);
+
+// RTP pacing of all clients (token bucket, see CRtpPacer)
+void rtsp_server_set_pacing(uint32_t rateKbps, uint32_t burstBytes);
+uint32_t rtsp_server_pacing_kbps();
+uint32_t rtsp_server_pacing_burst();
+// Pacing counters summed over the connected clients
+void rtsp_server_pacing_stats(RtpPacerStats *total);
+
+// Counters since boot over all clients, including those that have left
+struct RtspTotals {
+    uint32_t framesSent;   // Frames completely sent, summed over clients
+    uint32_t packets;
+    uint32_t bytes;
+    uint32_t clientDrops;  // Frames skipped or cut short for a slow client
+};
+void rtsp_server_totals(RtspTotals *totals);
+
+void rtsp_server_frame_timing(RtspFrameTiming *timing);
+// Start measuring the capture latency afresh, e.g. after a capture profile change
+void rtsp_server_reset_latency();
 
 // Get current codec name for display
 const char* getCodecName();
@@ -1,7 +1,8 @@
 #include "sd_recorder.h"
 #include "FS.h"
 #include "SD_MMC.h"
-#include "esp_camera.h" // Added for camera functions
+#include "frame_hub.h"
+#include "metrics.h"
 
 #include "config.h"
 #include "wifi_manager.h"
@@ -40,11 +41,11 @@
     return;
   }
   Serial.println("[INFO] SD Card initialized");
+  frame_hub_set_interval(FRAME_HUB_RECORDER, RECORD_FRAME_INTERVAL_MS);
   _sdMountSuccess = true;
 }
 
 // --- Recording Globals ---
-unsigned long _lastRecordFrame = 0;
 unsigned long _currentSegmentStart = 0;
 File _recordFile;
 bool _isRecording = false;
@@ -166,18 +167,24 @@ void sd_recorder_loop() {
         if (!_isRecording) return; // Still failed
     }
 
-    // 3. Record Frame (Limit FPS to something reasonable, e.g., 5 FPS for background recording)
-    if (now - _lastRecordFrame > 200) { // 5 FPS
-        camera_fb_t * fb = esp_camera_fb_get();
-        if (!fb) return;
-        
+    // 3. Record Frame (the frame hub limits this to RECORD_FRAME_INTERVAL_MS and
+    // hands us the frame RTSP is sending anyway when it is recent enough)
+    camera_fb_t * fb = frame_hub_get(FRAME_HUB_RECORDER);
+    if (fb) {
         // Write MJPEG frame header + body
         // MJPEG boundary
         // We write raw JPEGs back to back. Some players need boundary headers, most VLC-like just play concatenated JPEGs.
         // A generic MJPEG stream usually just needs the JPEG bytes.
         
         // OPTIMIZATION: Check available space in write buffer?
-        if (_recordFile.write(fb->buf, fb->len) != fb->len) {
+        uint32_t writeStart = micros();
+        size_t written = _recordFile.write(fb->buf, fb->len);
+        uint32_t writeUs = micros() - writeStart;
+        metrics_add(metrics.sdWrites);
+        metrics_add(metrics.sdBytes, written);
+        metrics_add(metrics.sdWriteUs, writeUs);
+        metrics_max(metrics.sdWriteMaxUs, writeUs);
+        if (written != fb->len) {
             Serial.println("[ERROR] Write failed. Disk full?");
             _recordFile.close();
             _isRecording = false;
@@ -185,7 +192,6 @@ void sd_recorder_loop() {
             // Include flush occasionally? SD_MMC is buffered.
         }
         
-        esp_camera_fb_return(fb);
-        _lastRecordFrame = now;
+        frame_hub_release(fb);
     }
 }
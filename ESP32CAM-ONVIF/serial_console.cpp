@@ -3,6 +3,12 @@
 #include "wifi_manager.h"
 #include "camera_control.h"
 #include "SD_MMC.h"
+#include "rtsp_server.h"
+#include "frame_hub.h"
+#include "latency_stats.h"
+#include "loop_profiler.h"
+#include "heap_tracker.h"
+#include "pcap_tap.h"
 
 void process_command(String cmd) {
     cmd.trim();
@@ -18,6 +24,11 @@ void process_command(String cmd) {
         Serial.println("flash on     : Turn Flash LED ON");
         Serial.println("flash off    : Turn Flash LED OFF");
         Serial.println("ls           : List files on SD card");
+        Serial.println("latency      : Frame latency histograms per stage");
+        Serial.println("heap         : Heap use per subsystem and fragmentation");
+        Serial.println("pcap start   : Capture sent RTSP/RTP traffic to PSRAM");
+        Serial.println("pcap stop    : Stop the capture");
+        Serial.println("pcap save    : Write the capture to the SD card");
     } 
     else if (cmd == "status") {
         Serial.println("--- System Status ---");
@@ -27,9 +38,98 @@ void process_command(String cmd) {
         Serial.printf("Heap: %u bytes\n", ESP.getFreeHeap());
         Serial.printf("PSRAM: %u bytes\n", ESP.getFreePsram());
         
+        RtpPacerStats pacing;
+        rtsp_server_pacing_stats(&pacing);
+        Serial.printf("RTSP clients: %d/%d (%d multicast)\n", rtsp_server_client_count(), RTSP_MAX_CLIENTS,
+                      rtsp_server_multicast_viewers());
+        Serial.printf("RTP pacing: %u kbit/s, burst %u bytes\n", rtsp_server_pacing_kbps(), rtsp_server_pacing_burst());
+        Serial.printf("  frames %u, packets %u (%u writes), deferrals %u, frame send %u us (max %u us)\n",
+                      pacing.frames, pacing.packets, pacing.writes, pacing.deferrals, pacing.lastFrameUs, pacing.maxFrameUs);
+        RtspFrameTiming timing;
+        rtsp_server_frame_timing(&timing);
+        Serial.printf("  frame interval %u us, jitter %u us (max %u us), %u stale frames dropped, %u deadlines missed\n",
+                      timing.intervalUs, timing.jitterUs, timing.maxJitterUs, timing.dropped, timing.missedDeadlines);
+        Serial.printf("  %u viewers started on the frame in flight, first frame %u ms after PLAY (max %u ms)\n",
+                      timing.lateStarts, timing.firstFrameMs, timing.maxFirstFrameMs);
+        Serial.printf("Capture profile: %s, latency %u ms (max %u ms)\n",
+                      camera_profile_name(camera_profile()), timing.latencyMs, timing.maxLatencyMs);
+        FrameHubStats hub;
+        frame_hub_stats(&hub);
+        Serial.printf("Frame hub: %u captures, %u shared (rtsp %u, recorder %u, snapshot %u, stream %u)\n",
+                      hub.captures, hub.shared, hub.frames[FRAME_HUB_RTSP], hub.frames[FRAME_HUB_RECORDER],
+                      hub.frames[FRAME_HUB_SNAPSHOT], hub.frames[FRAME_HUB_STREAM]);
+        for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+            RtcpStats rtcp;
+            RtpDropStats drops;
+            if (!rtsp_server_rtcp_stats(i, &rtcp)) continue;
+            rtsp_server_drop_stats(i, &drops);
+            Serial.printf("  session %d: loss %.1f%% (%ld total), jitter %.1f ms, rtt %u ms, %u SR / %u RR\n",
+                          i, rtcp.fractionLost * 100.0f / 256.0f, (long) rtcp.cumulativeLost,
+                          rtcp.jitter / 90.0f, rtcp.rttMs, rtcp.srSent, rtcp.reports);
+            Serial.printf("    dropped %u frames, %u TCP stalls, backlog %u bytes (max %u)\n",
+                          drops.droppedFrames, drops.stalls, drops.backlogBytes, drops.maxBacklogBytes);
+        }
+        Serial.println("Loop (us, last " + String(LOOP_PROFILER_WINDOW) + " calls):");
+        for (int i = 0; i < LOOP_SUBSYSTEMS; i++) {
+            LoopProfile p;
+            loop_profiler_get((LoopSubsystem) i, &p);
+            Serial.printf("  %-10s min %6u  avg %6u  max %6u  p99 %6u  budget %6u  %u overruns\n",
+                          loop_subsystem_name((LoopSubsystem) i), p.minUs, p.avgUs, p.maxUs, p.p99Us,
+                          p.budgetUs, p.overruns);
+        }
+        
         if (FLASH_LED_ENABLED) Serial.println("Flash: Enabled");
         else Serial.println("Flash: Disabled");
     }
+    else if (cmd == "heap") {
+        heap_tracker_report(Serial);
+    }
+    else if (cmd == "latency") {
+        // Columns are bucket upper bounds in ms, counts summed over all sessions
+        Serial.print("--- Frame Latency (since capture) ---\n             ");
+        for (int b = 0; b < LATENCY_BUCKETS - 1; b++) {
+            Serial.printf("%6u", latency_bucket_limit_us(b) / 1000);
+        }
+        Serial.println("  more    max");
+        for (int s = 0; s < LATENCY_STAGES; s++) {
+            LatencyHistogram h;
+            latency_histogram((LatencyStage) s, -1, &h);
+            Serial.printf("%-13s", latency_stage_name((LatencyStage) s));
+            for (int b = 0; b < LATENCY_BUCKETS; b++) Serial.printf("%6u", h.counts[b]);
+            Serial.printf(" %6u us\n", h.maxUs);
+        }
+        for (int i = 0; i < LATENCY_SESSIONS; i++) {
+            LatencyHistogram h;
+            latency_histogram(LATENCY_LAST_PACKET, i, &h);
+            uint32_t frames = 0;
+            for (int b = 0; b < LATENCY_BUCKETS; b++) frames += h.counts[b];
+            if (frames == 0) continue;
+            Serial.printf("  %s %d: %u frames, last packet max %u us\n",
+                          i == RTSP_MAX_CLIENTS ? "multicast" : "session", i, frames, h.maxUs);
+        }
+    }
+    else if (cmd == "pcap start") {
+        if (pcap_tap_start(PCAP_RING_SIZE)) Serial.println("Capture started");
+        else Serial.println("No memory for the capture");
+    }
+    else if (cmd == "pcap stop") {
+        pcap_tap_stop();
+        PcapTapStats stats;
+        pcap_tap_stats(&stats);
+        Serial.printf("Capture stopped: %u packets, %u bytes kept, %u overwritten\n",
+                      stats.packets, stats.bytes, stats.overwritten);
+    }
+    else if (cmd == "pcap save") {
+        String name = "/capture_" + String(millis()) + ".pcap";
+        File file = SD_MMC.open(name, FILE_WRITE);
+        if (!file) {
+            Serial.println("Can't create " + name);
+            return;
+        }
+        size_t written = pcap_tap_write(file);
+        file.close();
+        Serial.printf("Saved %u bytes to %s\n", written, name.c_str());
+    }
     else if (cmd == "ip") {
         Serial.println(wifiManager.getLocalIP());
     }
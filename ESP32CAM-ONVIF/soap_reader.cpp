@@ -0,0 +1,229 @@
+#include "soap_reader.h"
+#include <string.h>
+#include <stdlib.h>
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool starts_with(const char *p, const char *end, const char *s) {
+    size_t n = strlen(s);
+    return (size_t) (end - p) >= n && memcmp(p, s, n) == 0;
+}
+
+static const char *find_str(const char *p, const char *end, const char *s) {
+    size_t n = strlen(s);
+    while ((size_t) (end - p) >= n) {
+        p = (const char *) memchr(p, s[0], end - p - n + 1);
+        if (!p) return NULL;
+        if (memcmp(p, s, n) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+// "wsse:Username" -> "Username"
+static SoapStr local_name(const char *p, size_t len) {
+    SoapStr s = { p, len };
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == ':') {
+            s.p = p + i + 1;
+            s.len = len - i - 1;
+        }
+    }
+    return s;
+}
+
+static SoapStr trim(SoapStr s) {
+    while (s.len > 0 && is_space(s.p[0])) { s.p++; s.len--; }
+    while (s.len > 0 && is_space(s.p[s.len - 1])) s.len--;
+    return s;
+}
+
+void soap_reader_init(SoapReader *r, const char *xml, size_t len) {
+    r->pos = xml;
+    r->end = xml + len;
+    r->depth = 0;
+}
+
+bool soap_next(SoapReader *r, SoapToken *t) {
+    for (;;) {
+        const char *p = r->pos;
+        if (p >= r->end) return false;
+        t->start = p;
+        t->name.p = t->attrs.p = t->text.p = p;
+        t->name.len = t->attrs.len = t->text.len = 0;
+        t->empty = false;
+
+        if (*p != '<') {
+            const char *lt = (const char *) memchr(p, '<', r->end - p);
+            if (!lt) lt = r->end;
+            t->type = SOAP_TEXT;
+            t->text.len = lt - p;
+            r->pos = lt;
+            return true;
+        }
+
+        // Declarations and comments are skipped, CDATA is text
+        const char *skipTo = NULL;
+        if (starts_with(p, r->end, "<?")) skipTo = "?>";
+        else if (starts_with(p, r->end, "<!--")) skipTo = "-->";
+        else if (starts_with(p, r->end, "<![CDATA[")) {
+            const char *q = find_str(p + 9, r->end, "]]>");
+            if (!q) return false;
+            t->type = SOAP_TEXT;
+            t->text.p = p + 9;
+            t->text.len = q - t->text.p;
+            r->pos = q + 3;
+            return true;
+        } else if (starts_with(p, r->end, "<!")) skipTo = ">";
+        if (skipTo) {
+            const char *q = find_str(p, r->end, skipTo);
+            if (!q) return false;
+            r->pos = q + strlen(skipTo);
+            continue;
+        }
+
+        // A tag, its end is the first '>' outside of quotes. The envelope's
+        // xmlns attributes are a good part of a request, so this jumps from
+        // quote to quote with memchr() instead of looking at every byte.
+        const char *q = p + 1;
+        const char *gt = (const char *) memchr(q, '>', r->end - q);
+        for (;;) {
+            if (!gt) return false;
+            const char *dq = (const char *) memchr(q, '"', gt - q);
+            const char *sq = (const char *) memchr(q, '\'', (dq ? dq : gt) - q);
+            const char *open = sq ? sq : dq;
+            if (!open) break;
+            const char *close = (const char *) memchr(open + 1, *open, r->end - open - 1);
+            if (!close) return false;
+            q = close + 1;
+            if (close > gt) gt = (const char *) memchr(q, '>', r->end - q);
+        }
+        q = gt;
+        r->pos = q + 1;
+
+        bool closing = p[1] == '/';
+        const char *n = p + (closing ? 2 : 1);
+        const char *ne = n;
+        while (ne < q && !is_space(*ne) && *ne != '/') ne++;
+        t->name = local_name(n, ne - n);
+        if (closing) {
+            t->type = SOAP_END;
+            r->depth--;
+            return true;
+        }
+        t->type = SOAP_START;
+        t->empty = q[-1] == '/';
+        t->attrs.p = ne;
+        t->attrs.len = (t->empty ? q - 1 : q) - ne;
+        if (!t->empty) r->depth++;
+        return true;
+    }
+}
+
+bool soap_find(SoapReader *r, const char *name, SoapToken *t) {
+    int depth = r->depth;
+    while (soap_next(r, t)) {
+        if (t->type == SOAP_END && r->depth < depth) return false;
+        if (t->type == SOAP_START && (!name || soap_str_equals(t->name, name))) return true;
+    }
+    return false;
+}
+
+// Text content of the element whose start tag t the reader just passed
+static bool element_text(SoapReader *r, SoapToken t, SoapStr *text) {
+    SoapStr s = { t.start, 0 };
+    if (!t.empty) {
+        // If comments or CDATA split the text, the first non-blank piece
+        while (soap_next(r, &t)) {
+            if (t.type == SOAP_START) return false;
+            if (t.type == SOAP_END) break;
+            if (s.len == 0) s = trim(t.text);
+        }
+    }
+    *text = s;
+    return true;
+}
+
+bool soap_find_text(SoapReader *r, const char *name, SoapStr *text) {
+    SoapToken t;
+    return soap_find(r, name, &t) && element_text(r, t, text);
+}
+
+int soap_find_texts(SoapReader *r, const char *const *names, SoapStr *texts, int count) {
+    for (int i = 0; i < count; i++) {
+        texts[i].p = NULL;
+        texts[i].len = 0;
+    }
+    int found = 0;
+    int depth = r->depth;
+    SoapToken t;
+    while (found < count && soap_next(r, &t)) {
+        if (t.type == SOAP_END && r->depth < depth) break;
+        if (t.type != SOAP_START) continue;
+        for (int i = 0; i < count; i++) {
+            if (!texts[i].p && soap_str_equals(t.name, names[i])) {
+                if (element_text(r, t, &texts[i])) found++;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+bool soap_attr(const SoapToken *t, const char *name, SoapStr *value) {
+    const char *p = t->attrs.p;
+    const char *end = p + t->attrs.len;
+    while (p < end) {
+        while (p < end && is_space(*p)) p++;
+        const char *n = p;
+        while (p < end && *p != '=' && !is_space(*p)) p++;
+        SoapStr attrName = local_name(n, p - n);
+        while (p < end && is_space(*p)) p++;
+        if (p >= end || *p != '=') return false;
+        p++;
+        while (p < end && is_space(*p)) p++;
+        if (p >= end || (*p != '"' && *p != '\'')) return false;
+        char quote = *p++;
+        const char *v = p;
+        while (p < end && *p != quote) p++;
+        if (p >= end) return false;
+        if (soap_str_equals(attrName, name)) {
+            value->p = v;
+            value->len = p - v;
+            return true;
+        }
+        p++;
+    }
+    return false;
+}
+
+bool soap_str_equals(const SoapStr &s, const char *str) {
+    return strlen(str) == s.len && memcmp(s.p, str, s.len) == 0;
+}
+
+int soap_str_compare(const SoapStr &s, const char *str) {
+    int c = strncmp(s.p, str, s.len);
+    if (c == 0 && str[s.len]) c = -1;      // s is a prefix of str
+    return c;
+}
+
+// Numbers are copied out, the buffer need not be NUL terminated after them
+static void soap_str_copy(const SoapStr &s, char *buf, size_t size) {
+    size_t n = s.len < size - 1 ? s.len : size - 1;
+    memcpy(buf, s.p, n);
+    buf[n] = 0;
+}
+
+long soap_str_int(const SoapStr &s) {
+    char buf[16];
+    soap_str_copy(s, buf, sizeof(buf));
+    return strtol(buf, NULL, 10);
+}
+
+float soap_str_float(const SoapStr &s) {
+    char buf[24];
+    soap_str_copy(s, buf, sizeof(buf));
+    return strtof(buf, NULL);
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Pull parser for ONVIF SOAP requests. It works on the request buffer in
+// place and never allocates: tokens and values point into the buffer.
+// Element and attribute names are matched by their local name, so
+// <wsse:Username>, <Username> and <ns2:Username> all are "Username".
+//
+// Handlers copy the reader (a plain struct) to look for several fields in
+// any order:
+//   SoapReader r = *body;
+//   SoapStr year;
+//   if (soap_find_text(&r, "Year", &year)) ...
+//
+// Entities (&amp; ...) are not decoded; ONVIF values we read (tokens,
+// numbers, base64) don't use them.
+struct SoapStr {
+    const char *p;
+    size_t len;
+};
+
+enum SoapTokenType {
+    SOAP_START,                     // <name attrs> or <name attrs/>
+    SOAP_END,                       // </name>
+    SOAP_TEXT                       // Character data or CDATA, untrimmed
+};
+
+struct SoapToken {
+    SoapTokenType type;
+    const char *start;              // The '<', or the first character of text
+    SoapStr name;                   // Local name, without prefix
+    SoapStr attrs;                  // Raw attribute text of a start tag
+    SoapStr text;
+    bool empty;                     // Start tag closed with "/>"
+};
+
+struct SoapReader {
+    const char *pos;
+    const char *end;
+    int depth;                      // Open elements before pos
+};
+
+void soap_reader_init(SoapReader *r, const char *xml, size_t len);
+// Next token, skipping the XML declaration and comments. False at the end
+// of the buffer or on a tag that isn't closed.
+bool soap_next(SoapReader *r, SoapToken *t);
+// Moves past the next start tag named name (any name if NULL) inside the
+// element the reader is in. False if there is none; the reader is then
+// somewhere after that element.
+bool soap_find(SoapReader *r, const char *name, SoapToken *t);
+// soap_find(), then the element's text content, trimmed. False if it has
+// child elements instead.
+bool soap_find_text(SoapReader *r, const char *name, SoapStr *text);
+// soap_find_text() for several names in one pass over the element the
+// reader is in, whatever their order. texts[i].p is NULL for a name that
+// wasn't found (or has child elements); returns how many were found.
+int soap_find_texts(SoapReader *r, const char *const *names, SoapStr *texts, int count);
+bool soap_attr(const SoapToken *t, const char *name, SoapStr *value);
+
+bool soap_str_equals(const SoapStr &s, const char *str);
+// <0, 0 or >0 like strcmp(s, str)
+int soap_str_compare(const SoapStr &s, const char *str);
+long soap_str_int(const SoapStr &s);
+float soap_str_float(const SoapStr &s);
+
+// Binary search for name in a table of count entries sorted by their name
+// member in strcmp() order. NULL if it isn't there.
+template <typename Entry>
+Entry *soap_lookup(Entry *table, int count, const SoapStr &name) {
+    int lo = 0, hi = count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int c = soap_str_compare(name, table[mid].name);
+        if (c == 0) return &table[mid];
+        if (c < 0) hi = mid - 1;
+        else lo = mid + 1;
+    }
+    return NULL;
+}
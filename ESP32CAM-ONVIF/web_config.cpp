@@ -12,6 +12,11 @@
 #include <SD_MMC.h>
 #include <ArduinoJson.h>
 #include "esp_camera.h"
+#include "frame_hub.h"
+#include "latency_stats.h"
+#include "metrics.h"
+#include "loop_profiler.h"
+#include "pcap_tap.h"
 #include "wifi_manager.h"
 #include "config.h"
 #include <Update.h>
@@ -31,6 +36,156 @@ bool isAuthenticated(WebServer &server) {
     return true;
 }
 
+// Print that sends a chunked HTTP response in small pieces, so large
+// responses never have to be assembled in one String
+class WebChunkPrint : public Print {
+public:
+    WebChunkPrint(WebServer &server) : _server(server), _len(0) {}
+    size_t write(uint8_t c) override {
+        _buf[_len++] = c;
+        if (_len == sizeof(_buf)) flush();
+        return 1;
+    }
+    size_t write(const uint8_t *data, size_t len) override {
+        if (_len + len <= sizeof(_buf)) {
+            memcpy(_buf + _len, data, len);
+            _len += len;
+        } else {
+            flush();
+            _server.sendContent((const char *) data, len);
+        }
+        return len;
+    }
+    void flush() {
+        if (_len) _server.sendContent(_buf, _len);
+        _len = 0;
+    }
+private:
+    WebServer &_server;
+    char _buf[512];
+    size_t _len;
+};
+
+// {"fb_get":{"counts":[...],"max_us":...},...} for one session or all (-1)
+static void latencyStagesJson(Print &out, int session) {
+    out.print('{');
+    for (int s = 0; s < LATENCY_STAGES; s++) {
+        LatencyHistogram h;
+        latency_histogram((LatencyStage) s, session, &h);
+        out.printf("%s\"%s\":{\"counts\":[", s > 0 ? "," : "", latency_stage_name((LatencyStage) s));
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            out.printf(b > 0 ? ",%u" : "%u", h.counts[b]);
+        }
+        out.printf("],\"max_us\":%u}", h.maxUs);
+    }
+    out.print('}');
+}
+
+// /api/latency: histograms of all sessions and the recent samples, several
+// kB, written piece by piece like /api/status
+static void latencyJson(Print &out) {
+    out.print("{\"buckets_us\":[");
+    // Upper bounds; the last bucket counts everything above the last bound
+    for (int b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        out.printf(b > 0 ? ",%u" : "%u", latency_bucket_limit_us(b));
+    }
+    out.print("],\"stages\":");
+    latencyStagesJson(out, -1);
+    out.print(",\"sessions\":[");
+    for (int i = 0; i < LATENCY_SESSIONS; i++) {
+        out.printf("%s{\"slot\":%d,\"multicast\":%s,\"stages\":", i > 0 ? "," : "", i,
+                   i == RTSP_MAX_CLIENTS ? "true" : "false");
+        latencyStagesJson(out, i);
+        out.print('}');
+    }
+    out.print("],\"recent\":[");
+    LatencySample samples[LATENCY_RING_SIZE];
+    int count = latency_recent(samples, LATENCY_RING_SIZE);
+    for (int i = 0; i < count; i++) {
+        out.printf("%s{\"slot\":%u,\"capture_ms\":%u", i > 0 ? "," : "", samples[i].session, samples[i].captureMs);
+        for (int s = 0; s < LATENCY_STAGES; s++) {
+            out.printf(",\"%s_us\":%u", latency_stage_name((LatencyStage) s), samples[i].stageUs[s]);
+        }
+        out.print('}');
+    }
+    out.print("]}");
+}
+
+// /api/status, written piece by piece: with a few RTSP sessions and all
+// loop subsystems it is several kB, too much to build up in a String
+static void statusJson(Print &out) {
+    out.printf("{\"status\":\"Online\",\"rtsp\":\"%s\",", getRTSPUrl().c_str());
+    out.printf("\"onvif\":\"http://%s:%d/onvif/device_service\",", WiFi.localIP().toString().c_str(), ONVIF_PORT);
+    out.printf("\"onvif_enabled\":%s,", onvif_is_enabled() ? "true" : "false");
+    out.printf("\"motion\":%s,", motion_detected() ? "true" : "false");
+    out.printf("\"recording\":%s,", sd_recorder_is_recording() ? "true" : "false");
+    out.printf("\"sd_mounted\":%s,", sd_recorder_is_mounted() ? "true" : "false");
+    out.printf("\"heap\":%u,", ESP.getFreeHeap());
+    out.printf("\"uptime\":%u,", millis() / 1000);
+    out.printf("\"autoflash\":%s,", auto_flash_is_enabled() ? "true" : "false");
+
+    RtpPacerStats pacing;
+    rtsp_server_pacing_stats(&pacing);
+    out.printf("\"rtsp_clients\":%d,", rtsp_server_client_count());
+    out.printf("\"multicast_viewers\":%d,", rtsp_server_multicast_viewers());
+    out.printf("\"pacing\":{\"kbps\":%u,\"burst\":%u,\"frames\":%u,\"packets\":%u,\"bytes\":%u,"
+               "\"writes\":%u,\"deferrals\":%u,\"last_frame_us\":%u,\"max_frame_us\":%u},",
+               rtsp_server_pacing_kbps(), rtsp_server_pacing_burst(), pacing.frames, pacing.packets,
+               pacing.bytes, pacing.writes, pacing.deferrals, pacing.lastFrameUs, pacing.maxFrameUs);
+
+    RtspFrameTiming timing;
+    rtsp_server_frame_timing(&timing);
+    out.printf("\"frame_timing\":{\"frames\":%u,\"dropped\":%u,\"interval_us\":%u,\"jitter_us\":%u,"
+               "\"max_jitter_us\":%u,\"missed_deadlines\":%u,\"late_starts\":%u,"
+               "\"first_frame_ms\":%u,\"max_first_frame_ms\":%u},",
+               timing.frames, timing.dropped, timing.intervalUs, timing.jitterUs, timing.maxJitterUs,
+               timing.missedDeadlines, timing.lateStarts, timing.firstFrameMs, timing.maxFirstFrameMs);
+    out.printf("\"capture\":{\"profile\":\"%s\",\"latency_ms\":%u,\"max_latency_ms\":%u},",
+               camera_profile_name(camera_profile()), timing.latencyMs, timing.maxLatencyMs);
+
+    FrameHubStats hub;
+    frame_hub_stats(&hub);
+    out.printf("\"frame_hub\":{\"captures\":%u,\"shared\":%u,\"rtsp\":%u,\"recorder\":%u,"
+               "\"snapshot\":%u,\"stream\":%u},",
+               hub.captures, hub.shared, hub.frames[FRAME_HUB_RTSP], hub.frames[FRAME_HUB_RECORDER],
+               hub.frames[FRAME_HUB_SNAPSHOT], hub.frames[FRAME_HUB_STREAM]);
+
+    out.print("\"sessions\":[");
+    bool firstSession = true;
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        RtcpStats rtcp;
+        RtpDropStats drops;
+        if (!rtsp_server_rtcp_stats(i, &rtcp)) continue;
+        rtsp_server_drop_stats(i, &drops);
+        if (!firstSession) out.print(",");
+        firstSession = false;
+        out.printf("{\"slot\":%d,\"sr_sent\":%u,\"reports\":%u,\"fraction_lost\":%.1f,\"lost\":%d,"
+                   "\"jitter_ms\":%.1f,\"rtt_ms\":%u,\"dropped_frames\":%u,\"tcp_stalls\":%u,"
+                   "\"backlog_bytes\":%u,\"max_backlog_bytes\":%u}",
+                   i, rtcp.srSent, rtcp.reports, rtcp.fractionLost * 100.0f / 256.0f, rtcp.cumulativeLost,
+                   rtcp.jitter / 90.0f, rtcp.rttMs, drops.droppedFrames, drops.stalls,
+                   drops.backlogBytes, drops.maxBacklogBytes);
+    }
+    out.print("],");
+
+    PcapTapStats capture;
+    pcap_tap_stats(&capture);
+    out.printf("\"pcap\":{\"active\":%s,\"packets\":%u,\"bytes\":%u,\"overwritten\":%u},",
+               pcapTapActive ? "true" : "false", capture.packets, capture.bytes, capture.overwritten);
+
+    out.print("\"loop\":[");
+    for (int i = 0; i < LOOP_SUBSYSTEMS; i++) {
+        LoopProfile p;
+        loop_profiler_get((LoopSubsystem) i, &p);
+        if (i > 0) out.print(",");
+        out.printf("{\"name\":\"%s\",\"calls\":%u,\"min_us\":%u,\"avg_us\":%u,\"max_us\":%u,"
+                   "\"p99_us\":%u,\"budget_us\":%u,\"overruns\":%u}",
+                   loop_subsystem_name((LoopSubsystem) i), p.calls, p.minUs, p.avgUs, p.maxUs,
+                   p.p99Us, p.budgetUs, p.overruns);
+    }
+    out.print("]}");
+}
+
 void web_config_start() {
     // SPIFFS no longer required for index.html, but still needed for SD/Config persistence if used
     if (!SPIFFS.begin(true)) {
@@ -48,19 +203,12 @@ void web_config_start() {
     // --- API ENDPOINTS ---
     webConfigServer.on("/api/status", HTTP_GET, []() {
         if (!isAuthenticated(webConfigServer)) return;
-        String json = "{";
-        json += "\"status\":\"Online\",";
-        json += "\"rtsp\":\"" + getRTSPUrl() + "\",";
-        json += "\"onvif\":\"http://" + WiFi.localIP().toString() + ":" + String(ONVIF_PORT) + "/onvif/device_service\",";
-        json += "\"onvif_enabled\":" + String(onvif_is_enabled() ? "true" : "false") + ",";
-        json += "\"motion\":" + String(motion_detected() ? "true" : "false") + ",";
-        json += "\"recording\":" + String(sd_recorder_is_recording() ? "true" : "false") + ",";
-        json += "\"sd_mounted\":" + String(sd_recorder_is_mounted() ? "true" : "false") + ",";
-        json += "\"heap\":" + String(ESP.getFreeHeap()) + ",";
-        json += "\"uptime\":" + String(millis() / 1000) + ",";
-        json += "\"autoflash\":" + String(auto_flash_is_enabled() ? "true" : "false");
-        json += "}";
-        webConfigServer.send(200, "application/json", json);
+        webConfigServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        webConfigServer.send(200, "application/json", "");
+        WebChunkPrint out(webConfigServer);
+        statusJson(out);
+        out.flush();
+        webConfigServer.sendContent("");   // end of the chunked response
     });
 
     // --- Change Camera Settings ---
@@ -77,6 +225,28 @@ void web_config_start() {
             // To change xclk, you must re-init the camera. Not recommended at runtime.
             // Save to config and apply on reboot if needed.
         }
+        if (doc.containsKey("capture_profile")) {
+            // Sets XCLK, buffer count and grab mode together, with a camera re-init
+            String name = doc["capture_profile"].as<String>();
+            CaptureProfile profile = camera_profile_from_name(name.c_str());
+            if (profile == CAPTURE_PROFILES) {
+                webConfigServer.send(400, "application/json", "{\"error\":\"Unknown capture profile\"}");
+                return;
+            }
+            if (!camera_set_profile(profile)) {
+                webConfigServer.send(503, "application/json", "{\"error\":\"Camera re-init failed\"}");
+                return;
+            }
+            rtsp_server_reset_latency();
+            s = esp_camera_sensor_get();
+        }
+        if (doc.containsKey("loop_budgets")) {
+            // {"loop_budgets": {"sd": 100, "web": 20}} in milliseconds
+            for (int i = 0; i < LOOP_SUBSYSTEMS; i++) {
+                JsonVariant ms = doc["loop_budgets"][loop_subsystem_name((LoopSubsystem) i)];
+                if (!ms.isNull()) loop_profiler_set_budget((LoopSubsystem) i, ms.as<uint32_t>() * 1000);
+            }
+        }
         if (doc.containsKey("resolution")) {
             String res = doc["resolution"].as<String>();
             if (res == "UXGA")      s->set_framesize(s, FRAMESIZE_UXGA);
@@ -107,9 +277,71 @@ void web_config_start() {
         if (doc.containsKey("hmirror"))     s->set_hmirror(s, doc["hmirror"]);
         if (doc.containsKey("vflip"))       s->set_vflip(s, doc["vflip"]);
         if (doc.containsKey("dcw"))         s->set_dcw(s, doc["dcw"]);
+        if (doc.containsKey("pace_kbps") || doc.containsKey("pace_burst")) {
+            uint32_t kbps  = rtsp_server_pacing_kbps();
+            uint32_t burst = rtsp_server_pacing_burst();
+            if (doc.containsKey("pace_kbps"))  kbps  = doc["pace_kbps"];
+            if (doc.containsKey("pace_burst")) burst = doc["pace_burst"];
+            if (kbps < 100) kbps = 100;             // keep at least a trickle going
+            if (burst < 1500) burst = 1500;         // one full packet must fit
+            rtsp_server_set_pacing(kbps, burst);
+        }
         webConfigServer.send(200, "application/json", "{\"ok\":1}");
     });
 
+    // --- Prometheus metrics ---
+    webConfigServer.on("/metrics", HTTP_GET, []() {
+        if (!isAuthenticated(webConfigServer)) return;
+        webConfigServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        webConfigServer.send(200, "text/plain; version=0.0.4", "");
+        WebChunkPrint out(webConfigServer);
+        metrics_write(out);
+        out.flush();
+        webConfigServer.sendContent("");   // end of the chunked response
+    });
+
+    // --- Frame latency per stage (see latency_stats.h) ---
+    webConfigServer.on("/api/latency", HTTP_GET, []() {
+        if (!isAuthenticated(webConfigServer)) return;
+        webConfigServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        webConfigServer.send(200, "application/json", "");
+        WebChunkPrint out(webConfigServer);
+        latencyJson(out);
+        out.flush();
+        webConfigServer.sendContent("");   // end of the chunked response
+    });
+
+    // --- Packet capture (see pcap_tap.h) ---
+    webConfigServer.on("/api/pcap/start", HTTP_POST, []() {
+        if (!isAuthenticated(webConfigServer)) return;
+        if (!pcap_tap_start(PCAP_RING_SIZE)) {
+            webConfigServer.send(503, "application/json", "{\"error\":\"No memory for the capture\"}");
+            return;
+        }
+        webConfigServer.send(200, "application/json", "{\"ok\":1}");
+    });
+    webConfigServer.on("/api/pcap/stop", HTTP_POST, []() {
+        if (!isAuthenticated(webConfigServer)) return;
+        pcap_tap_stop();
+        webConfigServer.send(200, "application/json", "{\"ok\":1}");
+    });
+    // Stops a running capture
+    webConfigServer.on("/api/pcap", HTTP_GET, []() {
+        if (!isAuthenticated(webConfigServer)) return;
+        pcap_tap_stop();
+        size_t size = pcap_tap_size();
+        if (size == 0) {
+            webConfigServer.send(404, "text/plain", "No capture");
+            return;
+        }
+        webConfigServer.sendHeader("Content-Disposition", "attachment; filename=\"capture.pcap\"");
+        webConfigServer.setContentLength(size);
+        webConfigServer.send(200, "application/vnd.tcpdump.pcap", "");
+        WebChunkPrint out(webConfigServer);
+        pcap_tap_write(out);
+        out.flush();
+    });
+
     // --- SD Card File List ---
     webConfigServer.on("/api/sd/list", HTTP_GET, []() {
         if (!isAuthenticated(webConfigServer)) return;
@@ -356,32 +588,23 @@ void web_config_start() {
         // Optimize TCP for streaming
         client.setTimeout(2); // Set low timeout for writes (2s) to prevent blocking
         
-        int64_t last_frame = 0;
-        const int frame_interval = 100; // 100ms = ~10 FPS
+        frame_hub_set_interval(FRAME_HUB_STREAM, 100); // 100ms = ~10 FPS
 
         while (client.connected()) {
             // CRITICAL: Feed the Watchdog Timer so the ESP32 doesn't reboot
             esp_task_wdt_reset();
             
             // Keep critical background tasks alive (God Loop Pattern)
-            rtsp_server_loop();   
+            // RTSP keeps streaming in its own task meanwhile
             onvif_server_loop();
             
-            int64_t now = esp_timer_get_time() / 1000;
-            if (now - last_frame < frame_interval) {
-                // Yield to allow WiFi stack to process
+            // Not due yet (or camera error): let the WiFi stack process
+            camera_fb_t *fb = frame_hub_get(FRAME_HUB_STREAM);
+            if (!fb) {
                 yield(); 
                 delay(10); // Sleep 10ms to save CPU
                 continue;
             }
-            last_frame = now;
-
-            camera_fb_t *fb = esp_camera_fb_get();
-            if (!fb) {
-                Serial.println("[WARN] Frame buffer failed");
-                delay(100);
-                continue;
-            }
             
             // Send buffer using chunked writes if needed, but client.write handles it.
             // Check if we can write to avoid stalling on full buffer
@@ -391,9 +614,10 @@ void web_config_start() {
             size_t wlen = client.write(fb->buf, fb->len);
             client.print("\r\n");
             
-            esp_camera_fb_return(fb); // Release immediately
+            size_t flen = fb->len;
+            frame_hub_release(fb); // Release immediately
             
-            if (wlen != fb->len) {
+            if (wlen != flen) {
                  Serial.println("[WARN] Stream write failed (Client disconnected?)");
                  break;
             }
@@ -405,14 +629,14 @@ void web_config_start() {
     // --- Snapshot endpoint ---
     webConfigServer.on("/snapshot", HTTP_GET, []() {
         if (!isAuthenticated(webConfigServer)) return;
-        camera_fb_t *fb = esp_camera_fb_get();
+        camera_fb_t *fb = frame_hub_get(FRAME_HUB_SNAPSHOT);
         if (!fb) {
             webConfigServer.send(500, "text/plain", "Camera Error");
             return;
         }
         webConfigServer.sendHeader("Content-Type", "image/jpeg");
         webConfigServer.send_P(200, "image/jpeg", (char*)fb->buf, fb->len);
-        esp_camera_fb_return(fb);
+        frame_hub_release(fb);
     });
 
     webConfigServer.begin();
@@ -3,6 +3,7 @@
 #include <SPIFFS.h>
 #include "config.h"
 #include "status_led.h"
+#include "metrics.h"
 
 // Global instance
 WiFiManager wifiManager;
@@ -31,6 +32,7 @@ void WiFiManager::loop() {
             // Force disconnect first to clear stuck states
             WiFi.disconnect();
             WiFi.reconnect();
+            metrics_add(metrics.wifiReconnects);
         }
         
         // 2. Fatal Timeout -> Reboot
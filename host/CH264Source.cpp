@@ -0,0 +1,77 @@
+#include "CH264Source.h"
+
+#include <stdio.h>
+
+size_t h264_next_nal(const uint8_t *data, size_t size, size_t pos, size_t *startCode)
+{
+    for (size_t i = pos; i + 3 <= size; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            *startCode = (i > pos && data[i - 1] == 0) ? i - 1 : i;
+            return i + 3;
+        }
+    }
+    *startCode = size;
+    return size;
+}
+
+CH264FileSource::CH264FileSource(const char *path) : m_Next(0)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        printf("Can't open %s\n", path);
+        return;
+    }
+    uint8_t buf[64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        m_Data.insert(m_Data.end(), buf, buf + n);
+    fclose(f);
+
+    const uint8_t *data = m_Data.data();
+    size_t size = m_Data.size();
+    size_t auStart = size;      // start code of the first NAL of the current unit
+    bool haveSlice = false;     // the current unit has its picture
+    bool idr = false;
+
+    size_t sc;
+    size_t nal = h264_next_nal(data, size, 0, &sc);
+    while (nal < size) {
+        size_t nextSc;
+        size_t next = h264_next_nal(data, size, nal, &nextSc);
+        uint8_t type = data[nal] & 0x1f;
+        bool slice = type >= 1 && type <= 5;
+        bool newPicture = slice ? nal + 1 < size && (data[nal + 1] & 0x80) : type == 6 || (type >= 7 && type <= 9);
+
+        if (haveSlice && newPicture) {
+            m_Units.push_back({ data + auStart, sc - auStart, idr });
+            auStart = size;
+            haveSlice = false;
+            idr = false;
+        }
+        if (auStart == size)
+            auStart = sc;
+        if (slice)
+            haveSlice = true;
+        if (type == 5)
+            idr = true;
+
+        sc = nextSc;
+        nal = next;
+    }
+    if (haveSlice)
+        m_Units.push_back({ data + auStart, size - auStart, idr });
+
+    if (m_Units.empty())
+        printf("No H.264 frames in %s\n", path);
+    else
+        printf("%s: %u frames\n", path, (unsigned) m_Units.size());
+}
+
+bool CH264FileSource::next(H264AccessUnit &au)
+{
+    if (m_Units.empty())
+        return false;
+    au = m_Units[m_Next];
+    m_Next = (m_Next + 1) % m_Units.size();
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// One encoded frame: NAL units in Annex B format (each behind a start code),
+// as the on-chip encoder hands them to H264Streamer
+struct H264AccessUnit
+{
+    const uint8_t *data;
+    size_t size;
+    bool idr;               // keyframe, SPS/PPS in front of it
+};
+
+// H.264 counterpart of CFrameSource for the host tools. Frames stay valid
+// as long as the source.
+class CH264Source
+{
+public:
+    virtual ~CH264Source() {}
+
+    // Next frame, in a loop. False if there are none.
+    virtual bool next(H264AccessUnit &au) = 0;
+};
+
+// Replays a raw H.264 elementary stream (e.g. "ffmpeg -i in.mp4 -an -c:v
+// libx264 -profile:v baseline -f h264 out.h264"). The file is split into
+// access units at access unit delimiters, parameter sets and SEI after a
+// slice, and at slices that start a new picture (first_mb_in_slice 0).
+class CH264FileSource : public CH264Source
+{
+public:
+    CH264FileSource(const char *path);
+
+    bool isOpen() const { return !m_Units.empty(); }
+    size_t frameCount() const { return m_Units.size(); }
+
+    virtual bool next(H264AccessUnit &au) override;
+
+private:
+    std::vector<uint8_t> m_Data;
+    std::vector<H264AccessUnit> m_Units;
+    size_t m_Next;
+};
+
+// Start of the next NAL unit (after its start code) at or after pos, or size
+// if there is none. *startCode is set to where its start code begins.
+size_t h264_next_nal(const uint8_t *data, size_t size, size_t pos, size_t *startCode);
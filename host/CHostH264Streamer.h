@@ -0,0 +1,12 @@
+#pragma once
+
+#include "CH264Streamer.h"
+
+// H.264 streamer for the host tools. Frames are handed to it with
+// beginAccessUnit(), streamImage() has nothing to grab.
+class CHostH264Streamer : public CH264Streamer
+{
+public:
+    CHostH264Streamer(SOCKET client) : CH264Streamer(client, 640, 480) {}
+    virtual void streamImage(uint32_t) override {}
+};
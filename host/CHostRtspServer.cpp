@@ -0,0 +1,278 @@
+#include "CHostRtspServer.h"
+#include "CHostH264Streamer.h"
+#include "MyStreamer.h"
+
+#include <fcntl.h>
+
+CHostRtspServer::CHostRtspServer(CFrameSource *jpeg, CH264Source *h264, const HostServerConfig &config)
+    : m_Jpeg(jpeg), m_H264(h264), m_Config(config), m_Listen(NULLSOCKET), m_Port(0),
+      m_Slots(config.maxClients), m_FrameInFlight(false), m_FrameStartMs(0),
+      m_NextFrameUs(0), m_ClockStarted(false), m_Frames(0), m_RetiredDrops(0)
+{
+    for (Slot &slot : m_Slots) {
+        slot.session = NULL;
+        slot.streamer = NULL;
+        slot.started = false;
+    }
+    memset(&m_Frame, 0, sizeof(m_Frame));
+    memset(&m_Retired, 0, sizeof(m_Retired));
+}
+
+CHostRtspServer::~CHostRtspServer()
+{
+    for (Slot &slot : m_Slots) {
+        delete slot.session;
+        delete slot.streamer;
+    }
+    closesocket(m_Listen);
+}
+
+bool CHostRtspServer::start(uint16_t port)
+{
+    m_Listen = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(m_Listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(m_Listen, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(m_Listen, 16) != 0) {
+        printf("Can't listen on port %u: %s\n", port, strerror(errno));
+        return false;
+    }
+    fcntl(m_Listen, F_SETFL, O_NONBLOCK);
+
+    socklen_t len = sizeof(addr);
+    getsockname(m_Listen, (sockaddr *) &addr, &len);
+    m_Port = ntohs(addr.sin_port);
+    return true;
+}
+
+CStreamer *CHostRtspServer::newStreamer(SOCKET client)
+{
+    CStreamer *streamer;
+    if (m_H264)
+        streamer = new CHostH264Streamer(client);
+    else {
+        streamer = new MyStreamer(*m_Jpeg);
+        streamer->setClientSocket(client);
+    }
+    streamer->setPacing(m_Config.paceKbps * 125, m_Config.paceBurst);
+    streamer->setTcpSegmentSize(m_Config.tcpSegment);
+    return streamer;
+}
+
+bool CHostRtspServer::streaming(const Slot &slot) const
+{
+    return slot.session && slot.session->m_streaming && !slot.session->m_stopped;
+}
+
+int CHostRtspServer::clientCount() const
+{
+    int count = 0;
+    for (const Slot &slot : m_Slots)
+        if (slot.session)
+            count++;
+    return count;
+}
+
+void CHostRtspServer::accept()
+{
+    SOCKET client = ::accept(m_Listen, NULL, NULL);
+    if (client < 0)
+        return;
+
+    for (Slot &slot : m_Slots) {
+        if (slot.session)
+            continue;
+        slot.streamer = newStreamer(client);
+        slot.session = new CRtspSession(client, slot.streamer);
+        slot.started = false;
+        return;
+    }
+
+    const char *busy = "RTSP/1.0 503 Service Unavailable\r\n\r\n";
+    send(client, busy, strlen(busy), MSG_NOSIGNAL);
+    closesocket(client);
+}
+
+void CHostRtspServer::beginFrame(uint32_t nowMs)
+{
+    uint32_t interval = 1000 / m_Config.fps;
+
+    if (m_H264) {
+        H264AccessUnit au;
+        if (!m_H264->next(au))
+            return;
+        for (Slot &slot : m_Slots) {
+            if (!streaming(slot))
+                continue;
+            CH264Streamer *streamer = (CH264Streamer *) slot.streamer;
+            if (!slot.started) {
+                // Like a new viewer on the ESP32 without a cached keyframe
+                slot.started = true;
+                streamer->resumeAtNextIDR();
+            }
+            streamer->beginAccessUnit(au.data, au.size, au.idr, nowMs, interval);
+        }
+    }
+    else {
+        if (!m_Jpeg->grab(m_Frame))
+            return;
+        JpegFrameInfo jpeg;
+        if (!parseJPEG(m_Frame.data, m_Frame.len, &jpeg)) {
+            m_Jpeg->release(m_Frame);
+            return;
+        }
+        for (Slot &slot : m_Slots) {
+            if (!streaming(slot))
+                continue;
+            slot.started = true;
+            slot.streamer->beginFrame(jpeg, m_Frame.timestampMs, interval);
+        }
+    }
+    m_FrameInFlight = true;
+    m_FrameStartMs = nowMs;
+    m_Frames++;
+}
+
+void CHostRtspServer::pump()
+{
+    if (!m_FrameInFlight)
+        return;
+
+    bool done = true;
+    for (Slot &slot : m_Slots) {
+        if (slot.streamer && slot.streamer->isFramePending() && !slot.session->m_stopped) {
+            if (!slot.streamer->pumpFrame())
+                done = false;
+        }
+    }
+    if (done) {
+        if (m_Jpeg)
+            m_Jpeg->release(m_Frame);
+        m_FrameInFlight = false;
+    }
+}
+
+void CHostRtspServer::dropLagging()
+{
+    for (Slot &slot : m_Slots) {
+        if (slot.streamer && slot.streamer->isFramePending())
+            slot.streamer->dropFrame();
+    }
+    if (m_Jpeg)
+        m_Jpeg->release(m_Frame);
+    m_FrameInFlight = false;
+}
+
+void CHostRtspServer::addTotals(const CStreamer *streamer)
+{
+    const RtpPacerStats &st = streamer->pacingStats();
+    m_Retired.frames    += st.frames;
+    m_Retired.packets   += st.packets;
+    m_Retired.bytes     += st.bytes;
+    m_Retired.writes    += st.writes;
+    m_Retired.copied    += st.copied;
+    m_Retired.deferrals += st.deferrals;
+    m_RetiredDrops += streamer->dropStats().droppedFrames;
+}
+
+void CHostRtspServer::removeStopped()
+{
+    for (Slot &slot : m_Slots) {
+        if (!slot.session || !slot.session->m_stopped)
+            continue;
+        addTotals(slot.streamer);
+        delete slot.session;    // closes the client socket
+        delete slot.streamer;   // closes the UDP ports
+        slot.session = NULL;
+        slot.streamer = NULL;
+    }
+}
+
+RtpPacerStats CHostRtspServer::pacingTotals() const
+{
+    RtpPacerStats total = m_Retired;
+    for (const Slot &slot : m_Slots) {
+        if (!slot.streamer)
+            continue;
+        const RtpPacerStats &st = slot.streamer->pacingStats();
+        total.frames    += st.frames;
+        total.packets   += st.packets;
+        total.bytes     += st.bytes;
+        total.writes    += st.writes;
+        total.copied    += st.copied;
+        total.deferrals += st.deferrals;
+        if (st.maxFrameUs > total.maxFrameUs)
+            total.maxFrameUs = st.maxFrameUs;
+    }
+    return total;
+}
+
+uint32_t CHostRtspServer::droppedFrames() const
+{
+    uint32_t drops = m_RetiredDrops;
+    for (const Slot &slot : m_Slots)
+        if (slot.streamer)
+            drops += slot.streamer->dropStats().droppedFrames;
+    return drops;
+}
+
+void CHostRtspServer::service()
+{
+    for (Slot &slot : m_Slots) {
+        if (slot.session)
+            slot.session->handleRequests(0);
+    }
+
+    pump();
+
+    uint32_t now = getMillis();
+    uint32_t interval = 1000 / m_Config.fps;
+    if (m_FrameInFlight && now - m_FrameStartMs > 2 * interval)
+        dropLagging();
+
+    bool anyStreaming = false;
+    for (const Slot &slot : m_Slots)
+        anyStreaming |= streaming(slot);
+
+    // Fixed frame clock, deadlines missed while a frame was busy are skipped
+    uint32_t nowUs = getMicros();
+    if (!anyStreaming)
+        m_ClockStarted = false;
+    else if (!m_FrameInFlight) {
+        if (!m_ClockStarted) {
+            m_NextFrameUs = nowUs;
+            m_ClockStarted = true;
+        }
+        if ((int32_t) (nowUs - m_NextFrameUs) >= 0) {
+            m_NextFrameUs += ((nowUs - m_NextFrameUs) / (interval * 1000) + 1) * interval * 1000;
+            beginFrame(now);
+            pump();
+        }
+    }
+
+    for (Slot &slot : m_Slots) {
+        if (streaming(slot))
+            slot.streamer->serviceRtcp(now);
+    }
+
+    removeStopped();
+    accept();
+}
+
+void CHostRtspServer::run(volatile bool *stop)
+{
+    while (!*stop) {
+        service();
+        if (m_FrameInFlight) {
+            usleep(200);    // waiting for pacer tokens
+            continue;
+        }
+        int32_t wait = m_ClockStarted ? (int32_t) (m_NextFrameUs - getMicros()) : 2000;
+        usleep(wait > 2000 ? 2000 : wait > 0 ? wait : 0);
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "CRtspSession.h"
+#include "CFrameSource.h"
+#include "CH264Source.h"
+
+#include <vector>
+
+struct HostServerConfig
+{
+    int maxClients;             // more get a 503
+    uint32_t fps;
+    uint32_t paceKbps;          // per client, raised per frame to finish within 3/4 of the interval
+    uint32_t paceBurst;
+    uint32_t tcpSegment;        // see CStreamer::setTcpSegmentSize()
+};
+
+// Same as RTSP_MAX_CLIENTS etc. in config.h, the host build doesn't include it
+#define HOST_SERVER_DEFAULTS { 8, 20, 8000, 8192, 2872 }
+
+// RTSP server for a PC, built like rtsp_server.cpp on the ESP32: every client
+// has its own CRtspSession and streamer, each frame is taken from the source
+// (and a JPEG parsed) once and paced out to all clients that are playing.
+// Frames are taken on a fixed frame clock; a client still busy with the
+// previous frame when the next one is due loses the rest of it. Everything
+// runs in the thread that calls service().
+class CHostRtspServer
+{
+public:
+    // Serves MJPEG at /mjpeg/1 from jpeg, or H.264 at /h264/1 from h264
+    CHostRtspServer(CFrameSource *jpeg, CH264Source *h264, const HostServerConfig &config);
+    ~CHostRtspServer();
+
+    // Listen on port (0 picks a free one, see port())
+    bool start(uint16_t port);
+    uint16_t port() const { return m_Port; }
+    const char *path() const { return m_H264 ? "h264/1" : "mjpeg/1"; }
+
+    // One pass over all the work, never blocks
+    void service();
+    // service() until *stop is set, sleeping while there is nothing to send
+    void run(volatile bool *stop);
+
+    int clientCount() const;
+    uint32_t framesCaptured() const { return m_Frames; }
+    // Sum over all clients, including those that have left
+    RtpPacerStats pacingTotals() const;
+    uint32_t droppedFrames() const;
+
+private:
+    struct Slot {
+        CRtspSession *session;
+        CStreamer *streamer;
+        bool started;           // PLAY seen and set up for its first frame
+    };
+
+    CStreamer *newStreamer(SOCKET client);
+    bool streaming(const Slot &slot) const;
+    void accept();
+    void beginFrame(uint32_t nowMs);
+    void pump();
+    void dropLagging();
+    void removeStopped();
+    void addTotals(const CStreamer *streamer);
+
+    CFrameSource *m_Jpeg;
+    CH264Source *m_H264;
+    HostServerConfig m_Config;
+    SOCKET m_Listen;
+    uint16_t m_Port;
+    std::vector<Slot> m_Slots;
+
+    bool m_FrameInFlight;
+    SourceFrame m_Frame;
+    uint32_t m_FrameStartMs;
+    uint32_t m_NextFrameUs;     // frame clock deadline
+    bool m_ClockStarted;
+    uint32_t m_Frames;
+
+    RtpPacerStats m_Retired;    // what disconnected clients had sent
+    uint32_t m_RetiredDrops;
+};
@@ -0,0 +1,165 @@
+#include "CRtpDepacketizer.h"
+
+#include <string.h>
+
+CRtpDepacketizer::CRtpDepacketizer()
+    : m_Started(false), m_FirstSeq(0), m_NextSeq(0), m_Ssrc(0), m_Timestamp(0), m_InFrame(false), m_Broken(false)
+{
+    memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+bool CRtpDepacketizer::push(const uint8_t *pkt, size_t len)
+{
+    if (len < 12 || (pkt[0] & 0xc0) != 0x80)
+        return false;
+
+    size_t hdrLen = 12 + 4 * (pkt[0] & 0x0f);        // CSRCs
+    if ((pkt[0] & 0x10) && hdrLen + 4 <= len)        // header extension
+        hdrLen += 4 + 4 * ((pkt[hdrLen + 2] << 8) | pkt[hdrLen + 3]);
+    if ((pkt[0] & 0x20) && len > hdrLen)             // padding
+        len -= pkt[len - 1];
+    if (hdrLen > len)
+        return false;
+
+    bool marker = pkt[1] & 0x80;
+    uint16_t seq = (pkt[2] << 8) | pkt[3];
+    uint32_t timestamp = ((uint32_t) pkt[4] << 24) | (pkt[5] << 16) | (pkt[6] << 8) | pkt[7];
+    uint32_t ssrc = ((uint32_t) pkt[8] << 24) | (pkt[9] << 16) | (pkt[10] << 8) | pkt[11];
+
+    if (!m_Started) {
+        m_Started = true;
+        m_FirstSeq = seq;
+        m_NextSeq = seq;
+        m_Ssrc = ssrc;
+    }
+    int16_t gap = (int16_t) (seq - m_NextSeq);
+    if (gap < 0) {
+        m_Stats.late++;
+        return false;
+    }
+    if (gap > 0) {
+        m_Stats.lost += gap;
+        if (m_InFrame)
+            m_Broken = true;
+    }
+    m_NextSeq = seq + 1;
+    m_Stats.packets++;
+    m_Stats.bytes += len - hdrLen;
+
+    // The marker packet of the previous frame went missing
+    if (m_InFrame && timestamp != m_Timestamp) {
+        m_Stats.errors++;
+        m_InFrame = false;
+    }
+
+    bool first = !m_InFrame;
+    if (first) {
+        m_Frame.clear();
+        m_InFrame = true;
+        m_Broken = false;           // payload() sees if the gap took its start
+        m_Timestamp = timestamp;
+    }
+    if (!m_Broken && !payload(pkt + hdrLen, len - hdrLen, first))
+        m_Broken = true;
+
+    if (!marker)
+        return false;
+    m_InFrame = false;
+    if (m_Broken) {
+        m_Stats.errors++;
+        return false;
+    }
+    m_Stats.frames++;
+    return true;
+}
+
+bool CJpegDepacketizer::payload(const uint8_t *data, size_t len, bool first)
+{
+    if (len < 8)
+        return false;
+    uint32_t offset = (data[1] << 16) | (data[2] << 8) | data[3];
+    uint8_t type = data[4];
+    uint8_t q = data[5];
+    size_t hdrLen = 8;
+
+    if (type >= 64 && type <= 127)                   // restart marker header
+        hdrLen += 4;
+    if (q >= 128 && offset == 0) {                   // quantization table header
+        if (len < hdrLen + 4)
+            return false;
+        hdrLen += 4 + ((data[hdrLen + 2] << 8) | data[hdrLen + 3]);
+    }
+    if (hdrLen > len)
+        return false;
+
+    if (first) {
+        m_Width = data[6] * 8;
+        m_Height = data[7] * 8;
+        m_Type = type;
+        m_QTables = q >= 128;
+    }
+    if (offset != m_Frame.size())
+        return false;                                // a fragment is missing
+    m_Frame.insert(m_Frame.end(), data + hdrLen, data + len);
+    return true;
+}
+
+void CH264Depacketizer::appendNal(const uint8_t *nal, size_t len)
+{
+    static const uint8_t startCode[] = { 0, 0, 0, 1 };
+    m_Frame.insert(m_Frame.end(), startCode, startCode + 4);
+    m_Frame.insert(m_Frame.end(), nal, nal + len);
+    if ((nal[0] & 0x1f) == 5)
+        m_Idr = true;
+}
+
+bool CH264Depacketizer::payload(const uint8_t *data, size_t len, bool first)
+{
+    if (first) {
+        m_InFu = false;
+        m_Idr = false;
+    }
+    if (len < 1)
+        return false;
+
+    uint8_t type = data[0] & 0x1f;
+    if (type >= 1 && type <= 23) {                   // Single NAL unit
+        if (m_InFu)
+            return false;
+        appendNal(data, len);
+        return true;
+    }
+    if (type == 24) {                                // STAP-A
+        if (m_InFu)
+            return false;
+        for (size_t i = 1; i + 2 <= len; ) {
+            size_t n = (data[i] << 8) | data[i + 1];
+            i += 2;
+            if (n == 0 || i + n > len)
+                return false;
+            appendNal(data + i, n);
+            i += n;
+        }
+        return true;
+    }
+    if (type == 28) {                                // FU-A
+        if (len < 2)
+            return false;
+        bool start = data[1] & 0x80;
+        bool end = data[1] & 0x40;
+        if (start) {
+            if (m_InFu)
+                return false;
+            uint8_t header = (data[0] & 0xe0) | (data[1] & 0x1f);
+            appendNal(&header, 1);
+            m_InFu = true;
+        }
+        else if (!m_InFu)
+            return false;                            // the start fragment is missing
+        m_Frame.insert(m_Frame.end(), data + 2, data + len);
+        if (end)
+            m_InFu = false;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// What a receiver saw of one RTP stream
+struct RtpReceiveStats
+{
+    uint32_t packets;           // accepted, in sequence order
+    uint32_t bytes;             // RTP payload bytes of those
+    uint32_t lost;              // sequence numbers that never arrived
+    uint32_t late;              // out of order or duplicate, dropped
+    uint32_t frames;            // frames reassembled
+    uint32_t errors;            // frames that could not be reassembled
+};
+
+// Reassembles frames from RTP packets. Packets have to arrive in order;
+// late ones are dropped, and a frame with a missing or malformed packet is
+// counted as an error instead of being handed out.
+class CRtpDepacketizer
+{
+public:
+    CRtpDepacketizer();
+    virtual ~CRtpDepacketizer() {}
+
+    // One RTP packet, without any interleave header. Returns true if it
+    // completed a frame, which is then in frame() until the next call.
+    bool push(const uint8_t *pkt, size_t len);
+
+    const std::vector<uint8_t> &frame() const { return m_Frame; }
+    uint32_t frameTimestamp() const { return m_Timestamp; }
+    // Sequence number of the first packet received, for RTP-Info checks
+    bool started() const { return m_Started; }
+    uint16_t firstSeq() const { return m_FirstSeq; }
+    uint32_t ssrc() const { return m_Ssrc; }
+    const RtpReceiveStats &stats() const { return m_Stats; }
+
+protected:
+    // Append the payload of the next packet of the frame to m_Frame. first is
+    // set for the first packet after the previous frame ended. Returns false
+    // if the packet doesn't fit where the frame is (missing fragments).
+    virtual bool payload(const uint8_t *data, size_t len, bool first) = 0;
+
+    std::vector<uint8_t> m_Frame;
+
+private:
+    RtpReceiveStats m_Stats;
+    bool m_Started;
+    uint16_t m_FirstSeq;
+    uint16_t m_NextSeq;
+    uint32_t m_Ssrc;
+    uint32_t m_Timestamp;
+    bool m_InFrame;             // packets of a frame arrived, no marker yet
+    bool m_Broken;              // the current frame lost a packet
+};
+
+// RFC 2435. The frame is the entropy coded scan, which is what CStreamer
+// sends of a JPEG, so it can be compared with parseJPEG()'s scan.
+class CJpegDepacketizer : public CRtpDepacketizer
+{
+public:
+    CJpegDepacketizer() : m_Width(0), m_Height(0), m_Type(0), m_QTables(false) {}
+
+    unsigned width() const { return m_Width; }
+    unsigned height() const { return m_Height; }
+    uint8_t type() const { return m_Type; }
+    bool hasQuantTables() const { return m_QTables; }     // in-band tables (Q >= 128)
+
+protected:
+    virtual bool payload(const uint8_t *data, size_t len, bool first) override;
+
+private:
+    unsigned m_Width;
+    unsigned m_Height;
+    uint8_t m_Type;
+    bool m_QTables;
+};
+
+// RFC 6184 (Single NAL unit, STAP-A and FU-A packets). The frame is the
+// access unit in Annex B format with 4 byte start codes.
+class CH264Depacketizer : public CRtpDepacketizer
+{
+public:
+    CH264Depacketizer() : m_InFu(false), m_Idr(false) {}
+
+    bool isIdr() const { return m_Idr; }
+
+protected:
+    virtual bool payload(const uint8_t *data, size_t len, bool first) override;
+
+private:
+    void appendNal(const uint8_t *nal, size_t len);
+
+    bool m_InFu;                // between FU-A start and end
+    bool m_Idr;
+};
@@ -0,0 +1,320 @@
+#include "CRtspClient.h"
+#include "platglue.h"
+
+#include <netdb.h>
+#include <strings.h>
+
+#define RTP_RECV_BUFFER (4 * 1024 * 1024)   // a few frames of every client, loss should mean the server dropped it
+
+static RtpReceiveStats noStats;
+
+std::string rtsp_header(const std::string &response, const char *name)
+{
+    size_t nameLen = strlen(name);
+    size_t pos = response.find("\r\n");
+    while (pos != std::string::npos) {
+        pos += 2;
+        size_t end = response.find("\r\n", pos);
+        if (end == std::string::npos || end == pos)
+            break;
+        if (end - pos > nameLen && response[pos + nameLen] == ':' &&
+            strncasecmp(response.c_str() + pos, name, nameLen) == 0) {
+            size_t v = pos + nameLen + 1;
+            while (v < end && response[v] == ' ')
+                v++;
+            return response.substr(v, end - v);
+        }
+        pos = end;
+    }
+    return "";
+}
+
+CRtspClient::CRtspClient()
+    : m_Rtsp(-1), m_Rtp(-1), m_Rtcp(-1), m_Tcp(false), m_H264(false), m_Closed(false), m_CSeq(1),
+      m_Depacketizer(NULL), m_PlayUs(0), m_FirstFrameUs(0), m_RtpInfoSeq(-1),
+      m_SdpWidth(0), m_SdpHeight(0), m_RtcpPackets(0)
+{
+}
+
+CRtspClient::~CRtspClient()
+{
+    close();
+    delete m_Depacketizer;
+}
+
+const RtpReceiveStats &CRtspClient::stats() const
+{
+    return m_Depacketizer ? m_Depacketizer->stats() : noStats;
+}
+
+bool CRtspClient::fail(const std::string &what)
+{
+    m_Error = what;
+    return false;
+}
+
+bool CRtspClient::connectTo(const std::string &host, uint16_t port, int timeoutMs)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), NULL, &hints, &res) != 0)
+        return fail("can't resolve " + host);
+
+    sockaddr_in addr = *(sockaddr_in *) res->ai_addr;
+    freeaddrinfo(res);
+    addr.sin_port = htons(port);
+
+    m_Rtsp = socket(AF_INET, SOCK_STREAM, 0);
+    struct timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(m_Rtsp, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int size = RTP_RECV_BUFFER;
+    setsockopt(m_Rtsp, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (::connect(m_Rtsp, (sockaddr *) &addr, sizeof(addr)) != 0)
+        return fail(std::string("connect: ") + strerror(errno));
+    return true;
+}
+
+// Any two ports will do, the server takes both from client_port
+bool CRtspClient::bindUdpPorts()
+{
+    int *socks[2] = { &m_Rtp, &m_Rtcp };
+    for (int i = 0; i < 2; i++) {
+        *socks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        if (bind(*socks[i], (sockaddr *) &addr, sizeof(addr)) != 0)
+            return fail(std::string("bind: ") + strerror(errno));
+    }
+    int size = RTP_RECV_BUFFER;
+    setsockopt(m_Rtp, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    return true;
+}
+
+static uint16_t local_port(int sock)
+{
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(sock, (sockaddr *) &addr, &len);
+    return ntohs(addr.sin_port);
+}
+
+bool CRtspClient::open(const char *url, bool tcp, int timeoutMs)
+{
+    m_Url = url;
+    m_Tcp = tcp;
+
+    // rtsp://host[:port]/path
+    if (strncmp(url, "rtsp://", 7) != 0)
+        return fail("not an rtsp:// URL");
+    std::string rest = url + 7;
+    std::string hostPort = rest.substr(0, rest.find('/'));
+    std::string host = hostPort.substr(0, hostPort.find(':'));
+    uint16_t port = 554;
+    if (hostPort.find(':') != std::string::npos)
+        port = atoi(hostPort.c_str() + hostPort.find(':') + 1);
+    if (!connectTo(host, port, timeoutMs))
+        return false;
+
+    std::string response, sdp;
+    if (!request("OPTIONS", m_Url, "", timeoutMs, &response, NULL))
+        return false;
+    if (!request("DESCRIBE", m_Url, "Accept: application/sdp\r\n", timeoutMs, &response, &sdp))
+        return false;
+
+    if (sdp.find("H264/90000") != std::string::npos) {
+        m_H264 = true;
+        m_Depacketizer = new CH264Depacketizer();
+    }
+    else if (sdp.find("JPEG/90000") != std::string::npos) {
+        m_Depacketizer = new CJpegDepacketizer();
+        size_t fmtp = sdp.find("a=fmtp:26 ");
+        if (fmtp != std::string::npos)
+            sscanf(sdp.c_str() + fmtp, "a=fmtp:26 width=%u;height=%u", &m_SdpWidth, &m_SdpHeight);
+    }
+    else
+        return fail("no MJPEG or H.264 stream in the SDP");
+
+    // The track URL: Content-Base plus the media's a=control
+    std::string base = rtsp_header(response, "Content-Base");
+    if (base.empty())
+        base = m_Url + "/";
+    std::string control = "track1";
+    size_t media = sdp.find("m=video");
+    size_t ctl = sdp.find("a=control:", media == std::string::npos ? 0 : media);
+    if (ctl != std::string::npos)
+        control = sdp.substr(ctl + 10, sdp.find_first_of("\r\n", ctl) - ctl - 10);
+    std::string trackUrl = control.compare(0, 7, "rtsp://") == 0 ? control : base + control;
+
+    char transport[128];
+    if (m_Tcp)
+        snprintf(transport, sizeof(transport), "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+    else {
+        if (!bindUdpPorts())
+            return false;
+        snprintf(transport, sizeof(transport), "Transport: RTP/AVP;unicast;client_port=%u-%u\r\n",
+                 local_port(m_Rtp), local_port(m_Rtcp));
+    }
+    if (!request("SETUP", trackUrl, transport, timeoutMs, &response, NULL))
+        return false;
+    m_Session = rtsp_header(response, "Session");
+    m_Session = m_Session.substr(0, m_Session.find(';'));
+    if (m_Session.empty())
+        return fail("SETUP response without a session");
+
+    m_PlayUs = getMicros();
+    if (!request("PLAY", m_Url, "Range: npt=0.000-\r\n", timeoutMs, &response, NULL))
+        return false;
+    std::string rtpInfo = rtsp_header(response, "RTP-Info");
+    size_t seq = rtpInfo.find("seq=");
+    if (seq != std::string::npos)
+        m_RtpInfoSeq = atoi(rtpInfo.c_str() + seq + 4);
+    return true;
+}
+
+void CRtspClient::close()
+{
+    if (m_Rtsp >= 0 && !m_Session.empty() && !m_Closed) {
+        // The server doesn't answer TEARDOWN, it just closes the connection
+        char req[256];
+        snprintf(req, sizeof(req), "TEARDOWN %s RTSP/1.0\r\nCSeq: %u\r\nSession: %s\r\n\r\n",
+                 m_Url.c_str(), m_CSeq++, m_Session.c_str());
+        send(m_Rtsp, req, strlen(req), MSG_NOSIGNAL);
+    }
+    if (m_Rtsp >= 0)
+        ::close(m_Rtsp);
+    if (m_Rtp >= 0)
+        ::close(m_Rtp);
+    if (m_Rtcp >= 0)
+        ::close(m_Rtcp);
+    m_Rtsp = m_Rtp = m_Rtcp = -1;
+    m_Session.clear();
+}
+
+bool CRtspClient::request(const char *method, const std::string &url, const std::string &headers,
+                          int timeoutMs, std::string *response, std::string *body)
+{
+    std::string req = std::string(method) + " " + url + " RTSP/1.0\r\n";
+    req += "CSeq: " + std::to_string(m_CSeq++) + "\r\n";
+    if (!m_Session.empty())
+        req += "Session: " + m_Session + "\r\n";
+    req += "User-Agent: rtsp-host-client\r\n" + headers + "\r\n";
+    if (send(m_Rtsp, req.data(), req.size(), MSG_NOSIGNAL) != (ssize_t) req.size())
+        return fail(std::string(method) + ": send failed");
+
+    uint32_t start = getMillis();
+    response->clear();
+    while (!consume(response, body)) {
+        int left = timeoutMs - (int) (getMillis() - start);
+        if (left <= 0 || !fill(left))
+            return fail(std::string(method) + ": no response");
+    }
+    if (response->compare(0, 12, "RTSP/1.0 200") != 0)
+        return fail(std::string(method) + ": " + response->substr(0, response->find('\r')));
+    return true;
+}
+
+bool CRtspClient::fill(int timeoutMs)
+{
+    struct pollfd p;
+    p.fd = m_Rtsp;
+    p.events = POLLIN;
+    if (::poll(&p, 1, timeoutMs) <= 0)
+        return false;
+
+    char buf[16 * 1024];
+    ssize_t n = recv(m_Rtsp, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        m_Closed = true;
+        return false;
+    }
+    if (n > 0)
+        m_Buf.append(buf, n);
+    return true;
+}
+
+bool CRtspClient::consume(std::string *response, std::string *body)
+{
+    size_t pos = 0;
+    bool done = false;
+    while (pos < m_Buf.size() && !done) {
+        const uint8_t *p = (const uint8_t *) m_Buf.data() + pos;
+        size_t avail = m_Buf.size() - pos;
+
+        if (p[0] == '$') {
+            if (avail < 4)
+                break;
+            size_t len = (p[2] << 8) | p[3];
+            if (avail < 4 + len)
+                break;
+            if (p[1] == 0)
+                rtpPacket(p + 4, len);
+            else
+                m_RtcpPackets++;
+            pos += 4 + len;
+            continue;
+        }
+
+        size_t hdrEnd = m_Buf.find("\r\n\r\n", pos);
+        if (hdrEnd == std::string::npos)
+            break;
+        std::string headers = m_Buf.substr(pos, hdrEnd + 4 - pos);
+        size_t contentLength = atoi(rtsp_header(headers, "Content-Length").c_str());
+        if (hdrEnd + 4 + contentLength > m_Buf.size())
+            break;
+        if (response) {
+            *response = headers;
+            if (body)
+                *body = m_Buf.substr(hdrEnd + 4, contentLength);
+            done = true;
+        }
+        pos = hdrEnd + 4 + contentLength;
+    }
+    m_Buf.erase(0, pos);
+    return done;
+}
+
+void CRtspClient::rtpPacket(const uint8_t *data, size_t len)
+{
+    if (!m_Depacketizer || !m_Depacketizer->push(data, len))
+        return;
+    if (m_FirstFrameUs == 0)
+        m_FirstFrameUs = getMicros();
+    if (m_OnFrame)
+        m_OnFrame(*m_Depacketizer);
+}
+
+bool CRtspClient::poll()
+{
+    if (m_Rtsp < 0 || m_Closed)
+        return false;
+
+    if (m_Rtp >= 0) {
+        uint8_t buf[2048];
+        ssize_t n;
+        while ((n = recv(m_Rtp, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+            rtpPacket(buf, n);
+        while (recv(m_Rtcp, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+            m_RtcpPackets++;
+    }
+
+    // Interleaved packets, keep-alive responses or the server closing
+    while (fill(0))
+        consume(NULL, NULL);
+    return !m_Closed;
+}
+
+void CRtspClient::wait(int timeoutMs)
+{
+    struct pollfd p[2];
+    p[0].fd = m_Rtsp;
+    p[0].events = POLLIN;
+    p[1].fd = m_Rtp;
+    p[1].events = POLLIN;
+    ::poll(p, m_Rtp >= 0 ? 2 : 1, timeoutMs);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "CRtpDepacketizer.h"
+
+#include <stdint.h>
+#include <string>
+#include <functional>
+
+// Minimal RTSP/RTP client for the host tools: OPTIONS, DESCRIBE, SETUP
+// (UDP or interleaved TCP) and PLAY against one stream, then reassembles
+// the MJPEG or H.264 frames it receives. Requests are answered in turn; once
+// playing, poll() reads whatever has arrived without blocking, so one thread
+// can drive many clients.
+class CRtspClient
+{
+public:
+    CRtspClient();
+    ~CRtspClient();
+
+    // Connect to url ("rtsp://host:port/mjpeg/1") and start playing. The
+    // codec comes from the SDP. Returns false with error() set on failure.
+    bool open(const char *url, bool tcp, int timeoutMs = 2000);
+    // TEARDOWN and close the connection
+    void close();
+
+    // Read what has arrived on the RTSP and RTP sockets. Returns false once
+    // the server closed the connection.
+    bool poll();
+    // Block until there is something to read or timeoutMs passed
+    void wait(int timeoutMs);
+
+    // Called for every reassembled frame
+    void onFrame(std::function<void(const CRtpDepacketizer &)> handler) { m_OnFrame = handler; }
+
+    bool isH264() const { return m_H264; }
+    bool isTcp() const { return m_Tcp; }
+    const std::string &error() const { return m_Error; }
+    const CRtpDepacketizer *depacketizer() const { return m_Depacketizer; }
+    const RtpReceiveStats &stats() const;
+
+    // getMicros() when PLAY was sent and when the first frame was complete (0 until then)
+    uint32_t playUs() const { return m_PlayUs; }
+    uint32_t firstFrameUs() const { return m_FirstFrameUs; }
+    // seq= of the RTP-Info header in the PLAY response, -1 if there was none
+    int rtpInfoSeq() const { return m_RtpInfoSeq; }
+    // SDP a=fmtp width/height for MJPEG, 0 if not announced
+    unsigned sdpWidth() const { return m_SdpWidth; }
+    unsigned sdpHeight() const { return m_SdpHeight; }
+    uint32_t rtcpPackets() const { return m_RtcpPackets; }
+
+    int rtspSocket() const { return m_Rtsp; }
+    int rtpSocket() const { return m_Rtp; }
+
+private:
+    bool fail(const std::string &what);
+    bool connectTo(const std::string &host, uint16_t port, int timeoutMs);
+    bool bindUdpPorts();
+    // Send a request and wait for its response. Interleaved data that arrives
+    // in the meantime goes to the depacketizer.
+    bool request(const char *method, const std::string &url, const std::string &headers,
+                 int timeoutMs, std::string *response, std::string *body);
+    bool fill(int timeoutMs);               // append to m_Buf, false on timeout or close
+    // Handle complete '$' frames at the start of m_Buf, and the response headers
+    // if one is there (returned in *response). Returns false if more data is needed.
+    bool consume(std::string *response, std::string *body);
+    void rtpPacket(const uint8_t *data, size_t len);
+
+    int m_Rtsp;
+    int m_Rtp;
+    int m_Rtcp;
+    bool m_Tcp;
+    bool m_H264;
+    bool m_Closed;
+    unsigned m_CSeq;
+    std::string m_Url;
+    std::string m_Session;
+    std::string m_Error;
+    std::string m_Buf;                      // received on the RTSP connection, not handled yet
+
+    CRtpDepacketizer *m_Depacketizer;
+    std::function<void(const CRtpDepacketizer &)> m_OnFrame;
+
+    uint32_t m_PlayUs;
+    uint32_t m_FirstFrameUs;
+    int m_RtpInfoSeq;
+    unsigned m_SdpWidth;
+    unsigned m_SdpHeight;
+    uint32_t m_RtcpPackets;
+};
+
+// Value of header name in an RTSP response, empty if it isn't there
+std::string rtsp_header(const std::string &response, const char *name);
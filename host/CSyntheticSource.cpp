@@ -0,0 +1,115 @@
+#include "CSyntheticSource.h"
+
+#define SYNTHETIC_FRAMES 8
+
+// xorshift, the frames only have to differ from each other
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void put_segment(std::vector<uint8_t> &out, uint8_t marker, size_t len)
+{
+    out.push_back(0xff);
+    out.push_back(marker);
+    out.push_back((len + 2) >> 8);
+    out.push_back((len + 2) & 0xff);
+}
+
+void make_synthetic_jpeg(std::vector<uint8_t> &out, uint32_t scanBytes,
+                         u_short width, u_short height, uint32_t seed)
+{
+    uint32_t state = seed | 1;
+    out.clear();
+    out.push_back(0xff);
+    out.push_back(0xd8);                    // SOI
+
+    for (uint8_t table = 0; table < 2; table++) {
+        put_segment(out, 0xdb, 65);         // DQT, 8 bit precision
+        out.push_back(table);
+        for (int i = 0; i < 64; i++)
+            out.push_back(1 + (next_random(&state) % 64));
+    }
+
+    put_segment(out, 0xc0, 15);             // SOF0, 3 components, 4:2:2
+    const uint8_t sof[] = { 8, (uint8_t) (height >> 8), (uint8_t) height, (uint8_t) (width >> 8), (uint8_t) width,
+                            3, 1, 0x21, 0, 2, 0x11, 1, 3, 0x11, 1 };
+    out.insert(out.end(), sof, sof + sizeof(sof));
+
+    put_segment(out, 0xda, 10);             // SOS
+    const uint8_t sos[] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+    out.insert(out.end(), sos, sos + sizeof(sos));
+
+    // Entropy coded data: 0xff is always followed by a stuffed 0x00
+    for (uint32_t i = 0; i < scanBytes; i++) {
+        uint8_t b = next_random(&state);
+        out.push_back(b);
+        if (b == 0xff) {
+            out.push_back(0x00);
+            i++;
+        }
+    }
+
+    out.push_back(0xff);
+    out.push_back(0xd9);                    // EOI
+}
+
+void make_synthetic_h264(std::vector<uint8_t> &out, uint32_t sliceBytes, bool idr, uint32_t seed)
+{
+    static const uint8_t sps[] = { 0, 0, 0, 1, 0x67, 0x42, 0xe0, 0x1e, 0xda, 0x02, 0x80, 0xf6, 0x80, 0x6d, 0x0a, 0x13, 0x50 };
+    static const uint8_t pps[] = { 0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80 };
+    uint32_t state = seed | 1;
+
+    out.clear();
+    if (idr) {
+        out.insert(out.end(), sps, sps + sizeof(sps));
+        out.insert(out.end(), pps, pps + sizeof(pps));
+    }
+    const uint8_t slice[] = { 0, 0, 0, 1, (uint8_t) (idr ? 0x65 : 0x41), 0x88 }; // first_mb_in_slice = 0
+    out.insert(out.end(), slice, slice + sizeof(slice));
+
+    // No zero bytes, so there is never anything that looks like a start code
+    for (uint32_t i = 2; i < sliceBytes; i++)
+        out.push_back(1 + next_random(&state) % 255);
+}
+
+CSyntheticJpegSource::CSyntheticJpegSource(uint32_t scanBytes, u_short width, u_short height)
+    : m_Frames(SYNTHETIC_FRAMES), m_Next(0), m_Width(width), m_Height(height)
+{
+    for (size_t i = 0; i < m_Frames.size(); i++)
+        make_synthetic_jpeg(m_Frames[i], scanBytes, width, height, 0x9e3779b9 * (i + 1));
+}
+
+bool CSyntheticJpegSource::grab(SourceFrame &frame)
+{
+    const std::vector<uint8_t> &f = m_Frames[m_Next];
+    m_Next = (m_Next + 1) % m_Frames.size();
+
+    frame.data = f.data();
+    frame.len = f.size();
+    frame.timestampMs = getMillis();
+    frame.grabUs = getMicros();
+    frame.handle = NULL;
+    return true;
+}
+
+CSyntheticH264Source::CSyntheticH264Source(uint32_t frameBytes, unsigned gop)
+    : m_Frames(gop > 0 ? gop : 1), m_Next(0)
+{
+    for (size_t i = 0; i < m_Frames.size(); i++)
+        make_synthetic_h264(m_Frames[i], frameBytes, i == 0, 0x9e3779b9 * (i + 1));
+}
+
+bool CSyntheticH264Source::next(H264AccessUnit &au)
+{
+    const std::vector<uint8_t> &f = m_Frames[m_Next];
+    au.data = f.data();
+    au.size = f.size();
+    au.idr = m_Next == 0;
+    m_Next = (m_Next + 1) % m_Frames.size();
+    return true;
+}
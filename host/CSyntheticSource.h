@@ -0,0 +1,51 @@
+#pragma once
+
+#include "CFrameSource.h"
+#include "CH264Source.h"
+
+#include <vector>
+
+// Made-up frames for tests and benchmarks that run without a recording.
+// They have the structure the packetizers look at (JPEG markers, quant
+// tables and a byte stuffed scan; H.264 start codes, SPS/PPS and slice
+// headers) around random data, so they don't decode to a picture. Each
+// source makes a few different frames up front and hands them out in turn.
+
+// Baseline 4:2:2 JPEG with a scan of about scanBytes
+void make_synthetic_jpeg(std::vector<uint8_t> &out, uint32_t scanBytes,
+                         u_short width, u_short height, uint32_t seed);
+// Access unit with a single slice NAL of sliceBytes, SPS/PPS in front if idr
+void make_synthetic_h264(std::vector<uint8_t> &out, uint32_t sliceBytes, bool idr, uint32_t seed);
+
+class CSyntheticJpegSource : public CFrameSource
+{
+public:
+    CSyntheticJpegSource(uint32_t scanBytes, u_short width = 640, u_short height = 480);
+
+    const std::vector<uint8_t> &frame(size_t i) const { return m_Frames[i % m_Frames.size()]; }
+
+    virtual bool grab(SourceFrame &frame) override;
+    virtual void release(SourceFrame &) override {}
+
+    virtual u_short width() override { return m_Width; }
+    virtual u_short height() override { return m_Height; }
+
+private:
+    std::vector<std::vector<uint8_t>> m_Frames;
+    size_t m_Next;
+    u_short m_Width;
+    u_short m_Height;
+};
+
+// An IDR frame every gop frames, P frames in between
+class CSyntheticH264Source : public CH264Source
+{
+public:
+    CSyntheticH264Source(uint32_t frameBytes, unsigned gop = 25);
+
+    virtual bool next(H264AccessUnit &au) override;
+
+private:
+    std::vector<std::vector<uint8_t>> m_Frames;
+    size_t m_Next;
+};
@@ -0,0 +1,170 @@
+// Per-frame CPU cost of the server as viewers are added. Each frame is
+// grabbed from the source and its JPEG parsed once, then sent to every
+// client, so the shared part of a frame must not grow with the client
+// count: the test checks there is exactly one grab per frame whatever
+// the number of clients, and that the CPU time per frame and client
+// does not go up as clients are added. Every client has to see an SSRC
+// of its own.
+#include "CHostRtspServer.h"
+#include "CRtspClient.h"
+#include "CSyntheticSource.h"
+
+#include <fcntl.h>
+#include <set>
+#include <signal.h>
+#include <time.h>
+#include <thread>
+
+#define FANOUT_FRAMES   40          // per run, at FANOUT_FPS
+#define FANOUT_FPS      50
+#define FANOUT_MAX_COST 2.0         // per client cost at 8 clients vs 1, allowing for noise
+
+// Counts the frames the server takes from the source
+class CCountingSource : public CFrameSource
+{
+public:
+    CCountingSource(CFrameSource &source) : m_Source(source), m_Grabs(0) {}
+
+    virtual bool grab(SourceFrame &frame) override
+    {
+        m_Grabs++;
+        return m_Source.grab(frame);
+    }
+    virtual void release(SourceFrame &frame) override { m_Source.release(frame); }
+    virtual u_short width() override { return m_Source.width(); }
+    virtual u_short height() override { return m_Source.height(); }
+
+    uint32_t grabs() const { return m_Grabs; }
+
+private:
+    CFrameSource &m_Source;
+    uint32_t m_Grabs;
+};
+
+struct FanoutResult
+{
+    uint32_t frames;        // sent by the server, i.e. frame clock ticks with viewers
+    uint32_t grabs;
+    double cpuUs;           // server thread
+    uint32_t received;      // frames, over all clients
+    uint32_t ssrcs;         // distinct SSRCs the clients saw
+};
+
+static double thread_cpu_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static FanoutResult run(int clientCount)
+{
+    CSyntheticJpegSource synthetic(40000);
+    CCountingSource source(synthetic);
+    HostServerConfig config = HOST_SERVER_DEFAULTS;
+    config.maxClients = clientCount;
+    config.fps = FANOUT_FPS;
+    config.paceKbps = 1000000;      // no waiting for tokens, only work counts
+
+    FanoutResult r = {};
+    CHostRtspServer server(&source, NULL, config);
+    if (!server.start(0))
+        return r;
+
+    // Serve until every client is playing, then measure a fixed number of frames
+    volatile bool stop = false;
+    volatile bool measuring = false;
+    uint32_t framesAtStart = 0, grabsAtStart = 0;
+    double cpuAtStart = 0;
+    std::thread serverThread([&] {
+        bool started = false;
+        while (!stop) {
+            if (measuring && !started) {
+                started = true;
+                framesAtStart = server.framesCaptured();
+                grabsAtStart = source.grabs();
+                cpuAtStart = thread_cpu_us();
+            }
+            if (started && server.framesCaptured() - framesAtStart >= FANOUT_FRAMES)
+                break;
+            server.service();
+            usleep(500);
+        }
+        r.frames = server.framesCaptured() - framesAtStart;
+        r.grabs = source.grabs() - grabsAtStart;
+        r.cpuUs = thread_cpu_us() - cpuAtStart;
+        stop = true;
+    });
+
+    char url[64];
+    snprintf(url, sizeof(url), "rtsp://127.0.0.1:%u/%s", server.port(), server.path());
+    std::vector<CRtspClient> clients(clientCount);
+    for (CRtspClient &client : clients) {
+        client.onFrame([&r](const CRtpDepacketizer &) { r.received++; });
+        client.open(url, false);
+    }
+    measuring = true;
+    while (!stop) {
+        clients[0].wait(5);
+        for (CRtspClient &client : clients)
+            client.poll();
+    }
+    serverThread.join();
+    std::set<uint32_t> ssrcs;
+    for (CRtspClient &client : clients) {
+        if (client.depacketizer())
+            ssrcs.insert(client.depacketizer()->ssrc());
+        client.close();
+    }
+    r.ssrcs = ssrcs.size();
+    return r;
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    // The sessions log every request
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+
+    static const int counts[] = { 1, 2, 4, 8 };
+    FanoutResult results[4];
+    for (int i = 0; i < 4; i++) {
+        dup2(devNull, STDOUT_FILENO);
+        results[i] = run(counts[i]);
+        fflush(stdout);
+        dup2(savedStdout, STDOUT_FILENO);
+    }
+    close(devNull);
+
+    int failures = 0;
+    printf("clients  frames  grabs/frame  cpu us/frame  cpu us/frame/client\n");
+    for (int i = 0; i < 4; i++) {
+        const FanoutResult &r = results[i];
+        double perFrame = r.frames ? r.cpuUs / r.frames : 0;
+        printf("%7d %7u %12.2f %13.0f %20.0f\n", counts[i], r.frames,
+               r.frames ? (double) r.grabs / r.frames : 0.0, perFrame, perFrame / counts[i]);
+        if (r.frames < FANOUT_FRAMES || r.grabs != r.frames) {
+            printf("FAIL: %d clients: %u frames took %u grabs\n", counts[i], r.frames, r.grabs);
+            failures++;
+        }
+        if (r.received == 0) {
+            printf("FAIL: %d clients received nothing\n", counts[i]);
+            failures++;
+        }
+        if (r.ssrcs != (uint32_t) counts[i]) {
+            printf("FAIL: %d clients saw %u SSRCs\n", counts[i], r.ssrcs);
+            failures++;
+        }
+    }
+    double one = results[0].frames ? results[0].cpuUs / results[0].frames : 0;
+    double eight = results[3].frames ? results[3].cpuUs / results[3].frames / 8 : 0;
+    if (one > 0 && eight > one * FANOUT_MAX_COST) {
+        printf("FAIL: per client cost went from %.0f to %.0f us per frame\n", one, eight);
+        failures++;
+    }
+    printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+
+// ONVIF requests as NVRs send them, for the SOAP benchmarks. The envelope
+// and WS-Security header follow what a Hikvision NVR sends (Dahua differs
+// only in namespace prefixes); the digest is not valid for any password.
+
+struct OnvifSample
+{
+    const char *action;
+    bool auth;              // WS-Security header
+    const char *body;       // Content of SOAP-ENV:Body
+};
+
+// Hikvision's probe after discovery, in order. The public calls go
+// without credentials, the rest with them.
+static const OnvifSample onvifProbeSequence[] = {
+    { "GetSystemDateAndTime", false, "<tds:GetSystemDateAndTime/>" },
+    { "GetCapabilities", false, "<tds:GetCapabilities><tds:Category>All</tds:Category></tds:GetCapabilities>" },
+    { "GetServices", false, "<tds:GetServices><tds:IncludeCapability>false</tds:IncludeCapability></tds:GetServices>" },
+    { "GetDeviceInformation", true, "<tds:GetDeviceInformation/>" },
+    { "GetNetworkInterfaces", true, "<tds:GetNetworkInterfaces/>" },
+    { "GetScopes", true, "<tds:GetScopes/>" },
+    { "GetProfiles", true, "<trt:GetProfiles/>" },
+    { "GetVideoSources", true, "<trt:GetVideoSources/>" },
+    { "GetVideoEncoderConfigurationOptions", true,
+      "<trt:GetVideoEncoderConfigurationOptions><trt:ConfigurationToken>VideoEncoderToken</trt:ConfigurationToken>"
+      "<trt:ProfileToken>MainProfile</trt:ProfileToken></trt:GetVideoEncoderConfigurationOptions>" },
+    { "GetVideoEncoderConfiguration", true,
+      "<trt:GetVideoEncoderConfiguration><trt:ConfigurationToken>VideoEncoderToken</trt:ConfigurationToken>"
+      "</trt:GetVideoEncoderConfiguration>" },
+    { "GetAudioEncoderConfigurations", true, "<trt:GetAudioEncoderConfigurations/>" },
+    { "GetOptions", true,
+      "<timg:GetOptions><timg:VideoSourceToken>VideoSourceToken</timg:VideoSourceToken></timg:GetOptions>" },
+    { "GetStreamUri", true,
+      "<trt:GetStreamUri><trt:StreamSetup><tt:Stream>RTP-Unicast</tt:Stream><tt:Transport><tt:Protocol>RTSP</tt:Protocol>"
+      "</tt:Transport></trt:StreamSetup><trt:ProfileToken>MainProfile</trt:ProfileToken></trt:GetStreamUri>" },
+    { "GetSnapshotUri", true,
+      "<trt:GetSnapshotUri><trt:ProfileToken>MainProfile</trt:ProfileToken></trt:GetSnapshotUri>" },
+    { "GetEventProperties", true, "<tev:GetEventProperties/>" },
+};
+
+// Requests whose handlers read fields from the body
+static const OnvifSample onvifSetSystemDateAndTime = {
+    "SetSystemDateAndTime", true,
+    "<tds:SetSystemDateAndTime><tds:DateTimeType>Manual</tds:DateTimeType><tds:DaylightSavings>false</tds:DaylightSavings>"
+    "<tds:TimeZone><tt:TZ>CST-8:00:00</tt:TZ></tds:TimeZone><tds:UTCDateTime><tt:Time><tt:Hour>9</tt:Hour>"
+    "<tt:Minute>41</tt:Minute><tt:Second>7</tt:Second></tt:Time><tt:Date><tt:Year>2026</tt:Year>"
+    "<tt:Month>10</tt:Month><tt:Day>17</tt:Day></tt:Date></tds:UTCDateTime></tds:SetSystemDateAndTime>"
+};
+static const OnvifSample onvifAbsoluteMove = {
+    "AbsoluteMove", true,
+    "<tptz:AbsoluteMove><tptz:ProfileToken>MainProfile</tptz:ProfileToken><tptz:Position>"
+    "<tt:PanTilt x=\"0.25\" y=\"-0.5\" space=\"http://www.onvif.org/ver10/tptz/PanTiltSpaces/PositionGenericSpace\"/>"
+    "</tptz:Position></tptz:AbsoluteMove>"
+};
+
+// The whole request as POSTed to /onvif/device_service
+inline std::string onvif_request(const OnvifSample &sample)
+{
+    std::string req =
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\" "
+        "xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\" xmlns:trt=\"http://www.onvif.org/ver10/media/wsdl\" "
+        "xmlns:timg=\"http://www.onvif.org/ver20/imaging/wsdl\" xmlns:tptz=\"http://www.onvif.org/ver20/ptz/wsdl\" "
+        "xmlns:tev=\"http://www.onvif.org/ver10/events/wsdl\" xmlns:tt=\"http://www.onvif.org/ver10/schema\">";
+    if (sample.auth)
+        req +=
+            "<s:Header><wsse:Security xmlns:wsse=\"http://docs.oasis-open.org/wss/2004/01/oasis-200401-wss-wssecurity-secext-1.0.xsd\" "
+            "xmlns:wsu=\"http://docs.oasis-open.org/wss/2004/01/oasis-200401-wss-wssecurity-utility-1.0.xsd\">"
+            "<wsse:UsernameToken><wsse:Username>admin</wsse:Username>"
+            "<wsse:Password Type=\"http://docs.oasis-open.org/wss/2004/01/oasis-200401-wss-username-token-profile-1.0#PasswordDigest\">"
+            "tuOSpGlFlIXsozq4HFNeeGeFLEI=</wsse:Password>"
+            "<wsse:Nonce EncodingType=\"http://docs.oasis-open.org/wss/2004/01/oasis-200401-wss-soap-message-security-1.0#Base64Binary\">"
+            "LKqI6G/AikKCQrN0zqZFlg==</wsse:Nonce>"
+            "<wsu:Created>2026-10-17T09:41:07.000Z</wsu:Created></wsse:UsernameToken></wsse:Security></s:Header>";
+    req += "<s:Body xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\">";
+    req += sample.body;
+    req += "</s:Body></s:Envelope>";
+    return req;
+}
@@ -0,0 +1,188 @@
+// Checks of CRtpPacer on a simulated clock: the rate it releases bytes at,
+// the burst cap after idle time, that a frame is sped up to finish within
+// its interval, that an empty bucket defers instead of waiting, and that
+// micros() wrapping around and very small time steps don't stall it. Then
+// a paced streamer on a real socket: pumpFrame() must hand control back
+// while the bucket refills rather than sleep, and still take about as long
+// as the rate says.
+#include "CRtpPacer.h"
+#include "MyStreamer.h"
+#include "CSyntheticSource.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+
+#define PACKET 1280
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Send packets whenever the pacer allows, stepping the clock by stepUs
+// from startUs for durationUs. Returns the bytes sent.
+static uint64_t run(CRtpPacer &pacer, uint32_t startUs, uint32_t durationUs, uint32_t stepUs)
+{
+    uint64_t sent = 0;
+    for (uint32_t t = 0; t < durationUs; t += stepUs) {
+        while (pacer.canSend(startUs + t)) {
+            pacer.consume(PACKET);
+            sent += PACKET;
+        }
+    }
+    return sent;
+}
+
+static void test_rate()
+{
+    // 1 MB/s for a second, from an empty bucket: the rate plus at most a burst and a packet
+    CRtpPacer pacer(1000000, 8 * PACKET);
+    pacer.beginFrame(0, 0, 0);
+    uint64_t sent = run(pacer, 0, 1000000, 100);
+    printf("rate: %llu bytes in 1 s at 1000000 B/s\n", (unsigned long long) sent);
+    check(sent >= 1000000 - PACKET && sent <= 1000000 + 8 * PACKET + PACKET, "bytes per second follow the rate");
+    check(pacer.stats().deferrals > 0, "an empty bucket is reported as a deferral");
+}
+
+static void test_burst()
+{
+    // After a long idle period only the burst (plus the overdraw of one packet) goes out at once
+    CRtpPacer pacer(1000000, 4 * PACKET);
+    pacer.beginFrame(0, 0, 0);
+    int packets = 0;
+    while (pacer.canSend(10000000) && packets < 1000) {
+        pacer.consume(PACKET);
+        packets++;
+    }
+    printf("burst: %d packets after 10 s idle, burst of 4\n", packets);
+    check(packets >= 4 && packets <= 5, "idle time is capped at the burst size");
+}
+
+static void test_frame_deadline()
+{
+    // 60 KB frame at 20 fps with a configured 100 KB/s: the frame rate is raised
+    // so it finishes within 3/4 of the 50 ms interval instead of taking 600 ms
+    CRtpPacer pacer(100000, 2 * PACKET);
+    uint32_t start = 5000000;
+    pacer.beginFrame(60000, 50, start);
+    uint64_t sent = 0;
+    uint32_t t = start;
+    while (sent < 60000 && t - start < 1000000) {
+        if (pacer.canSend(t)) {
+            pacer.consume(PACKET);
+            sent += PACKET;
+        }
+        else
+            t += 50;
+    }
+    pacer.endFrame(t);
+    printf("deadline: 60000 bytes in %u us, budget 37500 us\n", t - start);
+    check(sent >= 60000 && t - start <= 37500 + 1000, "a frame finishes within 3/4 of its interval");
+    check(pacer.stats().frames == 1 && pacer.stats().lastFrameUs == t - start, "frame time is recorded");
+    check(pacer.stats().maxFrameUs == pacer.stats().lastFrameUs, "worst frame time is recorded");
+
+    // The raised rate is for that frame only
+    pacer.beginFrame(0, 0, t);
+    uint64_t after = run(pacer, t + 1, 1000000, 100);
+    check(after <= 100000 + 3 * PACKET, "the configured rate applies again after the frame");
+}
+
+static void test_wraparound()
+{
+    // micros() wraps every 71 minutes
+    CRtpPacer pacer(1000000, 8 * PACKET);
+    uint32_t start = 0xFFFFFFFFu - 300000;
+    pacer.beginFrame(0, 0, start);
+    run(pacer, start, 1, 1);                // empty the bucket
+    uint64_t sent = run(pacer, start + 1, 1000000, 100);
+    printf("wraparound: %llu bytes in 1 s across the micros() wrap\n", (unsigned long long) sent);
+    check(sent >= 1000000 - PACKET && sent <= 1000000 + 8 * PACKET + PACKET, "the rate holds across the clock wrap");
+}
+
+static void test_small_steps()
+{
+    // At 64 KB/s a microsecond is worth 0.064 bytes: the fraction must carry
+    // over to the next call instead of being dropped every time
+    CRtpPacer pacer(64000, 2 * PACKET);
+    pacer.beginFrame(0, 0, 0);
+    uint64_t sent = run(pacer, 0, 1000000, 1);
+    printf("small steps: %llu bytes in 1 s at 64000 B/s, polled every us\n", (unsigned long long) sent);
+    check(sent >= 64000 - PACKET && sent <= 64000 + 3 * PACKET, "refill keeps fractional credit");
+}
+
+static void test_streamer_returns()
+{
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    int big = 1024 * 1024;
+    setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &big, sizeof(big));
+
+    // The streamer logs to stdout
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+
+    CSyntheticJpegSource source(30000);
+    MyStreamer streamer(source);
+    streamer.setClientSocket(fds[1]);
+    streamer.InitTransport(0, 0, true);
+    streamer.setTcpSegmentSize(0);
+    streamer.setPacing(300000, 4 * PACKET);     // 30 KB take about 100 ms
+
+    SourceFrame frame;
+    JpegFrameInfo jpeg;
+    source.grab(frame);
+    bool parsed = parseJPEG(frame.data, frame.len, &jpeg);
+    uint32_t start = getMicros();
+    uint32_t longestCall = 0, calls = 0;
+    bool begun = parsed && streamer.beginFrame(jpeg, 0, 0);
+    bool done = false;
+    while (begun && !done && getMicros() - start < 2000000) {
+        uint32_t callStart = getMicros();
+        done = streamer.pumpFrame();
+        uint32_t took = getMicros() - callStart;
+        if (took > longestCall)
+            longestCall = took;
+        calls++;
+        char drain[64 * 1024];
+        while (recv(fds[0], drain, sizeof(drain), MSG_DONTWAIT) > 0)
+            ;
+        usleep(200);
+    }
+    uint32_t total = getMicros() - start;
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    close(fds[0]);
+    close(fds[1]);
+
+    printf("streamer: %u bytes paced at 300000 B/s in %u us, %u pumpFrame() calls, longest %u us\n",
+           streamer.pacingStats().bytes, total, calls, longestCall);
+    check(begun && done, "the paced frame is sent");
+    check(calls > 10 && streamer.pacingStats().deferrals > 0, "pumpFrame() returns while the bucket refills");
+    check(longestCall < 20000, "pumpFrame() never sleeps through the frame");
+    check(total >= 70000, "the frame takes about as long as the rate says");
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    test_rate();
+    test_burst();
+    test_frame_deadline();
+    test_wraparound();
+    test_small_steps();
+    test_streamer_returns();
+    printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
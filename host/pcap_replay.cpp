@@ -0,0 +1,463 @@
+// Replays a capture of what the RTSP server sent (pcap_tap on the camera,
+// or Wireshark on the NVR's side) through the depacketizers: every RTP
+// stream in it, over UDP or interleaved in the RTSP connection, is
+// reassembled into frames, and the packets, frames, losses and reassembly
+// errors of each stream are reported, with how fast the whole capture
+// goes through.
+//
+// Without a file it checks itself: it streams synthetic MJPEG and H.264
+// through CHostRtspServer to a UDP and a TCP client with pcap_tap on, then
+// replays that capture and checks every frame in it is one the source
+// handed out, byte for byte.
+//   pcap_replay [-n rounds] [capture.pcap]
+#include "CHostRtspServer.h"
+#include "CRtspClient.h"
+#include "CSyntheticSource.h"
+#include "pcap_tap.h"
+
+#include <chrono>
+#include <fcntl.h>
+#include <map>
+#include <signal.h>
+#include <stdlib.h>
+#include <thread>
+
+#define TEST_FRAMES     30          // per client, for the self test
+
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW        101
+#define LINKTYPE_LINUX_SLL  113
+#define LINKTYPE_IPV4       228
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, const char *name)
+{
+    if (!ok) {
+        printf("FAIL %s: %s\n", name, what);
+        failures++;
+    }
+}
+
+static double now_ns()
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return ((uint32_t) get16(p) << 16) | get16(p + 2);
+}
+
+// The RTP packets of one stream, in capture order
+struct RtpStream
+{
+    std::string name;               // "udp 10.0.0.5:6970" or "tcp 10.0.0.5:51012 ch 0"
+    uint8_t payloadType;
+    std::vector<uint8_t> data;      // the packets back to back
+    std::vector<std::pair<size_t, size_t>> packets;     // offset and length in data
+};
+
+// One direction of a TCP connection, reassembled
+struct TcpFlow
+{
+    bool synced;
+    uint32_t nextSeq;
+    std::string buf;
+};
+
+struct Capture
+{
+    std::vector<RtpStream> streams;
+    std::map<std::string, size_t> byKey;
+    std::map<std::string, TcpFlow> flows;
+    std::map<int, bool> sdpH264;    // payload type -> H.264, from the SDP of DESCRIBE responses
+    uint32_t records;
+    uint32_t cut;                   // shorter than sent (snaplen), skipped
+    uint32_t tcpGaps;               // segments missing, the connection was resynced
+    uint32_t rtcp;
+};
+
+static std::string endpoint(uint32_t addr, uint16_t port)
+{
+    char s[32];
+    snprintf(s, sizeof(s), "%u.%u.%u.%u:%u", addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff, port);
+    return s;
+}
+
+static void add_rtp(Capture &cap, const std::string &key, const uint8_t *pkt, size_t len)
+{
+    if (len < 12 || (pkt[0] >> 6) != 2)
+        return;
+    if (pkt[1] >= 200 && pkt[1] <= 204) {       // RTCP sender report, SDES, BYE ...
+        cap.rtcp++;
+        return;
+    }
+    auto it = cap.byKey.find(key);
+    if (it == cap.byKey.end()) {
+        it = cap.byKey.emplace(key, cap.streams.size()).first;
+        cap.streams.push_back(RtpStream());
+        cap.streams.back().name = key;
+        cap.streams.back().payloadType = pkt[1] & 0x7f;
+    }
+    RtpStream &s = cap.streams[it->second];
+    s.packets.push_back(std::make_pair(s.data.size(), len));
+    s.data.insert(s.data.end(), pkt, pkt + len);
+}
+
+// The payload type numbers the SDP of a DESCRIBE response maps to H.264
+static void read_sdp(Capture &cap, const std::string &body)
+{
+    size_t pos = 0;
+    while ((pos = body.find("a=rtpmap:", pos)) != std::string::npos) {
+        pos += 9;
+        int pt = atoi(body.c_str() + pos);
+        size_t space = body.find(' ', pos);
+        if (space != std::string::npos)
+            cap.sdpH264[pt] = body.compare(space + 1, 5, "H264/") == 0;
+    }
+}
+
+// Interleaved '$' frames and RTSP messages at the start of flow.buf
+static void consume_tcp(Capture &cap, const std::string &key, TcpFlow &flow)
+{
+    size_t pos = 0;
+    std::string &buf = flow.buf;
+    while (pos < buf.size()) {
+        if (buf[pos] == '$') {
+            if (buf.size() - pos < 4)
+                break;
+            uint8_t channel = buf[pos + 1];
+            size_t len = get16((const uint8_t *) buf.data() + pos + 2);
+            if (buf.size() - pos < 4 + len)
+                break;
+            char name[16];
+            snprintf(name, sizeof(name), " ch %u", channel);
+            if (channel % 2 == 0)
+                add_rtp(cap, key + name, (const uint8_t *) buf.data() + pos + 4, len);
+            else
+                cap.rtcp++;
+            pos += 4 + len;
+        }
+        else if (buf.compare(pos, 5, "RTSP/") == 0) {
+            size_t end = buf.find("\r\n\r\n", pos);
+            if (end == std::string::npos)
+                break;
+            std::string headers = buf.substr(pos, end + 4 - pos);
+            std::string length = rtsp_header(headers, "Content-Length");
+            size_t bodyLen = length.empty() ? 0 : atoi(length.c_str());
+            if (buf.size() - end - 4 < bodyLen)
+                break;
+            read_sdp(cap, buf.substr(end + 4, bodyLen));
+            pos = end + 4 + bodyLen;
+        }
+        else {
+            // Not at a message boundary, after a gap: wait for one
+            size_t next = buf.find_first_of("$R", pos + 1);
+            pos = next == std::string::npos ? buf.size() : next;
+        }
+    }
+    buf.erase(0, pos);
+}
+
+static void add_tcp(Capture &cap, const std::string &key, uint32_t seq, const uint8_t *data, size_t len)
+{
+    TcpFlow &flow = cap.flows[key];
+    if (flow.synced && seq != flow.nextSeq) {
+        if ((int32_t) (seq + len - flow.nextSeq) <= 0)
+            return;                                 // retransmission
+        if ((int32_t) (seq - flow.nextSeq) < 0) {
+            size_t skip = flow.nextSeq - seq;       // partly retransmitted
+            data += skip;
+            len -= skip;
+        }
+        else {
+            cap.tcpGaps++;
+            flow.buf.clear();
+        }
+    }
+    flow.synced = true;
+    flow.nextSeq = seq + len;
+    flow.buf.append((const char *) data, len);
+    consume_tcp(cap, key, flow);
+}
+
+// An IPv4 packet of a pcap record
+static void add_ip(Capture &cap, const uint8_t *ip, size_t len)
+{
+    if (len < 20 || (ip[0] >> 4) != 4)
+        return;
+    size_t ihl = (ip[0] & 0x0f) * 4;
+    size_t total = get16(ip + 2);
+    if ((get16(ip + 6) & 0x3fff) != 0 || total < ihl || total > len)
+        return;                                     // fragments are not put back together
+    uint32_t src = get32(ip + 12), dst = get32(ip + 16);
+    const uint8_t *l4 = ip + ihl;
+    size_t l4len = total - ihl;
+    if (ip[9] == 17 && l4len >= 8) {
+        std::string key = "udp " + endpoint(src, get16(l4)) + " > " + endpoint(dst, get16(l4 + 2));
+        add_rtp(cap, key, l4 + 8, l4len - 8);
+    }
+    else if (ip[9] == 6 && l4len >= 20) {
+        size_t off = (l4[12] >> 4) * 4;
+        if (off < 20 || off > l4len)
+            return;
+        std::string key = "tcp " + endpoint(src, get16(l4)) + " > " + endpoint(dst, get16(l4 + 2));
+        if (l4len > off)
+            add_tcp(cap, key, get32(l4 + 4), l4 + off, l4len - off);
+    }
+}
+
+static bool read_pcap(const char *path, Capture &cap)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        printf("can't open %s\n", path);
+        return false;
+    }
+    uint8_t h[24];
+    if (fread(h, 1, sizeof(h), f) != sizeof(h)) {
+        printf("%s: not a pcap file\n", path);
+        fclose(f);
+        return false;
+    }
+    // Written in the byte order of the machine that captured it
+    uint32_t magic;
+    memcpy(&magic, h, 4);
+    bool swapped = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    if (!swapped && magic != 0xa1b2c3d4 && magic != 0xa1b23c4d) {
+        printf("%s: not a pcap file (pcapng is not read, save as pcap)\n", path);
+        fclose(f);
+        return false;
+    }
+    auto u32 = [swapped](const uint8_t *p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return swapped ? __builtin_bswap32(v) : v;
+    };
+    uint32_t linktype = u32(h + 20);
+    size_t linkHeader;
+    if (linktype == LINKTYPE_RAW || linktype == LINKTYPE_IPV4)
+        linkHeader = 0;
+    else if (linktype == LINKTYPE_ETHERNET)
+        linkHeader = 14;
+    else if (linktype == LINKTYPE_LINUX_SLL)
+        linkHeader = 16;
+    else {
+        printf("%s: link type %u is not supported\n", path, linktype);
+        fclose(f);
+        return false;
+    }
+
+    uint8_t rec[16];
+    std::vector<uint8_t> pkt;
+    while (fread(rec, 1, sizeof(rec), f) == sizeof(rec)) {
+        uint32_t inclLen = u32(rec + 8), origLen = u32(rec + 12);
+        pkt.resize(inclLen);
+        if (fread(pkt.data(), 1, inclLen, f) != inclLen)
+            break;
+        cap.records++;
+        if (inclLen < origLen) {
+            cap.cut++;
+            continue;
+        }
+        if (inclLen < linkHeader)
+            continue;
+        // Ethernet and Linux cooked captures end their header with the ethertype
+        if (linkHeader && get16(pkt.data() + linkHeader - 2) != 0x0800)
+            continue;
+        add_ip(cap, pkt.data() + linkHeader, inclLen - linkHeader);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool is_h264(const Capture &cap, const RtpStream &s)
+{
+    auto it = cap.sdpH264.find(s.payloadType);
+    return it != cap.sdpH264.end() ? it->second : s.payloadType != 26;
+}
+
+// Feed one stream to a new depacketizer, handing every frame to onFrame
+template <typename OnFrame>
+static RtpReceiveStats replay(const Capture &cap, const RtpStream &s, OnFrame onFrame)
+{
+    CJpegDepacketizer jpeg;
+    CH264Depacketizer h264;
+    CRtpDepacketizer &d = is_h264(cap, s) ? (CRtpDepacketizer &) h264 : (CRtpDepacketizer &) jpeg;
+    for (const std::pair<size_t, size_t> &p : s.packets)
+        if (d.push(s.data.data() + p.first, p.second))
+            onFrame(d);
+    return d.stats();
+}
+
+// Prints the streams of the capture and how fast they replay. Returns the frames.
+static uint32_t report(const Capture &cap, int rounds)
+{
+    printf("%u records, %u cut short, %u RTCP, %u TCP gaps\n", cap.records, cap.cut, cap.rtcp, cap.tcpGaps);
+    uint64_t packets = 0, bytes = 0;
+    uint32_t frames = 0;
+    for (const RtpStream &s : cap.streams) {
+        RtpReceiveStats st = replay(cap, s, [](const CRtpDepacketizer &) {});
+        printf("  %-48s %-5s %7u packets %6u frames %5u lost %5u late %5u errors\n", s.name.c_str(),
+               is_h264(cap, s) ? "H.264" : "JPEG", st.packets, st.frames, st.lost, st.late, st.errors);
+        packets += s.packets.size();
+        bytes += s.data.size();
+        frames += st.frames;
+    }
+    if (packets == 0) {
+        printf("no RTP in the capture\n");
+        return 0;
+    }
+
+    double start = now_ns();
+    uint32_t sink = 0;
+    for (int r = 0; r < rounds; r++)
+        for (const RtpStream &s : cap.streams)
+            sink += replay(cap, s, [](const CRtpDepacketizer &) {}).frames;
+    double ns = (now_ns() - start) / rounds;
+    printf("replay: %.0f packets/s, %.1f MB/s, %.0f frames/s (%d rounds)\n",
+           packets * 1e9 / ns, bytes * 1e3 / ns, frames * 1e9 / ns, rounds);
+    if (sink != frames * (uint32_t) rounds)
+        printf("replay is not repeatable: %u frames, expected %u\n", sink, frames * rounds);
+    return frames;
+}
+
+// Stream a synthetic source to a UDP and a TCP client with the tap on, then
+// replay the capture and check it against the frames the source handed out
+static void self_test(bool h264, int rounds)
+{
+    const char *name = h264 ? "h264" : "mjpeg";
+    CSyntheticJpegSource jpegSource(40000);
+    CSyntheticH264Source h264Source(20000, 5);
+    HostServerConfig config = HOST_SERVER_DEFAULTS;
+    config.fps = 50;
+    config.paceKbps = 100000;
+
+    std::vector<std::vector<uint8_t>> expected;
+    for (int i = 0; i < 8; i++) {
+        if (h264) {
+            H264AccessUnit au;
+            h264Source.next(au);
+            expected.push_back(std::vector<uint8_t>(au.data, au.data + au.size));
+            continue;
+        }
+        JpegFrameInfo jpeg;
+        const std::vector<uint8_t> &f = jpegSource.frame(i);
+        if (parseJPEG(f.data(), f.size(), &jpeg))
+            expected.push_back(std::vector<uint8_t>(jpeg.scan, jpeg.scan + jpeg.scanLen));
+    }
+
+    char path[] = "/tmp/pcap_replayXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        check(false, "temporary file", name);
+        return;
+    }
+    close(fd);
+
+    // The sessions log every request
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+
+    uint32_t received = 0;
+    {
+        CHostRtspServer server(h264 ? NULL : &jpegSource, h264 ? &h264Source : NULL, config);
+        bool started = server.start(0) && pcap_tap_start(path);
+        volatile bool stop = false;
+        std::thread serverThread([&] { server.run(&stop); });
+
+        char url[64];
+        snprintf(url, sizeof(url), "rtsp://127.0.0.1:%u/%s", server.port(), server.path());
+        CRtspClient clients[2];
+        int frames[2] = { 0, 0 };
+        for (int i = 0; started && i < 2; i++) {
+            clients[i].onFrame([&, i](const CRtpDepacketizer &) { frames[i]++; });
+            clients[i].open(url, i == 1);
+        }
+        uint32_t start = getMillis();
+        while (started && (frames[0] < TEST_FRAMES || frames[1] < TEST_FRAMES) && getMillis() - start < 10000) {
+            clients[0].wait(10);
+            clients[0].poll();
+            clients[1].poll();
+        }
+        for (CRtspClient &client : clients)
+            client.close();
+        stop = true;
+        serverThread.join();
+        pcap_tap_stop();
+        received = frames[0] + frames[1];
+    }
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    printf("%s: capture of %u frames received over UDP and TCP\n", name, received);
+    Capture cap = {};
+    bool read = read_pcap(path, cap);
+    unlink(path);
+    check(read, "capture not readable", name);
+    if (!read)
+        return;
+    uint32_t frames = report(cap, rounds);
+
+    int mismatches = 0, udp = 0, tcp = 0;
+    uint32_t errors = 0, lost = 0;
+    for (const RtpStream &s : cap.streams) {
+        (s.name.compare(0, 3, "tcp") == 0 ? tcp : udp)++;
+        RtpReceiveStats st = replay(cap, s, [&](const CRtpDepacketizer &d) {
+            bool known = false;
+            for (const std::vector<uint8_t> &e : expected)
+                known |= e == d.frame();
+            mismatches += !known;
+        });
+        errors += st.errors;
+        lost += st.lost;
+        check(is_h264(cap, s) == h264, "codec not recognised", name);
+    }
+    check(udp == 1 && tcp == 1, "one stream over UDP and one over TCP", name);
+    check(frames >= received, "fewer frames than the clients received", name);
+    check(mismatches == 0, "frame differs from the one sent", name);
+    check(errors == 0 && lost == 0, "lost packets or reassembly errors", name);
+    check(cap.cut == 0 && cap.tcpGaps == 0, "capture incomplete", name);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = 20;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !path)
+            path = argv[i];
+        else {
+            printf("usage: pcap_replay [-n rounds] [capture.pcap]\n");
+            return 1;
+        }
+    }
+    if (rounds < 1)
+        rounds = 1;
+    signal(SIGPIPE, SIG_IGN);
+
+    if (path) {
+        Capture cap = {};
+        if (!read_pcap(path, cap))
+            return 1;
+        return report(cap, rounds) ? 0 : 1;
+    }
+
+    self_test(false, rounds);
+    self_test(true, rounds);
+    printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
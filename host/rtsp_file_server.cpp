@@ -0,0 +1,96 @@
+// RTSP server on a PC that streams a recording (or made-up frames) through
+// the firmware's RTSP and RTP code, e.g. to watch it with
+//   ffplay rtsp://127.0.0.1:8554/mjpeg/1
+#include "CHostRtspServer.h"
+#include "CFileSource.h"
+#include "CSyntheticSource.h"
+
+#include <signal.h>
+
+static volatile bool stopRequested = false;
+
+static void on_signal(int)
+{
+    stopRequested = true;
+}
+
+static void usage()
+{
+    printf("usage: rtsp_file_server [-p port] [-r fps] [-c clients] [-k pace_kbps] [-s frame_bytes]\n"
+           "                        [-w pcap_file] [file.mjpeg | file.h264 | -h264]\n"
+           "Without a file, synthetic MJPEG frames (-h264: H.264 frames) of frame_bytes are sent.\n");
+}
+
+int main(int argc, char **argv)
+{
+    HostServerConfig config = HOST_SERVER_DEFAULTS;
+    uint16_t port = 8554;
+    uint32_t frameBytes = 30000;
+    const char *file = NULL;
+    const char *pcapFile = NULL;
+    bool h264 = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-p") && hasValue) port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && hasValue) config.fps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c") && hasValue) config.maxClients = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-k") && hasValue) config.paceKbps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && hasValue) frameBytes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-w") && hasValue) pcapFile = argv[++i];
+        else if (!strcmp(argv[i], "-h264")) h264 = true;
+        else if (argv[i][0] != '-') file = argv[i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (config.fps == 0 || config.maxClients <= 0) {
+        usage();
+        return 1;
+    }
+    if (file) {
+        size_t len = strlen(file);
+        h264 = len > 5 && (!strcmp(file + len - 5, ".h264") || !strcmp(file + len - 4, ".264"));
+    }
+
+    CFrameSource *jpegSource = NULL;
+    CH264Source *h264Source = NULL;
+    if (h264 && file) {
+        CH264FileSource *source = new CH264FileSource(file);
+        if (!source->isOpen())
+            return 1;
+        h264Source = source;
+    }
+    else if (h264)
+        h264Source = new CSyntheticH264Source(frameBytes);
+    else if (file) {
+        CFileSource *source = new CFileSource(file);
+        if (!source->isOpen())
+            return 1;
+        jpegSource = source;
+    }
+    else
+        jpegSource = new CSyntheticJpegSource(frameBytes);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    CHostRtspServer server(jpegSource, h264Source, config);
+    if (!server.start(port))
+        return 1;
+    if (pcapFile && !pcap_tap_start(pcapFile))
+        return 1;
+    printf("Serving rtsp://127.0.0.1:%u/%s at %u fps\n", server.port(), server.path(), config.fps);
+
+    server.run(&stopRequested);
+
+    pcap_tap_stop();
+    RtpPacerStats totals = server.pacingTotals();
+    printf("%u frames captured, %u sent to clients in %u packets, %u dropped\n",
+           server.framesCaptured(), totals.frames, totals.packets, server.droppedFrames());
+    delete jpegSource;
+    delete h264Source;
+    return 0;
+}
@@ -0,0 +1,179 @@
+// Load generator: opens N RTSP sessions against a server, half over UDP and
+// half over interleaved TCP by default, receives and reassembles the
+// MJPEG or H.264 streams and reports per client fps, loss, reassembly
+// errors and time to first frame. Against a camera it is a capacity test;
+// without a URL it starts the host server in-process with synthetic frames,
+// which makes it a regression benchmark of the firmware's RTSP code.
+//   rtsp_loadgen [-n clients] [-t udp|tcp|mix] [-d seconds] [url]
+//   rtsp_loadgen [-n clients] [-t ...] [-d ...] [-h264] [-r fps] [-k pace_kbps] [-s frame_bytes]
+#include "CHostRtspServer.h"
+#include "CRtspClient.h"
+#include "CSyntheticSource.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <thread>
+
+struct ClientResult
+{
+    uint32_t frames;
+    uint32_t firstFrameMs;  // local clock, to measure intervals from the first frame
+    uint32_t lastFrameMs;
+    uint32_t maxGapMs;      // longest time between two frames
+};
+
+static volatile bool stopRequested = false;
+
+static void on_signal(int)
+{
+    stopRequested = true;
+}
+
+static void usage()
+{
+    printf("usage: rtsp_loadgen [-n clients] [-t udp|tcp|mix] [-d seconds] [url]\n"
+           "       rtsp_loadgen [-n clients] [-t udp|tcp|mix] [-d seconds] [-h264] [-r fps] [-k pace_kbps] [-s frame_bytes]\n"
+           "Without a url the host RTSP server is started in-process with synthetic frames.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int clientCount = 4;
+    const char *transport = "mix";
+    int seconds = 10;
+    const char *url = NULL;
+    bool h264 = false;
+    uint32_t frameBytes = 30000;
+    HostServerConfig config = HOST_SERVER_DEFAULTS;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-n") && hasValue) clientCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && hasValue) transport = argv[++i];
+        else if (!strcmp(argv[i], "-d") && hasValue) seconds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && hasValue) config.fps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-k") && hasValue) config.paceKbps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && hasValue) frameBytes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-h264")) h264 = true;
+        else if (argv[i][0] != '-') url = argv[i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (clientCount <= 0 || seconds <= 0 || config.fps == 0 ||
+        (strcmp(transport, "udp") && strcmp(transport, "tcp") && strcmp(transport, "mix"))) {
+        usage();
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+
+    // In-process server, quiet so the report isn't buried in request logs
+    CSyntheticJpegSource jpegSource(frameBytes);
+    CSyntheticH264Source h264Source(frameBytes);
+    config.maxClients = clientCount;
+    CHostRtspServer server(h264 ? NULL : &jpegSource, h264 ? &h264Source : NULL, config);
+    volatile bool stopServer = false;
+    std::thread serverThread;
+    char selfUrl[64];
+    int savedStdout = -1;
+    if (!url) {
+        if (!server.start(0))
+            return 1;
+        snprintf(selfUrl, sizeof(selfUrl), "rtsp://127.0.0.1:%u/%s", server.port(), server.path());
+        url = selfUrl;
+        fflush(stdout);
+        savedStdout = dup(STDOUT_FILENO);
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+        serverThread = std::thread([&] { server.run(&stopServer); });
+    }
+
+    std::vector<CRtspClient> clients(clientCount);
+    std::vector<ClientResult> results(clientCount);
+    std::vector<bool> opened(clientCount);
+    std::vector<std::string> errors(clientCount);
+    for (int i = 0; i < clientCount; i++) {
+        ClientResult &r = results[i];
+        memset(&r, 0, sizeof(r));
+        clients[i].onFrame([&r](const CRtpDepacketizer &) {
+            uint32_t now = getMillis();
+            if (r.frames == 0)
+                r.firstFrameMs = now;
+            else if (now - r.lastFrameMs > r.maxGapMs)
+                r.maxGapMs = now - r.lastFrameMs;
+            r.lastFrameMs = now;
+            r.frames++;
+        });
+        bool tcp = !strcmp(transport, "tcp") || (!strcmp(transport, "mix") && i % 2);
+        opened[i] = clients[i].open(url, tcp);
+        if (!opened[i])
+            errors[i] = clients[i].error();
+    }
+
+    uint32_t start = getMillis();
+    std::vector<struct pollfd> fds;
+    while (!stopRequested && getMillis() - start < (uint32_t) seconds * 1000) {
+        fds.clear();
+        for (int i = 0; i < clientCount; i++) {
+            if (!opened[i])
+                continue;
+            struct pollfd p;
+            p.events = POLLIN;
+            p.fd = clients[i].rtspSocket();
+            fds.push_back(p);
+            if (clients[i].rtpSocket() >= 0) {
+                p.fd = clients[i].rtpSocket();
+                fds.push_back(p);
+            }
+        }
+        if (fds.empty())
+            break;
+        ::poll(fds.data(), fds.size(), 10);
+        for (int i = 0; i < clientCount; i++) {
+            if (opened[i] && !clients[i].poll()) {
+                opened[i] = false;
+                errors[i] = "server closed the connection";
+            }
+        }
+    }
+    for (CRtspClient &client : clients)
+        client.close();
+
+    if (serverThread.joinable()) {
+        stopServer = true;
+        serverThread.join();
+        fflush(stdout);
+        dup2(savedStdout, STDOUT_FILENO);
+        close(savedStdout);
+    }
+
+    printf("%s, %d clients, %d s\n", url, clientCount, seconds);
+    printf("client tpt  codec  frames    fps  max gap ms  packets   lost  late  errors  first frame ms\n");
+    int failed = 0;
+    double fpsSum = 0, fpsMin = 0;
+    for (int i = 0; i < clientCount; i++) {
+        const CRtspClient &c = clients[i];
+        const ClientResult &r = results[i];
+        const RtpReceiveStats &st = c.stats();
+        double fps = r.frames > 1 && r.lastFrameMs != r.firstFrameMs ?
+                     (r.frames - 1) * 1000.0 / (r.lastFrameMs - r.firstFrameMs) : 0.0;
+        fpsSum += fps;
+        if (i == 0 || fps < fpsMin)
+            fpsMin = fps;
+        printf("%6d %-3s  %-5s %7u %6.1f %11u %8u %6u %5u %7u %15.1f",
+                i, c.isTcp() ? "TCP" : "UDP", c.isH264() ? "H.264" : "MJPEG",
+                r.frames, fps, r.maxGapMs, st.packets, st.lost, st.late, st.errors,
+                c.firstFrameUs() ? (c.firstFrameUs() - c.playUs()) / 1000.0 : 0.0);
+        if (!errors[i].empty())
+            printf("  %s", errors[i].c_str());
+        printf("\n");
+        if (r.frames == 0)
+            failed++;
+    }
+    printf("fps: %.1f total, %.1f per client on average, %.1f lowest; %d clients without frames\n",
+            fpsSum, fpsSum / clientCount, fpsMin, failed);
+    return failed ? 1 : 0;
+}
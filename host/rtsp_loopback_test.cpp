@@ -0,0 +1,129 @@
+// Streams synthetic MJPEG and H.264 frames through CHostRtspServer to RTSP
+// clients on 127.0.0.1, one over UDP and one over interleaved TCP at the
+// same time, and checks that every frame they reassemble is one that was
+// sent, byte for byte.
+#include "CHostRtspServer.h"
+#include "CRtspClient.h"
+#include "CSyntheticSource.h"
+
+#include <signal.h>
+#include <thread>
+
+#define TEST_FRAMES     20          // per client
+#define TEST_TIMEOUT_MS 10000
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, const char *name)
+{
+    if (!ok) {
+        printf("FAIL %s: %s\n", name, what);
+        failures++;
+    }
+}
+
+// Every frame the source can hand out, in the form the depacketizer rebuilds
+static std::vector<std::vector<uint8_t>> expected_jpeg(CSyntheticJpegSource &source)
+{
+    std::vector<std::vector<uint8_t>> frames;
+    for (int i = 0; i < 8; i++) {
+        JpegFrameInfo jpeg;
+        const std::vector<uint8_t> &f = source.frame(i);
+        if (parseJPEG(f.data(), f.size(), &jpeg))
+            frames.push_back(std::vector<uint8_t>(jpeg.scan, jpeg.scan + jpeg.scanLen));
+    }
+    return frames;
+}
+
+static void run_codec(bool h264)
+{
+    const char *name = h264 ? "h264" : "mjpeg";
+    CSyntheticJpegSource jpegSource(40000);
+    CSyntheticH264Source h264Source(20000, 5);
+    HostServerConfig config = HOST_SERVER_DEFAULTS;
+    config.fps = 50;
+    config.paceKbps = 100000;
+
+    std::vector<std::vector<uint8_t>> expected;
+    if (h264) {
+        for (int i = 0; i < 5; i++) {
+            H264AccessUnit au;
+            h264Source.next(au);
+            expected.push_back(std::vector<uint8_t>(au.data, au.data + au.size));
+        }
+    }
+    else
+        expected = expected_jpeg(jpegSource);
+
+    CHostRtspServer server(h264 ? NULL : &jpegSource, h264 ? &h264Source : NULL, config);
+    if (!server.start(0)) {
+        check(false, "server start", name);
+        return;
+    }
+    volatile bool stop = false;
+    std::thread serverThread([&] { server.run(&stop); });
+
+    char url[64];
+    snprintf(url, sizeof(url), "rtsp://127.0.0.1:%u/%s", server.port(), server.path());
+
+    CRtspClient clients[2];
+    int frames[2] = { 0, 0 };
+    int mismatches[2] = { 0, 0 };
+    bool firstIdr[2] = { true, true };
+    for (int i = 0; i < 2; i++) {
+        clients[i].onFrame([&, i](const CRtpDepacketizer &d) {
+            bool known = false;
+            for (const std::vector<uint8_t> &e : expected)
+                known |= e == d.frame();
+            if (!known)
+                mismatches[i]++;
+            if (h264 && frames[i] == 0)
+                firstIdr[i] = ((const CH264Depacketizer &) d).isIdr();
+            frames[i]++;
+        });
+        if (!clients[i].open(url, i == 1)) {
+            printf("%s client %d: %s\n", name, i, clients[i].error().c_str());
+            check(false, "open", name);
+        }
+    }
+
+    uint32_t start = getMillis();
+    while ((frames[0] < TEST_FRAMES || frames[1] < TEST_FRAMES) && getMillis() - start < TEST_TIMEOUT_MS) {
+        clients[0].wait(10);
+        clients[0].poll();
+        clients[1].poll();
+    }
+
+    for (int i = 0; i < 2; i++) {
+        const RtpReceiveStats &st = clients[i].stats();
+        printf("%s over %s: %d frames, %u packets, %u lost, %u errors, first frame after %.1f ms\n",
+               name, i ? "TCP" : "UDP", frames[i], st.packets, st.lost, st.errors,
+               clients[i].firstFrameUs() ? (clients[i].firstFrameUs() - clients[i].playUs()) / 1000.0 : 0.0);
+        check(frames[i] >= TEST_FRAMES, "too few frames", name);
+        check(mismatches[i] == 0, "frame differs from the one sent", name);
+        check(st.errors == 0, "reassembly errors", name);
+        check(st.lost == 0, "packets lost", name);
+        check(firstIdr[i], "first frame is not a keyframe", name);
+        check(clients[i].depacketizer() && clients[i].depacketizer()->firstSeq() == clients[i].rtpInfoSeq(),
+              "RTP-Info seq is not the first packet", name);
+        if (!h264) {
+            const CJpegDepacketizer *d = (const CJpegDepacketizer *) clients[i].depacketizer();
+            check(d && d->width() == 640 && d->height() == 480, "RTP/JPEG size", name);
+            check(d && d->hasQuantTables(), "no in-band quant tables", name);
+            check(clients[i].sdpWidth() == 640 && clients[i].sdpHeight() == 480, "SDP size", name);
+        }
+        clients[i].close();
+    }
+
+    stop = true;
+    serverThread.join();
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+    run_codec(false);
+    run_codec(true);
+    printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,162 @@
+// Cost of CRtspSession's request handling on a PC: requests are written to
+// one end of a socketpair and handleRequests(0) parses and answers them on
+// the other, one request per read, several pipelined in one read, split
+// into small pieces (partial reads) and with interleaved RTCP in between.
+// The idle case is what every pass of the RTSP task pays per client when
+// nothing arrived. Times include building and sending the response; the
+// session's log lines go to /dev/null.
+//   rtsp_parse_bench [-n requests]
+#include "CRtspSession.h"
+#include "MyStreamer.h"
+#include "CSyntheticSource.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <chrono>
+#include <string>
+
+static double now_ns()
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Read the responses, returns how many there were
+static int drain(int fd)
+{
+    char buf[16 * 1024];
+    std::string responses;
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        responses.append(buf, n);
+    int count = 0;
+    for (size_t pos = 0; (pos = responses.find("RTSP/1.0 200 OK\r\n", pos)) != std::string::npos; pos++)
+        count++;
+    return count;
+}
+
+// Receiver report as a client sends it over the RTSP connection, channel 1
+static const uint8_t rtcpFrame[] = {
+    '$', 1, 0, 32,
+    0x81, 201, 0, 7, 0x12, 0x34, 0x56, 0x78,
+    0x13, 0xf9, 0x7e, 0x67, 0, 0, 0, 0, 0, 0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+struct ParseRun
+{
+    const char *name;
+    int perWrite;           // requests written together
+    int chunk;              // bytes per write (0 = whole), handleRequests() after each
+    bool rtcp;              // an interleaved RTCP frame in front of every request
+};
+
+// ns per request, -1 if not every request was answered
+static double run(const ParseRun &r, const std::string &request, int count)
+{
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    int big = 4 * 1024 * 1024;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &big, sizeof(big));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &big, sizeof(big));
+
+    CSyntheticJpegSource source(1000);
+    MyStreamer streamer(source);
+    streamer.setClientSocket(fds[1]);
+    CRtspSession session(fds[1], &streamer);
+
+    std::string batch;
+    for (int i = 0; i < r.perWrite; i++) {
+        if (r.rtcp)
+            batch.append((const char *) rtcpFrame, sizeof(rtcpFrame));
+        batch += request;
+    }
+
+    double spent = 0;
+    int answered = 0;
+    for (int done = 0; done < count; done += r.perWrite) {
+        size_t chunk = r.chunk ? r.chunk : batch.size();
+        for (size_t pos = 0; pos < batch.size(); pos += chunk) {
+            size_t len = batch.size() - pos < chunk ? batch.size() - pos : chunk;
+            send(fds[0], batch.data() + pos, len, 0);
+            double start = now_ns();
+            session.handleRequests(0);
+            spent += now_ns() - start;
+        }
+        answered += drain(fds[0]);
+    }
+    close(fds[0]);
+    return answered == (count + r.perWrite - 1) / r.perWrite * r.perWrite ? spent / count : -1;
+}
+
+// ns per handleRequests(0) with nothing to read
+static double run_idle(int calls)
+{
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    CSyntheticJpegSource source(1000);
+    MyStreamer streamer(source);
+    streamer.setClientSocket(fds[1]);
+    CRtspSession session(fds[1], &streamer);
+
+    double start = now_ns();
+    for (int i = 0; i < calls; i++)
+        session.handleRequests(0);
+    double spent = now_ns() - start;
+    close(fds[0]);
+    return spent / calls;
+}
+
+int main(int argc, char **argv)
+{
+    int count = 20000;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            count = atoi(argv[++i]);
+        else {
+            printf("usage: rtsp_parse_bench [-n requests]\n");
+            return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    const char *url = "rtsp://192.168.1.20:554/mjpeg/1";
+    std::string options = std::string("OPTIONS ") + url + " RTSP/1.0\r\nCSeq: 2\r\nUser-Agent: LibVLC/3.0.18\r\n\r\n";
+    std::string keepalive = std::string("GET_PARAMETER ") + url + " RTSP/1.0\r\nCSeq: 7\r\n"
+                            "User-Agent: LibVLC/3.0.18\r\nSession: 12345678\r\n\r\n";
+    std::string describe = std::string("DESCRIBE ") + url + " RTSP/1.0\r\nCSeq: 3\r\n"
+                           "User-Agent: LibVLC/3.0.18\r\nAccept: application/sdp\r\n\r\n";
+
+    static const ParseRun runs[] = {
+        { "one per read",           1, 0,  false },
+        { "8 pipelined per read",   8, 0,  false },
+        { "16 byte pieces",         1, 16, false },
+        { "after interleaved RTCP", 1, 0,  true  },
+    };
+
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+
+    double results[3][4];
+    const std::string *requests[3] = { &options, &keepalive, &describe };
+    dup2(devNull, STDOUT_FILENO);
+    for (int q = 0; q < 3; q++)
+        for (int i = 0; i < 4; i++)
+            results[q][i] = run(runs[i], *requests[q], count);
+    double idle = run_idle(count * 10);
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(devNull);
+
+    printf("%d requests per case, ns per request\n", count);
+    printf("%-24s %10s %14s %10s\n", "", "OPTIONS", "GET_PARAMETER", "DESCRIBE");
+    bool ok = true;
+    for (int i = 0; i < 4; i++) {
+        printf("%-24s %10.0f %14.0f %10.0f\n", runs[i].name, results[0][i], results[1][i], results[2][i]);
+        for (int q = 0; q < 3; q++)
+            ok &= results[q][i] >= 0;
+    }
+    printf("idle handleRequests(0): %.0f ns per call\n", idle);
+    if (!ok)
+        printf("FAIL: requests without a response (-1 above)\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+// Requests per second of classifying ONVIF requests, replaying the probe
+// sequence of a Hikvision NVR (onvif_requests.h) over and over: the
+// indexOf() chain handle_onvif_soap() had before the action table (first
+// match of about 30 scans over the whole request, then the public and
+// protected lists) against finding the first element of the Body with
+// soap_reader and looking it up with soap_lookup() in the firmware's
+// action list (onvif_actions.h), as it does now. The list is also checked:
+// it must be sorted for the binary search, and every request of the probe
+// sequence must find its entry.
+// Only the classification is timed, not authentication or the handlers.
+//   soap_dispatch_bench [-n rounds]
+#include "soap_reader.h"
+#include "onvif_actions.h"
+#include "onvif_requests.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static double now_ns()
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// --- Before: the indexOf() chain ---
+
+struct OldAction
+{
+    const char *needle;
+    const char *action;
+};
+
+// In the order they were tested, the first match won
+static const OldAction oldActions[] = {
+    { "GetSystemDateAndTime", "GetSystemDateAndTime" },
+    { "SetSystemDateAndTime", "SetSystemDateAndTime" },
+    { "SetSynchronizationPoint", "SetSynchronizationPoint" },
+    { "GetCapabilities", "GetCapabilities" },
+    { "GetServices", "GetServices" },
+    { "GetDeviceInformation", "GetDeviceInformation" },
+    { "GetProfiles", "GetProfiles" },
+    { "GetStreamUri", "GetStreamUri" },
+    { "GetSnapshotUri", "GetSnapshotUri" },
+    { "GetVideoSources", "GetVideoSources" },
+    { "GetVideoEncoderConfigurationOptions", "GetVideoOptions" },
+    { "GetVideoEncoderConfiguration", "GetVideoConfig" },
+    { "GetAudioEncoderConfiguration", "GetAudioConfig" },
+    { "SetVideoEncoderConfiguration", "SetVideoConfig" },
+    { "GetNetworkInterfaces", "GetNetworkInterfaces" },
+    { "GetNetworkProtocols", "GetNetworkProtocols" },
+    { "GetScopes", "GetScopes" },
+    { "GetHostname", "GetHostname" },
+    { "GetDNS", "GetDNS" },
+    { "GetNTP", "GetNTP" },
+    { "GetOSDOptions", "GetOSDOptions" },
+    { "GetMoveOptions", "GetMoveOptions" },
+    { "GetVideoAnalyticsConfigurations", "GetAnalyticsConfig" },
+    { "GetOptions", "GetImagingOptions" },          // and VideoSourceToken
+    { "SetImagingSettings", "SetImagingSettings" },
+    { "AbsoluteMove", "PTZ" },
+    { "ContinuousMove", "PTZ" },
+    { "Stop", "PTZ" },
+};
+
+static const char *oldPublic[] = {
+    "GetCapabilities", "GetServices", "GetSystemDateAndTime", "GetDeviceInformation", "GetScopes",
+    "GetHostname", "GetNetworkInterfaces", "GetNetworkProtocols", "GetDNS", "GetNTP",
+    "GetVideoOptions", "GetAudioConfig",
+};
+
+static const char *oldProtected[] = {
+    "GetStreamUri", "GetProfiles", "SetSystemDateAndTime", "GetVideoSources", "GetVideoConfig",
+    "GetSnapshotUri", "SetVideoConfig", "SetImagingSettings", "PTZ",
+};
+
+// indexOf() > 0, as the old code tested it
+static bool contains(const std::string &req, const char *s)
+{
+    size_t i = req.find(s);
+    return i != std::string::npos && i > 0;
+}
+
+// 1 for a public action, 2 for a protected one, 0 for neither
+static int classify_before(const std::string &req)
+{
+    std::string action = "Unknown";
+    for (const OldAction &a : oldActions) {
+        if (contains(req, a.needle) && (strcmp(a.needle, "GetOptions") || contains(req, "VideoSourceToken"))) {
+            action = a.action;
+            break;
+        }
+    }
+    for (const char *name : oldPublic)
+        if (action == name)
+            return 1;
+    for (const char *name : oldProtected)
+        if (action == name)
+            return 2;
+    return 0;
+}
+
+// --- After: the first element of the Body, looked up in a sorted table ---
+
+struct Action
+{
+    const char *name;
+    bool auth;
+};
+
+// The firmware's own table: names and auth flags of ONVIF_ACTION_LIST
+#define ACTION_ENTRY(name, auth, handler, tpl) { #name, auth },
+static Action actions[] = {
+    ONVIF_ACTION_LIST(ACTION_ENTRY)
+};
+#undef ACTION_ENTRY
+#define ACTIONS ((int) (sizeof(actions) / sizeof(actions[0])))
+
+static const Action *classify_after(const std::string &req)
+{
+    SoapReader body;
+    SoapToken bodyTag, actionTag;
+    soap_reader_init(&body, req.data(), req.size());
+    if (!soap_find(&body, "Body", &bodyTag) || bodyTag.empty || !soap_find(&body, NULL, &actionTag))
+        return NULL;
+    return soap_lookup(actions, ACTIONS, actionTag.name);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = 20000;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else {
+            printf("usage: soap_dispatch_bench [-n rounds]\n");
+            return 1;
+        }
+    }
+
+    bool ok = true;
+    for (int i = 1; i < ACTIONS; i++) {
+        if (strcmp(actions[i - 1].name, actions[i].name) >= 0) {
+            printf("FAIL: actions not sorted at %s\n", actions[i].name);
+            ok = false;
+        }
+    }
+
+    // Every action must be found by the binary search, which a mis-sorted
+    // entry would break for it or its neighbours
+    for (const Action &entry : actions) {
+        std::string body = std::string("<tds:") + entry.name + "/>";
+        OnvifSample sample = { entry.name, entry.auth, body.c_str() };
+        const Action *a = classify_after(onvif_request(sample));
+        if (a != &entry) {
+            printf("FAIL: %s not found in the action list\n", entry.name);
+            ok = false;
+        }
+    }
+
+    std::vector<std::string> requests;
+    for (const OnvifSample &sample : onvifProbeSequence)
+        requests.push_back(onvif_request(sample));
+
+    // Every request must find its entry, except those the camera doesn't implement
+    for (size_t i = 0; i < requests.size(); i++) {
+        const Action *a = classify_after(requests[i]);
+        const char *expected = onvifProbeSequence[i].action;
+        bool known = false;
+        for (const Action &entry : actions)
+            known |= !strcmp(entry.name, expected);
+        if (known ? !a || strcmp(a->name, expected) : a != NULL) {
+            printf("FAIL: %s classified as %s\n", expected, a ? a->name : "unknown");
+            ok = false;
+        }
+    }
+
+    int sink = 0;
+    double start = now_ns();
+    for (int r = 0; r < rounds; r++)
+        for (const std::string &req : requests)
+            sink += classify_before(req);
+    double before = now_ns() - start;
+
+    start = now_ns();
+    for (int r = 0; r < rounds; r++)
+        for (const std::string &req : requests) {
+            const Action *a = classify_after(req);
+            sink += a ? 1 + a->auth : 0;
+        }
+    double after = now_ns() - start;
+
+    double count = (double) rounds * requests.size();
+    printf("%zu request probe sequence, %d rounds\n", requests.size(), rounds);
+    printf("indexOf() chain:      %10.0f requests/s  %6.0f ns per request\n", count * 1e9 / before, before / count);
+    printf("Body element + table: %10.0f requests/s  %6.0f ns per request\n", count * 1e9 / after, after / count);
+    if (sink == 0)
+        printf("nothing classified\n");
+    return ok ? 0 : 1;
+}
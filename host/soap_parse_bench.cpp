@@ -0,0 +1,232 @@
+// Heap use and time of parsing ONVIF requests, the way onvif_server.cpp
+// did it before soap_reader (the body copied out of the WebServer, then
+// indexOf/substring/trim on it) against soap_reader working in place.
+// The old code is rebuilt on std::string, which is what Arduino's String
+// does on the heap, except that std::string keeps up to 15 characters
+// inline where String keeps 11: the "before" allocations are, if
+// anything, undercounted. Each request goes through what
+// handle_onvif_soap() did before dispatching it: find the action, the
+// Security header and its four fields, then the fields the handler reads.
+//   soap_parse_bench [-n requests]
+#include "soap_reader.h"
+#include "onvif_requests.h"
+
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every heap allocation of the process goes through here
+static size_t heapLive = 0, heapPeak = 0, heapAllocs = 0;
+
+void *operator new(size_t n)
+{
+    size_t *p = (size_t *) malloc(n + sizeof(size_t) * 2);
+    if (!p)
+        throw std::bad_alloc();
+    p[0] = n;
+    heapLive += n;
+    heapAllocs++;
+    if (heapLive > heapPeak)
+        heapPeak = heapLive;
+    return p + 2;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    if (!ptr)
+        return;
+    size_t *p = (size_t *) ptr - 2;
+    heapLive -= p[0];
+    free(p);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+static double now_ns()
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// --- Before: String copy and indexOf/substring, as the handlers were ---
+
+static std::string trimmed(std::string s)
+{
+    size_t b = s.find_first_not_of(" \t\r\n");
+    size_t e = s.find_last_not_of(" \t\r\n");
+    return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+}
+
+static int old_field(const std::string &req, const char *open, const char *close, size_t from, std::string *out)
+{
+    size_t start = req.find(open, from);
+    if (start == std::string::npos)
+        return 0;
+    start = req.find('>', start) + 1;
+    size_t end = req.find(close, start);
+    if (end == std::string::npos)
+        return 0;
+    *out = trimmed(req.substr(start, end - start));
+    return 1;
+}
+
+static int parse_before(const char *body, size_t len)
+{
+    std::string req(body, len);                 // onvifServer.arg(0)
+    int found = 0;
+
+    // The action name after the Body element, as a String for logging
+    size_t b = req.find("Body");
+    b = b == std::string::npos ? b : req.find('<', req.find('>', b));
+    size_t e = b == std::string::npos ? b : req.find_first_of(" />", b);
+    std::string action = b == std::string::npos ? "Unknown" : req.substr(req.find(':', b) + 1, e - req.find(':', b) - 1);
+    found += !action.empty();
+
+    // verify_soap_header()
+    size_t sec = req.find("Security");
+    if (sec != std::string::npos) {
+        std::string username, digest, nonce, created;
+        found += old_field(req, "<wsse:Username>", "</wsse:Username>", sec, &username);
+        found += username == "admin";
+        found += old_field(req, "<wsse:Password", "</wsse:Password>", sec, &digest);
+        found += old_field(req, "<wsse:Nonce", "</wsse:Nonce>", sec, &nonce);
+        found += old_field(req, "<wsu:Created>", "</wsu:Created>", sec, &created);
+    }
+
+    // handle_SetSystemDateAndTime(), getVal() builds its tags as Strings
+    size_t container = req.find("UTCDateTime");
+    if (container != std::string::npos) {
+        static const char *tags[] = { "Year", "Month", "Day", "Hour", "Minute", "Second" };
+        for (const char *tag : tags) {
+            size_t start = req.find("<" + std::string(tag) + ">", container);
+            if (start == std::string::npos)
+                start = req.find(":" + std::string(tag) + ">", container);
+            if (start != std::string::npos) {
+                size_t valStart = req.find('>', start) + 1;
+                found += atoi(req.substr(valStart, req.find('<', valStart) - valStart).c_str()) > 0;
+            }
+        }
+    }
+
+    // handle_ptz()
+    if (req.find("AbsoluteMove") != std::string::npos) {
+        size_t x = req.find("x=\"");
+        if (x != std::string::npos)
+            found += atof(req.substr(x + 3, req.find('"', x + 3) - x - 3).c_str()) != 0;
+        size_t y = req.find("y=\"");
+        if (y != std::string::npos)
+            found += atof(req.substr(y + 3, req.find('"', y + 3) - y - 3).c_str()) != 0;
+    }
+    return found;
+}
+
+// --- After: soap_reader over the receive buffer ---
+
+static int parse_after(const char *body, size_t len)
+{
+    int found = 0;
+    SoapReader envelope, r, security;
+    SoapToken bodyTag, actionTag, securityTag;
+    soap_reader_init(&envelope, body, len);
+    r = envelope;
+    bool hasBody = soap_find(&r, "Body", &bodyTag) && !bodyTag.empty && soap_find(&r, NULL, &actionTag);
+    found += hasBody;
+
+    security = envelope;
+    if (soap_find(&security, "Header", &securityTag) && soap_find(&security, "Security", &securityTag)) {
+        static const char *const fields[] = { "Username", "Password", "Nonce", "Created" };
+        SoapStr token[4];
+        found += soap_find_texts(&security, fields, token, 4);
+        found += token[0].p && soap_str_equals(token[0], "admin");
+    }
+    if (!hasBody)
+        return found;
+
+    if (soap_str_equals(actionTag.name, "SetSystemDateAndTime")) {
+        SoapToken container;
+        SoapReader b = r;
+        if (soap_find(&b, "UTCDateTime", &container)) {
+            static const char *const tags[] = { "Year", "Month", "Day", "Hour", "Minute", "Second" };
+            SoapStr val[6];
+            soap_find_texts(&b, tags, val, 6);
+            for (const SoapStr &v : val)
+                found += v.p && soap_str_int(v) > 0;
+        }
+    }
+    else if (soap_str_equals(actionTag.name, "AbsoluteMove")) {
+        SoapReader b = r;
+        SoapToken panTilt;
+        SoapStr val;
+        if (soap_find(&b, "PanTilt", &panTilt)) {
+            found += soap_attr(&panTilt, "x", &val) && soap_str_float(val) != 0;
+            found += soap_attr(&panTilt, "y", &val) && soap_str_float(val) != 0;
+        }
+    }
+    return found;
+}
+
+struct ParseResult
+{
+    double ns;              // per request
+    double allocs;          // per request
+    size_t peak;            // bytes, the largest of any request
+    int found;              // fields, of the last run over the request
+};
+
+static ParseResult measure(int (*parse)(const char *, size_t), const std::string &req, int count)
+{
+    ParseResult r = {};
+    size_t allocsBefore = heapAllocs;
+    heapPeak = heapLive;
+    size_t base = heapLive;
+    double start = now_ns();
+    for (int i = 0; i < count; i++)
+        r.found = parse(req.data(), req.size());
+    r.ns = (now_ns() - start) / count;
+    r.allocs = (double) (heapAllocs - allocsBefore) / count;
+    r.peak = heapPeak - base;
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    int count = 100000;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            count = atoi(argv[++i]);
+        else {
+            printf("usage: soap_parse_bench [-n requests]\n");
+            return 1;
+        }
+    }
+
+    const OnvifSample *samples[] = {
+        &onvifProbeSequence[0],     // GetSystemDateAndTime, no credentials
+        &onvifProbeSequence[12],    // GetStreamUri
+        &onvifSetSystemDateAndTime,
+        &onvifAbsoluteMove,
+    };
+
+    printf("%d requests per case\n", count);
+    printf("%-22s %6s  %12s %9s %10s  %12s %9s %10s\n", "", "bytes",
+           "before ns", "allocs", "peak B", "after ns", "allocs", "peak B");
+    bool ok = true;
+    for (const OnvifSample *sample : samples) {
+        std::string req = onvif_request(*sample);
+        ParseResult before = measure(parse_before, req, count);
+        ParseResult after = measure(parse_after, req, count);
+        printf("%-22s %6zu  %12.0f %9.1f %10zu  %12.0f %9.1f %10zu\n", sample->action, req.size(),
+               before.ns, before.allocs, before.peak, after.ns, after.allocs, after.peak);
+        // Both must have found the same fields, and the reader must not allocate
+        if (before.found != after.found || after.allocs != 0) {
+            printf("FAIL %s: fields found %d before, %d after, %.1f allocations\n",
+                   sample->action, before.found, after.found, after.allocs);
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
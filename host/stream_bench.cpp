@@ -0,0 +1,414 @@
+// Throughput of the RTP packetizers on a PC: frames are packetized by the
+// firmware's streamers as fast as they go (pacing off) and sent over
+// loopback UDP or interleaved TCP to a thread that reads and discards them.
+// Reports frames/s and, per frame, the sending thread's CPU time, packets,
+// socket writes (syscalls) and bytes copied.
+// -c adds runs without UDP batching (one sendmsg() per datagram) and
+// without TCP coalescing (one write per RTP packet) to compare against.
+// -b adds runs with the sends copying header and payload into one buffer
+// first, the way it was done before gather sends.
+// Each run is repeated (-r) and the cheapest kept, loopback timings are noisy.
+//   stream_bench [-n frames] [-s frame_bytes] [-t tcp_segment] [-r repeats] [-c] [-b] [file.mjpeg | file.h264]
+#include "CHostH264Streamer.h"
+#include "MyStreamer.h"
+#include "CFileSource.h"
+#include "CSyntheticSource.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <atomic>
+#include <thread>
+
+#define BENCH_RATE  2000000000u     // bytes per second, i.e. no pacing
+#define BENCH_BURST (1u << 30)
+
+// Receiving end on 127.0.0.1. The streamer needs a connected RTSP socket
+// in either case: TCP sends on it, UDP takes the destination address from it.
+class CLoopbackSink
+{
+public:
+    CLoopbackSink(bool tcp) : m_Tcp(tcp), m_Stop(false), m_Bytes(0), m_Packets(0)
+    {
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = loopback(0);
+        socklen_t len = sizeof(addr);
+        bind(listener, (sockaddr *) &addr, sizeof(addr));
+        listen(listener, 1);
+        getsockname(listener, (sockaddr *) &addr, &len);
+
+        m_Peer = socket(AF_INET, SOCK_STREAM, 0);
+        connect(m_Peer, (sockaddr *) &addr, sizeof(addr));
+        m_Server = ::accept(listener, NULL, NULL);
+        close(listener);
+
+        m_Udp = -1;
+        m_UdpPort = 0;
+        if (!tcp) {
+            m_Udp = socket(AF_INET, SOCK_DGRAM, 0);
+            addr = loopback(0);
+            bind(m_Udp, (sockaddr *) &addr, sizeof(addr));
+            getsockname(m_Udp, (sockaddr *) &addr, &len);
+            m_UdpPort = ntohs(addr.sin_port);
+            int size = 8 * 1024 * 1024;
+            setsockopt(m_Udp, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        }
+        m_Drain = std::thread([this] { drain(); });
+    }
+
+    ~CLoopbackSink()
+    {
+        finish();
+        close(m_Peer);
+        close(m_Server);
+        if (m_Udp >= 0)
+            close(m_Udp);
+    }
+
+    SOCKET server() const { return m_Server; }
+    u_short udpPort() const { return m_UdpPort; }
+    uint64_t bytes() const { return m_Bytes; }
+    uint64_t packets() const { return m_Packets; }
+
+    // Wait until everything sent has been read: to the end of the stream
+    // on TCP, until nothing has come for a while on UDP
+    void finish()
+    {
+        if (!m_Drain.joinable())
+            return;
+        if (m_Tcp)
+            shutdown(m_Server, SHUT_WR);
+        else
+            m_Stop = true;
+        m_Drain.join();
+    }
+
+private:
+    static sockaddr_in loopback(uint16_t port)
+    {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        return addr;
+    }
+
+    void drain()
+    {
+        int fd = m_Tcp ? m_Peer : m_Udp;
+        static uint8_t buf[64 * 1024];
+        while (true) {
+            struct pollfd p;
+            p.fd = fd;
+            p.events = POLLIN;
+            if (::poll(&p, 1, 100) <= 0) {
+                if (m_Stop)
+                    return;
+                continue;
+            }
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0)
+                return;
+            m_Bytes += n;
+            m_Packets++;
+        }
+    }
+
+    bool m_Tcp;
+    SOCKET m_Peer;
+    SOCKET m_Server;
+    int m_Udp;
+    u_short m_UdpPort;
+    std::atomic<bool> m_Stop;
+    std::atomic<uint64_t> m_Bytes;
+    std::atomic<uint64_t> m_Packets;
+    std::thread m_Drain;
+};
+
+struct BenchResult
+{
+    uint32_t frames;
+    double seconds;
+    double cpuSeconds;      // of the sending thread, without the receiver's work
+    RtpPacerStats pacer;
+    uint64_t copied;        // by the streamer and the platglue send functions
+    uint64_t received;
+};
+
+static double thread_cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wait_writable(SOCKET s)
+{
+    struct pollfd p;
+    p.fd = s;
+    p.events = POLLOUT;
+    ::poll(&p, 1, 100);
+}
+
+static void setup(CStreamer &streamer, CLoopbackSink &sink, bool tcp, uint32_t tcpSegment)
+{
+    streamer.setPacing(BENCH_RATE, BENCH_BURST);
+    streamer.setTcpSegmentSize(tcpSegment);
+    streamer.InitTransport(sink.udpPort(), sink.udpPort() + 1, tcp);
+}
+
+static void send_frame(CStreamer &streamer, SOCKET s)
+{
+    while (!streamer.pumpFrame())
+        wait_writable(s);
+}
+
+static BenchResult bench_jpeg(CFrameSource &source, bool tcp, uint32_t frames, uint32_t tcpSegment)
+{
+    CLoopbackSink sink(tcp);
+    MyStreamer streamer(source);
+    streamer.setClientSocket(sink.server());
+    setup(streamer, sink, tcp, tcpSegment);
+
+    // Parsed once up front so only the packetizer is measured
+    std::vector<SourceFrame> grabbed;
+    std::vector<JpegFrameInfo> parsed;
+    for (int i = 0; i < 8; i++) {
+        SourceFrame f;
+        JpegFrameInfo jpeg;
+        if (!source.grab(f))
+            break;
+        if (parseJPEG(f.data, f.len, &jpeg)) {
+            grabbed.push_back(f);
+            parsed.push_back(jpeg);
+        }
+        else
+            source.release(f);
+    }
+
+    BenchResult r = {};
+    if (parsed.empty())
+        return r;
+    uint64_t copiedBefore = sendCopiedBytes;
+    double cpuStart = thread_cpu_seconds();
+    uint32_t start = getMicros();
+    for (uint32_t i = 0; i < frames; i++) {
+        if (tcp)
+            wait_writable(sink.server());
+        if (streamer.beginFrame(parsed[i % parsed.size()], i * 50, 0))
+            send_frame(streamer, sink.server());
+    }
+    r.seconds = (getMicros() - start) / 1e6;
+    r.cpuSeconds = thread_cpu_seconds() - cpuStart;
+    for (SourceFrame &f : grabbed)
+        source.release(f);
+    sink.finish();
+    r.frames = frames;
+    r.pacer = streamer.pacingStats();
+    r.copied = r.pacer.copied + sendCopiedBytes - copiedBefore;
+    r.received = sink.bytes();
+    return r;
+}
+
+static BenchResult bench_h264(CH264Source &source, bool tcp, uint32_t frames, uint32_t tcpSegment)
+{
+    CLoopbackSink sink(tcp);
+    CHostH264Streamer streamer(sink.server());
+    setup(streamer, sink, tcp, tcpSegment);
+
+    BenchResult r = {};
+    uint64_t copiedBefore = sendCopiedBytes;
+    double cpuStart = thread_cpu_seconds();
+    uint32_t start = getMicros();
+    for (uint32_t i = 0; i < frames; i++) {
+        H264AccessUnit au;
+        if (!source.next(au))
+            return r;
+        if (tcp)
+            wait_writable(sink.server());
+        if (streamer.beginAccessUnit(au.data, au.size, au.idr, i * 50, 0))
+            send_frame(streamer, sink.server());
+    }
+    r.seconds = (getMicros() - start) / 1e6;
+    r.cpuSeconds = thread_cpu_seconds() - cpuStart;
+    sink.finish();
+    r.frames = frames;
+    r.pacer = streamer.pacingStats();
+    r.copied = r.pacer.copied + sendCopiedBytes - copiedBefore;
+    r.received = sink.bytes();
+    return r;
+}
+
+// The streamers log to stdout, the table goes there too
+static int savedStdout = -1;
+
+static void mute_stdout()
+{
+    fflush(stdout);
+    if (savedStdout < 0)
+        savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+}
+
+static void unmute_stdout()
+{
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+}
+
+// The run that took the least CPU of several; a TCP run that lost data is kept, report() fails it
+template <typename Run>
+static BenchResult cheapest(int repeats, bool tcp, Run run)
+{
+    mute_stdout();
+    BenchResult best = run();
+    for (int i = 1; i < repeats; i++) {
+        BenchResult r = run();
+        bool lost = tcp && r.received != r.pacer.bytes;
+        bool bestLost = tcp && best.received != best.pacer.bytes;
+        if (lost || (!bestLost && r.cpuSeconds < best.cpuSeconds))
+            best = r;
+    }
+    unmute_stdout();
+    return best;
+}
+
+// How the packets of a run go out
+struct SendMode
+{
+    const char *name;
+    bool tcp;
+    bool coalesce;          // TCP writes of the segment size, 0 otherwise
+    bool batch;             // UDP sendmmsg() batches
+    bool bounce;            // copy header and payload together first
+};
+
+// False if nothing was sent or TCP lost data, which would be a streamer bug
+static bool report(const char *codec, const SendMode &mode, const BenchResult &r)
+{
+    if (!r.frames || !r.pacer.frames) {
+        printf("%-5s %-3s %-8s  no frames sent\n", codec, mode.tcp ? "TCP" : "UDP", mode.name);
+        return false;
+    }
+    const RtpPacerStats &st = r.pacer;
+    printf("%-5s %-3s %-8s %9.0f %9.1f %9.1f %10.1f %12.0f %9.1f%%\n",
+           codec, mode.tcp ? "TCP" : "UDP", mode.name,
+           st.frames / r.seconds,
+           r.cpuSeconds * 1e6 / st.frames,
+           (double) st.packets / st.frames,
+           (double) st.writes / st.frames,
+           (double) r.copied / st.frames,
+           st.bytes ? 100.0 * r.received / st.bytes : 0.0);
+    return !mode.tcp || r.received == st.bytes;
+}
+
+// "MJPEG TCP per packet -> coalesced: 24.0 -> 11.0 writes/frame, 45.1 -> 33.6 us CPU/frame"
+static void compare(const char *codec, const char *what, const BenchResult &before, const BenchResult &after)
+{
+    if (!before.pacer.frames || !after.pacer.frames)
+        return;
+    printf("%-5s %s: %.1f -> %.1f writes/frame, %.1f -> %.1f us CPU/frame\n", codec, what,
+           (double) before.pacer.writes / before.pacer.frames, (double) after.pacer.writes / after.pacer.frames,
+           before.cpuSeconds * 1e6 / before.pacer.frames, after.cpuSeconds * 1e6 / after.pacer.frames);
+}
+
+static void usage()
+{
+    printf("usage: stream_bench [-n frames] [-s frame_bytes] [-t tcp_segment] [-r repeats] [-c] [-b] [file.mjpeg | file.h264]\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t frames = 2000;
+    uint32_t frameBytes = 30000;
+    uint32_t tcpSegment = 2872;
+    int repeats = 3;
+    const char *file = NULL;
+    bool comparePerPacket = false;
+    bool compareCopy = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-n") && hasValue) frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && hasValue) frameBytes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && hasValue) tcpSegment = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && hasValue) repeats = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c")) comparePerPacket = true;
+        else if (!strcmp(argv[i], "-b")) compareCopy = true;
+        else if (argv[i][0] != '-') file = argv[i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (repeats < 1) {
+        usage();
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    bool h264File = false;
+    if (file) {
+        size_t len = strlen(file);
+        h264File = len > 5 && (!strcmp(file + len - 5, ".h264") || !strcmp(file + len - 4, ".264"));
+    }
+
+    std::vector<SendMode> modes;
+    modes.push_back({ "batch", false, false, true, false });
+    modes.push_back({ tcpSegment ? "coalesce" : "packet", true, tcpSegment > 0, false, false });
+    if (comparePerPacket) {
+        modes.push_back({ "packet", false, false, false, false });
+        if (tcpSegment)
+            modes.push_back({ "packet", true, false, false, false });
+    }
+    if (compareCopy) {
+        modes.push_back({ "copy", false, false, false, true });
+        modes.push_back({ "copy", true, tcpSegment > 0, false, true });
+    }
+
+    bool ok = true;
+    BenchResult results[2][6] = {};     // MJPEG, H.264 by mode
+    printf("%u frames, TCP segment %u bytes, best of %d runs\n", frames, tcpSegment, repeats);
+    printf("codec tpt send       frames/s  cpu us/frm pkts/frm writes/frm copied B/frm  received\n");
+    for (size_t m = 0; m < modes.size(); m++) {
+        const SendMode &mode = modes[m];
+        sendBounceBuffer = mode.bounce;
+        sendUdpBatches = mode.batch;
+        uint32_t segment = mode.coalesce ? tcpSegment : 0;
+        if (!file || !h264File) {
+            CFileSource *fileSource = file ? new CFileSource(file) : NULL;
+            if (fileSource && !fileSource->isOpen())
+                return 1;
+            CSyntheticJpegSource synthetic(frameBytes);
+            CFrameSource &source = fileSource ? (CFrameSource &) *fileSource : synthetic;
+            results[0][m] = cheapest(repeats, mode.tcp, [&] { return bench_jpeg(source, mode.tcp, frames, segment); });
+            ok &= report("MJPEG", mode, results[0][m]);
+            delete fileSource;
+        }
+        if (!file || h264File) {
+            CH264FileSource *fileSource = file ? new CH264FileSource(file) : NULL;
+            if (fileSource && !fileSource->isOpen())
+                return 1;
+            CSyntheticH264Source synthetic(frameBytes);
+            CH264Source &source = fileSource ? (CH264Source &) *fileSource : synthetic;
+            results[1][m] = cheapest(repeats, mode.tcp, [&] { return bench_h264(source, mode.tcp, frames, segment); });
+            ok &= report("H.264", mode, results[1][m]);
+            delete fileSource;
+        }
+    }
+    sendBounceBuffer = false;
+    sendUdpBatches = true;
+
+    if (comparePerPacket) {
+        printf("\n");
+        for (int c = 0; c < 2; c++) {
+            const char *codec = c ? "H.264" : "MJPEG";
+            compare(codec, "UDP per packet -> batched", results[c][2], results[c][0]);
+            if (tcpSegment)
+                compare(codec, "TCP per packet -> coalesced", results[c][3], results[c][1]);
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+// Jitter of the frame interval a viewer sees while the camera is flooded
+// with ONVIF requests, with the RTSP server in the same loop as the SOAP
+// handlers (as loop() ran it before rtsp_stream_task) and in a thread of
+// its own at a higher priority than the handlers (as the task runs it now).
+// The flood replays the probe sequence of an NVR (onvif_requests.h) back
+// to back: every request is parsed with soap_reader and then keeps the
+// CPU busy for the handler time (-w), which stands in for building the
+// response and writing it out over WiFi on the ESP32. The viewer runs in
+// its own thread and timestamps every complete frame.
+//
+// The server thread and the viewer get SCHED_FIFO priorities where the
+// process is allowed to, which is what FreeRTOS priorities are; without
+// it the kernel's fair scheduler shares the CPU and the "task" row shows
+// less of a difference.
+//   stream_jitter_bench [-d seconds] [-w handler us] [-f fps]
+#include "CHostRtspServer.h"
+#include "CRtspClient.h"
+#include "CSyntheticSource.h"
+#include "soap_reader.h"
+#include "onvif_requests.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <thread>
+
+enum FloodMode
+{
+    NO_FLOOD,               // the server alone, for reference
+    SAME_LOOP,              // service() and one request in turn, as loop() did
+    SERVER_TASK,            // server thread above the request handlers
+};
+
+static const char *modeNames[] = { "no flood", "flood, one loop", "flood, stream task" };
+
+struct JitterResult
+{
+    uint32_t frames;        // received by the viewer
+    uint32_t requests;      // SOAP requests handled
+    double meanUs;          // frame interval
+    double stddevUs;
+    double p99Us;           // of |interval - nominal|
+    double maxUs;
+};
+
+static volatile int requestSink;
+
+static bool realtime(int priority)
+{
+    sched_param param = {};
+    param.sched_priority = priority;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+}
+
+// Parse the request as handle_onvif_soap() does, then hold the CPU for the handler
+static int handle_request(const std::string &req, uint32_t handlerUs)
+{
+    uint32_t start = getMicros();
+    int found = 0;
+    SoapReader r, security;
+    SoapToken bodyTag, actionTag, securityTag;
+    soap_reader_init(&r, req.data(), req.size());
+    security = r;
+    found += soap_find(&r, "Body", &bodyTag) && !bodyTag.empty && soap_find(&r, NULL, &actionTag);
+    if (soap_find(&security, "Header", &securityTag) && soap_find(&security, "Security", &securityTag)) {
+        static const char *const fields[] = { "Username", "Password", "Nonce", "Created" };
+        SoapStr token[4];
+        found += soap_find_texts(&security, fields, token, 4);
+    }
+    while (getMicros() - start < handlerUs)
+        ;
+    return found;
+}
+
+static JitterResult run(FloodMode mode, uint32_t fps, uint32_t durationUs, uint32_t handlerUs, bool *rt)
+{
+    JitterResult r = {};
+    CSyntheticJpegSource source(30000);
+    HostServerConfig config = HOST_SERVER_DEFAULTS;
+    config.fps = fps;
+    CHostRtspServer server(&source, NULL, config);
+    if (!server.start(0))
+        return r;
+
+    std::vector<std::string> requests;
+    for (const OnvifSample &sample : onvifProbeSequence)
+        requests.push_back(onvif_request(sample));
+
+    // The viewer is another machine: it gets the highest priority so that
+    // only the server's timing shows up in what it measures
+    volatile bool stop = false;
+    volatile bool playing = false;
+    std::vector<uint32_t> arrivals;
+    arrivals.reserve(durationUs / 1000000 * fps * 2 + 16);
+    char url[64];
+    snprintf(url, sizeof(url), "rtsp://127.0.0.1:%u/%s", server.port(), server.path());
+    std::thread viewer([&] {
+        *rt &= realtime(2);
+        CRtspClient client;
+        client.onFrame([&](const CRtpDepacketizer &) { arrivals.push_back(getMicros()); });
+        if (!client.open(url, false)) {
+            stop = true;
+            return;
+        }
+        playing = true;
+        while (!stop) {
+            client.wait(5);
+            client.poll();
+        }
+        client.close();
+    });
+
+    // The server has to answer the viewer's requests before anything is measured
+    std::thread serverThread;
+    volatile bool serverStop = false;
+    if (mode == SERVER_TASK) {
+        serverThread = std::thread([&] {
+            realtime(1);
+            server.run(&serverStop);
+        });
+    }
+    else {
+        while (!playing && !stop) {
+            server.service();
+            usleep(1000);
+        }
+    }
+    while (!playing && !stop)
+        usleep(1000);
+
+    uint32_t start = getMicros();
+    while (!stop && getMicros() - start < durationUs) {
+        if (mode != SERVER_TASK)
+            server.service();
+        if (mode == NO_FLOOD) {
+            usleep(500);
+            continue;
+        }
+        requestSink += handle_request(requests[r.requests % requests.size()], handlerUs);
+        r.requests++;
+    }
+    stop = true;
+    viewer.join();
+    serverStop = true;
+    if (serverThread.joinable())
+        serverThread.join();
+
+    // Frames that completed while the flood was on
+    std::vector<double> intervals, deviation;
+    size_t first = 0;
+    while (first < arrivals.size() && (int32_t) (arrivals[first] - start) < 0)
+        first++;
+    for (size_t i = first + 1; i < arrivals.size(); i++)
+        intervals.push_back(arrivals[i] - arrivals[i - 1]);
+    r.frames = arrivals.size() - first;
+    if (intervals.empty())
+        return r;
+    double nominal = 1e6 / fps, sum = 0, squares = 0;
+    for (double v : intervals) {
+        sum += v;
+        deviation.push_back(fabs(v - nominal));
+    }
+    r.meanUs = sum / intervals.size();
+    for (double v : intervals)
+        squares += (v - r.meanUs) * (v - r.meanUs);
+    r.stddevUs = sqrt(squares / intervals.size());
+    std::sort(deviation.begin(), deviation.end());
+    r.p99Us = deviation[(size_t) (deviation.size() * 0.99)];
+    r.maxUs = deviation.back();
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 5;
+    uint32_t handlerUs = 5000, fps = 20;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-d") && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+            handlerUs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+            fps = atoi(argv[++i]);
+        else {
+            printf("usage: stream_jitter_bench [-d seconds] [-w handler us] [-f fps]\n");
+            return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // The sessions log every request
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+
+    // The request handlers stay at normal priority, as loop() is the lowest
+    // task. A real-time spinning flood would also run into the kernel's
+    // throttling of real-time threads, which stops them for 50 ms a second.
+    bool rt = true;
+    JitterResult results[3];
+    for (int mode = NO_FLOOD; mode <= SERVER_TASK; mode++)
+        results[mode] = run((FloodMode) mode, fps, (uint32_t) (seconds * 1e6), handlerUs, &rt);
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    printf("%u fps (%.0f us), %.0f s per row, %u us per SOAP request, %u CPUs, %s\n", fps, 1e6 / fps,
+           seconds, handlerUs, std::thread::hardware_concurrency(),
+           rt ? "SCHED_FIFO priorities" : "no SCHED_FIFO, fair scheduler");
+    printf("%-20s %7s %9s %10s %10s %10s %10s\n", "", "frames", "requests",
+           "mean us", "stddev us", "p99 dev us", "max dev us");
+    bool ok = true;
+    for (int mode = NO_FLOOD; mode <= SERVER_TASK; mode++) {
+        const JitterResult &j = results[mode];
+        printf("%-20s %7u %9u %10.0f %10.0f %10.0f %10.0f\n", modeNames[mode], j.frames, j.requests,
+               j.meanUs, j.stddevUs, j.p99Us, j.maxUs);
+        if (j.frames < 2 || (mode != NO_FLOOD && j.requests == 0)) {
+            printf("FAIL: %s: no frames or no requests handled\n", modeNames[mode]);
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}